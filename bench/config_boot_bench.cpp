@@ -0,0 +1,410 @@
+// Host benchmark: wake-to-ready time with the binary config image read in
+// place versus parsing the same configuration from JSON, plus the schema
+// evolution cases.
+//
+//   g++ -std=c++20 -O2 -Icommon/include -Ifirmware/include bench/config_boot_bench.cpp -o config_boot_bench
+//   ./config_boot_bench [iterations]
+//
+// "Ready" means the wake has what it needs to act: the IrrigationConfig, the
+// zone programs due now, the APN and server. The JSON path copies the file
+// out of "flash" first, as a read from a filesystem would, and parses it with
+// a small allocation-free parser; a real filesystem and a DOM parser such as
+// ArduinoJson only add to its time. The image path opens the mapped bytes:
+// with the CRC pass on a cold boot, without it on a deep-sleep wake.
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "agro/config_store.hpp"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+agro::ConfigImageBuilder example_config() {
+  agro::ConfigImageBuilder b;
+  b.generation = 7;
+  b.system = {17, 900, 120, 0};
+  std::strcpy(b.uplink.apn, "internet");
+  std::strcpy(b.uplink.host, "203.0.113.7");
+  std::strcpy(b.uplink.sms_number, "+491700000000");
+  const agro::ZoneProgram programs[] = {
+      {0, 0x15, 330, 120000, 45, 350}, {1, 0x7f, 375, 40000, 20, 0},   {2, 0x0a, 360, 80000, 30, 300},
+      {3, 0x7f, 1200, 25000, 15, 0},   {4, 0x41, 300, 200000, 60, 400}, {5, 0x1f, 420, 60000, 25, 0},
+  };
+  for (const auto& p : programs) b.zones[b.zone_count++] = p;
+  const agro::GeofenceVertex fence[] = {
+      {481173020, 115166700}, {481181500, 115189200}, {481167300, 115201400}, {481159100, 115177600}};
+  for (const auto& v : fence) b.geofence[b.geofence_count++] = v;
+  return b;
+}
+
+std::string to_json(const agro::ConfigImageBuilder& b) {
+  char buf[512];
+  std::string j = "{\n";
+  std::snprintf(buf, sizeof(buf), "  \"system\": {\"node_id\": %u, \"wake_period_s\": %u, \"utc_offset_min\": %d},\n",
+                b.system.node_id, b.system.wake_period_s, b.system.utc_offset_min);
+  j += buf;
+  const auto& u = b.uplink;
+  std::snprintf(buf, sizeof(buf),
+                "  \"uplink\": {\"apn\": \"%s\", \"host\": \"%s\", \"port\": %u, \"upload_every_wakes\": %u,\n"
+                "             \"max_batch_records\": %u, \"sms_after_failures\": %u, \"sms_number\": \"%s\"},\n",
+                u.apn, u.host, u.port, u.upload_every_wakes, u.max_batch_records, u.sms_after_failures, u.sms_number);
+  j += buf;
+  const auto& t = b.thresholds;
+  std::snprintf(buf, sizeof(buf),
+                "  \"thresholds\": {\"soil_air_raw\": %u, \"soil_water_raw\": %u, \"soil_dry_raw\": %u,\n"
+                "    \"soil_wet_raw\": %u, \"pulses_per_liter\": %u, \"max_open_s\": %u, \"no_flow_s\": %u,\n"
+                "    \"leak_pulses\": %u, \"stuck_open_ml_per_min\": %u, \"battery_low_mv\": %u,\n"
+                "    \"battery_cutoff_mv\": %u},\n",
+                t.soil_air_raw, t.soil_water_raw, t.soil_dry_raw, t.soil_wet_raw, t.pulses_per_liter, t.max_open_s,
+                t.no_flow_s, t.leak_pulses, t.stuck_open_ml_per_min, t.battery_low_mv, t.battery_cutoff_mv);
+  j += buf;
+  j += "  \"zones\": [\n";
+  for (size_t i = 0; i < b.zone_count; ++i) {
+    const auto& z = b.zones[i];
+    std::snprintf(buf, sizeof(buf),
+                  "    {\"zone\": %u, \"days_mask\": %u, \"start_minute\": %u, \"liters\": %u, \"max_minutes\": %u, "
+                  "\"dry_permille\": %u}%s\n",
+                  z.zone, z.days_mask, z.start_minute, z.target_ml / 1000, z.max_minutes, z.dry_permille,
+                  i + 1 < b.zone_count ? "," : "");
+    j += buf;
+  }
+  j += "  ],\n  \"geofence\": [";
+  for (size_t i = 0; i < b.geofence_count; ++i) {
+    std::snprintf(buf, sizeof(buf), "%s[%.7f, %.7f]", i ? ", " : "", b.geofence[i].lat_e7 / 1e7,
+                  b.geofence[i].lon_e7 / 1e7);
+    j += buf;
+  }
+  j += "]\n}\n";
+  return j;
+}
+
+// Allocation-free JSON reader filling the same structs: tracks the key path
+// (object key, array index) and assigns each scalar it meets.
+class JsonConfigParser {
+ public:
+  explicit JsonConfigParser(agro::ConfigImageBuilder* out) : out_(out) {}
+
+  bool parse(const char* text, size_t len) {
+    p_ = text;
+    end_ = text + len;
+    ws();
+    return value(0) && (ws(), p_ == end_);
+  }
+
+ private:
+  static constexpr int kMaxDepth = 4;
+
+  void ws() {
+    while (p_ < end_ && (*p_ == ' ' || *p_ == '\n' || *p_ == '\r' || *p_ == '\t')) ++p_;
+  }
+
+  bool string(const char** s, size_t* n) {
+    if (p_ >= end_ || *p_ != '"') return false;
+    *s = ++p_;
+    while (p_ < end_ && *p_ != '"') {
+      if (*p_ == '\\') ++p_;  // escapes are passed through; config strings have none
+      ++p_;
+    }
+    if (p_ >= end_) return false;
+    *n = size_t(p_ - *s);
+    ++p_;
+    return true;
+  }
+
+  bool value(int depth) {
+    if (depth >= kMaxDepth || p_ >= end_) return false;
+    if (*p_ == '{') {
+      ++p_;
+      ws();
+      if (p_ < end_ && *p_ == '}') return ++p_, true;
+      for (;;) {
+        ws();
+        if (!string(&key_[depth], &key_len_[depth])) return false;
+        ws();
+        if (p_ >= end_ || *p_++ != ':') return false;
+        ws();
+        index_[depth] = -1;
+        if (!value(depth + 1)) return false;
+        ws();
+        if (p_ < end_ && *p_ == ',') {
+          ++p_;
+          continue;
+        }
+        return p_ < end_ && *p_++ == '}';
+      }
+    }
+    if (*p_ == '[') {
+      ++p_;
+      ws();
+      key_len_[depth] = 0;
+      if (p_ < end_ && *p_ == ']') return ++p_, true;
+      for (int i = 0;; ++i) {
+        ws();
+        index_[depth] = i;
+        if (!value(depth + 1)) return false;
+        ws();
+        if (p_ < end_ && *p_ == ',') {
+          ++p_;
+          continue;
+        }
+        return p_ < end_ && *p_++ == ']';
+      }
+    }
+    if (*p_ == '"') {
+      const char* s;
+      size_t n;
+      return string(&s, &n) && assign_string(depth, s, n);
+    }
+    char* num_end = nullptr;
+    const double d = std::strtod(p_, &num_end);
+    if (num_end == p_) return false;
+    p_ = num_end;
+    return assign_number(depth, d);
+  }
+
+  bool key_is(int depth, const char* k) const {
+    return key_len_[depth] == std::strlen(k) && std::memcmp(key_[depth], k, key_len_[depth]) == 0;
+  }
+
+  template <size_t N>
+  static bool copy_str(char (&dst)[N], const char* s, size_t n) {
+    if (n >= N) return false;
+    std::memcpy(dst, s, n);
+    dst[n] = '\0';
+    return true;
+  }
+
+  bool assign_string(int depth, const char* s, size_t n) {
+    if (depth != 2 || !key_is(0, "uplink")) return true;
+    auto& u = out_->uplink;
+    if (key_is(1, "apn")) return copy_str(u.apn, s, n);
+    if (key_is(1, "host")) return copy_str(u.host, s, n);
+    if (key_is(1, "sms_number")) return copy_str(u.sms_number, s, n);
+    return true;
+  }
+
+  bool assign_number(int depth, double d) {
+    const auto v = static_cast<long>(d);
+    if (depth == 2 && key_is(0, "system")) {
+      auto& s = out_->system;
+      if (key_is(1, "node_id")) s.node_id = uint32_t(v);
+      else if (key_is(1, "wake_period_s")) s.wake_period_s = uint32_t(v);
+      else if (key_is(1, "utc_offset_min")) s.utc_offset_min = int16_t(v);
+    } else if (depth == 2 && key_is(0, "uplink")) {
+      auto& u = out_->uplink;
+      if (key_is(1, "port")) u.port = uint16_t(v);
+      else if (key_is(1, "upload_every_wakes")) u.upload_every_wakes = uint16_t(v);
+      else if (key_is(1, "max_batch_records")) u.max_batch_records = uint16_t(v);
+      else if (key_is(1, "sms_after_failures")) u.sms_after_failures = uint8_t(v);
+    } else if (depth == 2 && key_is(0, "thresholds")) {
+      auto& t = out_->thresholds;
+      if (key_is(1, "soil_air_raw")) t.soil_air_raw = uint16_t(v);
+      else if (key_is(1, "soil_water_raw")) t.soil_water_raw = uint16_t(v);
+      else if (key_is(1, "soil_dry_raw")) t.soil_dry_raw = uint16_t(v);
+      else if (key_is(1, "soil_wet_raw")) t.soil_wet_raw = uint16_t(v);
+      else if (key_is(1, "pulses_per_liter")) t.pulses_per_liter = uint16_t(v);
+      else if (key_is(1, "max_open_s")) t.max_open_s = uint16_t(v);
+      else if (key_is(1, "no_flow_s")) t.no_flow_s = uint16_t(v);
+      else if (key_is(1, "leak_pulses")) t.leak_pulses = uint16_t(v);
+      else if (key_is(1, "stuck_open_ml_per_min")) t.stuck_open_ml_per_min = uint32_t(v);
+      else if (key_is(1, "battery_low_mv")) t.battery_low_mv = uint16_t(v);
+      else if (key_is(1, "battery_cutoff_mv")) t.battery_cutoff_mv = uint16_t(v);
+    } else if (depth == 3 && key_is(0, "zones")) {
+      const int i = index_[1];
+      if (i < 0 || size_t(i) >= agro::kMaxZonePrograms) return false;
+      out_->zone_count = std::max(out_->zone_count, size_t(i) + 1);
+      auto& z = out_->zones[i];
+      if (key_is(2, "zone")) z.zone = uint8_t(v);
+      else if (key_is(2, "days_mask")) z.days_mask = uint8_t(v);
+      else if (key_is(2, "start_minute")) z.start_minute = uint16_t(v);
+      else if (key_is(2, "liters")) z.target_ml = uint32_t(v) * 1000u;
+      else if (key_is(2, "max_minutes")) z.max_minutes = uint16_t(v);
+      else if (key_is(2, "dry_permille")) z.dry_permille = uint16_t(v);
+    } else if (depth == 3 && key_is(0, "geofence")) {
+      const int i = index_[1];
+      if (i < 0 || size_t(i) >= agro::kMaxGeofenceVertices) return false;
+      out_->geofence_count = std::max(out_->geofence_count, size_t(i) + 1);
+      const int32_t e7 = static_cast<int32_t>(d * 1e7 + (d < 0 ? -0.5 : 0.5));
+      (index_[2] == 0 ? out_->geofence[i].lat_e7 : out_->geofence[i].lon_e7) = e7;
+    }
+    return true;
+  }
+
+  agro::ConfigImageBuilder* out_;
+  const char* p_ = nullptr;
+  const char* end_ = nullptr;
+  const char* key_[kMaxDepth] = {};
+  size_t key_len_[kMaxDepth] = {};
+  int index_[kMaxDepth] = {};
+};
+
+// What a wake needs before it can act.
+struct Ready {
+  agro::IrrigationConfig irrigation;
+  agro::ZoneProgram due[agro::kMaxZonePrograms];
+  size_t due_count = 0;
+  const char* apn = nullptr;
+  const char* host = nullptr;
+};
+
+constexpr uint8_t kWeekday = 2;  // Wednesday
+constexpr uint16_t kMinute = 330;
+
+Ready ready_from_view(const agro::ConfigView& v) {
+  Ready r;
+  r.irrigation = agro::irrigation_config(v.thresholds());
+  r.due_count = agro::due_zone_programs(v, kWeekday, kMinute, r.due, agro::kMaxZonePrograms);
+  r.apn = v.uplink().apn;
+  r.host = v.uplink().host;
+  return r;
+}
+
+Ready ready_from_parsed(const agro::ConfigImageBuilder& b) {
+  Ready r;
+  r.irrigation = agro::irrigation_config(b.thresholds);
+  for (size_t i = 0; i < b.zone_count; ++i) {
+    const auto& z = b.zones[i];
+    if ((z.days_mask >> kWeekday & 1) && z.start_minute == kMinute) r.due[r.due_count++] = z;
+  }
+  r.apn = b.uplink.apn;
+  r.host = b.uplink.host;
+  return r;
+}
+
+bool same(const Ready& a, const Ready& b) {
+  return a.irrigation.pulses_per_liter == b.irrigation.pulses_per_liter &&
+         a.irrigation.max_open_ms == b.irrigation.max_open_ms && a.due_count == b.due_count &&
+         (a.due_count == 0 || std::memcmp(a.due, b.due, a.due_count * sizeof(a.due[0])) == 0) &&
+         std::strcmp(a.apn, b.apn) == 0 && std::strcmp(a.host, b.host) == 0;
+}
+
+template <class F>
+double ns_per(uint32_t iterations, F&& f) {
+  const auto t0 = Clock::now();
+  for (uint32_t i = 0; i < iterations; ++i) f();
+  return std::chrono::duration<double, std::nano>(Clock::now() - t0).count() / iterations;
+}
+
+// Lays out an image by hand, to stand in for images written by older or
+// newer compilers than this build.
+struct RawSection {
+  uint16_t id;
+  uint16_t entry_bytes;
+  uint16_t count;
+  std::vector<uint8_t> bytes;
+};
+
+std::vector<uint8_t> craft_image(const std::vector<RawSection>& sections) {
+  const size_t header_bytes = sizeof(agro::ConfigHeader) + sections.size() * sizeof(agro::SectionEntry);
+  std::vector<uint8_t> img((header_bytes + 7) & ~size_t{7}, 0);
+  std::vector<agro::SectionEntry> table;
+  for (const auto& s : sections) {
+    table.push_back({s.id, s.entry_bytes, s.count, 0, uint32_t(img.size())});
+    img.insert(img.end(), s.bytes.begin(), s.bytes.end());
+    img.resize((img.size() + 7) & ~size_t{7}, 0);
+  }
+  agro::ConfigHeader h{agro::kConfigMagic, uint32_t(img.size()), 0, agro::kConfigMajor, 0, uint16_t(header_bytes),
+                       uint16_t(sections.size()), 1};
+  std::memcpy(img.data(), &h, sizeof(h));
+  std::memcpy(img.data() + sizeof(h), table.data(), table.size() * sizeof(agro::SectionEntry));
+  h.crc32 = agro::crc32(img.data() + 12, img.size() - 12);
+  std::memcpy(img.data() + 8, &h.crc32, 4);
+  return img;
+}
+
+template <class T>
+std::vector<uint8_t> bytes_of(const T& v, size_t n = sizeof(T)) {
+  std::vector<uint8_t> out(n, 0);
+  std::memcpy(out.data(), &v, std::min(n, sizeof(T)));
+  return out;
+}
+
+bool evolution_checks() {
+  agro::ThresholdConfig t;
+  t.pulses_per_liter = 330;
+  t.battery_cutoff_mv = 10900;
+  agro::ZoneProgram z{3, 0x7f, 600, 5000, 10, 0};
+
+  // Older compiler: ThresholdConfig ended after leak_pulses.
+  const size_t old_thresholds = offsetof(agro::ThresholdConfig, stuck_open_ml_per_min);
+  const auto older = craft_image({{3, uint16_t(old_thresholds), 1, bytes_of(t, old_thresholds)}});
+  agro::ConfigView v;
+  bool ok = v.open(older.data(), older.size()) == agro::ConfigStatus::kOk && v.thresholds().pulses_per_liter == 330 &&
+            v.thresholds().battery_cutoff_mv == agro::ThresholdConfig{}.battery_cutoff_mv &&
+            v.uplink().port == agro::UplinkConfig{}.port;
+
+  // Newer compiler: wider zone entries and a section this build does not know.
+  std::vector<uint8_t> zones = bytes_of(z, sizeof(z) + 4);
+  zones.insert(zones.end(), zones.begin(), zones.end());
+  const auto newer = craft_image({{4, uint16_t(sizeof(z) + 4), 2, zones},
+                                  {3, uint16_t(sizeof(t) + 8), 1, bytes_of(t, sizeof(t) + 8)},
+                                  {42, 4, 1, {1, 2, 3, 4}}});
+  ok = ok && v.open(newer.data(), newer.size()) == agro::ConfigStatus::kOk && v.zone_count() == 2 &&
+       v.zone(1).target_ml == 5000 && v.zone(1).start_minute == 600 && v.thresholds().battery_cutoff_mv == 10900;
+
+  // Corruption and a future major version are rejected.
+  auto bad = newer;
+  bad[bad.size() - 3] ^= 1;
+  ok = ok && v.open(bad.data(), bad.size()) == agro::ConfigStatus::kBadCrc && !v.valid();
+  auto major = newer;
+  major[12] = agro::kConfigMajor + 1;
+  ok = ok && v.open(major.data(), major.size()) == agro::ConfigStatus::kIncompatible;
+  return ok;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  const uint32_t iterations = argc > 1 ? uint32_t(std::max(1, std::atoi(argv[1]))) : 200000;
+  const agro::ConfigImageBuilder cfg = example_config();
+  uint8_t image[agro::ConfigImageBuilder::kMaxImageBytes];
+  const size_t image_len = cfg.build(image, sizeof(image));
+  const std::string json = to_json(cfg);
+
+  // Sanity: both paths produce the same ready state.
+  agro::ConfigImageBuilder parsed;
+  JsonConfigParser(&parsed).parse(json.data(), json.size());
+  agro::ConfigView view;
+  const bool parse_ok = view.open(image, image_len) == agro::ConfigStatus::kOk;
+  const Ready expect = ready_from_parsed(cfg);
+  bool ok = parse_ok && same(ready_from_view(view), expect) && same(ready_from_parsed(parsed), expect) &&
+            expect.due_count > 0;
+
+  volatile size_t sink = 0;
+  std::vector<char> ram(json.size());
+  const double json_ns = ns_per(iterations, [&] {
+    std::memcpy(ram.data(), json.data(), json.size());  // file read out of flash
+    agro::ConfigImageBuilder b;
+    JsonConfigParser(&b).parse(ram.data(), ram.size());
+    sink = sink + ready_from_parsed(b).due_count;
+  });
+  const double cold_ns = ns_per(iterations, [&] {
+    agro::ConfigView v;
+    v.open(image, image_len, true);
+    sink = sink + ready_from_view(v).due_count;
+  });
+  const double warm_ns = ns_per(iterations, [&] {
+    agro::ConfigView v;
+    v.open(image, image_len, false);
+    sink = sink + ready_from_view(v).due_count;
+  });
+
+  std::printf("config: %zu B image, %zu B JSON, %zu zone programs, %zu geofence vertices\n", image_len, json.size(),
+              cfg.zone_count, cfg.geofence_count);
+  std::printf("wake-to-ready: JSON parse             %7.0f ns\n", json_ns);
+  std::printf("               image, CRC checked     %7.0f ns  %5.1fx  (cold boot)\n", cold_ns, json_ns / cold_ns);
+  std::printf("               image, CRC cached      %7.0f ns  %5.1fx  (deep-sleep wake)\n", warm_ns, json_ns / warm_ns);
+
+  const bool evolution_ok = evolution_checks();
+  std::printf("schema evolution (older, newer, corrupt, next major): %s\n", evolution_ok ? "ok" : "FAILED");
+  ok = ok && evolution_ok;
+  if (!parse_ok || !same(ready_from_view(view), expect)) std::printf("MISMATCH between JSON and image paths\n");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,184 @@
+// Host benchmark: worst-case valve close latency and per-core utilization
+// with a saturated radio workload, single Arduino-style loop versus the
+// partitioned runtime (radio and control on separate threads standing in
+// for the two ESP32 cores, linked by CoreQueue rings).
+//
+//   g++ -std=c++20 -O2 -pthread -Ifirmware/include bench/core_partition_bench.cpp -o core_partition_bench
+//   ./core_partition_bench [seconds]
+//
+// The radio side never idles: it spins through AT exchanges of 20-600 ms as
+// a blocking modem driver would, and asks for an irrigation run every half
+// second. The simulated meter reaches each run's target at a known instant;
+// latency is how long after that instant the relay actually drops.
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "agro/core_runtime.hpp"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr uint16_t kPulsesPerLiter = 10000;
+constexpr double kPulsesPerUs = 0.05;  // 5 L/s keeps each run ~200 ms
+constexpr int32_t kTargetMl = 1000;
+constexpr uint32_t kRadioMinMs = 20, kRadioMaxMs = 600;
+constexpr uint32_t kRequestEveryMs = 500;
+
+const Clock::time_point g_t0 = Clock::now();
+
+uint64_t now_us() {
+  return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - g_t0).count());
+}
+
+uint64_t thread_cpu_us() {
+  timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return uint64_t(ts.tv_sec) * 1000000u + uint64_t(ts.tv_nsec) / 1000u;
+}
+
+// Flow meter and relay. Flow starts and stops instantly with the relay.
+class Plumbing {
+ public:
+  uint32_t pulses() const {
+    const uint64_t since = open_since_us_.load(std::memory_order_acquire);
+    const double extra = since ? (now_us() - since) * kPulsesPerUs : 0.0;
+    return static_cast<uint32_t>(acc_.load(std::memory_order_acquire) + extra);
+  }
+
+  static void set_valve(void* ctx, bool open) {
+    auto* self = static_cast<Plumbing*>(ctx);
+    const uint64_t now = now_us();
+    if (open) {
+      self->open_since_us_.store(now, std::memory_order_release);
+      self->ideal_close_us_ = now + uint64_t(kTargetMl / 1000.0 * kPulsesPerLiter / kPulsesPerUs);
+      return;
+    }
+    const uint64_t since = self->open_since_us_.exchange(0, std::memory_order_acq_rel);
+    self->acc_.fetch_add(uint32_t((now - since) * kPulsesPerUs), std::memory_order_acq_rel);
+    self->latencies_us.push_back(now > self->ideal_close_us_ ? uint32_t(now - self->ideal_close_us_) : 0);
+  }
+
+  std::vector<uint32_t> latencies_us;
+
+ private:
+  std::atomic<uint64_t> open_since_us_{0};
+  std::atomic<uint32_t> acc_{0};
+  uint64_t ideal_close_us_ = 0;
+};
+
+agro::IrrigationConfig bench_config() {
+  agro::IrrigationConfig cfg;
+  cfg.pulses_per_liter = kPulsesPerLiter;
+  cfg.settle_ms = 20;
+  cfg.leak_window_ms = 50;
+  return cfg;
+}
+
+// Busy work standing in for a blocking AT exchange and its parsing.
+void radio_exchange(std::mt19937& rng) {
+  const uint64_t until = now_us() + 1000u * std::uniform_int_distribution<uint32_t>(kRadioMinMs, kRadioMaxMs)(rng);
+  volatile uint64_t sink = 0;
+  while (now_us() < until) sink = sink + 1;
+}
+
+struct Result {
+  std::vector<uint32_t> latencies_us;
+  double util[2] = {};
+  uint32_t runs = 0;
+};
+
+Result run_single_loop(double seconds) {
+  agro::CoreLinks links;
+  Plumbing plumbing;
+  agro::ControlLoop control(links, bench_config(), &Plumbing::set_valve, &plumbing);
+  std::mt19937 rng(5);
+  Result r;
+  const uint64_t end = now_us() + uint64_t(seconds * 1e6);
+  const uint64_t cpu0 = thread_cpu_us(), wall0 = now_us();
+  uint64_t next_request = 0;
+  while (now_us() < end) {
+    if (now_us() >= next_request) {
+      links.to_control.push({agro::MsgType::kIrrigate, 0, 0, uint32_t(now_us()), kTargetMl, 0});
+      next_request = now_us() + kRequestEveryMs * 1000u;
+    }
+    radio_exchange(rng);
+    control.step(uint32_t(now_us() / 1000), plumbing.pulses());
+    agro::CoreMessage m;
+    while (links.to_radio.pop(&m)) r.runs += m.type == agro::MsgType::kValveStatus;
+  }
+  r.util[0] = double(thread_cpu_us() - cpu0) / double(now_us() - wall0);
+  r.latencies_us = plumbing.latencies_us;
+  return r;
+}
+
+Result run_partitioned(double seconds) {
+  static agro::CoreLinks links;
+  Plumbing plumbing;
+  agro::ControlLoop control(links, bench_config(), &Plumbing::set_valve, &plumbing);
+  std::atomic<bool> stop{false};
+  Result r;
+  const uint64_t wall0 = now_us();
+
+  std::thread radio([&] {
+    std::mt19937 rng(5);
+    const uint64_t cpu0 = thread_cpu_us();
+    uint64_t next_request = 0;
+    while (!stop.load(std::memory_order_relaxed)) {
+      if (now_us() >= next_request) {
+        links.to_control.push({agro::MsgType::kIrrigate, 0, 0, uint32_t(now_us()), kTargetMl, 0});
+        next_request = now_us() + kRequestEveryMs * 1000u;
+      }
+      radio_exchange(rng);
+      agro::CoreMessage m;
+      while (links.to_radio.pop(&m)) r.runs += m.type == agro::MsgType::kValveStatus;
+    }
+    r.util[0] = double(thread_cpu_us() - cpu0) / double(now_us() - wall0);
+  });
+
+  std::thread ctl([&] {
+    const uint64_t cpu0 = thread_cpu_us();
+    while (!stop.load(std::memory_order_relaxed)) {
+      control.step(uint32_t(now_us() / 1000), plumbing.pulses());
+      // The ESP32 task also wakes on a notification; polling at 10 ms stands in.
+      std::this_thread::sleep_for(std::chrono::milliseconds(std::min<uint32_t>(control.next_tick_ms(), 10)));
+    }
+    r.util[1] = double(thread_cpu_us() - cpu0) / double(now_us() - wall0);
+  });
+
+  std::this_thread::sleep_for(std::chrono::microseconds(uint64_t(seconds * 1e6)));
+  stop = true;
+  radio.join();
+  ctl.join();
+  r.latencies_us = plumbing.latencies_us;
+  return r;
+}
+
+void report(const char* name, Result r) {
+  std::sort(r.latencies_us.begin(), r.latencies_us.end());
+  const auto pct = [&](size_t p) {
+    const auto& v = r.latencies_us;
+    return v.empty() ? 0.0 : v[std::min(v.size() - 1, v.size() * p / 100)] / 1000.0;
+  };
+  std::printf("%-12s runs %3u  valve close latency p50 %7.2f ms  p99 %7.2f ms  max %7.2f ms", name, r.runs, pct(50),
+              pct(99), pct(100));
+  std::printf("  util radio %3.0f%% control %3.0f%%\n", 100 * r.util[0], 100 * r.util[1]);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  const double seconds = argc > 1 ? std::max(1.0, std::atof(argv[1])) : 10.0;
+  std::printf("saturated radio workload, %.0f s each, %u hardware threads\n", seconds,
+              std::thread::hardware_concurrency());
+  report("single loop", run_single_loop(seconds));
+  report("partitioned", run_partitioned(seconds));
+  return 0;
+}
@@ -0,0 +1,305 @@
+// Host benchmark for the coroutine drivers: switch cost and frame memory
+// against a thread-per-driver design, plus a scripted run of the modem
+// session and GPS acquisition sharing one scheduler.
+//
+//   g++ -std=c++20 -O2 -pthread -Icommon/include -Ifirmware/include bench/coro_driver_bench.cpp firmware/src/memory.cpp -o coro_driver_bench
+//   ./coro_driver_bench [rounds]
+//
+// The thread variant stands in for one RTOS task per driver: two threads
+// handing a binary semaphore back and forth, each with its own stack. The
+// scripted SIM800L answers the AT commands the session sends, with
+// registration taking several CREG polls; the NEO-6M emits GGA once a second
+// and gets a fix after 25 s. Exits non-zero if either driver fails or a
+// frame leaks.
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <semaphore>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "agro/gps_acquire.hpp"
+#include "agro/modem_session.hpp"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// What a thread-per-driver design would pin per driver on the ESP32: the
+// smallest stack that survives snprintf plus the AT parsing, and the TCB.
+constexpr uint32_t kDriverTaskStackBytes = 3072;
+constexpr uint32_t kTaskTcbBytes = 360;
+
+double ns_since(Clock::time_point t0, uint32_t n) {
+  return std::chrono::duration<double, std::nano>(Clock::now() - t0).count() / n;
+}
+
+agro::Task<void> yielder(agro::Scheduler& sched, uint32_t rounds) {
+  for (uint32_t i = 0; i < rounds; ++i) co_await sched.yield();
+}
+
+double coroutine_round_trip_ns(uint32_t rounds) {
+  agro::Scheduler sched;
+  if (!sched.spawn(yielder(sched, rounds))) return 0;
+  const auto t0 = Clock::now();
+  while (!sched.idle()) sched.poll(0);
+  return ns_since(t0, rounds);
+}
+
+double thread_round_trip_ns(uint32_t rounds) {
+  std::binary_semaphore ping(0), pong(0);
+  std::thread other([&] {
+    for (uint32_t i = 0; i < rounds; ++i) {
+      ping.acquire();
+      pong.release();
+    }
+  });
+  const auto t0 = Clock::now();
+  for (uint32_t i = 0; i < rounds; ++i) {
+    ping.release();
+    pong.acquire();
+  }
+  const double ns = ns_since(t0, rounds);
+  other.join();
+  return ns;
+}
+
+// A UART whose far end is scripted: replies are queued with a due time and
+// pushed into the RX ring as the simulated clock reaches them.
+class FakeUart {
+ public:
+  agro::UartRxRing ring;
+  uint32_t now_ms = 0;
+
+  static size_t write(void* ctx, const uint8_t* data, size_t len) {
+    auto* self = static_cast<FakeUart*>(ctx);
+    self->tx_.append(reinterpret_cast<const char*>(data), len);
+    self->on_tx();
+    return len;
+  }
+
+  void reply(uint32_t delay_ms, const std::string& text) { pending_.push_back({now_ms + delay_ms, text}); }
+
+  void deliver() {
+    std::stable_sort(pending_.begin(), pending_.end(), [](const Pending& a, const Pending& b) { return a.due < b.due; });
+    while (!pending_.empty() && int32_t(now_ms - pending_.front().due) >= 0) {
+      for (char c : pending_.front().text) ring.push(static_cast<uint8_t>(c));
+      pending_.erase(pending_.begin());
+    }
+  }
+
+  uint32_t next_due() const { return pending_.empty() ? agro::Scheduler::kForever : pending_.front().due; }
+
+ protected:
+  virtual ~FakeUart() = default;
+  virtual void on_tx() {}
+  std::string tx_;
+
+ private:
+  struct Pending {
+    uint32_t due;
+    std::string text;
+  };
+  std::vector<Pending> pending_;
+};
+
+class FakeSim800 : public FakeUart {
+ public:
+  std::string received;  // payload bytes that reached the "server"
+
+ private:
+  void on_tx() override {
+    if (send_left_ > 0) {
+      const size_t n = std::min(send_left_, tx_.size());
+      received += tx_.substr(0, n);
+      tx_.erase(0, n);
+      send_left_ -= n;
+      if (send_left_ == 0) reply(800, "\r\nSEND OK\r\n");
+      return;
+    }
+    size_t cr;
+    while ((cr = tx_.find('\r')) != std::string::npos) {
+      const std::string cmd = tx_.substr(0, cr);
+      tx_.erase(0, cr + 1);
+      command(cmd);
+    }
+  }
+
+  void command(const std::string& cmd) {
+    if (cmd == "AT" && ++at_count_ < 3) return;  // autobaud: first attempts go unanswered
+    if (cmd == "AT+CREG?") {
+      reply(40, ++creg_count_ < 6 ? "\r\n+CREG: 0,2\r\n\r\nOK\r\n" : "\r\n+CREG: 0,1\r\n\r\nOK\r\n");
+    } else if (cmd == "AT+CIICR") {
+      reply(2500, "\r\nOK\r\n");
+    } else if (cmd == "AT+CIFSR") {
+      reply(60, "\r\n10.12.34.56\r\n");
+    } else if (cmd.rfind("AT+CIPSTART", 0) == 0) {
+      reply(30, "\r\nOK\r\n");
+      reply(3200, "\r\nCONNECT OK\r\n");
+    } else if (cmd.rfind("AT+CIPSEND=", 0) == 0) {
+      send_left_ = std::strtoul(cmd.c_str() + 11, nullptr, 10);
+      reply(50, "\r\n> ");
+    } else if (cmd == "AT+CIPCLOSE=1") {
+      reply(200, "\r\nCLOSE OK\r\n");
+    } else if (cmd == "AT+CIPSHUT") {
+      reply(400, "\r\nSHUT OK\r\n");
+    } else {
+      reply(20, "\r\nOK\r\n");
+    }
+  }
+
+  int at_count_ = 0;
+  int creg_count_ = 0;
+  size_t send_left_ = 0;
+};
+
+std::string nmea(const char* body) {
+  uint8_t sum = 0;
+  for (const char* p = body; *p; ++p) sum ^= static_cast<uint8_t>(*p);
+  char buf[128];
+  std::snprintf(buf, sizeof(buf), "$%s*%02X\r\n", body, sum);
+  return buf;
+}
+
+// NEO-6M: GGA plus the other default sentences every second; a fix with a
+// TIMEPULSE edge from fix_ms on.
+class FakeNeo6m : public FakeUart {
+ public:
+  explicit FakeNeo6m(uint32_t fix_ms) : fix_ms_(fix_ms) {}
+
+  agro::EdgeSignal timepulse;
+
+  void tick() {
+    while (int32_t(now_ms - next_epoch_) >= 0) {
+      const bool fix = int32_t(next_epoch_ - fix_ms_) >= 0;
+      const uint32_t saved = now_ms;
+      now_ms = next_epoch_;
+      reply(0, nmea("GPRMC,120000.00,V,,,,,,,010126,,,N"));
+      reply(5, fix ? nmea("GPGGA,120000.00,4807.03812,N,01131.00025,E,1,08,1.1,545.4,M,46.9,M,,")
+                   : nmea("GPGGA,120000.00,,,,,0,03,99.9,,,,,,"));
+      reply(10, nmea("GPGSA,A,1,,,,,,,,,,,,,99.99,99.99,99.99"));
+      now_ms = saved;
+      if (fix) timepulse.fire();
+      next_epoch_ += 1000;
+    }
+  }
+
+  uint32_t next_epoch() const { return next_epoch_; }
+
+ private:
+  uint32_t fix_ms_;
+  uint32_t next_epoch_ = 0;
+};
+
+agro::Task<void> run_modem(agro::Scheduler& sched, agro::LinePort& port, const agro::ModemSessionConfig& cfg,
+                           const uint8_t* payload, size_t len, agro::SessionResult* out, uint32_t* done_ms) {
+  *out = co_await agro::modem_session(sched, port, cfg, payload, len);
+  *done_ms = sched.now_ms();
+}
+
+agro::Task<void> run_gps(agro::Scheduler& sched, agro::LinePort& port, agro::EdgeSignal* pps,
+                         agro::GpsAcquireConfig cfg, agro::GpsFix* out) {
+  *out = co_await agro::gps_acquire(sched, port, pps, cfg);
+}
+
+struct ScriptResult {
+  agro::SessionResult session = agro::SessionResult::kNoFrame;
+  uint32_t session_ms = 0;
+  agro::GpsFix fix;
+  uint32_t switches = 0;
+  uint32_t polls = 0;
+  bool payload_ok = false;
+};
+
+ScriptResult run_script(bool use_timepulse) {
+  FakeSim800 modem;
+  FakeNeo6m gps(25000);
+  agro::LinePort gsm_port(modem.ring, &FakeUart::write, &modem);
+  agro::LinePort gps_port(gps.ring, &FakeUart::write, &gps);
+  agro::Scheduler sched;
+
+  agro::ModemSessionConfig cfg;
+  cfg.host = "203.0.113.7";
+  cfg.port = 5683;
+  const char payload[] = "\xA1\x01\x02 telemetry batch";
+  ScriptResult r;
+  sched.spawn(run_modem(sched, gsm_port, cfg, reinterpret_cast<const uint8_t*>(payload), sizeof(payload) - 1,
+                        &r.session, &r.session_ms));
+  sched.spawn(run_gps(sched, gps_port, use_timepulse ? &gps.timepulse : nullptr, {}, &r.fix));
+
+  uint32_t now = 0;
+  while (!sched.idle() && now < 200000) {
+    modem.now_ms = gps.now_ms = now;
+    gps.tick();
+    modem.deliver();
+    gps.deliver();
+    const uint32_t wait = sched.poll(now);
+    ++r.polls;
+    if (wait == 0) continue;
+    // Sleep until the next deadline or the next byte from either module,
+    // as the driver task would on its notification.
+    uint32_t next = wait == agro::Scheduler::kForever ? UINT32_MAX : now + wait;
+    next = std::min({next, modem.next_due(), gps.next_due(), gps.next_epoch()});
+    now = std::max(now + 1, next);
+  }
+  r.switches = sched.switches();
+  r.payload_ok = modem.received == std::string(payload, sizeof(payload) - 1);
+  return r;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  const uint32_t rounds = argc > 1 ? std::max(1, std::atoi(argv[1])) : 1000000;
+
+  const double coro_ns = coroutine_round_trip_ns(rounds);
+  const double thread_ns = thread_round_trip_ns(std::min<uint32_t>(rounds, 200000));
+  std::printf("switch round trip: coroutine via scheduler %.1f ns, thread pair (binary_semaphore) %.1f ns, %.0fx\n",
+              coro_ns, thread_ns, thread_ns / coro_ns);
+
+  // Frame sizes: allocate each coroutine once without running it.
+  agro::Scheduler sched;
+  FakeSim800 modem;
+  agro::LinePort port(modem.ring, &FakeUart::write, &modem);
+  agro::EdgeSignal pps;
+  agro::ModemSessionConfig cfg;
+  size_t at_frame = 0, session_frame = 0, gps_frame = 0;
+  {
+    agro::coro_detail::g_largest_frame = 0;
+    auto t = agro::at_command(sched, port, "AT", "OK", 1000);
+    at_frame = agro::coro_frame_stats().largest_frame_bytes;
+    agro::coro_detail::g_largest_frame = 0;
+    auto s = agro::modem_session(sched, port, cfg, nullptr, 0);
+    session_frame = agro::coro_frame_stats().largest_frame_bytes;
+    agro::coro_detail::g_largest_frame = 0;
+    auto g = agro::gps_acquire(sched, port, &pps, {});
+    gps_frame = agro::coro_frame_stats().largest_frame_bytes;
+  }
+  const size_t coro_bytes = session_frame + at_frame + gps_frame + sizeof(agro::Scheduler) + 2 * sizeof(agro::LinePort);
+  const size_t task_bytes = 2 * (kDriverTaskStackBytes + kTaskTcbBytes) + 2 * sizeof(agro::LinePort);
+  std::printf("frames: modem_session %zu B, at_command %zu B, gps_acquire %zu B (pool block %zu B)\n", session_frame,
+              at_frame, gps_frame, agro::mem::kCoroFrameBytes);
+  std::printf("driver memory: coroutines %zu B vs thread per driver %zu B (%u B stack + %u B TCB each)\n", coro_bytes,
+              task_bytes, kDriverTaskStackBytes, kTaskTcbBytes);
+
+  bool ok = session_frame <= agro::mem::kCoroFrameBytes && gps_frame <= agro::mem::kCoroFrameBytes &&
+            at_frame <= agro::mem::kCoroFrameBytes;
+  for (bool pps_on : {false, true}) {
+    const ScriptResult r = run_script(pps_on);
+    std::printf("%-18s session %s in %5.1f s, payload %s; fix %s ttff %4.1f s %d sats; %u resumes, %u polls\n",
+                pps_on ? "gps via TIMEPULSE" : "gps parsing NMEA",
+                r.session == agro::SessionResult::kSent ? "sent" : "FAILED", r.session_ms / 1000.0,
+                r.payload_ok ? "intact" : "CORRUPT", r.fix.valid ? "ok" : "NONE", r.fix.ttff_ms / 1000.0,
+                r.fix.satellites, r.switches, r.polls);
+    ok = ok && r.session == agro::SessionResult::kSent && r.payload_ok && r.fix.valid;
+  }
+
+  const agro::PoolStats frames = agro::mem::pool_report().coro_frames;
+  std::printf("frame pool: high water %u/%u, in use %u, failures %u\n", frames.high_water, frames.capacity,
+              frames.in_use, frames.failures);
+  ok = ok && frames.in_use == 0 && frames.failures == 0;
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,164 @@
+// Host benchmark: per-subsystem pools versus the default heap on the
+// telemetry batching workload of one wake cycle.
+//
+//   g++ -std=c++20 -O2 -Icommon/include -Ifirmware/include bench/pool_bench.cpp firmware/src/memory.cpp -o pool_bench
+//   ./pool_bench [wakes]
+//
+// Each wake parses a burst of GPS frames, builds a batch of telemetry records,
+// assembles the uplink through AT response lines, releases acknowledged
+// records in arbitrary order, and ends the cycle. The heap variant uses
+// new/delete and malloc/free for the same objects; the pool variant uses the
+// agro::mem pools and reset_wake_pools().
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "agro/memory.hpp"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct WakePlan {
+  int gps_frames;
+  int records;
+  int gsm_lines;
+  std::vector<int> release_order;
+};
+
+std::vector<WakePlan> make_plans(int wakes) {
+  std::mt19937 rng(42);
+  std::vector<WakePlan> plans(wakes);
+  for (auto& p : plans) {
+    p.gps_frames = std::uniform_int_distribution<int>(4, 8)(rng);
+    p.records = std::uniform_int_distribution<int>(40, 250)(rng);
+    p.gsm_lines = std::uniform_int_distribution<int>(2, 8)(rng);
+    p.release_order.resize(p.records);
+    for (int i = 0; i < p.records; ++i) p.release_order[i] = i;
+    std::shuffle(p.release_order.begin(), p.release_order.end(), rng);
+  }
+  return plans;
+}
+
+struct Latency {
+  std::vector<uint32_t> ns;
+  void add(Clock::duration d) { ns.push_back(uint32_t(std::chrono::duration_cast<std::chrono::nanoseconds>(d).count())); }
+  void report(const char* name, double total_ns, size_t ops) {
+    std::sort(ns.begin(), ns.end());
+    std::printf("%-6s total %8.2f ms  %6.1f ns/op  alloc p50 %4u ns  p99 %4u ns  p99.99 %5u ns  max %6u ns\n",
+                name, total_ns / 1e6, total_ns / ops, ns[ns.size() / 2], ns[ns.size() * 99 / 100],
+                ns[ns.size() * 9999 / 10000], ns.back());
+  }
+};
+
+volatile uint32_t g_sink;
+
+void touch(void* p, size_t n) {
+  std::memset(p, 0x5a, n);
+  g_sink = g_sink + static_cast<unsigned char*>(p)[n - 1];
+}
+
+double run_heap(const std::vector<WakePlan>& plans, Latency& lat, size_t& ops) {
+  std::vector<void*> frames, lines;
+  std::vector<agro::TelemetryRecord*> recs;
+  const auto t0 = Clock::now();
+  for (const auto& p : plans) {
+    for (int i = 0; i < p.gps_frames; ++i) {
+      const auto a = Clock::now();
+      void* f = std::malloc(agro::mem::kGpsFrameBytes);
+      lat.add(Clock::now() - a);
+      touch(f, agro::mem::kGpsFrameBytes);
+      frames.push_back(f);
+    }
+    for (int i = 0; i < p.records; ++i) {
+      const auto a = Clock::now();
+      auto* r = new agro::TelemetryRecord{};
+      lat.add(Clock::now() - a);
+      r->time = uint32_t(i);
+      recs.push_back(r);
+    }
+    void* payload = std::malloc(agro::mem::kGsmPayloadBytes);
+    touch(payload, 64);
+    for (int i = 0; i < p.gsm_lines; ++i) {
+      const auto a = Clock::now();
+      void* l = std::malloc(agro::mem::kGsmLineBytes);
+      lat.add(Clock::now() - a);
+      touch(l, 32);
+      lines.push_back(l);
+    }
+    for (int idx : p.release_order) delete recs[idx];
+    for (void* f : frames) std::free(f);
+    for (void* l : lines) std::free(l);
+    std::free(payload);
+    ops += 2 * (p.gps_frames + p.records + p.gsm_lines + 1);
+    frames.clear();
+    lines.clear();
+    recs.clear();
+  }
+  return double(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - t0).count());
+}
+
+double run_pools(const std::vector<WakePlan>& plans, Latency& lat, size_t& ops) {
+  std::vector<agro::TelemetryRecord*> recs;
+  recs.reserve(agro::mem::kTelemetryRecords);
+  auto& frames = agro::mem::gps_frames();
+  auto& lines = agro::mem::gsm_lines();
+  auto& telemetry = agro::mem::telemetry();
+  const auto t0 = Clock::now();
+  for (const auto& p : plans) {
+    agro::mem::reset_wake_pools();
+    for (int i = 0; i < p.gps_frames; ++i) {
+      const auto a = Clock::now();
+      void* f = frames.allocate();
+      lat.add(Clock::now() - a);
+      touch(f, agro::mem::kGpsFrameBytes);
+    }
+    for (int i = 0; i < p.records; ++i) {
+      const auto a = Clock::now();
+      auto* r = telemetry.create();
+      lat.add(Clock::now() - a);
+      r->time = uint32_t(i);
+      recs.push_back(r);
+    }
+    void* payload = agro::mem::gsm_payload().allocate(agro::mem::kGsmPayloadBytes);
+    touch(payload, 64);
+    for (int i = 0; i < p.gsm_lines; ++i) {
+      const auto a = Clock::now();
+      void* l = lines.allocate();
+      lat.add(Clock::now() - a);
+      touch(l, 32);
+    }
+    // Acknowledged records go back individually; frames and lines die with
+    // the wake.
+    for (int idx : p.release_order) telemetry.destroy(recs[idx]);
+    ops += 2 * (p.gps_frames + p.records + p.gsm_lines + 1);
+    recs.clear();
+  }
+  return double(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - t0).count());
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  const int wakes = argc > 1 ? std::max(1, std::atoi(argv[1])) : 20000;
+  const auto plans = make_plans(wakes);
+
+  std::printf("telemetry batching workload, %d wakes\n", wakes);
+  Latency heap_lat, pool_lat;
+  size_t heap_ops = 0, pool_ops = 0;
+  const double heap_ns = run_heap(plans, heap_lat, heap_ops);
+  const double pool_ns = run_pools(plans, pool_lat, pool_ops);
+  heap_lat.report("heap", heap_ns, heap_ops);
+  pool_lat.report("pools", pool_ns, pool_ops);
+
+  const auto r = agro::mem::pool_report();
+  std::printf("high water: gsm lines %u/%u, gsm payload %u/%u B, gps frames %u/%u, telemetry %u/%u, failures %u\n",
+              r.gsm_lines.high_water, r.gsm_lines.capacity, r.gsm_payload.high_water, r.gsm_payload.capacity,
+              r.gps_frames.high_water, r.gps_frames.capacity, r.telemetry.high_water, r.telemetry.capacity,
+              r.gsm_lines.failures + r.gsm_payload.failures + r.gps_frames.failures + r.telemetry.failures);
+  return 0;
+}
@@ -0,0 +1,147 @@
+// Host benchmark: irrigation rules interpreted from bytecode (rule_vm.hpp)
+// against the same rules compiled in as C++.
+//
+//   g++ -std=c++17 -O2 -Icommon/include bench/rule_vm_bench.cpp -o rule_vm_bench
+//   ./rule_vm_bench [millions of evaluations]
+//
+// The rule set is what a field with eight zones might run: a watering rule
+// per zone over soil, battery, time window and the last run, plus load
+// shedding on a low battery. Inputs are drawn at random so both sides take
+// every branch. Every evaluation checks that both produce the same actions
+// and the run exits non-zero otherwise. On the ESP32 both sides run a few
+// times slower; the ratio is what carries over, and either is negligible
+// against one wake.
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "agro/rule_compiler.hpp"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr int kZones = 8;
+
+std::vector<std::string> rule_text() {
+  std::vector<std::string> rules;
+  char buf[256];
+  for (int z = 0; z < kZones; ++z) {
+    std::snprintf(buf, sizeof(buf),
+                  "if soil(%d) < %d and soc > 30%% and (minute >= 05:00 and minute < 08:00 or minute >= 19:30) "
+                  "and since_run(%d) > 600 then water(%d, min(%d L, (%d - soil(%d)) * 40))",
+                  z, 280 + 10 * z, z, z, 20 + 5 * z, 500, z);
+    rules.push_back(buf);
+  }
+  rules.push_back("if battery_mv < 11600 or soc < 15% then skip(0), skip(1), skip(2), alarm(7)");
+  rules.push_back("if weekday == 6 and soil(3) > 700 then skip(3)");
+  return rules;
+}
+
+void add(agro::RuleActions* out, agro::RuleActionKind kind, uint8_t zone, uint32_t value) {
+  if (out->count == agro::kMaxRuleActions) {
+    ++out->dropped;
+    return;
+  }
+  out->items[out->count++] = agro::RuleAction{kind, zone, value};
+}
+
+// The same rules as native code, as they would be written into the firmware.
+void native(const agro::RuleInputs& in, agro::RuleActions* out) {
+  const bool window = (in.minute_of_day >= 300 && in.minute_of_day < 480) || in.minute_of_day >= 1170;
+  for (int z = 0; z < kZones; ++z) {
+    if (in.soil_permille[z] < 280 + 10 * z && in.soc_permille > 300 && window && in.minutes_since_run[z] > 600) {
+      const int32_t ml = std::min<int32_t>((20 + 5 * z) * 1000, (500 - in.soil_permille[z]) * 40);
+      add(out, agro::RuleActionKind::kWater, uint8_t(z), ml > 0 ? uint32_t(ml) : 0);
+    }
+  }
+  if (in.battery_mv < 11600 || in.soc_permille < 150) {
+    for (uint8_t z = 0; z < 3; ++z) add(out, agro::RuleActionKind::kSkip, z, 0);
+    add(out, agro::RuleActionKind::kAlarm, 0, 7);
+  }
+  if (in.weekday == 6 && in.soil_permille[3] > 700) add(out, agro::RuleActionKind::kSkip, 3, 0);
+}
+
+bool same(const agro::RuleActions& a, const agro::RuleActions& b) {
+  if (a.count != b.count || a.dropped != b.dropped) return false;
+  for (uint8_t i = 0; i < a.count; ++i) {
+    if (a.items[i].kind != b.items[i].kind || a.items[i].zone != b.items[i].zone ||
+        a.items[i].value != b.items[i].value) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  const long millions = argc > 1 ? std::max(1L, std::atol(argv[1])) : 2;
+  const long n = millions * 1000000;
+  const std::vector<std::string> text = rule_text();
+  agro::RuleCompiler compiler;
+  for (const std::string& r : text) {
+    if (!compiler.add(r)) {
+      std::printf("FAIL: %s\n  %s\n", r.c_str(), compiler.error().c_str());
+      return 1;
+    }
+  }
+  agro::RuleProgram program;
+  if (!program.load(compiler.code().data(), compiler.code().size())) {
+    std::printf("FAIL: compiled rules do not verify\n");
+    return 1;
+  }
+  std::printf("%zu rules in %zu bytes of bytecode (%zu instructions)\n", text.size(), program.bytes(),
+              program.bytes() / agro::kRuleInstructionBytes);
+
+  // Inputs drawn up front so the draw is not timed.
+  std::mt19937 rng(3);
+  std::vector<agro::RuleInputs> inputs(4096);
+  for (agro::RuleInputs& in : inputs) {
+    for (int z = 0; z < kZones; ++z) {
+      in.soil_permille[z] = uint16_t(rng() % 1000);
+      in.minutes_since_run[z] = uint16_t(rng() % 2000);
+    }
+    in.soc_permille = uint16_t(rng() % 1000);
+    in.battery_mv = uint16_t(11200 + rng() % 1600);
+    in.minute_of_day = uint16_t(rng() % 1440);
+    in.weekday = uint8_t(rng() % 7);
+  }
+
+  long mismatches = 0, steps = 0, actions = 0;
+  for (const agro::RuleInputs& in : inputs) {
+    agro::RuleActions a, b;
+    program.run(in, &a);
+    native(in, &b);
+    mismatches += !same(a, b);
+  }
+
+  auto t0 = Clock::now();
+  for (long i = 0; i < n; ++i) {
+    agro::RuleActions out;
+    steps += program.run(inputs[size_t(i) & 4095], &out);
+    actions += out.count;
+  }
+  const double vm_s = std::chrono::duration<double>(Clock::now() - t0).count();
+  t0 = Clock::now();
+  long native_actions = 0;
+  for (long i = 0; i < n; ++i) {
+    agro::RuleActions out;
+    native(inputs[size_t(i) & 4095], &out);
+    native_actions += out.count;
+  }
+  const double native_s = std::chrono::duration<double>(Clock::now() - t0).count();
+
+  const double per_rule = 1e9 / double(n) / double(text.size());
+  std::printf("  bytecode  %7.1f ns per rule set  %5.1f ns per rule  %5.1f instructions per rule  %4.2f ns each\n",
+              vm_s * 1e9 / double(n), vm_s * per_rule, double(steps) / double(n) / double(text.size()),
+              vm_s * 1e9 / double(steps));
+  std::printf("  native    %7.1f ns per rule set  %5.1f ns per rule\n", native_s * 1e9 / double(n),
+              native_s * per_rule);
+  std::printf("  interpretation costs %.1fx native; actions %ld vs %ld, mismatches %ld\n", vm_s / native_s, actions,
+              native_actions, mismatches);
+  return mismatches == 0 && actions == native_actions ? 0 : 1;
+}
@@ -0,0 +1,170 @@
+// Host benchmark and checks for the device shadow store: a million devices
+// read and updated from every thread at several read/write mixes, against
+// an unordered_map behind a shared_mutex, with a check for torn reads.
+//
+//   g++ -std=c++17 -O2 -pthread -Icommon/include -Iserver/include bench/shadow_bench.cpp server/src/device_shadow.cpp -o shadow_bench
+//   ./shadow_bench [devices] [threads]
+//
+// IMEIs are real-shaped: a handful of SIM800L type allocation codes, a
+// serial and the Luhn digit. Every write is a battery or a position record
+// whose two values are tied (SoC = mV mod 997, lon = -lat), so a reader
+// that sees them disagree has seen half a write. The run fails on a torn
+// read, a missing device or a lost insert.
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "agro/server/device_shadow.hpp"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+using agro::RecordKind;
+using agro::TelemetryRecord;
+using agro::server::DeviceShadow;
+using agro::server::ShadowStore;
+
+constexpr double kRunS = 0.5;  // per mix and store
+
+uint64_t imei(uint64_t tac, uint64_t serial) {
+  const uint64_t body = tac * 1000000 + serial;  // 14 digits
+  // Luhn over the 14 digits, doubling every second from the right.
+  uint64_t x = body, sum = 0;
+  for (int i = 0; i < 14; ++i, x /= 10) {
+    uint64_t d = x % 10;
+    if (i % 2 == 0) d = d * 2 > 9 ? d * 2 - 9 : d * 2;
+    sum += d;
+  }
+  return body * 10 + (10 - sum % 10) % 10;
+}
+
+// One write: tied values, so a torn read shows.
+TelemetryRecord tied(uint32_t n, uint32_t time) {
+  TelemetryRecord r;
+  r.time = time;
+  if (n & 1) {
+    r.kind = RecordKind::kBattery;
+    r.a = int32_t(11000 + n % 2000);
+    r.b = r.a % 997;
+  } else {
+    r.kind = RecordKind::kPosition;
+    r.a = int32_t(450000000 + n % 1000000);
+    r.b = -r.a;
+  }
+  return r;
+}
+
+bool torn(const DeviceShadow& s) {
+  return (s.battery_s != 0 && s.soc_permille != s.battery_mv % 997) || (s.position_s != 0 && s.lon != -s.lat);
+}
+
+// The obvious alternative.
+class LockedStore {
+ public:
+  bool update(uint64_t key, uint32_t device_id, const TelemetryRecord& r) {
+    std::unique_lock<std::shared_mutex> lock(mu_);
+    DeviceShadow& s = map_[key];
+    s.device_id = device_id;
+    agro::server::merge_record(&s, r);
+    return true;
+  }
+  bool read(uint64_t key, DeviceShadow* out) const {
+    std::shared_lock<std::shared_mutex> lock(mu_);
+    const auto it = map_.find(key);
+    if (it == map_.end()) return false;
+    *out = it->second;
+    return true;
+  }
+
+ private:
+  mutable std::shared_mutex mu_;
+  std::unordered_map<uint64_t, DeviceShadow> map_;
+};
+
+struct Result {
+  double mops = 0;
+  uint64_t torn = 0, missing = 0;
+};
+
+template <typename Store>
+Result run(Store& store, const std::vector<uint64_t>& keys, unsigned threads, unsigned write_percent) {
+  std::atomic<bool> stop{false};
+  std::atomic<uint64_t> ops{0}, torn_reads{0}, missing{0};
+  std::vector<std::thread> pool;
+  for (unsigned t = 0; t < threads; ++t) {
+    pool.emplace_back([&, t] {
+      uint64_t x = 0x9e3779b97f4a7c15ull * (t + 1);  // xorshift
+      uint64_t n = 0, bad = 0, lost = 0;
+      uint32_t time = 1700000000 + t;
+      DeviceShadow s;
+      while (!stop.load(std::memory_order_relaxed)) {
+        for (int k = 0; k < 256; ++k, ++n) {
+          x ^= x << 13;
+          x ^= x >> 7;
+          x ^= x << 17;
+          const size_t i = size_t(x % keys.size());
+          if (x >> 57 < write_percent * 128 / 100) {
+            store.update(keys[i], uint32_t(i), tied(uint32_t(x >> 32), time += threads));
+          } else if (!store.read(keys[i], &s)) {
+            ++lost;
+          } else {
+            bad += torn(s);
+          }
+        }
+      }
+      ops += n;
+      torn_reads += bad;
+      missing += lost;
+    });
+  }
+  const auto t0 = Clock::now();
+  std::this_thread::sleep_for(std::chrono::duration<double>(kRunS));
+  stop = true;
+  for (std::thread& th : pool) th.join();
+  const double s = std::chrono::duration<double>(Clock::now() - t0).count();
+  return {double(ops) / s / 1e6, torn_reads, missing};
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  const size_t devices = argc > 1 ? size_t(std::max(1000, std::atoi(argv[1]))) : 1000000;
+  const unsigned hw = std::max(1u, std::thread::hardware_concurrency());
+  // At least two, so readers always race a writer.
+  const unsigned threads = argc > 2 ? unsigned(std::max(1, std::atoi(argv[2]))) : std::max(2u, hw);
+
+  const uint64_t tacs[] = {86145103, 86253504, 86731604, 86476203};
+  std::vector<uint64_t> keys(devices);
+  for (size_t i = 0; i < devices; ++i) keys[i] = imei(tacs[i % 4], i / 4);
+
+  ShadowStore store(devices);
+  LockedStore locked;
+  auto t0 = Clock::now();
+  for (size_t i = 0; i < devices; ++i) store.update(keys[i], uint32_t(i), tied(uint32_t(i), 1600000000));
+  const double insert_ns = std::chrono::duration<double, std::nano>(Clock::now() - t0).count() / double(devices);
+  t0 = Clock::now();
+  for (size_t i = 0; i < devices; ++i) locked.update(keys[i], uint32_t(i), tied(uint32_t(i), 1600000000));
+  const double locked_insert_ns =
+      std::chrono::duration<double, std::nano>(Clock::now() - t0).count() / double(devices);
+  bool ok = store.size() == devices;
+  std::printf("%zu devices, %u threads on %u hardware threads; %.0f MB, %.0f B per device\n", devices, threads, hw,
+              double(store.memory_bytes()) / 1e6, double(store.memory_bytes()) / double(devices));
+  std::printf("  first insert: %.0f ns (shared_mutex map %.0f ns)\n", insert_ns, locked_insert_ns);
+  std::printf("  writes   shadow store       shared_mutex map\n");
+  for (unsigned w : {0u, 5u, 50u}) {
+    const Result a = run(store, keys, threads, w);
+    const Result b = run(locked, keys, threads, w);
+    std::printf("  %3u%%    %7.1f M ops/s      %7.1f M ops/s%s\n", w, a.mops, b.mops,
+                a.torn || a.missing ? "  TORN OR MISSING" : "");
+    ok = ok && a.torn == 0 && a.missing == 0 && b.missing == 0;
+  }
+  ok = ok && store.size() == devices;
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,198 @@
+// Host benchmark and checks for the spatial indexes: field lookup by
+// position, nearest devices and devices inside a polygon, against brute
+// force on a sample, and the cost per query.
+//
+//   g++ -std=c++17 -O2 -Iserver/include bench/spatial_bench.cpp server/src/spatial_index.cpp -o spatial_bench
+//   ./spatial_bench [fields] [devices]
+//
+// 100 farm districts on a 10 x 10 grid, 60 km apart, each a square of
+// fields of about 250 m (1M fields by default). A field is a simple
+// polygon of 4 to 8 vertices inside its plot. 90% of the devices stand
+// near a field's centre, most of them inside it, the rest along the roads. Regions for the polygon query
+// are irregular 12-gons of 1 to 10 km.
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "agro/server/spatial_index.hpp"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+using agro::server::DeviceGrid;
+using agro::server::DevicePosition;
+using agro::server::FieldIndex;
+using agro::server::GeoPoint;
+
+constexpr int kDistricts = 10;              // per side
+constexpr int32_t kDistrictStep = 5400000;  // 1e-7 degrees, ~60 km of latitude
+constexpr int32_t kPlot = 22500;            // ~250 m
+constexpr int32_t kLat0 = 440000000, kLon0 = 10000000;
+constexpr int kSample = 200;                // brute-force checks per query kind
+
+struct Polygon {
+  std::vector<GeoPoint> v;
+};
+
+// Star-shaped around the centre with sorted angles, so never self-crossing.
+Polygon star(GeoPoint c, int32_t radius, int sides, std::mt19937& rng) {
+  std::uniform_real_distribution<double> u(0, 1);
+  std::vector<double> angles(static_cast<size_t>(sides));
+  for (double& a : angles) a = u(rng) * 2 * 3.14159265358979;
+  std::sort(angles.begin(), angles.end());
+  Polygon p;
+  for (double a : angles) {
+    const double r = radius * (0.6 + 0.4 * u(rng));
+    p.v.push_back({c.lat + int32_t(r * std::sin(a)), c.lon + int32_t(r * std::cos(a) * 1.4)});
+  }
+  return p;
+}
+
+double seconds_since(Clock::time_point t0) { return std::chrono::duration<double>(Clock::now() - t0).count(); }
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  const size_t n_fields = argc > 1 ? size_t(std::max(1000, std::atoi(argv[1]))) : 1000000;
+  const size_t n_devices = argc > 2 ? size_t(std::max(100, std::atoi(argv[2]))) : 100000;
+  std::mt19937 rng(11);
+  std::uniform_real_distribution<double> u(0, 1);
+
+  // Fields, plot by plot, district by district.
+  const int side = int(std::ceil(std::sqrt(double(n_fields) / (kDistricts * kDistricts))));
+  std::vector<Polygon> fields;
+  std::vector<GeoPoint> centres;
+  fields.reserve(n_fields);
+  for (size_t f = 0; f < n_fields; ++f) {
+    const size_t d = f / (size_t(side) * side), k = f % (size_t(side) * side);
+    // Plots are 1.4 times wider in 1e-7 degrees of longitude: square on the ground at 44 N.
+    const int32_t lat = kLat0 + int32_t(d / kDistricts) * kDistrictStep + int32_t(k / side) * kPlot;
+    const int32_t lon = kLon0 + int32_t(d % kDistricts) * kDistrictStep + int32_t(k % side) * kPlot * 7 / 5;
+    const GeoPoint c{lat + kPlot / 2, lon + kPlot * 7 / 10};
+    fields.push_back(star(c, kPlot / 2 - 500, 4 + int(u(rng) * 5), rng));
+    centres.push_back(c);
+  }
+  std::vector<DevicePosition> devices(n_devices);
+  for (size_t i = 0; i < n_devices; ++i) {
+    devices[i].device_id = uint32_t(1000 + i);
+    const GeoPoint c = centres[size_t(u(rng) * double(n_fields))];
+    const int32_t spread = u(rng) < 0.9 ? kPlot / 10 : kPlot * 2;
+    devices[i].pos = {c.lat + int32_t((u(rng) - 0.5) * spread), c.lon + int32_t((u(rng) - 0.5) * spread)};
+  }
+  std::printf("%zu fields in %d districts, %zu devices\n", n_fields, kDistricts * kDistricts, n_devices);
+
+  auto t0 = Clock::now();
+  FieldIndex index;
+  for (size_t f = 0; f < fields.size(); ++f) index.add(uint32_t(f), fields[f].v.data(), fields[f].v.size());
+  index.build();
+  const double field_build = seconds_since(t0);
+  t0 = Clock::now();
+  DeviceGrid grid;
+  grid.build(devices);
+  const double grid_build = seconds_since(t0);
+  std::printf("build: R-tree %.0f ms (%zu levels), device grid %.1f ms\n", field_build * 1e3, index.levels(),
+              grid_build * 1e3);
+
+  bool ok = true;
+  long mismatches = 0;
+
+  // Which field is each device in.
+  std::vector<uint32_t> hits;
+  long in_field = 0;
+  t0 = Clock::now();
+  for (const DevicePosition& d : devices) {
+    hits.clear();
+    index.fields_at(d.pos, &hits);
+    in_field += !hits.empty();
+  }
+  const double at_us = seconds_since(t0) / double(n_devices) * 1e6;
+  for (int s = 0; s < kSample; ++s) {
+    const GeoPoint p = devices[size_t(s) * n_devices / kSample].pos;
+    hits.clear();
+    index.fields_at(p, &hits);
+    std::vector<uint32_t> want;
+    for (size_t f = 0; f < fields.size(); ++f) {
+      if (agro::server::inside_polygon(p, fields[f].v.data(), fields[f].v.size())) want.push_back(uint32_t(f));
+    }
+    std::sort(hits.begin(), hits.end());
+    mismatches += hits != want;
+  }
+  std::printf("  field at position    %6.2f us/query  (%ld of %zu devices in a field)\n", at_us, in_field, n_devices);
+
+  // Nearest devices to random points in the districts.
+  constexpr size_t kK = 8;
+  std::vector<GeoPoint> queries(20000);
+  for (GeoPoint& q : queries) q = centres[size_t(u(rng) * double(n_fields))];
+  std::vector<DeviceGrid::Neighbor> near;
+  t0 = Clock::now();
+  for (const GeoPoint& q : queries) grid.nearest(q, kK, &near);
+  const double knn_us = seconds_since(t0) / double(queries.size()) * 1e6;
+  double kth_sum = 0;
+  for (int s = 0; s < kSample; ++s) {
+    const GeoPoint q = queries[size_t(s)];
+    grid.nearest(q, kK, &near);
+    const double lon_m = 0.011132 * std::cos(q.lat * 1e-7 * 3.14159265358979 / 180);
+    std::vector<double> d2;
+    for (const DevicePosition& d : devices) {
+      const double y = double(d.pos.lat - q.lat) * 0.011132, x = double(d.pos.lon - q.lon) * lon_m;
+      d2.push_back(x * x + y * y);
+    }
+    std::nth_element(d2.begin(), d2.begin() + kK - 1, d2.end());
+    const double kth = std::sqrt(d2[kK - 1]);
+    kth_sum += kth;
+    mismatches += near.size() != kK || std::fabs(near.back().distance_m - kth) > 0.01 + 1e-5 * kth;
+  }
+  std::printf("  %zu nearest devices   %6.2f us/query  (the %zuth at %.0f m on average)\n", kK, knn_us, kK,
+              kth_sum / kSample);
+
+  // Devices inside a field, and inside a region.
+  std::vector<uint32_t> ids;
+  const auto brute = [&](const Polygon& poly) {
+    std::vector<uint32_t> want;
+    for (const DevicePosition& d : devices) {
+      if (agro::server::inside_polygon(d.pos, poly.v.data(), poly.v.size())) want.push_back(d.device_id);
+    }
+    return want;
+  };
+  t0 = Clock::now();
+  size_t found = 0;
+  for (size_t q = 0; q < queries.size(); ++q) {
+    const Polygon& f = fields[size_t(u(rng) * double(n_fields))];
+    ids.clear();
+    grid.inside(f.v.data(), f.v.size(), &ids);
+    found += ids.size();
+  }
+  const double field_us = seconds_since(t0) / double(queries.size()) * 1e6;
+  std::vector<Polygon> regions;
+  for (int r = 0; r < 2000; ++r) {
+    regions.push_back(star(queries[size_t(r)], int32_t(kPlot * (4 + 36 * u(rng))), 12, rng));
+  }
+  size_t region_found = 0;
+  t0 = Clock::now();
+  for (const Polygon& r : regions) {
+    ids.clear();
+    grid.inside(r.v.data(), r.v.size(), &ids);
+    region_found += ids.size();
+  }
+  const double region_us = seconds_since(t0) / double(regions.size()) * 1e6;
+  for (int s = 0; s < kSample; ++s) {
+    const Polygon& poly = s % 2 ? regions[size_t(s)] : fields[size_t(s) * n_fields / kSample];
+    ids.clear();
+    grid.inside(poly.v.data(), poly.v.size(), &ids);
+    std::vector<uint32_t> want = brute(poly);
+    std::sort(ids.begin(), ids.end());
+    mismatches += ids != want;
+  }
+  std::printf("  devices in a field   %6.2f us/query  (%.1f devices on average)\n", field_us,
+              double(found) / double(queries.size()));
+  std::printf("  devices in a region  %6.2f us/query  (%.0f devices on average)\n", region_us,
+              double(region_found) / double(regions.size()));
+
+  std::printf("brute-force mismatches: %ld of %d\n", mismatches, 4 * kSample);
+  ok = ok && mismatches == 0;
+  return ok ? 0 : 1;
+}
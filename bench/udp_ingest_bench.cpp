@@ -0,0 +1,491 @@
+// Host benchmark and checks for the UDP ingestion front end: a local load
+// generator floods it with sealed telemetry datagrams over loopback and
+// reports packets per second per core and the ack round-trip tail, first
+// acking at once, then with acks held for the write-ahead log.
+//
+//   g++ -std=c++17 -O2 -pthread -Icommon/include -Iserver/include bench/udp_ingest_bench.cpp server/src/udp_ingest.cpp server/src/telemetry_wal.cpp -o udp_ingest_bench
+//   ./udp_ingest_bench [devices] [workers] [log dir]
+//
+// Every device sends 25 frames of four records, as a controller's packet
+// after a wake, from its own slot among 64 source sockets (so SO_REUSEPORT
+// has source addresses to spread). The generator keeps 512 frames in flight
+// and checks every ack under the device's ack key. Then it replays acked
+// frames, forges some and sends some from an unknown device. The run fails
+// if more than 0.1% of the frames go unacked, a record is lost or
+// delivered twice, a replay is not acked again, or a forgery is accepted.
+// With the log (in the working directory unless given), it also fails if an
+// acked frame is missing from the log, and after reading the log back into
+// a fresh ingest, if the replays are taken for new frames. Last, a log group
+// is reported failed: its frame must be neither acked nor delivered, and
+// its resend delivered once, also when the log is read back.
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "agro/server/telemetry_wal.hpp"
+#include "agro/server/udp_ingest.hpp"
+#include "agro/telemetry_codec.hpp"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+using agro::FrameDir;
+using agro::GcmKey;
+using agro::RecordKind;
+using agro::SealedHeader;
+using agro::TelemetryRecord;
+using agro::server::kUdpAckBytes;
+using agro::server::kUdpWalHeader;
+using agro::server::TelemetryWal;
+using agro::server::UdpIngest;
+using agro::server::WalConfig;
+
+constexpr uint32_t kRounds = 25;
+constexpr uint32_t kRecordsPerFrame = 4;
+constexpr uint32_t kEpoch = 7;
+constexpr size_t kSockets = 64;
+constexpr size_t kWindow = 512;
+constexpr size_t kBurst = 32;
+constexpr int64_t kLostNs = 500000000;  // unacked this long: lost
+
+int64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+void device_key(uint32_t device_id, uint8_t key[16]) {
+  for (int i = 0; i < 16; ++i) key[i] = uint8_t(device_id * 131 + i * 7);
+}
+
+// All frames, sealed up front so the generator spends its time on I/O.
+struct Frames {
+  std::vector<uint8_t> bytes;
+  std::vector<uint32_t> offset;  // frame i is bytes[offset[i], offset[i + 1])
+  const uint8_t* data(size_t i) const { return bytes.data() + offset[i]; }
+  size_t size(size_t i) const { return offset[i + 1] - offset[i]; }
+};
+
+size_t seal_one(const GcmKey& key, uint32_t device_id, uint32_t round, uint8_t* out) {
+  uint8_t packet[64];
+  agro::TelemetryPacker packer(packet, sizeof(packet), uint16_t(round), 1700000000 + round * 900);
+  TelemetryRecord r;
+  r.time = 1700000000 + round * 900;
+  r.kind = RecordKind::kBattery;
+  r.a = int32_t(3900 - round);
+  r.b = int32_t(800 - round);
+  packer.add(r);
+  r.kind = RecordKind::kSoil;
+  r.a = int32_t(300 + device_id % 200);
+  r.b = 1800;
+  packer.add(r);
+  r.kind = RecordKind::kPosition;
+  r.a = int32_t(452000000 + device_id);
+  r.b = int32_t(-931000000 - device_id);
+  packer.add(r);
+  r.time += 30;
+  r.kind = RecordKind::kValve;
+  r.a = 12000;
+  r.b = 45000;
+  packer.add(r);
+  SealedHeader h;
+  h.device_id = device_id;
+  h.epoch = kEpoch;
+  h.counter = round;
+  return agro::seal_frame(key, h, packet, packer.size(), out, agro::server::kUdpMaxDatagram);
+}
+
+uint32_t get_le32(const uint8_t* p) {
+  return uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 | uint32_t(p[3]) << 24;
+}
+
+int open_client(uint16_t port) {
+  const int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  const int big = 4 << 20;
+  setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &big, sizeof(big));
+  if (fd < 0 || connect(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0) {
+    std::perror("client socket");
+    std::exit(1);
+  }
+  return fd;
+}
+
+class Generator {
+ public:
+  Generator(uint16_t port, uint32_t devices, const std::vector<GcmKey>& ack_keys)
+      : devices_(devices), ack_keys_(ack_keys) {
+    for (size_t s = 0; s < kSockets; ++s) {
+      fds_.push_back(open_client(port));
+      polls_.push_back({fds_.back(), POLLIN, 0});
+    }
+  }
+  ~Generator() {
+    for (int fd : fds_) close(fd);
+  }
+
+  // Sends frames in order with at most kWindow unacked, until every frame
+  // is acked or given up on. Frame i belongs to device i % devices.
+  void run(const Frames& frames, size_t count) {
+    sent_ns_.assign(count, 0);
+    acked_.assign(count, 0);
+    size_t next = 0, oldest = 0, in_flight = 0;
+    std::vector<size_t> by_socket[kSockets];
+    while (oldest < count) {
+      // Send a burst per socket, each device from its own socket.
+      if (next < count && in_flight < kWindow) {
+        for (std::vector<size_t>& v : by_socket) v.clear();
+        const size_t end = std::min(count, next + std::min(kWindow - in_flight, kBurst * 8));
+        for (; next < end; ++next) by_socket[(next % devices_) % kSockets].push_back(next);
+        for (size_t s = 0; s < kSockets; ++s) send(s, frames, by_socket[s]);
+      }
+      receive(next < count && in_flight < kWindow ? 0 : 10);
+      const int64_t t = now_ns();
+      while (oldest < next && (acked_[oldest] || t - sent_ns_[oldest] > kLostNs)) {
+        if (!acked_[oldest]) {
+          acked_[oldest] = 2;
+          ++lost_;
+        }
+        ++oldest;
+      }
+      in_flight = 0;
+      for (size_t i = oldest; i < next; ++i) in_flight += acked_[i] == 0;
+    }
+  }
+
+  // Sends frames once each and waits up to a second for their acks.
+  size_t send_and_wait(const Frames& frames, const std::vector<size_t>& which) {
+    const uint64_t before = acks_;
+    for (size_t i = 0; i < which.size(); i += kBurst) {
+      std::vector<size_t> part(which.begin() + long(i), which.begin() + long(std::min(which.size(), i + kBurst)));
+      send(i / kBurst % kSockets, frames, part);
+      receive(0);
+    }
+    const int64_t until = now_ns() + 1000000000;
+    while (acks_ - before < which.size() && now_ns() < until) receive(10);
+    return size_t(acks_ - before);
+  }
+
+  bool acked(size_t i) const { return acked_[i] == 1; }
+  std::vector<int64_t>& latencies() { return latencies_; }
+  uint64_t lost() const { return lost_; }
+  uint64_t bad_acks() const { return bad_acks_; }
+
+ private:
+  void send(size_t s, const Frames& frames, const std::vector<size_t>& which) {
+    mmsghdr msgs[kBurst * 8];
+    iovec iov[kBurst * 8];
+    for (size_t done = 0; done < which.size();) {
+      const size_t n = std::min(which.size() - done, size_t(kBurst * 8));
+      const int64_t t = now_ns();
+      for (size_t k = 0; k < n; ++k) {
+        const size_t i = which[done + k];
+        iov[k] = {const_cast<uint8_t*>(frames.data(i)), frames.size(i)};
+        msgs[k] = {};
+        msgs[k].msg_hdr.msg_iov = &iov[k];
+        msgs[k].msg_hdr.msg_iovlen = 1;
+        if (i < sent_ns_.size() && sent_ns_[i] == 0) sent_ns_[i] = t;
+      }
+      const int m = sendmmsg(fds_[s], msgs, unsigned(n), 0);
+      if (m <= 0) {
+        receive(1);  // socket buffer full: let the acks drain
+        continue;
+      }
+      done += size_t(m);
+    }
+  }
+
+  void receive(int timeout_ms) {
+    if (poll(polls_.data(), polls_.size(), timeout_ms) <= 0) return;
+    uint8_t buf[kBurst][kUdpAckBytes + 16];
+    mmsghdr msgs[kBurst];
+    iovec iov[kBurst];
+    for (size_t s = 0; s < kSockets; ++s) {
+      if (!(polls_[s].revents & POLLIN)) continue;
+      for (;;) {
+        for (size_t k = 0; k < kBurst; ++k) {
+          iov[k] = {buf[k], sizeof(buf[k])};
+          msgs[k] = {};
+          msgs[k].msg_hdr.msg_iov = &iov[k];
+          msgs[k].msg_hdr.msg_iovlen = 1;
+        }
+        const int n = recvmmsg(fds_[s], msgs, kBurst, MSG_DONTWAIT, nullptr);
+        if (n <= 0) break;
+        const int64_t t = now_ns();
+        for (int k = 0; k < n; ++k) on_ack(buf[k], msgs[k].msg_len, t);
+      }
+    }
+  }
+
+  void on_ack(uint8_t* ack, size_t len, int64_t t) {
+    SealedHeader h;
+    uint8_t* payload;
+    size_t payload_len;
+    if (len != kUdpAckBytes || !agro::parse_sealed_header(ack, len, &h) || h.dir != FrameDir::kDownlink ||
+        h.device_id >= ack_keys_.size() ||
+        !agro::open_frame(ack_keys_[h.device_id], ack, len, h, &payload, &payload_len) ||
+        agro::sealed_detail::get_be32(payload) != h.counter) {
+      ++bad_acks_;
+      return;
+    }
+    ++acks_;
+    const size_t i = size_t(h.counter) * devices_ + h.device_id;
+    if (i < acked_.size() && acked_[i] == 0) {
+      acked_[i] = 1;
+      latencies_.push_back(t - sent_ns_[i]);
+    }
+  }
+
+  uint32_t devices_;
+  const std::vector<GcmKey>& ack_keys_;
+  std::vector<int> fds_;
+  std::vector<pollfd> polls_;
+  std::vector<int64_t> sent_ns_;
+  std::vector<uint8_t> acked_;  // 1 acked, 2 given up
+  std::vector<int64_t> latencies_;
+  uint64_t acks_ = 0, lost_ = 0, bad_acks_ = 0;
+};
+
+struct Setup {
+  uint32_t devices = 0;
+  unsigned workers = 0;
+  std::vector<GcmKey> keys, ack_keys;
+  Frames frames;
+  std::vector<size_t> replays;
+  Frames bad;  // forged frames and a stranger, sent as forged
+  std::vector<size_t> forged;
+};
+
+void set_keys(const Setup& s, UdpIngest* ingest) {
+  for (uint32_t d = 0; d < s.devices; ++d) {
+    uint8_t key[16];
+    device_key(d, key);
+    ingest->set_key(d, 0, key);
+  }
+}
+
+// One load run, with acks held for a log at wal_path if it is not empty.
+bool run_pass(const Setup& s, const std::string& wal_path) {
+  const size_t count = s.frames.offset.size() - 1;
+  std::vector<std::atomic<uint64_t>> delivered(s.workers);
+  auto sink = [&](unsigned w, uint32_t, const TelemetryRecord*, size_t n) {
+    delivered[w].fetch_add(n, std::memory_order_relaxed);
+  };
+  UdpIngest ingest({"127.0.0.1", 0, s.workers}, sink);
+  set_keys(s, &ingest);
+  WalConfig wal_cfg;
+  wal_cfg.path = wal_path;
+  TelemetryWal wal(wal_cfg, [&](const uint64_t* cookies, size_t n, int error) {
+    ingest.on_durable(cookies, n, error);
+  });
+  if (!wal_path.empty()) {
+    std::remove(wal_path.c_str());
+    if (!wal.open()) {
+      std::perror(wal_path.c_str());
+      std::exit(1);
+    }
+    ingest.attach_wal(&wal);
+  }
+  if (!ingest.start()) {
+    std::perror("start");
+    std::exit(1);
+  }
+
+  Generator gen(ingest.port(), s.devices, s.ack_keys);
+  const auto t0 = Clock::now();
+  gen.run(s.frames, count);
+  const double wall_s = std::chrono::duration<double>(Clock::now() - t0).count();
+  const size_t replay_acks = gen.send_and_wait(s.frames, s.replays);
+  const size_t forged_acks = gen.send_and_wait(s.bad, s.forged);
+
+  // The log first, so the acks it still holds go out.
+  wal.close();
+  ingest.stop();
+  const UdpIngest::Stats total = ingest.stats();
+  uint64_t sink_records = 0;
+  for (const std::atomic<uint64_t>& n : delivered) sink_records += n;
+
+  std::vector<int64_t>& lat = gen.latencies();
+  std::sort(lat.begin(), lat.end());
+  auto pct = [&](double p) { return lat.empty() ? 0.0 : double(lat[size_t(double(lat.size() - 1) * p)]) / 1e3; };
+  std::printf("%s\n", wal_path.empty() ? "acks at once:" : "acks held for the write-ahead log:");
+  std::printf("  %.0f frames/s over loopback, %.1f datagrams per recvmmsg, %llu unacked\n", double(count) / wall_s,
+              double(total.datagrams) / double(std::max<uint64_t>(1, total.batches)),
+              (unsigned long long)gen.lost());
+  for (unsigned w = 0; w < s.workers; ++w) {
+    const UdpIngest::Stats ws = ingest.stats(w);
+    std::printf("  worker %u: %llu datagrams, %.0f per CPU second\n", w, (unsigned long long)ws.datagrams,
+                ws.cpu_us ? double(ws.datagrams) / (double(ws.cpu_us) / 1e6) : 0.0);
+  }
+  std::printf("  ack round trip: p50 %.0f us, p99 %.0f us, p99.9 %.0f us, max %.0f us\n", pct(0.5), pct(0.99),
+              pct(0.999), pct(1.0));
+  std::printf("  replays acked again %zu of %zu; forged and unknown acked %zu of %zu (bad tag %llu, unknown %llu)\n",
+              replay_acks, s.replays.size(), forged_acks, s.forged.size(), (unsigned long long)total.bad_tag,
+              (unsigned long long)total.unknown_device);
+
+  const uint64_t acked = count - gen.lost();
+  bool ok = gen.lost() * 1000 <= count && gen.bad_acks() == 0;
+  // A frame whose ack was lost may still have been delivered, once.
+  ok = ok && sink_records == total.records && total.records >= acked * kRecordsPerFrame &&
+       total.records <= count * kRecordsPerFrame;
+  ok = ok && replay_acks == s.replays.size() && total.replayed == s.replays.size();
+  ok = ok && forged_acks == 0 && total.bad_tag == 100 && total.unknown_device == 1;
+  if (wal_path.empty()) return ok;
+
+  // Every acked frame must be in the log, and every delivered one logged
+  // once.
+  std::vector<uint8_t> logged(count, 0);
+  uint64_t entries = 0, misplaced = 0;
+  TelemetryWal::recover(wal_path, [&](const uint8_t* e, size_t len) {
+    ++entries;
+    const size_t i = size_t(get_le32(e + 8)) * s.devices + get_le32(e);
+    if (len <= kUdpWalHeader || i >= count || logged[i]++ != 0) ++misplaced;
+  });
+  uint64_t acked_unlogged = 0;
+  for (size_t i = 0; i < count; ++i) acked_unlogged += gen.acked(i) && !logged[i];
+  std::printf("  log: %llu frames in %.1f per sync, %llu acked but not logged, %llu held retries dropped\n",
+              (unsigned long long)entries, double(entries) / double(std::max<uint64_t>(1, wal.stats().groups)),
+              (unsigned long long)acked_unlogged, (unsigned long long)total.retried);
+  ok = ok && acked_unlogged == 0 && misplaced == 0 && total.unlogged == 0 &&
+       entries * kRecordsPerFrame == total.records;
+
+  // After a restart from the log, the same replays are known frames.
+  std::atomic<uint64_t> restored{0};
+  UdpIngest again({"127.0.0.1", 0, s.workers}, [&](unsigned, uint32_t, const TelemetryRecord*, size_t n) {
+    restored.fetch_add(n, std::memory_order_relaxed);
+  });
+  set_keys(s, &again);
+  TelemetryWal::recover(wal_path, [&](const uint8_t* e, size_t len) { again.restore(e, len); });
+  const uint64_t from_log = restored;
+  if (!again.start()) {
+    std::perror("start");
+    std::exit(1);
+  }
+  Generator regen(again.port(), s.devices, s.ack_keys);
+  const size_t reacked = regen.send_and_wait(s.frames, s.replays);
+  again.stop();
+  const UdpIngest::Stats after = again.stats();
+  std::printf("  restart: %llu records from the log, replays acked %zu of %zu, %llu taken as new\n",
+              (unsigned long long)from_log, reacked, s.replays.size(), (unsigned long long)after.records);
+  return ok && from_log == total.records && reacked == s.replays.size() && after.records == 0 &&
+         after.replayed == s.replays.size();
+}
+
+// The first log group reported failed to the ingest, as after EIO on its
+// sync; the log itself carries on, so the resend is logged in a later group.
+bool failed_group(const Setup& s, const std::string& wal_path) {
+  std::atomic<uint64_t> delivered{0};
+  UdpIngest ingest({"127.0.0.1", 0, s.workers}, [&](unsigned, uint32_t, const TelemetryRecord*, size_t n) {
+    delivered.fetch_add(n, std::memory_order_relaxed);
+  });
+  set_keys(s, &ingest);
+  WalConfig wal_cfg;
+  wal_cfg.path = wal_path;
+  std::atomic<bool> fail{true};
+  TelemetryWal wal(wal_cfg, [&](const uint64_t* cookies, size_t n, int error) {
+    ingest.on_durable(cookies, n, fail.exchange(false) ? EIO : error);
+  });
+  std::remove(wal_path.c_str());
+  if (!wal.open()) {
+    std::perror(wal_path.c_str());
+    std::exit(1);
+  }
+  ingest.attach_wal(&wal);
+  if (!ingest.start()) {
+    std::perror("start");
+    std::exit(1);
+  }
+  const std::vector<size_t> frame = {0};
+  Generator gen(ingest.port(), s.devices, s.ack_keys);
+  const size_t failed_acks = gen.send_and_wait(s.frames, frame);
+  const uint64_t failed_records = delivered;
+  const size_t resent_acks = gen.send_and_wait(s.frames, frame);
+  wal.close();
+  ingest.stop();
+  const uint64_t unlogged = ingest.stats().unlogged;
+
+  std::atomic<uint64_t> restored{0};
+  UdpIngest again({"127.0.0.1", 0, 1}, [&](unsigned, uint32_t, const TelemetryRecord*, size_t n) {
+    restored.fetch_add(n, std::memory_order_relaxed);
+  });
+  set_keys(s, &again);
+  uint64_t entries = 0;
+  TelemetryWal::recover(wal_path, [&](const uint8_t* e, size_t len) {
+    ++entries;
+    again.restore(e, len);
+  });
+  std::printf("failed log group: %zu acked, %llu records delivered; resent: %zu acked, %llu delivered; "
+              "read back: %llu entries, %llu records\n",
+              failed_acks, (unsigned long long)failed_records, resent_acks, (unsigned long long)delivered.load(),
+              (unsigned long long)entries, (unsigned long long)restored.load());
+  return failed_acks == 0 && failed_records == 0 && unlogged == 1 && resent_acks == 1 &&
+         delivered == kRecordsPerFrame && entries == 2 && restored == kRecordsPerFrame;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Setup s;
+  s.devices = argc > 1 ? uint32_t(std::max(100, std::atoi(argv[1]))) : 20000;
+  const unsigned hw = std::max(1u, std::thread::hardware_concurrency());
+  // At least two, so more than one socket shares the port.
+  s.workers = argc > 2 ? unsigned(std::max(1, std::atoi(argv[2]))) : std::max(2u, hw);
+  const std::string wal_path = std::string(argc > 3 ? argv[3] : ".") + "/udp_ingest_bench.log";
+
+  s.keys.resize(s.devices);
+  s.ack_keys.resize(s.devices);
+  for (uint32_t d = 0; d < s.devices; ++d) {
+    uint8_t key[16];
+    device_key(d, key);
+    agro::gcm_init(&s.keys[d], key);
+    agro::derive_ack_key(s.keys[d], &s.ack_keys[d]);
+  }
+  const size_t count = size_t(s.devices) * kRounds;
+  s.frames.bytes.resize(count * agro::server::kUdpMaxDatagram / 4);
+  size_t pos = 0;
+  for (size_t i = 0; i < count; ++i) {
+    s.frames.offset.push_back(uint32_t(pos));
+    const uint32_t d = uint32_t(i % s.devices);
+    pos += seal_one(s.keys[d], d, uint32_t(i / s.devices), s.frames.bytes.data() + pos);
+  }
+  s.frames.offset.push_back(uint32_t(pos));
+
+  // Replays of acked frames, forgeries, a stranger.
+  for (size_t i = 0; i < 1000 && i < count; ++i) s.replays.push_back(i * 7 % count);
+  s.bad = s.frames;
+  for (size_t i = 0; i < 100; ++i) {
+    const size_t k = count - 1 - i;
+    s.bad.bytes[s.bad.offset[k] + agro::kSealedHeaderBytes + 2] ^= 0x40;
+    s.forged.push_back(k);
+  }
+  size_t stranger_bytes = 0;
+  {
+    GcmKey key;
+    uint8_t raw[16] = {1};
+    agro::gcm_init(&key, raw);
+    stranger_bytes = seal_one(key, s.devices + 5, 0, s.bad.bytes.data() + s.bad.offset[0]);
+  }
+  s.bad.offset[1] = s.bad.offset[0] + uint32_t(stranger_bytes);  // frame 1 is no longer sent
+  s.forged.push_back(0);
+
+  std::printf("%u devices, %zu frames of %u records, %u workers on %u hardware threads\n", s.devices, count,
+              kRecordsPerFrame, s.workers, hw);
+  bool ok = run_pass(s, "");
+  ok = run_pass(s, wal_path) && ok;
+  ok = failed_group(s, wal_path) && ok;
+  std::remove(wal_path.c_str());
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,277 @@
+// AES-128-GCM for telemetry frames, shared by the firmware and the server.
+//
+// The expanded key is a GcmKey: the AES round keys and a 4-bit GHASH table
+// for H = E(K, 0^128), both computed once per key. The firmware keeps it in
+// RTC memory so a wake never repeats the setup; the server keeps one per
+// device. The block cipher in counter mode is a template parameter: the
+// portable T-table AES here by default, the ESP32 AES accelerator on the
+// device. GHASH always runs on the CPU from the table.
+//
+// 96-bit nonces only. Counter blocks increment the low 32 bits (inc32);
+// frames are far shorter than 2^32 blocks, so a 128-bit counter gives the
+// same keystream.
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace agro {
+
+inline constexpr size_t kGcmNonceBytes = 12;
+inline constexpr size_t kGcmTagBytes = 16;
+
+namespace gcm_detail {
+
+constexpr uint8_t xtime(uint8_t a) { return uint8_t(a << 1 ^ (a & 0x80 ? 0x1b : 0)); }
+
+constexpr uint8_t gf_mul(uint8_t a, uint8_t b) {
+  uint8_t r = 0;
+  for (; b; b >>= 1, a = xtime(a)) {
+    if (b & 1) r ^= a;
+  }
+  return r;
+}
+
+constexpr std::array<uint8_t, 256> make_sbox() {
+  std::array<uint8_t, 256> s{};
+  for (int x = 0; x < 256; ++x) {
+    // Inverse as x^254; 0 maps to 0.
+    uint8_t inv = 1, base = uint8_t(x);
+    for (int e = 254; e; e >>= 1, base = gf_mul(base, base)) {
+      if (e & 1) inv = gf_mul(inv, base);
+    }
+    if (x == 0) inv = 0;
+    uint8_t v = inv;
+    for (int r = 1; r <= 4; ++r) v ^= uint8_t(inv << r | inv >> (8 - r));
+    s[size_t(x)] = uint8_t(v ^ 0x63);
+  }
+  return s;
+}
+
+inline constexpr std::array<uint8_t, 256> kSbox = make_sbox();
+
+// Te0[x] = (2s, s, s, 3s); the other three tables are byte rotations of it.
+constexpr std::array<uint32_t, 256> make_te0() {
+  std::array<uint32_t, 256> t{};
+  for (size_t x = 0; x < 256; ++x) {
+    const uint8_t s = kSbox[x];
+    t[x] = uint32_t(xtime(s)) << 24 | uint32_t(s) << 16 | uint32_t(s) << 8 | uint32_t(xtime(s) ^ s);
+  }
+  return t;
+}
+
+inline constexpr std::array<uint32_t, 256> kTe0 = make_te0();
+
+constexpr uint32_t ror(uint32_t v, int n) { return v >> n | v << (32 - n); }
+
+inline uint32_t load_be32(const uint8_t* p) {
+  return uint32_t(p[0]) << 24 | uint32_t(p[1]) << 16 | uint32_t(p[2]) << 8 | p[3];
+}
+inline void store_be32(uint8_t* p, uint32_t v) {
+  p[0] = uint8_t(v >> 24);
+  p[1] = uint8_t(v >> 16);
+  p[2] = uint8_t(v >> 8);
+  p[3] = uint8_t(v);
+}
+inline uint64_t load_be64(const uint8_t* p) { return uint64_t(load_be32(p)) << 32 | load_be32(p + 4); }
+inline void store_be64(uint8_t* p, uint64_t v) {
+  store_be32(p, uint32_t(v >> 32));
+  store_be32(p + 4, uint32_t(v));
+}
+
+inline constexpr uint16_t kLast4[16] = {0x0000, 0x1c20, 0x3840, 0x2460, 0x7080, 0x6ca0, 0x48c0, 0x54e0,
+                                        0xe100, 0xfd20, 0xd940, 0xc560, 0x9180, 0x8da0, 0xa9c0, 0xb5e0};
+
+}  // namespace gcm_detail
+
+struct GcmKey {
+  uint8_t key[16];
+  uint32_t round_keys[44];
+  uint64_t hh[16];  // GHASH table: multiples of H by each 4-bit value
+  uint64_t hl[16];
+};
+
+inline void aes128_encrypt_block(const GcmKey& k, const uint8_t in[16], uint8_t out[16]) {
+  using namespace gcm_detail;
+  const uint32_t* rk = k.round_keys;
+  uint32_t s0 = load_be32(in) ^ rk[0], s1 = load_be32(in + 4) ^ rk[1];
+  uint32_t s2 = load_be32(in + 8) ^ rk[2], s3 = load_be32(in + 12) ^ rk[3];
+  const auto round = [](uint32_t a, uint32_t b, uint32_t c, uint32_t d, uint32_t key) {
+    return kTe0[a >> 24] ^ ror(kTe0[(b >> 16) & 0xff], 8) ^ ror(kTe0[(c >> 8) & 0xff], 16) ^ ror(kTe0[d & 0xff], 24) ^
+           key;
+  };
+  for (int r = 1; r < 10; ++r) {
+    rk += 4;
+    const uint32_t t0 = round(s0, s1, s2, s3, rk[0]);
+    const uint32_t t1 = round(s1, s2, s3, s0, rk[1]);
+    const uint32_t t2 = round(s2, s3, s0, s1, rk[2]);
+    const uint32_t t3 = round(s3, s0, s1, s2, rk[3]);
+    s0 = t0, s1 = t1, s2 = t2, s3 = t3;
+  }
+  rk += 4;
+  const auto last = [](uint32_t a, uint32_t b, uint32_t c, uint32_t d, uint32_t key) {
+    return (uint32_t(kSbox[a >> 24]) << 24 | uint32_t(kSbox[(b >> 16) & 0xff]) << 16 |
+            uint32_t(kSbox[(c >> 8) & 0xff]) << 8 | kSbox[d & 0xff]) ^
+           key;
+  };
+  store_be32(out, last(s0, s1, s2, s3, rk[0]));
+  store_be32(out + 4, last(s1, s2, s3, s0, rk[1]));
+  store_be32(out + 8, last(s2, s3, s0, s1, rk[2]));
+  store_be32(out + 12, last(s3, s0, s1, s2, rk[3]));
+}
+
+// Key expansion and the GHASH table: one AES block and a few dozen XORs.
+inline void gcm_init(GcmKey* k, const uint8_t key[16]) {
+  using namespace gcm_detail;
+  std::memcpy(k->key, key, 16);
+  uint32_t* w = k->round_keys;
+  for (int i = 0; i < 4; ++i) w[i] = load_be32(key + 4 * i);
+  uint8_t rcon = 1;
+  for (int i = 4; i < 44; ++i) {
+    uint32_t t = w[i - 1];
+    if (i % 4 == 0) {
+      t = uint32_t(kSbox[(t >> 16) & 0xff]) << 24 | uint32_t(kSbox[(t >> 8) & 0xff]) << 16 |
+          uint32_t(kSbox[t & 0xff]) << 8 | kSbox[t >> 24];
+      t ^= uint32_t(rcon) << 24;
+      rcon = xtime(rcon);
+    }
+    w[i] = w[i - 4] ^ t;
+  }
+
+  uint8_t h[16] = {};
+  aes128_encrypt_block(*k, h, h);
+  uint64_t vh = load_be64(h), vl = load_be64(h + 8);
+  k->hh[0] = k->hl[0] = 0;
+  k->hh[8] = vh;
+  k->hl[8] = vl;
+  for (int i = 4; i > 0; i >>= 1) {
+    const uint64_t t = (vl & 1) * 0xe1000000ull;
+    vl = vh << 63 | vl >> 1;
+    vh = vh >> 1 ^ t << 32;
+    k->hh[i] = vh;
+    k->hl[i] = vl;
+  }
+  for (int i = 2; i <= 8; i *= 2) {
+    for (int j = 1; j < i; ++j) {
+      k->hh[i + j] = k->hh[i] ^ k->hh[j];
+      k->hl[i + j] = k->hl[i] ^ k->hl[j];
+    }
+  }
+}
+
+// x = x * H in GF(2^128).
+inline void ghash_mult(const GcmKey& k, uint8_t x[16]) {
+  using namespace gcm_detail;
+  uint8_t lo = x[15] & 0xf;
+  uint64_t zh = k.hh[lo], zl = k.hl[lo];
+  for (int i = 15; i >= 0; --i) {
+    lo = x[i] & 0xf;
+    const uint8_t hi = x[i] >> 4;
+    if (i != 15) {
+      const uint8_t rem = zl & 0xf;
+      zl = zh << 60 | zl >> 4;
+      zh = zh >> 4 ^ uint64_t(kLast4[rem]) << 48;
+      zh ^= k.hh[lo];
+      zl ^= k.hl[lo];
+    }
+    const uint8_t rem = zl & 0xf;
+    zl = zh << 60 | zl >> 4;
+    zh = zh >> 4 ^ uint64_t(kLast4[rem]) << 48;
+    zh ^= k.hh[hi];
+    zl ^= k.hl[hi];
+  }
+  store_be64(x, zh);
+  store_be64(x + 8, zl);
+}
+
+inline void ghash_update(const GcmKey& k, uint8_t acc[16], const uint8_t* data, size_t len) {
+  for (; len; ) {
+    const size_t n = len < 16 ? len : 16;
+    for (size_t i = 0; i < n; ++i) acc[i] ^= data[i];
+    ghash_mult(k, acc);
+    data += n;
+    len -= n;
+  }
+}
+
+// Portable counter mode: XORs the keystream starting at counter block ctr
+// into data.
+struct SoftwareCtr {
+  const GcmKey& key;
+
+  void operator()(const uint8_t ctr[16], uint8_t* data, size_t len) const {
+    uint8_t block[16], ks[16];
+    std::memcpy(block, ctr, 16);
+    uint32_t c = gcm_detail::load_be32(block + 12);
+    for (size_t off = 0; off < len; off += 16) {
+      aes128_encrypt_block(key, block, ks);
+      const size_t n = len - off < 16 ? len - off : 16;
+      for (size_t i = 0; i < n; ++i) data[off + i] ^= ks[i];
+      gcm_detail::store_be32(block + 12, ++c);
+    }
+  }
+};
+
+namespace gcm_detail {
+
+template <class Ctr>
+void tag(const GcmKey& k, Ctr& ctr, const uint8_t j0[16], const uint8_t* aad, size_t aad_len, const uint8_t* ct,
+         size_t len, uint8_t out[16]) {
+  uint8_t acc[16] = {};
+  ghash_update(k, acc, aad, aad_len);
+  ghash_update(k, acc, ct, len);
+  uint8_t lens[16];
+  store_be64(lens, uint64_t(aad_len) * 8);
+  store_be64(lens + 8, uint64_t(len) * 8);
+  ghash_update(k, acc, lens, 16);
+  ctr(j0, acc, 16);  // E(K, J0) xor GHASH
+  std::memcpy(out, acc, 16);
+}
+
+inline void counter_blocks(const uint8_t nonce[kGcmNonceBytes], uint8_t j0[16], uint8_t first[16]) {
+  std::memcpy(j0, nonce, kGcmNonceBytes);
+  store_be32(j0 + 12, 1);
+  std::memcpy(first, j0, 16);
+  store_be32(first + 12, 2);
+}
+
+}  // namespace gcm_detail
+
+// Encrypts data in place and writes the tag.
+template <class Ctr>
+void gcm_seal(const GcmKey& k, Ctr&& ctr, const uint8_t nonce[kGcmNonceBytes], const uint8_t* aad, size_t aad_len,
+              uint8_t* data, size_t len, uint8_t tag[kGcmTagBytes]) {
+  uint8_t j0[16], first[16];
+  gcm_detail::counter_blocks(nonce, j0, first);
+  ctr(first, data, len);
+  gcm_detail::tag(k, ctr, j0, aad, aad_len, data, len, tag);
+}
+
+// Checks the tag in constant time and decrypts data in place only if it
+// matches; returns false (data untouched) otherwise.
+template <class Ctr>
+bool gcm_open(const GcmKey& k, Ctr&& ctr, const uint8_t nonce[kGcmNonceBytes], const uint8_t* aad, size_t aad_len,
+              uint8_t* data, size_t len, const uint8_t tag[kGcmTagBytes]) {
+  uint8_t j0[16], first[16], expect[16];
+  gcm_detail::counter_blocks(nonce, j0, first);
+  gcm_detail::tag(k, ctr, j0, aad, aad_len, data, len, expect);
+  uint8_t diff = 0;
+  for (size_t i = 0; i < kGcmTagBytes; ++i) diff |= uint8_t(expect[i] ^ tag[i]);
+  if (diff != 0) return false;
+  ctr(first, data, len);
+  return true;
+}
+
+inline void gcm_seal(const GcmKey& k, const uint8_t nonce[kGcmNonceBytes], const uint8_t* aad, size_t aad_len,
+                     uint8_t* data, size_t len, uint8_t tag[kGcmTagBytes]) {
+  gcm_seal(k, SoftwareCtr{k}, nonce, aad, aad_len, data, len, tag);
+}
+
+inline bool gcm_open(const GcmKey& k, const uint8_t nonce[kGcmNonceBytes], const uint8_t* aad, size_t aad_len,
+                     uint8_t* data, size_t len, const uint8_t tag[kGcmTagBytes]) {
+  return gcm_open(k, SoftwareCtr{k}, nonce, aad, aad_len, data, len, tag);
+}
+
+}  // namespace agro
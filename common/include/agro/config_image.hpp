@@ -0,0 +1,305 @@
+// Binary configuration image, read in place from a memory-mapped flash
+// partition.
+//
+//   ConfigHeader   magic, total size, CRC-32 of everything after the CRC,
+//                  schema major/minor, section count, generation
+//   SectionEntry*  id, entry size, entry count, offset (8-byte aligned)
+//   sections       fixed-layout little-endian structs, NUL-padded strings
+//
+// Nothing is parsed at boot: open() checks the header and section table and
+// the accessors return references into the image.
+//
+// Schema evolution: fields are only ever appended to a section struct, and
+// each section records the entry size it was written with. A reader that
+// knows a larger struct copies the stored prefix over its defaults; a reader
+// that knows a smaller one reads its prefix and ignores the rest. New
+// sections get new ids and old readers skip ids they do not know. Only a
+// change that breaks this (reordering, resizing a field) bumps
+// kConfigMajor, and readers reject any other major.
+//
+// The image is written by tools/agro_config.cpp from a text file.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#include "agro/crc32.hpp"
+#include "agro/rule_vm.hpp"
+
+namespace agro {
+
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "config image is little-endian and read in place");
+
+inline constexpr uint32_t kConfigMagic = 0x46434741;  // "AGCF"
+inline constexpr uint16_t kConfigMajor = 1;
+inline constexpr uint16_t kConfigMinor = 1;  // 1: rules
+inline constexpr size_t kMaxZonePrograms = 16;
+inline constexpr size_t kMaxGeofenceVertices = 16;
+
+enum class ConfigSection : uint16_t {
+  kSystem = 1,
+  kUplink = 2,
+  kThresholds = 3,
+  kZones = 4,
+  kGeofence = 5,
+  kRules = 6,  // rule_vm.hpp bytecode, entry size 1
+};
+
+struct ConfigHeader {
+  uint32_t magic;
+  uint32_t total_bytes;
+  uint32_t crc32;  // over bytes [12, total_bytes)
+  uint16_t major;
+  uint16_t minor;
+  uint16_t header_bytes;
+  uint16_t section_count;
+  uint32_t generation;  // bumped by the compiler on every build
+};
+static_assert(sizeof(ConfigHeader) == 24);
+
+struct SectionEntry {
+  uint16_t id;
+  uint16_t entry_bytes;
+  uint16_t count;
+  uint16_t reserved;
+  uint32_t offset;
+};
+static_assert(sizeof(SectionEntry) == 12);
+
+struct SystemConfig {
+  uint32_t node_id = 0;
+  uint32_t wake_period_s = 900;
+  int16_t utc_offset_min = 0;
+  uint16_t reserved = 0;
+};
+
+struct UplinkConfig {
+  char apn[32] = "internet";
+  char host[48] = "";
+  uint16_t port = 5683;
+  uint16_t upload_every_wakes = 4;
+  uint16_t max_batch_records = 64;
+  uint8_t sms_after_failures = 3;  // failed GPRS uploads before the SMS fallback
+  uint8_t reserved = 0;
+  char sms_number[20] = "";
+};
+
+struct ThresholdConfig {
+  // Soil probe calibration (SoilProbeConfig).
+  uint16_t soil_air_raw = 3300;
+  uint16_t soil_water_raw = 1400;
+  uint16_t soil_dry_raw = 2600;
+  uint16_t soil_wet_raw = 2200;
+  // Flow meter and valve supervision (IrrigationConfig).
+  uint16_t pulses_per_liter = 450;
+  uint16_t max_open_s = 1800;
+  uint16_t no_flow_s = 15;
+  uint16_t leak_pulses = 10;
+  uint32_t stuck_open_ml_per_min = 1500;
+  // Battery.
+  uint16_t battery_low_mv = 11800;
+  uint16_t battery_cutoff_mv = 11400;
+};
+
+struct ZoneProgram {
+  uint8_t zone = 0;
+  uint8_t days_mask = 0x7f;  // bit 0 = Monday
+  uint16_t start_minute = 0;  // local time
+  uint32_t target_ml = 0;
+  uint16_t max_minutes = 30;
+  uint16_t dry_permille = 0;  // skip the run if the soil is wetter; 0 = always run
+};
+
+struct GeofenceVertex {
+  int32_t lat_e7 = 0;
+  int32_t lon_e7 = 0;
+};
+
+static_assert(std::is_trivially_copyable_v<SystemConfig> && std::is_trivially_copyable_v<UplinkConfig> &&
+              std::is_trivially_copyable_v<ThresholdConfig> && std::is_trivially_copyable_v<ZoneProgram> &&
+              std::is_trivially_copyable_v<GeofenceVertex>);
+
+enum class ConfigStatus : uint8_t {
+  kOk = 0,
+  kTooShort,
+  kBadMagic,
+  kIncompatible,  // different major version
+  kBadCrc,
+  kBadSection,  // section table points outside the image
+};
+
+class ConfigView {
+ public:
+  // image must stay mapped for the lifetime of the view. check_crc can be
+  // skipped when the same image was verified before (see crc()).
+  ConfigStatus open(const void* image, size_t len, bool check_crc = true) {
+    *this = ConfigView();
+    const auto* base = static_cast<const uint8_t*>(image);
+    if (len < sizeof(ConfigHeader)) return ConfigStatus::kTooShort;
+    const auto* h = reinterpret_cast<const ConfigHeader*>(base);
+    if (h->magic != kConfigMagic) return ConfigStatus::kBadMagic;
+    if (h->major != kConfigMajor) return ConfigStatus::kIncompatible;
+    if (h->total_bytes > len || h->total_bytes < h->header_bytes ||
+        h->header_bytes < sizeof(ConfigHeader) + size_t{h->section_count} * sizeof(SectionEntry)) {
+      return ConfigStatus::kTooShort;
+    }
+    if (check_crc && crc32(base + 12, h->total_bytes - 12) != h->crc32) return ConfigStatus::kBadCrc;
+
+    const auto* table = reinterpret_cast<const SectionEntry*>(base + sizeof(ConfigHeader));
+    for (uint16_t i = 0; i < h->section_count; ++i) {
+      const SectionEntry& s = table[i];
+      if (s.offset % 8 != 0 || uint64_t{s.offset} + uint64_t{s.entry_bytes} * s.count > h->total_bytes) {
+        return ConfigStatus::kBadSection;
+      }
+      const uint8_t* data = base + s.offset;
+      switch (static_cast<ConfigSection>(s.id)) {
+        case ConfigSection::kSystem:
+          bind(data, s, &system_, &system_copy_);
+          break;
+        case ConfigSection::kUplink:
+          bind(data, s, &uplink_, &uplink_copy_);
+          break;
+        case ConfigSection::kThresholds:
+          bind(data, s, &thresholds_, &thresholds_copy_);
+          break;
+        case ConfigSection::kZones:
+          zones_ = {data, s.entry_bytes, s.count};
+          break;
+        case ConfigSection::kGeofence:
+          fence_ = {data, s.entry_bytes, s.count};
+          break;
+        case ConfigSection::kRules:
+          if (s.entry_bytes == 1) rules_ = {data, 1, s.count};
+          break;
+        default:
+          break;  // written by a newer compiler
+      }
+    }
+    header_ = h;
+    return ConfigStatus::kOk;
+  }
+
+  bool valid() const { return header_ != nullptr; }
+  uint32_t crc() const { return header_ ? header_->crc32 : 0; }
+  uint32_t generation() const { return header_ ? header_->generation : 0; }
+  uint16_t minor() const { return header_ ? header_->minor : 0; }
+
+  // Defaults for sections the image does not have.
+  const SystemConfig& system() const { return system_ ? *system_ : system_copy_; }
+  const UplinkConfig& uplink() const { return uplink_ ? *uplink_ : uplink_copy_; }
+  const ThresholdConfig& thresholds() const { return thresholds_ ? *thresholds_ : thresholds_copy_; }
+
+  size_t zone_count() const { return zones_.count; }
+  ZoneProgram zone(size_t i) const { return zones_.get<ZoneProgram>(i); }
+  size_t geofence_count() const { return fence_.count; }
+  GeofenceVertex geofence(size_t i) const { return fence_.get<GeofenceVertex>(i); }
+  // Unverified; see RuleProgram::load().
+  const uint8_t* rules() const { return rules_.data; }
+  size_t rule_bytes() const { return rules_.count; }
+
+ private:
+  struct Array {
+    const uint8_t* data = nullptr;
+    uint16_t stride = 0;
+    uint16_t count = 0;
+
+    template <class T>
+    T get(size_t i) const {
+      T v{};
+      if (i < count) std::memcpy(&v, data + i * stride, stride < sizeof(T) ? stride : sizeof(T));
+      return v;
+    }
+  };
+
+  // Points *in_place into the image when the stored entry covers every field
+  // this build knows; otherwise overlays the stored prefix on the defaults.
+  template <class T>
+  static void bind(const uint8_t* data, const SectionEntry& s, const T** in_place, T* copy) {
+    if (s.count == 0) return;
+    if (s.entry_bytes >= sizeof(T)) {
+      *in_place = reinterpret_cast<const T*>(data);
+    } else {
+      std::memcpy(copy, data, s.entry_bytes);
+    }
+  }
+
+  const ConfigHeader* header_ = nullptr;
+  SystemConfig system_copy_;
+  UplinkConfig uplink_copy_;
+  ThresholdConfig thresholds_copy_;
+  const SystemConfig* system_ = nullptr;
+  const UplinkConfig* uplink_ = nullptr;
+  const ThresholdConfig* thresholds_ = nullptr;
+  Array zones_;
+  Array fence_;
+  Array rules_;
+};
+
+// Host side: lays out an image from filled-in structs.
+class ConfigImageBuilder {
+ public:
+  static constexpr size_t kMaxSections = 6;
+  static constexpr size_t kMaxImageBytes = 2048;
+
+  SystemConfig system;
+  UplinkConfig uplink;
+  ThresholdConfig thresholds;
+  ZoneProgram zones[kMaxZonePrograms];
+  size_t zone_count = 0;
+  GeofenceVertex geofence[kMaxGeofenceVertices];
+  size_t geofence_count = 0;
+  uint8_t rules[kMaxRuleBytes] = {};
+  size_t rule_bytes = 0;
+  uint32_t generation = 0;
+
+  // Returns the image size, or 0 if cap is too small.
+  size_t build(uint8_t* out, size_t cap) const {
+    struct Part {
+      ConfigSection id;
+      const void* data;
+      uint16_t entry_bytes;
+      uint16_t count;
+    };
+    const Part parts[kMaxSections] = {
+        {ConfigSection::kSystem, &system, sizeof(SystemConfig), 1},
+        {ConfigSection::kUplink, &uplink, sizeof(UplinkConfig), 1},
+        {ConfigSection::kThresholds, &thresholds, sizeof(ThresholdConfig), 1},
+        {ConfigSection::kZones, zones, sizeof(ZoneProgram), static_cast<uint16_t>(zone_count)},
+        {ConfigSection::kGeofence, geofence, sizeof(GeofenceVertex), static_cast<uint16_t>(geofence_count)},
+        {ConfigSection::kRules, rules, 1, static_cast<uint16_t>(rule_bytes)},
+    };
+    const size_t header_bytes = sizeof(ConfigHeader) + kMaxSections * sizeof(SectionEntry);
+    size_t off = align8(header_bytes);
+    if (off > cap) return 0;
+    std::memset(out, 0, off);
+    auto* table = reinterpret_cast<SectionEntry*>(out + sizeof(ConfigHeader));
+    for (size_t i = 0; i < kMaxSections; ++i) {
+      const Part& p = parts[i];
+      const size_t bytes = size_t{p.entry_bytes} * p.count;
+      if (align8(off + bytes) > cap) return 0;
+      table[i] = {static_cast<uint16_t>(p.id), p.entry_bytes, p.count, 0, static_cast<uint32_t>(off)};
+      std::memcpy(out + off, p.data, bytes);
+      std::memset(out + off + bytes, 0, align8(off + bytes) - (off + bytes));
+      off = align8(off + bytes);
+    }
+    ConfigHeader h{kConfigMagic,
+                   static_cast<uint32_t>(off),
+                   0,
+                   kConfigMajor,
+                   kConfigMinor,
+                   static_cast<uint16_t>(header_bytes),
+                   static_cast<uint16_t>(kMaxSections),
+                   generation};
+    std::memcpy(out, &h, sizeof(h));
+    h.crc32 = crc32(out + 12, off - 12);
+    std::memcpy(out + 8, &h.crc32, sizeof(h.crc32));
+    return off;
+  }
+
+ private:
+  static size_t align8(size_t n) { return (n + 7) & ~size_t{7}; }
+};
+
+}  // namespace agro
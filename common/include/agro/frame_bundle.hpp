@@ -0,0 +1,94 @@
+// Several sealed frames (sealed_frame.hpp) in one buffer, for frames relayed
+// by another node: u8 length, frame, repeated. Mesh members hand their
+// frames to the uplink node in bundles, and the uplink uploads its store as
+// one; the server splits it and verifies every frame under its own device's
+// key, so the relay needs no keys.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace agro {
+
+inline constexpr size_t kMaxBundledFrame = 255;
+
+// The first frame in data. Returns the bytes it takes, or 0 at the end or if
+// the rest is truncated.
+inline size_t next_bundled(const uint8_t* data, size_t len, const uint8_t** frame, size_t* frame_len) {
+  if (len < 1 || data[0] == 0 || len < 1 + size_t(data[0])) return 0;
+  *frame = data + 1;
+  *frame_len = data[0];
+  return 1 + size_t(data[0]);
+}
+
+// A FIFO of frames in a fixed buffer. Constant-initializable, so it can sit
+// in RTC memory across deep sleep.
+template <size_t N>
+class FrameBundle {
+ public:
+  bool push(const uint8_t* frame, size_t len) {
+    if (len == 0 || len > kMaxBundledFrame || used_ + 1 + len > N) {
+      ++dropped_;
+      return false;
+    }
+    buf_[used_] = uint8_t(len);
+    std::memcpy(buf_ + used_ + 1, frame, len);
+    used_ += 1 + len;
+    ++count_;
+    return true;
+  }
+
+  // Pushes every frame of a received bundle; returns how many were kept.
+  size_t append(const uint8_t* bundle, size_t len) {
+    size_t kept = 0, off = 0, k, n;
+    const uint8_t* f;
+    while ((k = next_bundled(bundle + off, len - off, &f, &n)) != 0) {
+      kept += push(f, n);
+      off += k;
+    }
+    return kept;
+  }
+
+  // Copies whole frames from the front into out, as a bundle, while they
+  // fit; *count is how many. Returns the bytes written.
+  size_t pack(uint8_t* out, size_t capacity, size_t* count) const {
+    size_t off = 0, k, n;
+    const uint8_t* f;
+    *count = 0;
+    while ((k = next_bundled(buf_ + off, used_ - off, &f, &n)) != 0 && off + k <= capacity) {
+      off += k;
+      ++*count;
+    }
+    std::memcpy(out, buf_, off);
+    return off;
+  }
+
+  // Removes count frames from the front, once they were delivered; returns
+  // the bytes they took.
+  size_t drop(size_t count) {
+    size_t off = 0, k, n;
+    const uint8_t* f;
+    for (; count > 0 && (k = next_bundled(buf_ + off, used_ - off, &f, &n)) != 0; --count) {
+      off += k;
+      --count_;
+    }
+    std::memmove(buf_, buf_ + off, used_ - off);
+    used_ -= off;
+    return off;
+  }
+
+  bool empty() const { return used_ == 0; }
+  size_t bytes() const { return used_; }
+  size_t count() const { return count_; }
+  // Frames refused for lack of room since power-on.
+  uint32_t dropped() const { return dropped_; }
+
+ private:
+  uint8_t buf_[N] = {};
+  size_t used_ = 0;
+  size_t count_ = 0;
+  uint32_t dropped_ = 0;
+};
+
+}  // namespace agro
@@ -0,0 +1,549 @@
+// Host side: compiles irrigation rules (rule_vm.hpp) from text, one rule per
+// call, and disassembles code back for review.
+//
+//   if soil(2) < 300 and soc > 40% and minute >= 05:00 then water(2, 15 L)
+//   if battery_mv < 11600 then skip(0), skip(1), alarm(7)
+//
+// Conditions combine comparisons (< <= > >= == !=) with and, or, not and
+// parentheses; values are integers with + - * /, min(x, y), max(x, y) and
+// the inputs soil(z) and since_run(z) per zone, soc, battery_mv, minute and
+// weekday (0 = Monday). Literals: 12, 40% (permille), 15 L (ml), 05:30
+// (minute of the day). Actions: water(zone, ml), skip(zone), alarm(code).
+//
+// A rule is parsed into a small tree first, so constants fold, a literal
+// operand becomes an immediate, and and/or/not turn into jumps that stop at
+// the first test that decides the condition.
+#pragma once
+
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "agro/rule_vm.hpp"
+
+namespace agro {
+
+class RuleCompiler {
+ public:
+  // Appends the code for one rule. On a mistake returns false with error()
+  // set and leaves the code as it was.
+  bool add(const std::string& rule) {
+    src_ = rule;
+    pos_ = 0;
+    error_.clear();
+    const size_t start = code_.size();
+    if (!compile_rule() || code_.size() > kMaxRuleBytes) {
+      if (error_.empty()) error_ = "rules exceed " + std::to_string(kMaxRuleBytes) + " bytes";
+      code_.resize(start);
+      return false;
+    }
+    return true;
+  }
+
+  const std::vector<uint8_t>& code() const { return code_; }
+  const std::string& error() const { return error_; }
+
+ private:
+  enum class Tok { kEnd, kNumber, kName, kPunct };
+
+  // Tokens: names, numbers with their suffix folded in, operators.
+  Tok peek(std::string* text = nullptr, int32_t* value = nullptr) {
+    const size_t save = pos_;
+    const Tok t = next(text, value);
+    pos_ = save;
+    return t;
+  }
+
+  Tok next(std::string* text = nullptr, int32_t* value = nullptr) {
+    while (pos_ < src_.size() && std::isspace(uint8_t(src_[pos_]))) ++pos_;
+    if (pos_ == src_.size()) return Tok::kEnd;
+    const size_t b = pos_;
+    const char ch = src_[pos_];
+    if (std::isdigit(uint8_t(ch))) {
+      long n = 0;
+      while (pos_ < src_.size() && std::isdigit(uint8_t(src_[pos_]))) n = n * 10 + (src_[pos_++] - '0');
+      if (pos_ < src_.size() && src_[pos_] == ':') {
+        ++pos_;
+        long m = 0;
+        const size_t mb = pos_;
+        while (pos_ < src_.size() && std::isdigit(uint8_t(src_[pos_]))) m = m * 10 + (src_[pos_++] - '0');
+        if (pos_ - mb != 2 || n > 23 || m > 59) return bad("bad time of day");
+        n = n * 60 + m;
+      } else {
+        size_t s = pos_;
+        while (s < src_.size() && src_[s] == ' ') ++s;
+        if (s < src_.size() && src_[s] == '%') {
+          n *= 10;
+          pos_ = s + 1;
+        } else if (s < src_.size() && src_[s] == 'L' &&
+                   (s + 1 == src_.size() || !std::isalnum(uint8_t(src_[s + 1])))) {
+          n *= 1000;
+          pos_ = s + 1;
+        }
+      }
+      if (n > INT32_MAX) return bad("number out of range");
+      if (value) *value = int32_t(n);
+      return Tok::kNumber;
+    }
+    if (std::isalpha(uint8_t(ch)) || ch == '_') {
+      while (pos_ < src_.size() && (std::isalnum(uint8_t(src_[pos_])) || src_[pos_] == '_')) ++pos_;
+      if (text) *text = src_.substr(b, pos_ - b);
+      return Tok::kName;
+    }
+    static const char* kTwo[] = {"<=", ">=", "==", "!="};
+    for (const char* op : kTwo) {
+      if (src_.compare(pos_, 2, op) == 0) {
+        pos_ += 2;
+        if (text) *text = op;
+        return Tok::kPunct;
+      }
+    }
+    ++pos_;
+    if (text) *text = std::string(1, ch);
+    return Tok::kPunct;
+  }
+
+  Tok bad(const std::string& msg) {
+    if (error_.empty()) error_ = msg + " at column " + std::to_string(pos_ + 1);
+    pos_ = src_.size();
+    return Tok::kEnd;
+  }
+  bool fail(const std::string& msg) {
+    bad(msg);
+    return false;
+  }
+
+  bool expect(const char* what) {
+    std::string t;
+    const Tok k = next(&t);
+    if ((k == Tok::kPunct || k == Tok::kName) && t == what) return true;
+    return fail(std::string("expected '") + what + "'");
+  }
+  bool accept(const char* what) {
+    std::string t;
+    const Tok k = peek(&t);
+    if ((k == Tok::kPunct || k == Tok::kName) && t == what) {
+      next();
+      return true;
+    }
+    return false;
+  }
+
+  // Parse tree. Values: kNumber, kInput, kArith; conditions: the rest.
+  struct Node {
+    enum Kind { kNumber, kInput, kArith, kCompare, kAnd, kOr, kNot } kind = kNumber;
+    std::string op;
+    int32_t value = 0;
+    RuleInput input = RuleInput::kSoilPermille;
+    uint8_t zone = 0;
+    std::vector<Node> kids;
+
+    bool is_value() const { return kind <= kArith; }
+  };
+
+  static Node number(int32_t v) {
+    Node n;
+    n.value = v;
+    return n;
+  }
+
+  static Node binary(Node::Kind kind, const std::string& op, Node lhs, Node rhs) {
+    Node n;
+    n.kind = kind;
+    n.op = op;
+    n.kids.push_back(std::move(lhs));
+    n.kids.push_back(std::move(rhs));
+    return n;
+  }
+
+  // Same wrapping arithmetic as RuleProgram::run().
+  static int32_t fold(const std::string& op, int32_t x, int32_t y) {
+    if (op == "+") return int32_t(uint32_t(x) + uint32_t(y));
+    if (op == "-") return int32_t(uint32_t(x) - uint32_t(y));
+    if (op == "*") return int32_t(uint32_t(x) * uint32_t(y));
+    if (op == "/") return y == 0 || (y == -1 && x == INT32_MIN) ? 0 : x / y;
+    if (op == "min") return x < y ? x : y;
+    return x > y ? x : y;
+  }
+
+  static Node arith(const std::string& op, Node lhs, Node rhs) {
+    if (lhs.kind == Node::kNumber && rhs.kind == Node::kNumber) return number(fold(op, lhs.value, rhs.value));
+    return binary(Node::kArith, op, std::move(lhs), std::move(rhs));
+  }
+
+  bool zone_arg(uint8_t* zone) {
+    int32_t v;
+    if (!expect("(") || next(nullptr, &v) != Tok::kNumber) return fail("expected a zone number");
+    if (v >= int32_t(kMaxZones)) return fail("zone must be 0-" + std::to_string(kMaxZones - 1));
+    *zone = uint8_t(v);
+    return true;
+  }
+
+  bool value_of(Node* n, bool ok) {
+    if (!ok) return false;
+    if (!n->is_value()) return fail("a condition is not a value");
+    return true;
+  }
+
+  bool atom(Node* n) {
+    std::string t;
+    int32_t v = 0;
+    const Tok k = next(&t, &v);
+    if (k == Tok::kNumber) {
+      *n = number(v);
+      return true;
+    }
+    if (k == Tok::kPunct && t == "(") return expr(n) && expect(")");
+    if (k == Tok::kPunct && t == "-") {
+      Node x;
+      if (!value_of(&x, atom(&x))) return false;
+      *n = arith("*", std::move(x), number(-1));
+      return true;
+    }
+    if (k != Tok::kName) return fail("expected a value");
+    if (t == "soil" || t == "since_run") {
+      n->kind = Node::kInput;
+      n->input = t == "soil" ? RuleInput::kSoilPermille : RuleInput::kMinutesSinceRun;
+      return zone_arg(&n->zone) && expect(")");
+    }
+    if (t == "min" || t == "max") {
+      Node x, y;
+      if (!expect("(") || !value_of(&x, sum(&x)) || !expect(",") || !value_of(&y, sum(&y)) || !expect(")")) {
+        return false;
+      }
+      *n = arith(t, std::move(x), std::move(y));
+      return true;
+    }
+    static const struct {
+      const char* name;
+      RuleInput input;
+    } kInputs[] = {{"soc", RuleInput::kSocPermille},
+                   {"battery_mv", RuleInput::kBatteryMv},
+                   {"minute", RuleInput::kMinuteOfDay},
+                   {"weekday", RuleInput::kWeekday}};
+    for (const auto& in : kInputs) {
+      if (t == in.name) {
+        n->kind = Node::kInput;
+        n->input = in.input;
+        return true;
+      }
+    }
+    return fail("unknown name '" + t + "'");
+  }
+
+  bool term(Node* n) {
+    if (!atom(n)) return false;
+    for (;;) {
+      const char* op = accept("*") ? "*" : accept("/") ? "/" : nullptr;
+      if (!op) return true;
+      Node rhs;
+      if (!value_of(n, true) || !value_of(&rhs, atom(&rhs))) return false;
+      *n = arith(op, std::move(*n), std::move(rhs));
+    }
+  }
+
+  bool sum(Node* n) {
+    if (!term(n)) return false;
+    for (;;) {
+      const char* op = accept("+") ? "+" : accept("-") ? "-" : nullptr;
+      if (!op) return true;
+      Node rhs;
+      if (!value_of(n, true) || !value_of(&rhs, term(&rhs))) return false;
+      *n = arith(op, std::move(*n), std::move(rhs));
+    }
+  }
+
+  bool compare(Node* n) {
+    if (!sum(n)) return false;
+    std::string t;
+    if (peek(&t) != Tok::kPunct) return true;
+    for (const char* op : {"<", "<=", ">", ">=", "==", "!="}) {
+      if (t != op) continue;
+      next();
+      Node rhs;
+      if (!value_of(n, true) || !value_of(&rhs, sum(&rhs))) return false;
+      *n = binary(Node::kCompare, op, std::move(*n), std::move(rhs));
+      return true;
+    }
+    return true;
+  }
+
+  bool negation(Node* n) {
+    if (!accept("not")) return compare(n);
+    Node x;
+    if (!negation(&x)) return false;
+    n->kind = Node::kNot;
+    n->kids.push_back(std::move(x));
+    return true;
+  }
+
+  bool conjunction(Node* n) {
+    if (!negation(n)) return false;
+    while (accept("and")) {
+      Node rhs;
+      if (!negation(&rhs)) return false;
+      *n = binary(Node::kAnd, "and", std::move(*n), std::move(rhs));
+    }
+    return true;
+  }
+
+  bool expr(Node* n) {
+    if (!conjunction(n)) return false;
+    while (accept("or")) {
+      Node rhs;
+      if (!conjunction(&rhs)) return false;
+      *n = binary(Node::kOr, "or", std::move(*n), std::move(rhs));
+    }
+    return true;
+  }
+
+  // Code generation.
+
+  void emit(RuleOp op, uint8_t a, uint8_t b, uint8_t c) { code_.insert(code_.end(), {uint8_t(op), a, b, c}); }
+  void emit_imm(RuleOp op, uint8_t a, int32_t imm) {
+    emit(op, a, uint8_t(imm), uint8_t(uint32_t(imm) >> 8));
+  }
+
+  static bool fits16(int32_t v) { return v >= INT16_MIN && v <= INT16_MAX; }
+
+  void load(uint8_t r, int32_t v) {
+    emit_imm(RuleOp::kLoad, r, int16_t(v));
+    if (!fits16(v)) emit_imm(RuleOp::kLoadHigh, r, int32_t(uint32_t(v) >> 16));
+  }
+
+  // Leaves n in register r; deeper operands use r + 1...
+  bool value(const Node& n, uint8_t r) {
+    if (r >= kRuleRegisters) return fail("expression too deep");
+    switch (n.kind) {
+      case Node::kNumber:
+        load(r, n.value);
+        return true;
+      case Node::kInput:
+        emit(RuleOp::kInput, r, uint8_t(n.input), n.zone);
+        return true;
+      default:
+        break;
+    }
+    const Node& rhs = n.kids[1];
+    if (rhs.kind == Node::kNumber && (n.op == "+" || n.op == "*" || n.op == "-")) {
+      const int32_t k = n.op == "-" ? int32_t(0u - uint32_t(rhs.value)) : rhs.value;
+      if (fits16(k)) {
+        if (!value(n.kids[0], r)) return false;
+        if (n.op == "*" && k == 1) return true;
+        if (n.op != "*" && k == 0) return true;
+        emit_imm(n.op == "*" ? RuleOp::kMulImm : RuleOp::kAddImm, r, k);
+        return true;
+      }
+    }
+    if (!value(n.kids[0], r) || !value(rhs, uint8_t(r + 1))) return false;
+    static const struct {
+      const char* text;
+      RuleOp op;
+    } kOps[] = {{"+", RuleOp::kAdd}, {"-", RuleOp::kSub}, {"*", RuleOp::kMul},
+                {"/", RuleOp::kDiv}, {"min", RuleOp::kMin}, {"max", RuleOp::kMax}};
+    for (const auto& o : kOps) {
+      if (n.op == o.text) emit(o.op, r, r, uint8_t(r + 1));
+    }
+    return true;
+  }
+
+  // Puts a comparison's result in r0. Returns false in *inverted when r0
+  // holds the comparison itself, true when it holds its negation.
+  bool test(const Node& n, bool* inverted) {
+    *inverted = false;
+    const Node& lhs = n.kids[0];
+    const Node& rhs = n.kids[1];
+    if (rhs.kind == Node::kNumber) {
+      // Against a literal: compare in place. x <= k is x < k + 1.
+      const int32_t k = rhs.value;
+      RuleOp op = RuleOp::kCount;
+      int32_t imm = k;
+      if (n.op == "<") {
+        op = RuleOp::kLessImm;
+      } else if (n.op == ">") {
+        op = RuleOp::kGreaterImm;
+      } else if (n.op == "<=" && k < INT16_MAX) {
+        op = RuleOp::kLessImm;
+        imm = k + 1;
+      } else if (n.op == ">=" && k > INT16_MIN) {
+        op = RuleOp::kGreaterImm;
+        imm = k - 1;
+      } else if (n.op == "==" || n.op == "!=") {
+        op = RuleOp::kEqualImm;
+        *inverted = n.op == "!=";
+      }
+      if (op != RuleOp::kCount && fits16(imm)) {
+        if (!value(lhs, 0)) return false;
+        emit_imm(op, 0, imm);
+        return true;
+      }
+      *inverted = false;
+    }
+    // a > b is b < a: operands swap, no extra opcodes.
+    static const struct {
+      const char* text;
+      RuleOp op;
+      bool swap;
+    } kOps[] = {{"<", RuleOp::kLess, false},      {"<=", RuleOp::kLessEqual, false}, {">", RuleOp::kLess, true},
+                {">=", RuleOp::kLessEqual, true}, {"==", RuleOp::kEqual, false},     {"!=", RuleOp::kNotEqual, false}};
+    if (!value(lhs, 0) || !value(rhs, 1)) return false;
+    for (const auto& o : kOps) {
+      if (n.op == o.text) emit(o.op, 0, o.swap ? 1 : 0, o.swap ? 0 : 1);
+    }
+    return true;
+  }
+
+  void jump_to(std::vector<size_t>* labels, RuleOp op, uint8_t r) {
+    labels->push_back(code_.size());
+    emit(op, r, 0, 0);
+  }
+
+  // Points every jump in labels at the next instruction.
+  void bind(const std::vector<size_t>& labels) {
+    for (size_t at : labels) {
+      const size_t skip = (code_.size() - at) / kRuleInstructionBytes - 1;
+      code_[at + 2] = uint8_t(skip);
+      code_[at + 3] = uint8_t(skip >> 8);
+    }
+  }
+
+  // Emits a jump to labels taken when n evaluates to when; otherwise falls
+  // through.
+  bool branch(const Node& n, bool when, std::vector<size_t>* labels) {
+    switch (n.kind) {
+      case Node::kNot:
+        return branch(n.kids[0], !when, labels);
+      case Node::kAnd:
+      case Node::kOr: {
+        // and jumping on false (or on true): either side decides. Otherwise
+        // the left side can only decide against, so it skips the right.
+        const bool decides = (n.kind == Node::kAnd) != when;
+        if (decides) return branch(n.kids[0], when, labels) && branch(n.kids[1], when, labels);
+        std::vector<size_t> past;
+        if (!branch(n.kids[0], !when, &past) || !branch(n.kids[1], when, labels)) return false;
+        bind(past);
+        return true;
+      }
+      case Node::kCompare: {
+        bool inverted;
+        if (!test(n, &inverted)) return false;
+        jump_to(labels, when != inverted ? RuleOp::kJumpIfNonZero : RuleOp::kJumpIfZero, 0);
+        return true;
+      }
+      default:
+        // A bare value holds when nonzero.
+        if (!value(n, 0)) return false;
+        jump_to(labels, when ? RuleOp::kJumpIfNonZero : RuleOp::kJumpIfZero, 0);
+        return true;
+    }
+  }
+
+  bool action() {
+    std::string t;
+    if (next(&t) != Tok::kName) return fail("expected an action");
+    uint8_t zone;
+    if (t == "water") {
+      Node ml;
+      if (!zone_arg(&zone) || !expect(",") || !value_of(&ml, sum(&ml)) || !expect(")") || !value(ml, 0)) {
+        return false;
+      }
+      emit(RuleOp::kWater, zone, 0, 0);
+    } else if (t == "skip") {
+      if (!zone_arg(&zone) || !expect(")")) return false;
+      emit(RuleOp::kSkip, zone, 0, 0);
+    } else if (t == "alarm") {
+      int32_t v;
+      if (!expect("(") || next(nullptr, &v) != Tok::kNumber || v > 0xffff) return fail("expected an alarm code");
+      if (!expect(")")) return false;
+      emit_imm(RuleOp::kAlarm, 0, v);
+    } else {
+      return fail("unknown action '" + t + "'");
+    }
+    return true;
+  }
+
+  bool compile_rule() {
+    Node cond;
+    if (!expect("if") || !expr(&cond) || !expect("then")) return false;
+    std::vector<size_t> skip;
+    if (cond.kind == Node::kNumber) {
+      if (cond.value == 0) jump_to(&skip, RuleOp::kJump, 0);
+    } else if (!branch(cond, false, &skip)) {
+      return false;
+    }
+    do {
+      if (!action()) return false;
+    } while (accept(","));
+    if (peek() != Tok::kEnd) return fail("unexpected text after the actions");
+    bind(skip);
+    return error_.empty();
+  }
+
+  std::string src_;
+  size_t pos_ = 0;
+  std::string error_;
+  std::vector<uint8_t> code_;
+};
+
+// One line per instruction, for agro_config dump and review.
+inline std::string rule_disassemble(const uint8_t* code, size_t len) {
+  static const char* kOps[] = {"end", "load", "loadh", "input", "add",  "sub", "mul", "div",   "min",
+                               "max", "lt",   "le",    "eq",    "ne",   "addi", "muli", "lti", "gti",
+                               "eqi", "jz",   "jnz",   "jmp",   "water", "skip", "alarm"};
+  static_assert(sizeof(kOps) / sizeof(kOps[0]) == size_t(RuleOp::kCount));
+  static const char* kInputs[] = {"soil", "since_run", "soc", "battery_mv", "minute", "weekday"};
+  static_assert(sizeof(kInputs) / sizeof(kInputs[0]) == size_t(RuleInput::kCount));
+  std::string out;
+  char line[64];
+  for (size_t i = 0; i + kRuleInstructionBytes <= len; i += kRuleInstructionBytes) {
+    const uint8_t* in = code + i;
+    const auto op = RuleOp(in[0]);
+    const char* name = in[0] < uint8_t(RuleOp::kCount) ? kOps[in[0]] : "?";
+    const int imm = rule_detail::imm16(in);
+    switch (op) {
+      case RuleOp::kLoad:
+      case RuleOp::kLoadHigh:
+      case RuleOp::kAddImm:
+      case RuleOp::kMulImm:
+      case RuleOp::kLessImm:
+      case RuleOp::kGreaterImm:
+      case RuleOp::kEqualImm:
+        std::snprintf(line, sizeof(line), "%3zu  %-5s r%u, %d\n", i / 4, name, in[1], imm);
+        break;
+      case RuleOp::kInput:
+        if (in[2] <= uint8_t(RuleInput::kMinutesSinceRun)) {
+          std::snprintf(line, sizeof(line), "%3zu  %-5s r%u, %s(%u)\n", i / 4, name, in[1], kInputs[in[2]], in[3]);
+        } else {
+          std::snprintf(line, sizeof(line), "%3zu  %-5s r%u, %s\n", i / 4, name, in[1],
+                        in[2] < uint8_t(RuleInput::kCount) ? kInputs[in[2]] : "?");
+        }
+        break;
+      case RuleOp::kJumpIfZero:
+      case RuleOp::kJumpIfNonZero:
+        std::snprintf(line, sizeof(line), "%3zu  %-5s r%u, %zu\n", i / 4, name, in[1], i / 4 + 1 + size_t(imm));
+        break;
+      case RuleOp::kJump:
+        std::snprintf(line, sizeof(line), "%3zu  %-5s %zu\n", i / 4, name, i / 4 + 1 + size_t(imm));
+        break;
+      case RuleOp::kWater:
+        std::snprintf(line, sizeof(line), "%3zu  %-5s zone %u, r%u\n", i / 4, name, in[1], in[2]);
+        break;
+      case RuleOp::kSkip:
+        std::snprintf(line, sizeof(line), "%3zu  %-5s zone %u\n", i / 4, name, in[1]);
+        break;
+      case RuleOp::kEnd:
+      case RuleOp::kAlarm:
+        std::snprintf(line, sizeof(line), "%3zu  %-5s %d\n", i / 4, name, op == RuleOp::kAlarm ? imm & 0xffff : 0);
+        break;
+      default:
+        std::snprintf(line, sizeof(line), "%3zu  %-5s r%u, r%u, r%u\n", i / 4, name, in[1], in[2], in[3]);
+        break;
+    }
+    out += line;
+  }
+  return out;
+}
+
+}  // namespace agro
@@ -0,0 +1,245 @@
+// Irrigation rules as bytecode, so the logic that decides when to water can
+// change with a config image of a few hundred bytes instead of a firmware
+// update over the SIM800L.
+//
+// A rule is "if <condition> then <actions>", written in the text form that
+// rule_compiler.hpp turns into instructions for a small register machine:
+// sixteen int32 registers, fixed four-byte instructions
+//
+//   op, a, b, c          r[a] = r[b] <op> r[c], or as listed below
+//   op, a, imm16 (LE)    constants, forward jumps, actions
+//
+// Conditions compile to conditional jumps that stop at the first failing
+// test, so a rule whose first comparison fails costs three instructions.
+// Jumps only go forward, so a program runs at most one pass over its
+// instructions and needs no step limit; rule_verify() checks that, the
+// register and zone numbers and every opcode once when the image is opened,
+// and run() then trusts the code. Arithmetic wraps and cannot trap:
+// division by zero gives zero.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "agro/telemetry.hpp"
+
+namespace agro {
+
+inline constexpr size_t kRuleRegisters = 16;
+inline constexpr size_t kRuleInstructionBytes = 4;
+inline constexpr size_t kMaxRuleBytes = 1024;
+inline constexpr size_t kMaxRuleActions = 8;
+
+enum class RuleOp : uint8_t {
+  kEnd = 0,
+  kLoad,            // r[a] = imm16, sign-extended
+  kLoadHigh,        // r[a] = r[a] & 0xffff | imm16 << 16
+  kInput,           // r[a] = input b (RuleInput) for zone c
+  kAdd,             // r[a] = r[b] + r[c]
+  kSub,
+  kMul,
+  kDiv,
+  kMin,
+  kMax,
+  kLess,            // r[a] = r[b] < r[c], 0 or 1
+  kLessEqual,
+  kEqual,
+  kNotEqual,
+  kAddImm,          // r[a] += imm16
+  kMulImm,          // r[a] *= imm16
+  kLessImm,         // r[a] = r[a] < imm16, 0 or 1
+  kGreaterImm,
+  kEqualImm,
+  kJumpIfZero,      // if r[a] == 0, skip imm16 instructions
+  kJumpIfNonZero,
+  kJump,            // skip imm16 instructions
+  kWater,           // water zone a with r[b] ml
+  kSkip,            // skip zone a's scheduled programs until tomorrow
+  kAlarm,           // report alarm imm16
+  kCount,
+};
+
+enum class RuleInput : uint8_t {
+  kSoilPermille = 0,   // per zone
+  kMinutesSinceRun,    // per zone, saturates at 0xffff
+  kSocPermille,
+  kBatteryMv,
+  kMinuteOfDay,        // local time
+  kWeekday,            // 0 = Monday
+  kCount,
+};
+
+struct RuleInputs {
+  uint16_t soil_permille[kMaxZones] = {};
+  uint16_t minutes_since_run[kMaxZones] = {};
+  uint16_t soc_permille = 0;
+  uint16_t battery_mv = 0;
+  uint16_t minute_of_day = 0;
+  uint8_t weekday = 0;
+};
+
+enum class RuleActionKind : uint8_t {
+  kWater = 0,  // value = ml
+  kSkip,
+  kAlarm,      // value = code
+};
+
+struct RuleAction {
+  RuleActionKind kind = RuleActionKind::kWater;
+  uint8_t zone = 0;
+  uint32_t value = 0;
+};
+
+struct RuleActions {
+  RuleAction items[kMaxRuleActions];
+  uint8_t count = 0;
+  uint8_t dropped = 0;  // beyond kMaxRuleActions
+};
+
+namespace rule_detail {
+
+inline int32_t imm16(const uint8_t* in) { return int16_t(uint16_t(in[2] | in[3] << 8)); }
+
+}  // namespace rule_detail
+
+// Checks code before it is ever run. Returns false for anything run() could
+// not execute safely.
+inline bool rule_verify(const uint8_t* code, size_t len) {
+  if (len % kRuleInstructionBytes != 0 || len > kMaxRuleBytes) return false;
+  const size_t n = len / kRuleInstructionBytes;
+  for (size_t i = 0; i < n; ++i) {
+    const uint8_t* in = code + i * kRuleInstructionBytes;
+    const auto op = RuleOp(in[0]);
+    const int32_t imm = rule_detail::imm16(in);
+    switch (op) {
+      case RuleOp::kEnd:
+        break;
+      case RuleOp::kLoad:
+      case RuleOp::kLoadHigh:
+        if (in[1] >= kRuleRegisters) return false;
+        break;
+      case RuleOp::kInput:
+        if (in[1] >= kRuleRegisters || in[2] >= uint8_t(RuleInput::kCount) || in[3] >= kMaxZones) return false;
+        break;
+      case RuleOp::kAddImm:
+      case RuleOp::kMulImm:
+      case RuleOp::kLessImm:
+      case RuleOp::kGreaterImm:
+      case RuleOp::kEqualImm:
+        if (in[1] >= kRuleRegisters) return false;
+        break;
+      case RuleOp::kWater:
+        if (in[1] >= kMaxZones || in[2] >= kRuleRegisters) return false;
+        break;
+      case RuleOp::kJumpIfZero:
+      case RuleOp::kJumpIfNonZero:
+      case RuleOp::kJump:
+        if ((op != RuleOp::kJump && in[1] >= kRuleRegisters) || imm < 0 || i + 1 + size_t(imm) > n) return false;
+        break;
+      case RuleOp::kSkip:
+        if (in[1] >= kMaxZones) return false;
+        break;
+      case RuleOp::kAlarm:
+        break;
+      default:
+        if (in[0] >= uint8_t(RuleOp::kCount) || in[1] >= kRuleRegisters || in[2] >= kRuleRegisters ||
+            in[3] >= kRuleRegisters) {
+          return false;
+        }
+        break;
+    }
+  }
+  return true;
+}
+
+// Verified code, e.g. the rules section of the config image, read in place.
+class RuleProgram {
+ public:
+  bool load(const uint8_t* code, size_t len) {
+    code_ = nullptr;
+    len_ = 0;
+    if (!rule_verify(code, len)) return false;
+    code_ = code;
+    len_ = len;
+    return true;
+  }
+
+  bool empty() const { return len_ == 0; }
+  size_t bytes() const { return len_; }
+
+  // Runs every rule against in, appending to *out. Returns the number of
+  // instructions executed.
+  uint32_t run(const RuleInputs& in, RuleActions* out) const {
+    int32_t r[kRuleRegisters] = {};
+    const uint8_t* pc = code_;
+    const uint8_t* const end = code_ + len_;
+    uint32_t steps = 0;
+    while (pc < end) {
+      const uint8_t a = pc[1], b = pc[2], c = pc[3];
+      const int32_t imm = rule_detail::imm16(pc);
+      const auto op = RuleOp(pc[0]);
+      pc += kRuleInstructionBytes;
+      ++steps;
+      switch (op) {
+        case RuleOp::kEnd: return steps;
+        case RuleOp::kLoad: r[a] = imm; break;
+        case RuleOp::kLoadHigh: r[a] = int32_t((uint32_t(r[a]) & 0xffff) | uint32_t(imm) << 16); break;
+        case RuleOp::kInput: r[a] = input(in, RuleInput(b), c); break;
+        case RuleOp::kAdd: r[a] = int32_t(uint32_t(r[b]) + uint32_t(r[c])); break;
+        case RuleOp::kSub: r[a] = int32_t(uint32_t(r[b]) - uint32_t(r[c])); break;
+        case RuleOp::kMul: r[a] = int32_t(uint32_t(r[b]) * uint32_t(r[c])); break;
+        case RuleOp::kDiv: r[a] = r[c] == 0 || (r[c] == -1 && r[b] == INT32_MIN) ? 0 : r[b] / r[c]; break;
+        case RuleOp::kMin: r[a] = r[b] < r[c] ? r[b] : r[c]; break;
+        case RuleOp::kMax: r[a] = r[b] > r[c] ? r[b] : r[c]; break;
+        case RuleOp::kLess: r[a] = r[b] < r[c]; break;
+        case RuleOp::kLessEqual: r[a] = r[b] <= r[c]; break;
+        case RuleOp::kEqual: r[a] = r[b] == r[c]; break;
+        case RuleOp::kNotEqual: r[a] = r[b] != r[c]; break;
+        case RuleOp::kAddImm: r[a] = int32_t(uint32_t(r[a]) + uint32_t(imm)); break;
+        case RuleOp::kMulImm: r[a] = int32_t(uint32_t(r[a]) * uint32_t(imm)); break;
+        case RuleOp::kLessImm: r[a] = r[a] < imm; break;
+        case RuleOp::kGreaterImm: r[a] = r[a] > imm; break;
+        case RuleOp::kEqualImm: r[a] = r[a] == imm; break;
+        case RuleOp::kJumpIfZero:
+          if (r[a] == 0) pc += size_t(imm) * kRuleInstructionBytes;
+          break;
+        case RuleOp::kJumpIfNonZero:
+          if (r[a] != 0) pc += size_t(imm) * kRuleInstructionBytes;
+          break;
+        case RuleOp::kJump: pc += size_t(imm) * kRuleInstructionBytes; break;
+        case RuleOp::kWater: emit(out, RuleActionKind::kWater, a, r[b] > 0 ? uint32_t(r[b]) : 0); break;
+        case RuleOp::kSkip: emit(out, RuleActionKind::kSkip, a, 0); break;
+        case RuleOp::kAlarm: emit(out, RuleActionKind::kAlarm, 0, uint32_t(uint16_t(imm))); break;
+        case RuleOp::kCount: break;
+      }
+    }
+    return steps;
+  }
+
+ private:
+  static int32_t input(const RuleInputs& in, RuleInput i, uint8_t zone) {
+    switch (i) {
+      case RuleInput::kSoilPermille: return in.soil_permille[zone];
+      case RuleInput::kMinutesSinceRun: return in.minutes_since_run[zone];
+      case RuleInput::kSocPermille: return in.soc_permille;
+      case RuleInput::kBatteryMv: return in.battery_mv;
+      case RuleInput::kMinuteOfDay: return in.minute_of_day;
+      case RuleInput::kWeekday: return in.weekday;
+      case RuleInput::kCount: break;
+    }
+    return 0;
+  }
+
+  static void emit(RuleActions* out, RuleActionKind kind, uint8_t zone, uint32_t value) {
+    if (out->count == kMaxRuleActions) {
+      ++out->dropped;
+      return;
+    }
+    out->items[out->count++] = RuleAction{kind, zone, value};
+  }
+
+  const uint8_t* code_ = nullptr;
+  size_t len_ = 0;
+};
+
+}  // namespace agro
@@ -0,0 +1,190 @@
+// Authenticated, encrypted framing for telemetry over GPRS.
+//
+//   u8   kSealedFrameVersion
+//   u8   direction (bit 0, 1 = downlink) | key id << 1
+//   u32  device id, big endian
+//   u32  epoch, big endian (31 bits)
+//   u32  counter, big endian
+//   ...  AES-128-GCM ciphertext of the payload (a telemetry packet, a command)
+//   u8[16] tag
+//
+// The 14-byte header is the additional data, so nothing in it can be
+// changed either. The nonce is device id || direction:epoch || counter. The
+// sender bumps its epoch on every cold boot (persisted, so it never repeats)
+// and counts frames within it in RTC memory, so a nonce is never reused
+// under one key even across deep sleep and power loss. Downlink frames carry
+// the epoch of the device's latest uplink, with the server's own counter, so
+// a device rejects anything sealed for an earlier boot. The receiver keeps a
+// ReplayWindow per device and direction.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "agro/aes_gcm.hpp"
+
+namespace agro {
+
+inline constexpr uint8_t kSealedFrameVersion = 0xE1;
+inline constexpr size_t kSealedHeaderBytes = 14;
+inline constexpr size_t kSealedOverhead = kSealedHeaderBytes + kGcmTagBytes;
+inline constexpr uint32_t kMaxEpoch = 0x7fffffff;
+
+enum class FrameDir : uint8_t {
+  kUplink = 0,
+  kDownlink = 1,
+};
+
+struct SealedHeader {
+  FrameDir dir = FrameDir::kUplink;
+  uint8_t key_id = 0;  // 0..127, for key rotation
+  uint32_t device_id = 0;
+  uint32_t epoch = 0;
+  uint32_t counter = 0;
+};
+
+namespace sealed_detail {
+
+inline void put_be32(uint8_t* p, uint32_t v) {
+  p[0] = uint8_t(v >> 24);
+  p[1] = uint8_t(v >> 16);
+  p[2] = uint8_t(v >> 8);
+  p[3] = uint8_t(v);
+}
+inline uint32_t get_be32(const uint8_t* p) {
+  return uint32_t(p[0]) << 24 | uint32_t(p[1]) << 16 | uint32_t(p[2]) << 8 | p[3];
+}
+
+inline void nonce(const SealedHeader& h, uint8_t out[kGcmNonceBytes]) {
+  put_be32(out, h.device_id);
+  put_be32(out + 4, h.epoch | (h.dir == FrameDir::kDownlink ? 0x80000000u : 0));
+  put_be32(out + 8, h.counter);
+}
+
+}  // namespace sealed_detail
+
+inline bool parse_sealed_header(const uint8_t* frame, size_t len, SealedHeader* h) {
+  using sealed_detail::get_be32;
+  if (len < kSealedOverhead || frame[0] != kSealedFrameVersion) return false;
+  h->dir = (frame[1] & 1) ? FrameDir::kDownlink : FrameDir::kUplink;
+  h->key_id = frame[1] >> 1;
+  h->device_id = get_be32(frame + 2);
+  h->epoch = get_be32(frame + 6);
+  h->counter = get_be32(frame + 10);
+  return h->epoch <= kMaxEpoch;
+}
+
+// Writes the sealed frame of payload to out; returns its length, or 0 if it
+// does not fit in capacity. payload and out may not overlap.
+template <class Ctr>
+size_t seal_frame(const GcmKey& k, Ctr&& ctr, const SealedHeader& h, const uint8_t* payload, size_t len, uint8_t* out,
+                  size_t capacity) {
+  using sealed_detail::put_be32;
+  if (len + kSealedOverhead > capacity || h.epoch > kMaxEpoch) return 0;
+  out[0] = kSealedFrameVersion;
+  out[1] = uint8_t(h.key_id << 1 | (h.dir == FrameDir::kDownlink ? 1 : 0));
+  put_be32(out + 2, h.device_id);
+  put_be32(out + 6, h.epoch);
+  put_be32(out + 10, h.counter);
+  uint8_t n[kGcmNonceBytes];
+  sealed_detail::nonce(h, n);
+  uint8_t* body = out + kSealedHeaderBytes;
+  std::memcpy(body, payload, len);
+  gcm_seal(k, ctr, n, out, kSealedHeaderBytes, body, len, body + len);
+  return len + kSealedOverhead;
+}
+
+// Authenticates and decrypts frame in place. On success *payload points at
+// the plaintext inside frame. The caller checks the header against its
+// ReplayWindow first and updates it only after this returns true.
+template <class Ctr>
+bool open_frame(const GcmKey& k, Ctr&& ctr, uint8_t* frame, size_t len, const SealedHeader& h, uint8_t** payload,
+                size_t* payload_len) {
+  if (len < kSealedOverhead) return false;
+  uint8_t n[kGcmNonceBytes];
+  sealed_detail::nonce(h, n);
+  uint8_t* body = frame + kSealedHeaderBytes;
+  const size_t body_len = len - kSealedOverhead;
+  if (!gcm_open(k, ctr, n, frame, kSealedHeaderBytes, body, body_len, body + body_len)) return false;
+  *payload = body;
+  *payload_len = body_len;
+  return true;
+}
+
+inline size_t seal_frame(const GcmKey& k, const SealedHeader& h, const uint8_t* payload, size_t len, uint8_t* out,
+                         size_t capacity) {
+  return seal_frame(k, SoftwareCtr{k}, h, payload, len, out, capacity);
+}
+
+inline bool open_frame(const GcmKey& k, uint8_t* frame, size_t len, const SealedHeader& h, uint8_t** payload,
+                       size_t* payload_len) {
+  return open_frame(k, SoftwareCtr{k}, frame, len, h, payload, payload_len);
+}
+
+// The key a server seals datagram acks under (server/udp_ingest.hpp):
+// E(device key, "ACK" block), so acks never share a nonce with downlink
+// commands sealed under the device key itself.
+inline void derive_ack_key(const GcmKey& device_key, GcmKey* out) {
+  uint8_t block[16] = {'A', 'C', 'K'}, key[16];
+  aes128_encrypt_block(device_key, block, key);
+  gcm_init(out, key);
+}
+
+// Sender side nonce state: the epoch from persistent storage, the counter
+// from RTC memory. next() fails once the counter is exhausted; the sender
+// then needs a new epoch.
+struct FrameCounter {
+  uint32_t epoch = 0;
+  uint32_t counter = 0;
+
+  bool next(SealedHeader* h) {
+    if (counter == UINT32_MAX || epoch > kMaxEpoch) return false;
+    h->epoch = epoch;
+    h->counter = counter++;
+    return true;
+  }
+};
+
+// Sliding window over the last 64 counters of the newest epoch, so frames
+// reordered or retried by the GPRS path still pass once each. Frames of an
+// older epoch are always rejected.
+class ReplayWindow {
+ public:
+  static constexpr uint32_t kWidth = 64;
+
+  bool fresh(uint32_t epoch, uint32_t counter) const {
+    if (!started_ || epoch > epoch_) return true;
+    if (epoch < epoch_) return false;
+    if (counter > top_) return true;
+    const uint32_t back = top_ - counter;
+    return back < kWidth && (seen_ >> back & 1) == 0;
+  }
+
+  // Only after the frame authenticated.
+  void accept(uint32_t epoch, uint32_t counter) {
+    if (!started_ || epoch > epoch_) {
+      started_ = true;
+      epoch_ = epoch;
+      top_ = counter;
+      seen_ = 1;
+      return;
+    }
+    if (counter > top_) {
+      const uint32_t shift = counter - top_;
+      seen_ = shift >= kWidth ? 0 : seen_ << shift;
+      seen_ |= 1;
+      top_ = counter;
+    } else {
+      seen_ |= uint64_t(1) << (top_ - counter);
+    }
+  }
+
+ private:
+  bool started_ = false;
+  uint32_t epoch_ = 0;
+  uint32_t top_ = 0;
+  uint64_t seen_ = 0;
+};
+
+}  // namespace agro
@@ -0,0 +1,284 @@
+// Uplink sessions over the GPRS TCP connection, with ticket resumption.
+//
+// Sealed frames (sealed_frame.hpp) under the long-term device key need no
+// handshake, but every frame then rides on the one key for the device's
+// life. A session instead runs its frames under a fresh session key:
+//
+//   full      C: Hello (device id, client random, GMAC)
+//             S: HelloReply (server random, lifetime, ticket), sealed
+//             C: Data...              session key = PRF(device key, randoms)
+//             S: Ack
+//   resumed   C: Resume (ticket), Data...  in the first flight
+//             S: Ack [, NewTicket]
+//
+// The ticket is the session state sealed under the server's ticket key, so
+// the server keeps nothing per session. The device keeps the ticket, its
+// session key and frame counter in RTC memory across deep sleep. Resuming
+// saves the handshake round trip; at 2G latency that is about a second of
+// modem-on time per session. Data frames use the ticket's sequence number
+// as their epoch, so the server's per-device ReplayWindow also rejects 0-RTT
+// data replayed from an older ticket once a newer one has been used. The
+// server sends NewTicket once a ticket has lived half its lifetime; an
+// expired or unknown ticket gets Reject and the client falls back to Hello
+// on the same connection.
+//
+// Records on the stream: u8 type, u16 body length (big endian), body.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "agro/sealed_frame.hpp"
+
+namespace agro {
+
+enum class SessionRecord : uint8_t {
+  kHello = 1,
+  kHelloReply,
+  kResume,
+  kData,
+  kAck,
+  kNewTicket,
+  kReject,
+};
+
+inline constexpr size_t kRecordHeaderBytes = 3;
+inline constexpr size_t kSessionRandomBytes = 16;
+// Ticket: nonce(12) || sealed(device id, key id, issued, seq, session key) || tag(16).
+inline constexpr size_t kTicketPlainBytes = 4 + 1 + 4 + 4 + 16;
+inline constexpr size_t kTicketBytes = kGcmNonceBytes + kTicketPlainBytes + kGcmTagBytes;
+inline constexpr size_t kHelloBodyBytes = 4 + 1 + kSessionRandomBytes + kGcmTagBytes;
+// Ticket grant: lifetime(4) || sequence(4) || server random || ticket.
+inline constexpr size_t kTicketGrantBytes = 4 + 4 + kSessionRandomBytes + kTicketBytes;
+inline constexpr size_t kHelloReplyBodyBytes = kTicketGrantBytes + kGcmTagBytes;
+inline constexpr size_t kNewTicketBodyBytes = kSealedOverhead + kTicketGrantBytes;
+inline constexpr size_t kAckBodyBytes = kSealedOverhead + 4;
+
+namespace session_detail {
+
+inline void put_be32(uint8_t* p, uint32_t v) { sealed_detail::put_be32(p, v); }
+inline uint32_t get_be32(const uint8_t* p) { return sealed_detail::get_be32(p); }
+
+inline size_t record_header(uint8_t* out, SessionRecord type, size_t len) {
+  out[0] = uint8_t(type);
+  out[1] = uint8_t(len >> 8);
+  out[2] = uint8_t(len);
+  return kRecordHeaderBytes;
+}
+
+}  // namespace session_detail
+
+// Session key = E(device key, client random XOR server random). One AES
+// block is a PRF with a 128-bit output, which is all a 128-bit key needs.
+inline void derive_session_key(const GcmKey& device_key, const uint8_t client[kSessionRandomBytes],
+                               const uint8_t server[kSessionRandomBytes], uint8_t out[16]) {
+  uint8_t x[16];
+  for (size_t i = 0; i < 16; ++i) x[i] = uint8_t(client[i] ^ server[i]);
+  x[0] ^= 0x5a;  // separates the PRF input from GHASH's E(K, 0)
+  aes128_encrypt_block(device_key, x, out);
+}
+
+// Finds the first complete record in data. Returns the bytes it takes, 0 if
+// more bytes are needed, or SIZE_MAX if the length field is out of range.
+inline constexpr size_t kMaxRecordBody = 1024;
+inline size_t next_record(const uint8_t* data, size_t len, SessionRecord* type, const uint8_t** body,
+                          size_t* body_len) {
+  if (len < kRecordHeaderBytes) return 0;
+  const size_t n = size_t(data[1]) << 8 | data[2];
+  if (n > kMaxRecordBody) return SIZE_MAX;
+  if (len < kRecordHeaderBytes + n) return 0;
+  *type = SessionRecord(data[0]);
+  *body = data + kRecordHeaderBytes;
+  *body_len = n;
+  return kRecordHeaderBytes + n;
+}
+
+// Device side. Constant-initializable so it can live in RTC memory; only the
+// ticket part needs to survive deep sleep.
+class SessionClient {
+ public:
+  enum class State : uint8_t {
+    kIdle = 0,
+    kAwaitHello,  // Hello sent, data held back
+    kAwaitAck,    // data sent
+    kDone,
+    kFailed,
+  };
+
+  SessionClient() = default;
+
+  // Once per cold boot; drops any ticket.
+  void set_device(uint32_t device_id, uint8_t key_id, const uint8_t device_key[16]) {
+    device_id_ = device_id;
+    key_id_ = key_id;
+    gcm_init(&device_key_, device_key);
+    have_ticket_ = false;
+  }
+
+  bool can_resume(uint32_t now_s) const {
+    return have_ticket_ && now_s - ticket_received_s_ < ticket_lifetime_s_ && counter_.counter != UINT32_MAX;
+  }
+
+  // First flight of a session carrying payload (a telemetry packet). With a
+  // live ticket that is Resume + Data; otherwise Hello, and the data goes
+  // out after the reply. random: 16 fresh bytes. Returns bytes written.
+  size_t begin(uint32_t now_s, const uint8_t random[kSessionRandomBytes], const uint8_t* payload, size_t len,
+               uint8_t* out, size_t capacity) {
+    payload_ = payload;
+    payload_len_ = len;
+    std::memcpy(client_random_, random, kSessionRandomBytes);
+    if (can_resume(now_s)) {
+      resumed_ = true;
+      size_t n = resume_record(out, capacity);
+      const size_t d = data_record(out + n, capacity - n);
+      if (n == 0 || d == 0) return fail();
+      state_ = State::kAwaitAck;
+      return n + d;
+    }
+    resumed_ = false;
+    const size_t n = hello_record(out, capacity);
+    if (n == 0) return fail();
+    state_ = State::kAwaitHello;
+    return n;
+  }
+
+  // Handles one record from the server at now_s; writes any reply to out and
+  // returns its length.
+  size_t on_record(SessionRecord type, const uint8_t* body, size_t len, uint32_t now_s, uint8_t* out,
+                   size_t capacity) {
+    switch (type) {
+      case SessionRecord::kHelloReply: {
+        if (state_ != State::kAwaitHello || len != kHelloReplyBodyBytes) return fail();
+        uint8_t grant[kHelloReplyBodyBytes];
+        std::memcpy(grant, body, len);
+        uint8_t nonce[kGcmNonceBytes];
+        std::memcpy(nonce, client_random_, kGcmNonceBytes);
+        nonce[0] ^= 0x80;  // the reply's nonce differs from the Hello's
+        if (!gcm_open(device_key_, nonce, client_random_, kSessionRandomBytes, grant, kTicketGrantBytes,
+                      grant + kTicketGrantBytes)) {
+          return fail();
+        }
+        uint8_t key[16];
+        derive_session_key(device_key_, client_random_, grant + 8, key);
+        adopt(grant, key, now_s);
+        const size_t n = data_record(out, capacity);
+        if (n == 0) return fail();
+        state_ = State::kAwaitAck;
+        return n;
+      }
+      case SessionRecord::kAck: {
+        uint8_t* plain;
+        if (state_ != State::kAwaitAck || len != kAckBodyBytes || !open_downlink(body, len, &plain) ||
+            session_detail::get_be32(plain) != counter_.counter - 1) {
+          return fail();
+        }
+        state_ = State::kDone;
+        return 0;
+      }
+      case SessionRecord::kNewTicket: {
+        // Optional; a bad one is ignored and the old ticket kept.
+        uint8_t* grant;
+        if (state_ != State::kDone || len != kNewTicketBodyBytes || !open_downlink(body, len, &grant)) return 0;
+        // The new session key comes from the old one and the new random.
+        const uint8_t zero[kSessionRandomBytes] = {};
+        uint8_t key[16];
+        derive_session_key(session_key_, zero, grant + 8, key);
+        adopt(grant, key, now_s);
+        return 0;
+      }
+      case SessionRecord::kReject:
+        if (state_ != State::kAwaitAck || !resumed_) return fail();
+        // Ticket unknown or expired: full handshake on the same connection.
+        have_ticket_ = false;
+        resumed_ = false;
+        state_ = State::kAwaitHello;
+        return hello_record(out, capacity);
+      default:
+        return fail();
+    }
+  }
+
+  State state() const { return state_; }
+  bool resumed() const { return resumed_; }
+  bool has_ticket() const { return have_ticket_; }
+  void forget_ticket() { have_ticket_ = false; }
+
+ private:
+  size_t fail() {
+    state_ = State::kFailed;
+    return 0;
+  }
+
+  size_t hello_record(uint8_t* out, size_t capacity) {
+    using session_detail::put_be32;
+    if (capacity < kRecordHeaderBytes + kHelloBodyBytes) return 0;
+    uint8_t* b = out + session_detail::record_header(out, SessionRecord::kHello, kHelloBodyBytes);
+    put_be32(b, device_id_);
+    b[4] = key_id_;
+    std::memcpy(b + 5, client_random_, kSessionRandomBytes);
+    // GMAC: no plaintext, the whole body so far is additional data.
+    gcm_seal(device_key_, client_random_, b, 5 + kSessionRandomBytes, b, 0, b + 5 + kSessionRandomBytes);
+    return kRecordHeaderBytes + kHelloBodyBytes;
+  }
+
+  size_t resume_record(uint8_t* out, size_t capacity) {
+    if (capacity < kRecordHeaderBytes + kTicketBytes) return 0;
+    session_detail::record_header(out, SessionRecord::kResume, kTicketBytes);
+    std::memcpy(out + kRecordHeaderBytes, ticket_, kTicketBytes);
+    return kRecordHeaderBytes + kTicketBytes;
+  }
+
+  size_t data_record(uint8_t* out, size_t capacity) {
+    const size_t body = payload_len_ + kSealedOverhead;
+    if (capacity < kRecordHeaderBytes + body) return 0;
+    SealedHeader h;
+    h.key_id = key_id_;
+    h.device_id = device_id_;
+    if (!counter_.next(&h)) return 0;
+    session_detail::record_header(out, SessionRecord::kData, body);
+    return kRecordHeaderBytes +
+           seal_frame(session_key_, h, payload_, payload_len_, out + kRecordHeaderBytes, capacity - kRecordHeaderBytes);
+  }
+
+  // A downlink frame under the session key, opened in scratch_.
+  bool open_downlink(const uint8_t* body, size_t len, uint8_t** plain) {
+    if (len > sizeof(scratch_)) return false;
+    std::memcpy(scratch_, body, len);
+    SealedHeader h;
+    size_t plain_len;
+    return parse_sealed_header(scratch_, len, &h) && h.dir == FrameDir::kDownlink && h.device_id == device_id_ &&
+           h.epoch == counter_.epoch && open_frame(session_key_, scratch_, len, h, plain, &plain_len);
+  }
+
+  // grant: lifetime || sequence || server random || ticket.
+  void adopt(const uint8_t* grant, const uint8_t key[16], uint32_t now_s) {
+    ticket_lifetime_s_ = session_detail::get_be32(grant);
+    counter_.epoch = session_detail::get_be32(grant + 4) & kMaxEpoch;
+    counter_.counter = 0;
+    std::memcpy(ticket_, grant + 8 + kSessionRandomBytes, kTicketBytes);
+    ticket_received_s_ = now_s;
+    gcm_init(&session_key_, key);
+    have_ticket_ = true;
+  }
+
+  uint32_t device_id_ = 0;
+  uint8_t key_id_ = 0;
+  GcmKey device_key_ = {};
+  // Ticket state, persisted across deep sleep.
+  bool have_ticket_ = false;
+  uint32_t ticket_received_s_ = 0;
+  uint32_t ticket_lifetime_s_ = 0;
+  uint8_t ticket_[kTicketBytes] = {};
+  GcmKey session_key_ = {};
+  FrameCounter counter_;
+  // Per session.
+  State state_ = State::kIdle;
+  bool resumed_ = false;
+  uint8_t client_random_[kSessionRandomBytes] = {};
+  const uint8_t* payload_ = nullptr;
+  size_t payload_len_ = 0;
+  uint8_t scratch_[kNewTicketBodyBytes] = {};
+};
+
+}  // namespace agro
@@ -0,0 +1,40 @@
+// Telemetry record shared by the firmware and the ingestion server.
+#pragma once
+
+#include <cstdint>
+
+namespace agro {
+
+enum class RecordKind : uint8_t {
+  kSoil = 0,   // a = moisture permille, b = raw ADC
+  kBattery,    // a = battery mV, b = SoC permille
+  kPosition,   // a = latitude, b = longitude, both 1e-7 degrees
+  kValve,      // a = delivered ml, b = open ms
+  kFlow,       // a = cumulative ml, b = rate ml/min
+  kFault,      // a = fault code, b = subsystem-specific detail
+  kGeofence,   // a = distance outside the fence in m, b = fence id
+  kCount,
+};
+
+// Zones are packed into 3 bits on the wire.
+inline constexpr uint8_t kMaxZones = 8;
+
+// flags: several readings merged under storage pressure (telemetry_queue.hpp).
+// The low 15 bits count them; a and b are their mean, time the newest.
+inline constexpr uint16_t kRecordSummary = 0x8000;
+
+struct TelemetryRecord {
+  uint32_t time = 0;  // unix seconds
+  RecordKind kind = RecordKind::kSoil;
+  uint8_t zone = 0;
+  uint16_t flags = 0;
+  int32_t a = 0;
+  int32_t b = 0;
+};
+
+inline bool operator==(const TelemetryRecord& x, const TelemetryRecord& y) {
+  return x.time == y.time && x.kind == y.kind && x.zone == y.zone && x.flags == y.flags && x.a == y.a &&
+         x.b == y.b;
+}
+
+}  // namespace agro
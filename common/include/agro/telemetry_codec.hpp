@@ -0,0 +1,151 @@
+// Dense, self-contained binary packing of telemetry records.
+//
+// Each packet stands alone so a lost or reordered packet never makes its
+// neighbours undecodable:
+//
+//   u8      kPacketVersion
+//   u16     sequence number, big endian
+//   varint  base time (unix seconds)
+//   record* tag     u8: kind << 4 | zone << 1 | has_flags
+//           dt      zigzag varint, seconds since the previous record
+//           da, db  zigzag varint, change from the previous record of the
+//                   same kind in this packet (absolute for the first)
+//           flags   varint, only if has_flags
+//
+// Slowly varying series (battery mV, positions, soil) collapse to a couple of
+// bytes per record.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "agro/telemetry.hpp"
+
+namespace agro {
+
+inline constexpr uint8_t kPacketVersion = 0xA1;
+inline constexpr size_t kPacketHeaderMax = 1 + 2 + 5;
+inline constexpr size_t kRecordMaxEncoded = 1 + 5 + 5 + 5 + 3;
+
+inline uint32_t zigzag(int32_t v) { return (static_cast<uint32_t>(v) << 1) ^ static_cast<uint32_t>(v >> 31); }
+inline int32_t unzigzag(uint32_t v) { return static_cast<int32_t>(v >> 1) ^ -static_cast<int32_t>(v & 1); }
+
+inline size_t put_varint(uint8_t* out, uint32_t v) {
+  size_t n = 0;
+  while (v >= 0x80) {
+    out[n++] = static_cast<uint8_t>(v | 0x80);
+    v >>= 7;
+  }
+  out[n++] = static_cast<uint8_t>(v);
+  return n;
+}
+
+// Returns bytes consumed, or 0 on truncated/overlong input.
+inline size_t get_varint(const uint8_t* in, size_t len, uint32_t* v) {
+  uint32_t result = 0;
+  for (size_t i = 0; i < len && i < 5; ++i) {
+    result |= static_cast<uint32_t>(in[i] & 0x7f) << (7 * i);
+    if ((in[i] & 0x80) == 0) {
+      *v = result;
+      return i + 1;
+    }
+  }
+  return 0;
+}
+
+class TelemetryPacker {
+ public:
+  // base_time should be the time of the first record to be added.
+  TelemetryPacker(uint8_t* buf, size_t capacity, uint16_t seq, uint32_t base_time)
+      : buf_(buf), cap_(capacity), last_time_(base_time) {
+    if (cap_ < kPacketHeaderMax) {
+      cap_ = 0;
+      return;
+    }
+    buf_[0] = kPacketVersion;
+    buf_[1] = static_cast<uint8_t>(seq >> 8);
+    buf_[2] = static_cast<uint8_t>(seq);
+    size_ = 3 + put_varint(buf_ + 3, base_time);
+  }
+
+  // Appends r if it fits; leaves the packet unchanged and returns false if not.
+  bool add(const TelemetryRecord& r) {
+    if (cap_ == 0) return false;
+    uint8_t tmp[kRecordMaxEncoded];
+    const size_t k = static_cast<size_t>(r.kind) & 0x0f;
+    size_t n = 0;
+    tmp[n++] = static_cast<uint8_t>(k << 4 | (r.zone & 0x07) << 1 | (r.flags ? 1 : 0));
+    n += put_varint(tmp + n, zigzag(static_cast<int32_t>(r.time - last_time_)));
+    n += put_varint(tmp + n, zigzag(static_cast<int32_t>(static_cast<uint32_t>(r.a) - prev_a_[k])));
+    n += put_varint(tmp + n, zigzag(static_cast<int32_t>(static_cast<uint32_t>(r.b) - prev_b_[k])));
+    if (r.flags) n += put_varint(tmp + n, r.flags);
+    if (size_ + n > cap_) return false;
+    std::memcpy(buf_ + size_, tmp, n);
+    size_ += n;
+    last_time_ = r.time;
+    prev_a_[k] = static_cast<uint32_t>(r.a);
+    prev_b_[k] = static_cast<uint32_t>(r.b);
+    ++count_;
+    return true;
+  }
+
+  size_t size() const { return size_; }
+  size_t count() const { return count_; }
+
+ private:
+  uint8_t* buf_;
+  size_t cap_;
+  size_t size_ = 0;
+  size_t count_ = 0;
+  uint32_t last_time_;
+  uint32_t prev_a_[16] = {};
+  uint32_t prev_b_[16] = {};
+};
+
+// Decodes one packet, calling sink(const TelemetryRecord&) per record.
+// Returns false on a malformed packet; records before the error have
+// already been delivered.
+template <class Sink>
+bool unpack_telemetry(const uint8_t* in, size_t len, uint16_t* seq, Sink&& sink) {
+  if (len < 4 || in[0] != kPacketVersion) return false;
+  *seq = static_cast<uint16_t>(in[1] << 8 | in[2]);
+  uint32_t time = 0;
+  size_t pos = 3;
+  size_t n = get_varint(in + pos, len - pos, &time);
+  if (n == 0) return false;
+  pos += n;
+
+  uint32_t prev_a[16] = {}, prev_b[16] = {};
+  while (pos < len) {
+    const uint8_t tag = in[pos++];
+    const size_t k = tag >> 4;
+    if (k >= static_cast<size_t>(RecordKind::kCount)) return false;
+    uint32_t dt, da, db, flags = 0;
+    if ((n = get_varint(in + pos, len - pos, &dt)) == 0) return false;
+    pos += n;
+    if ((n = get_varint(in + pos, len - pos, &da)) == 0) return false;
+    pos += n;
+    if ((n = get_varint(in + pos, len - pos, &db)) == 0) return false;
+    pos += n;
+    if (tag & 1) {
+      if ((n = get_varint(in + pos, len - pos, &flags)) == 0) return false;
+      pos += n;
+    }
+    time += static_cast<uint32_t>(unzigzag(dt));
+    prev_a[k] += static_cast<uint32_t>(unzigzag(da));
+    prev_b[k] += static_cast<uint32_t>(unzigzag(db));
+
+    TelemetryRecord r;
+    r.time = time;
+    r.kind = static_cast<RecordKind>(k);
+    r.zone = static_cast<uint8_t>((tag >> 1) & 0x07);
+    r.flags = static_cast<uint16_t>(flags);
+    r.a = static_cast<int32_t>(prev_a[k]);
+    r.b = static_cast<int32_t>(prev_b[k]);
+    sink(r);
+  }
+  return true;
+}
+
+}  // namespace agro
@@ -0,0 +1,45 @@
+// Pin and rail assignments for the controller board (see Schematic_diagram.pdf).
+//
+// Pins that the schematic leaves free are claimed here by the subsystems that
+// use them, so every GPIO decision lives in one place.
+#pragma once
+
+#include <cstdint>
+
+namespace agro::board {
+
+// NEO-6M on UART2.
+inline constexpr int kGpsRxPin = 16;
+inline constexpr int kGpsTxPin = 17;
+inline constexpr uint32_t kGpsBaud = 9600;
+// NEO-6M TIMEPULSE (1 PPS once the receiver has a fix); GPIO39 is input-only.
+inline constexpr int kGpsTimepulsePin = 39;
+
+// SIM800L on UART1; the +5V module rail is switched by POWER-ENABLE.
+inline constexpr int kGsmRxPin = 4;
+inline constexpr int kGsmTxPin = 2;
+inline constexpr uint32_t kGsmBaud = 9600;
+inline constexpr int kGsmPowerEnablePin = 23;
+// SIM800L DTR: high lets the module enter AT+CSCLK=1 sleep, low wakes it.
+// Held through deep sleep with the rail while the module sleeps.
+inline constexpr int kGsmDtrPin = 32;
+
+// Solenoid valve relay, driven through Q4.
+inline constexpr int kValveRelayPin = 27;
+// Shunt amplifier on the valve supply. GPIO36 is ADC1 channel 0 (the DMA
+// mode only reads ADC1) and input-only.
+inline constexpr int kValveShuntAdcPin = 36;
+inline constexpr int kValveShuntAdcChannel = 0;
+
+// Hall-effect flow meter on the valve outlet, counted by a PCNT unit.
+// GPIO35 is input-only, which is all the meter needs.
+inline constexpr int kFlowMeterPin = 35;
+
+// Capacitive soil probe. Both pins must be RTC-capable so the ULP can power
+// and sample the probe while the main cores sleep: GPIO25 is RTC_GPIO6 and
+// GPIO34 is ADC1 channel 6 (ADC2 is unavailable to the ULP).
+inline constexpr int kSoilProbePowerPin = 25;
+inline constexpr int kSoilProbeAdcPin = 34;
+inline constexpr int kSoilProbeAdcChannel = 6;
+
+}  // namespace agro::board
@@ -0,0 +1,164 @@
+// Solenoid coil current diagnostics for the valve path through Q4.
+//
+// A shunt on the 12 V valve supply, amplified onto an ADC1 pin, is sampled
+// by the ADC's DMA (continuous) mode for one short burst each time the relay
+// switches. A DC solenoid has a recognizable inrush: the current rises with
+// the coil's L/R time constant, dips as the plunger pulls in (its motion
+// raises the inductance and the back-EMF briefly wins), then climbs to V/R.
+// The classifier runs on each DMA block as it arrives and ends the burst as
+// soon as the verdict is certain:
+//
+//   short          any sample above short_ma, or half of it already at
+//                  open_ms (too little inductance); cut the relay at once
+//   open           nothing above open_ma after open_ms: blown coil, broken
+//                  wire, or relay contacts that never closed
+//   normal         the pull-in dip, typically 4-8 ms in
+//   plunger stuck  current but no dip by the end of the burst (burst_ms)
+//   relay stuck    after switching off, current still flows: welded contacts
+//
+// A healthy actuation costs about 7 ms of ADC time, while the CPU is awake
+// for the valve run anyway; only a jammed plunger takes the whole burst.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+#include "agro/telemetry.hpp"
+
+namespace agro {
+
+struct CoilCurrentConfig {
+  // ADC counts per ampere through the shunt: 0.1 ohm, gain 20, 12 dB
+  // attenuation. Calibrated per board.
+  uint16_t counts_per_amp = 2640;
+  uint32_t sample_hz = 20000;  // ESP32 digital controller minimum
+  uint16_t open_ma = 35;
+  uint16_t short_ma = 900;     // 2.5x the 350 mA of a 12 V, 34 ohm coil
+  uint8_t open_ms = 2;
+  uint8_t burst_ms = 40;
+  // Pull-in: the smoothed current falls this far below its running peak.
+  // Only after open_ms, so relay contact bounce does not count.
+  uint16_t dip_permille = 40;
+  // Moving average over 2^smooth_shift samples against ADC noise; at most
+  // kCoilMaxSmoothShift.
+  uint8_t smooth_shift = 3;
+};
+
+inline constexpr uint8_t kCoilMaxSmoothShift = 5;
+
+// In order of severity after kNormal.
+enum class CoilVerdict : uint8_t {
+  kPending = 0,
+  kNormal,
+  kPlungerStuck,
+  kOpen,
+  kShort,
+  kRelayStuck,
+};
+
+// Streaming classifier for one burst. Feed raw 12-bit samples in order.
+class CoilClassifier {
+ public:
+  // energize: the relay just closed (inrush) rather than opened. A
+  // smooth_shift beyond the ring is clamped to it.
+  CoilClassifier(const CoilCurrentConfig& cfg, bool energize) : cfg_(cfg), energize_(energize) {
+    if (cfg_.smooth_shift > kCoilMaxSmoothShift) cfg_.smooth_shift = kCoilMaxSmoothShift;
+  }
+
+  // Returns the verdict so far; kPending means keep sampling.
+  CoilVerdict feed(const uint16_t* raw, size_t n) {
+    const uint32_t open_n = cfg_.sample_hz * cfg_.open_ms / 1000;
+    const uint32_t burst_n = cfg_.sample_hz * cfg_.burst_ms / 1000;
+    const uint32_t window = 1u << cfg_.smooth_shift;
+    for (size_t i = 0; i < n && verdict_ == CoilVerdict::kPending; ++i) {
+      const uint32_t ma = uint32_t(raw[i]) * 1000 / cfg_.counts_per_amp;
+      if (ma > peak_ma_) peak_ma_ = uint16_t(ma);
+      // Moving sum over the last window samples.
+      const uint32_t slot = samples_ & (window - 1);
+      sum_ += ma - ring_[slot];
+      ring_[slot] = uint16_t(ma);
+      ++samples_;
+      if (!energize_) {
+        // The flyback diode keeps the coil current off the supply shunt.
+        if (samples_ >= open_n) {
+          verdict_ = sum_ >> cfg_.smooth_shift > cfg_.open_ma ? CoilVerdict::kRelayStuck : CoilVerdict::kNormal;
+        }
+        continue;
+      }
+      if (ma >= cfg_.short_ma || (samples_ == open_n && sum_ >> cfg_.smooth_shift >= cfg_.short_ma / 2u)) {
+        verdict_ = CoilVerdict::kShort;
+      } else if (samples_ == open_n && peak_ma_ < cfg_.open_ma) {
+        verdict_ = CoilVerdict::kOpen;
+      } else if (samples_ >= window) {
+        const uint32_t smooth = sum_ >> cfg_.smooth_shift;
+        if (smooth > smooth_peak_) {
+          smooth_peak_ = smooth;
+        } else if (samples_ > open_n && smooth_peak_ > cfg_.open_ma &&
+                   smooth * 1000 < smooth_peak_ * (1000u - cfg_.dip_permille)) {
+          verdict_ = CoilVerdict::kNormal;
+          dip_ms_ = uint16_t(samples_ * 1000 / cfg_.sample_hz);
+        }
+      }
+      if (verdict_ == CoilVerdict::kPending && samples_ >= burst_n) verdict_ = CoilVerdict::kPlungerStuck;
+    }
+    return verdict_;
+  }
+
+  CoilVerdict verdict() const { return verdict_; }
+  uint16_t peak_ma() const { return peak_ma_; }
+  // Time from closing the relay to the pull-in dip (normal verdicts only).
+  uint16_t dip_ms() const { return dip_ms_; }
+  uint32_t samples() const { return samples_; }
+
+ private:
+  static constexpr size_t kRing = 1u << kCoilMaxSmoothShift;
+
+  CoilCurrentConfig cfg_;
+  bool energize_;
+  CoilVerdict verdict_ = CoilVerdict::kPending;
+  uint32_t samples_ = 0;
+  uint32_t sum_ = 0;
+  uint16_t ring_[kRing] = {};
+  uint16_t peak_ma_ = 0;
+  uint32_t smooth_peak_ = 0;
+  uint16_t dip_ms_ = 0;
+};
+
+// Fault code space for kFault records (a = code, b = detail): 0x0100 | verdict
+// for the coil, with b = peak mA.
+inline constexpr int32_t kCoilFaultCode = 0x0100;
+
+inline TelemetryRecord coil_fault_record(uint32_t time, uint8_t zone, CoilVerdict v, uint16_t peak_ma) {
+  TelemetryRecord r;
+  r.time = time;
+  r.kind = RecordKind::kFault;
+  r.zone = zone;
+  r.a = kCoilFaultCode | int32_t(v);
+  r.b = peak_ma;
+  return r;
+}
+
+// ESP32 driver: ADC1 digital controller with I2S0 DMA on the shunt pin,
+// started only for a burst. Call check() right after each ValveRelay::set();
+// it blocks until the verdict (at most burst_ms) and latches a fault for the
+// next uplink. On kShort the caller opens the relay before anything else.
+class CoilMonitor {
+ public:
+  explicit CoilMonitor(const CoilCurrentConfig& cfg) : cfg_(cfg) {}
+
+  bool begin();
+  CoilVerdict check(bool energized);
+  uint16_t last_peak_ma() const { return last_peak_ma_; }
+
+  // Latched fault (kNormal: none) for the next uplink; reading clears it.
+  CoilVerdict take_fault() { return std::exchange(fault_, CoilVerdict::kNormal); }
+  CoilVerdict fault() const { return fault_; }
+
+ private:
+  CoilCurrentConfig cfg_;
+  CoilVerdict fault_ = CoilVerdict::kNormal;
+  uint16_t last_peak_ma_ = 0;
+};
+
+}  // namespace agro
@@ -0,0 +1,92 @@
+// Device configuration: the binary image from the "agrocfg" flash partition,
+// memory-mapped and read in place (config_image.hpp), and the conversions
+// into the subsystem configs.
+//
+// The CRC over the image is checked on a cold boot only. The checked CRC is
+// kept in RTC memory, so deep-sleep wakes just map the partition and check
+// the header against it.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "agro/config_image.hpp"
+#include "agro/irrigation.hpp"
+#include "agro/rule_vm.hpp"
+#include "agro/soil_moisture.hpp"
+
+namespace agro {
+
+inline IrrigationConfig irrigation_config(const ThresholdConfig& t) {
+  IrrigationConfig c;
+  c.pulses_per_liter = t.pulses_per_liter;
+  c.max_open_ms = uint32_t{t.max_open_s} * 1000u;
+  c.no_flow_ms = uint32_t{t.no_flow_s} * 1000u;
+  c.leak_pulses = t.leak_pulses;
+  c.stuck_open_ml_per_min = t.stuck_open_ml_per_min;
+  return c;
+}
+
+inline SoilProbeConfig soil_probe_config(const ThresholdConfig& t) {
+  SoilProbeConfig c;
+  c.air_raw = t.soil_air_raw;
+  c.water_raw = t.soil_water_raw;
+  c.dry_raw = t.soil_dry_raw;
+  c.wet_raw = t.soil_wet_raw;
+  return c;
+}
+
+// Zone programs due to start at minute_of_day on weekday (0 = Monday), in
+// image order. Returns the number written to out.
+inline size_t due_zone_programs(const ConfigView& cfg, uint8_t weekday, uint16_t minute_of_day, ZoneProgram* out,
+                                size_t cap) {
+  size_t n = 0;
+  for (size_t i = 0; i < cfg.zone_count() && n < cap; ++i) {
+    const ZoneProgram z = cfg.zone(i);
+    if ((z.days_mask >> weekday & 1) && z.start_minute == minute_of_day) out[n++] = z;
+  }
+  return n;
+}
+
+// The next program to start at or after minute_of_week (0 = Monday 00:00,
+// local time), wrapping into next week. index is kNone without programs.
+struct ScheduleCursor {
+  static constexpr uint8_t kNone = 0xff;
+  uint8_t index = kNone;
+  uint16_t minute_of_week = 0;
+};
+
+inline ScheduleCursor next_zone_program(const ConfigView& cfg, uint16_t minute_of_week) {
+  constexpr uint16_t kMinutesPerWeek = 7 * 24 * 60;
+  ScheduleCursor best;
+  uint16_t best_wait = kMinutesPerWeek;
+  for (size_t i = 0; i < cfg.zone_count(); ++i) {
+    const ZoneProgram z = cfg.zone(i);
+    for (uint8_t day = 0; day < 7; ++day) {
+      if (!(z.days_mask >> day & 1)) continue;
+      const uint16_t at = uint16_t(day * 24 * 60 + z.start_minute);
+      const uint16_t wait = uint16_t((at + kMinutesPerWeek - minute_of_week) % kMinutesPerWeek);
+      if (wait < best_wait) {
+        best_wait = wait;
+        best = {static_cast<uint8_t>(i), at};
+      }
+    }
+  }
+  return best;
+}
+
+// The rules section, verified and read in place. Empty if the image has none
+// or it fails rule_verify(); the zone programs then run as scheduled.
+inline RuleProgram config_rules(const ConfigView& cfg) {
+  RuleProgram p;
+  if (cfg.rule_bytes() != 0) p.load(cfg.rules(), cfg.rule_bytes());
+  return p;
+}
+
+// ESP32: maps the partition on first use. The returned view is invalid
+// (valid() false) if the partition is missing or the image is rejected;
+// callers then run on the defaults it returns.
+const ConfigView& boot_config();
+ConfigStatus boot_config_status();
+
+}  // namespace agro
@@ -0,0 +1,152 @@
+// Dual-core partitioning: radio work on one core, valve and sensor control on
+// the other, talking only through preallocated messages in SPSC rings.
+//
+// Core 0 (PRO_CPU, alongside the Wi-Fi/ESP-NOW stack) runs the SIM800L AT
+// engine and GPS parsing, where a single command can block for seconds.
+// Core 1 (APP_CPU) runs ControlLoop at a higher priority and never waits on
+// anything but its own tick or a notification, so a slow modem response can
+// never hold the solenoid valve open.
+//
+// Each direction is one SpscRing of fixed-size CoreMessage slots allocated
+// with the runtime; sending is a slot write plus a task notification.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "agro/irrigation.hpp"
+#include "agro/spsc_ring.hpp"
+
+namespace agro {
+
+enum class MsgType : uint8_t {
+  kNone = 0,
+  // radio -> control
+  kIrrigate,          // zone, a = target ml
+  kStopValve,         // zone
+  kGpsFix,            // a = lat, b = lon (1e-7 deg)
+  // control -> radio
+  kValveStatus,       // zone, a = delivered ml, b = open ms
+  kValveFault,        // zone, a = ValveFault
+  kIrrigateRejected,  // zone, a = target ml, b = IrrigationState at the time
+};
+
+struct CoreMessage {
+  MsgType type = MsgType::kNone;
+  uint8_t zone = 0;
+  uint16_t flags = 0;
+  uint32_t stamp_us = 0;  // sender's clock, for latency accounting
+  int32_t a = 0;
+  int32_t b = 0;
+};
+
+inline constexpr size_t kCoreQueueDepth = 64;
+using CoreQueue = SpscRing<CoreMessage, kCoreQueueDepth>;
+
+struct CoreLinks {
+  CoreQueue to_control;
+  CoreQueue to_radio;
+};
+
+// Busy time per core and the worst lateness of a valve action, in us.
+struct CoreStats {
+  uint64_t busy_us[2] = {};
+  uint64_t wall_us = 0;
+  uint32_t valve_latency_max_us = 0;
+  uint32_t messages = 0;
+  uint32_t dropped = 0;  // ring full; the sender keeps the message for later
+  // Control -> radio ring full: a fault is sent again on the next step, a
+  // status or rejection is lost.
+  uint32_t control_dropped = 0;
+};
+
+// Control-core loop around the irrigation controller. Portable: the ESP32
+// runtime calls it from the pinned control task and the host benchmark from
+// a thread.
+class ControlLoop {
+ public:
+  using SetValve = void (*)(void* ctx, bool open);
+
+  ControlLoop(CoreLinks& links, const IrrigationConfig& cfg, SetValve set_valve, void* ctx)
+      : links_(links), irrigation_(cfg), set_valve_(set_valve), ctx_(ctx) {}
+
+  // One iteration: applies queued commands, advances the controller and
+  // drives the relay. Returns true if a message for the radio core was
+  // queued (the caller notifies it).
+  bool step(uint32_t now_ms, uint32_t pulses) {
+    bool sent = false;
+    CoreMessage m;
+    while (links_.to_control.pop(&m)) {
+      ++messages_;
+      switch (m.type) {
+        case MsgType::kIrrigate:
+          if (!irrigation_.start(static_cast<uint32_t>(m.a), pulses, now_ms)) {
+            sent |= send({MsgType::kIrrigateRejected, m.zone, 0, now_ms * 1000u, m.a,
+                          static_cast<int32_t>(irrigation_.state())});
+          }
+          break;
+        case MsgType::kStopValve:
+          irrigation_.abort(pulses, now_ms);
+          break;
+        default:
+          break;
+      }
+    }
+
+    const bool was_open = valve_open_;
+    valve_open_ = irrigation_.update(pulses, now_ms);
+    if (valve_open_ != was_open) set_valve_(ctx_, valve_open_);
+
+    if (was_open && !valve_open_) {
+      sent |= send({MsgType::kValveStatus, 0, 0, now_ms * 1000u, static_cast<int32_t>(irrigation_.delivered_ml()),
+                    static_cast<int32_t>(irrigation_.last_open_ms())});
+    }
+    // Cleared only once queued, so a full ring delays the fault, not loses it.
+    const ValveFault f = irrigation_.fault();
+    if (f != ValveFault::kNone && send({MsgType::kValveFault, 0, 0, now_ms * 1000u, static_cast<int32_t>(f), 0})) {
+      irrigation_.take_fault();
+      sent = true;
+    }
+    return sent;
+  }
+
+  // How long the control task may sleep before the next step is due.
+  uint32_t next_tick_ms() const { return irrigation_.valve_open() ? kRunningTickMs : kIdleTickMs; }
+
+  const IrrigationController& irrigation() const { return irrigation_; }
+  uint32_t messages() const { return messages_; }
+  // Messages for the radio core that found its ring full.
+  uint32_t dropped() const { return dropped_; }
+
+ private:
+  static constexpr uint32_t kRunningTickMs = 10;
+  static constexpr uint32_t kIdleTickMs = 1000;
+
+  bool send(const CoreMessage& m) {
+    if (links_.to_radio.push(m)) return true;
+    ++dropped_;
+    return false;
+  }
+
+  CoreLinks& links_;
+  IrrigationController irrigation_;
+  SetValve set_valve_;
+  void* ctx_;
+  bool valve_open_ = false;
+  uint32_t messages_ = 0;
+  uint32_t dropped_ = 0;
+};
+
+// ESP32 runtime. radio_step runs on core 0 after each message from the
+// control core and at least every 20 ms otherwise, and may block; it reads
+// control messages from links().to_radio and posts commands with
+// post_to_control().
+using RadioStep = void (*)(CoreLinks& links);
+
+bool start_core_runtime(RadioStep radio_step, const IrrigationConfig& cfg);
+CoreLinks& core_links();
+// Radio core only. Returns false if the control ring is full.
+bool post_to_control(const CoreMessage& m);
+CoreStats core_stats();
+
+}  // namespace agro
@@ -0,0 +1,426 @@
+// Stackless coroutines for the UART-attached drivers.
+//
+// A driver is written as straight-line code ("send AT+CIPSEND, wait for the
+// prompt, write the payload, wait for SEND OK") and suspends at every wait.
+// All drivers of one task share a Scheduler: poll() resumes whatever became
+// ready and reports how long the task may block until the next deadline;
+// the UART and GPIO interrupts wake the task with a notification.
+//
+// Frames come from mem::coro_frames(), never the heap. A frame that does not
+// fit, or a full pool, makes the coroutine call yield a default-constructed
+// result, so every result type keeps its failure value at zero.
+//
+// Awaitables: sleep(), yield(), line() for a LinePort and edge() for an
+// EdgeSignal set from a GPIO interrupt. A Task can also co_await another Task.
+#pragma once
+
+#if !defined(__cpp_impl_coroutine)
+#error "coroutine drivers need C++20 coroutine support (GCC 10+, the ESP-IDF 5 toolchain)"
+#endif
+
+#include <atomic>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+
+#include "agro/memory.hpp"
+#include "agro/uart_rx.hpp"
+
+namespace agro {
+
+namespace coro_detail {
+
+// Largest frame ever requested, for sizing kCoroFrameBytes; oversize counts
+// requests that did not fit a block.
+inline uint32_t g_largest_frame = 0;
+inline uint32_t g_oversize_frames = 0;
+
+inline void* frame_allocate(size_t n) noexcept {
+  if (n > g_largest_frame) g_largest_frame = static_cast<uint32_t>(n);
+  if (n > mem::kCoroFrameBytes) {
+    ++g_oversize_frames;
+    return nullptr;
+  }
+  return mem::coro_frames().allocate();
+}
+
+inline void frame_free(void* p) noexcept { mem::coro_frames().deallocate(p); }
+
+struct PromiseBase {
+  std::coroutine_handle<> continuation = std::noop_coroutine();
+
+  static void* operator new(size_t n) noexcept { return frame_allocate(n); }
+  static void operator delete(void* p) noexcept { frame_free(p); }
+
+  std::suspend_always initial_suspend() noexcept { return {}; }
+
+  struct FinalAwaiter {
+    bool await_ready() noexcept { return false; }
+    template <class P>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+      return h.promise().continuation;
+    }
+    void await_resume() noexcept {}
+  };
+  FinalAwaiter final_suspend() noexcept { return {}; }
+
+  // The firmware builds without exceptions.
+  void unhandled_exception() noexcept { std::abort(); }
+};
+
+template <class T>
+struct Promise;
+
+}  // namespace coro_detail
+
+struct CoroFrameStats {
+  uint32_t largest_frame_bytes;
+  uint32_t oversize_frames;
+};
+
+inline CoroFrameStats coro_frame_stats() { return {coro_detail::g_largest_frame, coro_detail::g_oversize_frames}; }
+
+// Lazily started coroutine returning T. Owns its frame.
+template <class T = void>
+class [[nodiscard]] Task {
+ public:
+  using promise_type = coro_detail::Promise<T>;
+  using Handle = std::coroutine_handle<promise_type>;
+
+  Task() = default;
+  explicit Task(Handle h) : h_(h) {}
+  Task(Task&& o) noexcept : h_(std::exchange(o.h_, {})) {}
+  Task& operator=(Task&& o) noexcept {
+    if (this != &o) {
+      destroy();
+      h_ = std::exchange(o.h_, {});
+    }
+    return *this;
+  }
+  ~Task() { destroy(); }
+
+  // False if no frame could be allocated.
+  bool valid() const { return static_cast<bool>(h_); }
+  bool done() const { return !h_ || h_.done(); }
+
+  // co_await task: runs it to completion and resumes the caller with its
+  // result, without going through the scheduler.
+  bool await_ready() const noexcept { return !h_; }
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept {
+    h_.promise().continuation = caller;
+    return h_;
+  }
+  T await_resume() noexcept {
+    if constexpr (!std::is_void_v<T>) return h_ ? std::move(h_.promise().value) : T{};
+  }
+
+  // Hands the frame to a Scheduler root slot.
+  Handle release() { return std::exchange(h_, {}); }
+
+ private:
+  void destroy() {
+    if (h_) h_.destroy();
+    h_ = {};
+  }
+
+  Handle h_;
+};
+
+namespace coro_detail {
+
+template <class T>
+struct Promise : PromiseBase {
+  T value{};
+
+  Task<T> get_return_object() noexcept { return Task<T>(std::coroutine_handle<Promise>::from_promise(*this)); }
+  static Task<T> get_return_object_on_allocation_failure() noexcept { return Task<T>(); }
+  template <class U>
+  void return_value(U&& v) noexcept {
+    value = std::forward<U>(v);
+  }
+};
+
+template <>
+struct Promise<void> : PromiseBase {
+  Task<void> get_return_object() noexcept {
+    return Task<void>(std::coroutine_handle<Promise>::from_promise(*this));
+  }
+  static Task<void> get_return_object_on_allocation_failure() noexcept { return Task<void>(); }
+  void return_void() noexcept {}
+};
+
+}  // namespace coro_detail
+
+// Lines from a UART ring, and the write side of the same UART.
+class LinePort {
+ public:
+  using WriteFn = size_t (*)(void* ctx, const uint8_t* data, size_t len);
+  static constexpr size_t kMaxLine = mem::kGsmLineBytes - 1;
+
+  LinePort(UartRxRing& ring, WriteFn write, void* ctx) : ring_(ring), write_(write), ctx_(ctx) {}
+
+  size_t write(const char* s) { return write(reinterpret_cast<const uint8_t*>(s), std::strlen(s)); }
+  size_t write(const uint8_t* data, size_t len) { return write_(ctx_, data, len); }
+
+  // True once a complete line is buffered; it stays until take().
+  bool poll() {
+    if (!pending_) pending_ = splitter_.next(ring_, &line_, &len_);
+    return pending_;
+  }
+  const char* take(size_t* len) {
+    if (!poll()) return nullptr;
+    pending_ = false;
+    *len = len_;
+    return line_;
+  }
+
+  // Throws away everything received so far, e.g. NMEA that queued up while
+  // the driver waited for something else. A partial line survives in the
+  // splitter and comes out garbled; NMEA checksums and AT matching reject it.
+  void flush() {
+    pending_ = false;
+    const uint8_t* src;
+    size_t n;
+    while ((n = ring_.read_span(&src)) != 0) ring_.consume(n);
+  }
+
+  uint32_t truncated_lines() const { return splitter_.truncated_lines(); }
+
+ private:
+  UartRxRing& ring_;
+  WriteFn write_;
+  void* ctx_;
+  LineSplitter<kMaxLine> splitter_;
+  const char* line_ = nullptr;
+  size_t len_ = 0;
+  bool pending_ = false;
+};
+
+// Edge counter for a GPIO interrupt. fire() is ISR-safe; the ESP32 glue
+// (attach_edge) also notifies the driver task.
+class EdgeSignal {
+ public:
+  void fire() { count_.fetch_add(1, std::memory_order_release); }
+  uint32_t count() const { return count_.load(std::memory_order_acquire); }
+
+  void* notify_task = nullptr;
+
+ private:
+  std::atomic<uint32_t> count_{0};
+};
+
+// A received line, valid until the next line() on the same port. text is
+// nullptr on timeout.
+struct Line {
+  const char* text = nullptr;
+  size_t len = 0;
+
+  explicit operator bool() const { return text != nullptr; }
+  bool starts_with(const char* prefix) const {
+    const size_t n = std::strlen(prefix);
+    return text && len >= n && std::memcmp(text, prefix, n) == 0;
+  }
+};
+
+class Scheduler {
+ public:
+  static constexpr uint32_t kForever = UINT32_MAX;
+  static constexpr size_t kMaxRoots = 4;
+
+  // Intrusive wait-list node, embedded in each awaiter (so in the frame of
+  // the suspended coroutine).
+  struct Waiter {
+    Scheduler* sched = nullptr;
+    Waiter* next = nullptr;
+    std::coroutine_handle<> handle;
+    bool (*ready)(Waiter*) = nullptr;  // nullptr: waits for the deadline only
+    uint32_t deadline_ms = kForever;
+    bool timed_out = false;
+
+    void arm(Scheduler* s, uint32_t timeout_ms) {
+      sched = s;
+      deadline_ms = timeout_ms == kForever ? kForever : s->now_ms_ + timeout_ms;
+    }
+    void await_suspend(std::coroutine_handle<> h) {
+      handle = h;
+      sched->enqueue(this);
+    }
+  };
+
+  struct SleepAwaiter : Waiter {
+    bool await_ready() const { return false; }
+    void await_resume() const {}
+  };
+
+  struct LineAwaiter : Waiter {
+    LinePort* port;
+    bool await_ready() { return port->poll(); }
+    Line await_resume() {
+      Line l;
+      l.text = port->take(&l.len);
+      return l;
+    }
+  };
+
+  struct EdgeAwaiter : Waiter {
+    EdgeSignal* signal;
+    uint32_t seen;
+    bool await_ready() const { return signal->count() != seen; }
+    // True on an edge, false on timeout.
+    bool await_resume() const { return signal->count() != seen; }
+  };
+
+  // Takes ownership of a root coroutine; it starts on the next poll().
+  bool spawn(Task<void>&& task) {
+    if (!task.valid()) return false;
+    for (auto& r : roots_) {
+      if (!r) {
+        r = task.release();
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Resumes everything that is ready at now_ms, once each. Returns how long
+  // the caller may block before polling again: 0 if something is already
+  // runnable, otherwise the time to the nearest deadline or kForever.
+  uint32_t poll(uint32_t now_ms) {
+    now_ms_ = now_ms;
+    for (size_t i = 0; i < kMaxRoots; ++i) {
+      if (roots_[i] && !(started_ & (1u << i))) {
+        started_ |= 1u << i;
+        resume(roots_[i]);
+      }
+    }
+
+    // Unlink everything ready first: resumed coroutines append new waiters,
+    // which wait for the next poll.
+    Waiter* ready_head = nullptr;
+    Waiter** ready_tail = &ready_head;
+    Waiter** link = &head_;
+    while (Waiter* w = *link) {
+      const bool expired = w->deadline_ms != kForever && int32_t(now_ms_ - w->deadline_ms) >= 0;
+      if ((w->ready && w->ready(w)) || expired) {
+        w->timed_out = expired;
+        *link = w->next;
+        w->next = nullptr;
+        *ready_tail = w;
+        ready_tail = &w->next;
+      } else {
+        link = &w->next;
+      }
+    }
+    tail_ = link;
+    while (ready_head) {
+      Waiter* w = ready_head;
+      ready_head = w->next;
+      resume(w->handle);
+    }
+    reap();
+    return next_timeout();
+  }
+
+  uint32_t now_ms() const { return now_ms_; }
+  bool idle() const {
+    for (const auto& r : roots_) {
+      if (r) return false;
+    }
+    return true;
+  }
+  uint32_t switches() const { return switches_; }
+
+  SleepAwaiter sleep(uint32_t ms) {
+    SleepAwaiter a;
+    a.arm(this, ms);
+    return a;
+  }
+  // Lets the other coroutines run before continuing.
+  SleepAwaiter yield() { return sleep(0); }
+
+  LineAwaiter line(LinePort& port, uint32_t timeout_ms) {
+    LineAwaiter a;
+    a.arm(this, timeout_ms);
+    a.port = &port;
+    a.ready = [](Waiter* w) { return static_cast<LineAwaiter*>(w)->port->poll(); };
+    return a;
+  }
+
+  EdgeAwaiter edge(EdgeSignal& signal, uint32_t timeout_ms) {
+    EdgeAwaiter a;
+    a.arm(this, timeout_ms);
+    a.signal = &signal;
+    a.seen = signal.count();
+    a.ready = [](Waiter* w) {
+      auto* e = static_cast<EdgeAwaiter*>(w);
+      return e->signal->count() != e->seen;
+    };
+    return a;
+  }
+
+ private:
+  using Root = std::coroutine_handle<Task<void>::promise_type>;
+
+  void resume(std::coroutine_handle<> h) {
+    ++switches_;
+    h.resume();
+  }
+
+  void enqueue(Waiter* w) {
+    w->next = nullptr;
+    *tail_ = w;
+    tail_ = &w->next;
+  }
+
+  void reap() {
+    for (size_t i = 0; i < kMaxRoots; ++i) {
+      if (roots_[i] && roots_[i].done()) {
+        roots_[i].destroy();
+        roots_[i] = {};
+        started_ &= ~(1u << i);
+      }
+    }
+  }
+
+  uint32_t next_timeout() const {
+    uint32_t best = kForever;
+    for (Waiter* w = head_; w; w = w->next) {
+      if (w->ready && w->ready(w)) return 0;
+      if (w->deadline_ms == kForever) continue;
+      const int32_t left = int32_t(w->deadline_ms - now_ms_);
+      const uint32_t ms = left > 0 ? uint32_t(left) : 0;
+      if (ms < best) best = ms;
+    }
+    return best;
+  }
+
+  Root roots_[kMaxRoots] = {};
+  uint32_t started_ = 0;  // bit per root slot that has been resumed once
+  Waiter* head_ = nullptr;
+  Waiter** tail_ = &head_;
+  uint32_t now_ms_ = 0;
+  uint32_t switches_ = 0;
+};
+
+// ESP32 glue. run_drivers() polls sched from the calling task until every
+// root has finished, blocking on its task notification in between; the
+// ports' UARTs must have been started with this task as consumer.
+void run_drivers(Scheduler& sched);
+// Counts edges on pin and notifies the current task.
+bool attach_edge(EdgeSignal& signal, int pin, bool rising);
+void detach_edge(int pin);
+
+// On-target cost of a coroutine round trip through the scheduler (suspend,
+// scan, resume) versus a task-notification round trip between two FreeRTOS
+// tasks on the same core (two context switches), in CPU cycles.
+struct SwitchCost {
+  uint32_t coroutine_cycles;
+  uint32_t task_cycles;
+};
+SwitchCost measure_switch_cost(uint32_t rounds);
+
+}  // namespace agro
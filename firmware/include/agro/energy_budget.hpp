@@ -0,0 +1,172 @@
+// Daily energy budget: what the controller may spend today so the 12 V
+// 24 Ah battery outlasts a spell without recharge.
+//
+// Every morning EnergyPlanner takes the SoC estimate and the day's demand
+// (radio sessions, GPS fixes, valve minutes) and returns what it can afford.
+// It keeps a floor above the cutoff big enough to run the sleep load and a
+// minimum service (one session a day, for alarms) for horizon_days with no
+// charge at all:
+//
+//   floor      = cutoff + horizon_days * (base + min_sessions * session)
+//   allowance  = (charge - floor) / horizon_days + harvest
+//
+// so spending the allowance every day only ever approaches the floor, and a
+// run of overcast days costs service, not the battery. harvest is what the
+// panel is expected to put back today: the smaller of its running mean and
+// yesterday's, learned from one morning's charge to the next plus what was
+// spent in between, so a dull day cuts tomorrow's credit at once. The
+// allowance goes to valve minutes first (the crop), then sessions, then
+// fixes, each up to its demand. Per-action costs are learned from the
+// coulomb counter, the same way ModemPowerPolicy learns its model. Charges
+// are in uAh, integer arithmetic only: a plan is a few multiplications and
+// divisions.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "agro/telemetry_queue.hpp"
+
+namespace agro {
+
+struct EnergyBudgetParams {
+  uint32_t capacity_mah = 24000;
+  uint16_t cutoff_permille = 200;  // below this the controller only sleeps
+  uint16_t horizon_days = 30;
+  // ESP32 deep sleep, LM2596 quiescent current and the soil wakes.
+  uint32_t base_uah_per_day = 130000;
+  uint8_t min_sessions = 1;
+  uint8_t learn_shift = 3;  // EWMA weight 1/8 once seeded
+};
+
+// Learned per device, kept in RTC memory; starts from typical values and no
+// credit for the panel.
+struct EnergyModel {
+  uint32_t session_uah = 700;        // boot, network search, one upload
+  uint32_t fix_uah = 300;            // NEO-6M hot start and tracking
+  uint32_t valve_minute_uah = 6000;  // 350 mA coil
+  uint32_t harvest_uah = 0;          // per day, running mean
+  uint32_t last_harvest_uah = 0;
+  uint16_t sessions = 0;             // observations, saturating
+  uint16_t fixes = 0;
+  uint16_t valve_runs = 0;
+  uint16_t days = 0;
+  uint32_t morning_uah = 0;          // charge at the last plan
+  uint32_t spent_uah = 0;            // counted since
+};
+
+struct DayDemand {
+  uint16_t sessions = 0;
+  uint16_t gps_fixes = 0;
+  uint16_t valve_minutes = 0;
+};
+
+struct DayPlan {
+  uint16_t sessions = 0;
+  uint16_t gps_fixes = 0;
+  uint16_t valve_minutes = 0;
+  uint32_t allowance_uah = 0;  // above the sleep load, including the minimum service
+  bool at_floor = false;       // only the minimum service is affordable
+};
+
+class EnergyPlanner {
+ public:
+  constexpr explicit EnergyPlanner(const EnergyBudgetParams& params = {}, const EnergyModel& model = {})
+      : p_(params), m_(model) {}
+
+  // Charge above which the planner spends, in uAh.
+  uint64_t floor_uah() const {
+    const uint64_t cutoff = uint64_t(p_.capacity_mah) * p_.cutoff_permille;  // mAh * permille = uAh
+    return cutoff + uint64_t(p_.horizon_days) * (p_.base_uah_per_day + uint64_t(p_.min_sessions) * m_.session_uah);
+  }
+
+  // Once each morning, with the SoC estimate.
+  DayPlan plan(uint16_t soc_permille, const DayDemand& want) {
+    const uint64_t charge = uint64_t(p_.capacity_mah) * soc_permille;
+    if (m_.days != 0) {
+      // What came in since the last plan; a full battery hides the rest.
+      const int64_t in = int64_t(charge) + m_.spent_uah + p_.base_uah_per_day - m_.morning_uah;
+      m_.last_harvest_uah = in > 0 ? uint32_t(in) : 0;
+      m_.harvest_uah = blend(m_.harvest_uah, m_.last_harvest_uah, uint16_t(m_.days - 1));
+    }
+    bump(m_.days);
+    m_.morning_uah = uint32_t(charge);
+    m_.spent_uah = 0;
+    return budget(charge, want);
+  }
+
+  // plan() without learning, e.g. to preview a demand.
+  DayPlan budget(uint64_t charge_uah, const DayDemand& want) const {
+    DayPlan d;
+    const uint64_t floor = floor_uah();
+    const uint64_t harvest = m_.harvest_uah < m_.last_harvest_uah ? m_.harvest_uah : m_.last_harvest_uah;
+    const uint64_t spare =
+        charge_uah > floor ? (charge_uah - floor) / (p_.horizon_days ? p_.horizon_days : 1) + harvest : 0;
+    const uint64_t min_service = uint64_t(p_.min_sessions) * m_.session_uah;
+    d.allowance_uah = uint32_t(spare + min_service > UINT32_MAX ? UINT32_MAX : spare + min_service);
+    // The minimum service is already inside the floor.
+    uint64_t left = spare;
+    d.valve_minutes = take(&left, want.valve_minutes, m_.valve_minute_uah);
+    const uint16_t extra = want.sessions > p_.min_sessions ? uint16_t(want.sessions - p_.min_sessions) : 0;
+    d.sessions = uint16_t(p_.min_sessions + take(&left, extra, m_.session_uah));
+    d.gps_fixes = take(&left, want.gps_fixes, m_.fix_uah);
+    d.at_floor = spare < m_.session_uah && spare < m_.valve_minute_uah && spare < m_.fix_uah;
+    return d;
+  }
+
+  // Coulomb-counted charge of one session, fix or valve run.
+  void observe_session(uint32_t uah) {
+    m_.session_uah = blend(m_.session_uah, uah, m_.sessions);
+    bump(m_.sessions);
+    m_.spent_uah += uah;
+  }
+  void observe_fix(uint32_t uah) {
+    m_.fix_uah = blend(m_.fix_uah, uah, m_.fixes);
+    bump(m_.fixes);
+    m_.spent_uah += uah;
+  }
+  void observe_valve(uint16_t minutes, uint32_t uah) {
+    m_.spent_uah += uah;
+    if (minutes == 0) return;
+    m_.valve_minute_uah = blend(m_.valve_minute_uah, uah / minutes, m_.valve_runs);
+    bump(m_.valve_runs);
+  }
+
+  const EnergyModel& model() const { return m_; }
+  const EnergyBudgetParams& params() const { return p_; }
+
+ private:
+  static uint16_t take(uint64_t* left, uint16_t want, uint32_t each) {
+    if (each == 0) return want;
+    const uint64_t n = *left / each < want ? *left / each : want;
+    *left -= n * each;
+    return uint16_t(n);
+  }
+
+  uint32_t blend(uint32_t old, uint32_t sample, uint16_t n) const {
+    const uint32_t window = 1u << p_.learn_shift;
+    const uint32_t k = n + 1u < window ? n + 1u : window;
+    if (n == 0) return sample;
+    return uint32_t((uint64_t(old) * (k - 1) + sample) / k);
+  }
+  static void bump(uint16_t& n) {
+    if (n != UINT16_MAX) ++n;
+  }
+
+  EnergyBudgetParams p_;
+  EnergyModel m_;
+};
+
+// Queue parameters for the day: sessions are spread over it, so nothing
+// but an alarm opens one sooner than 24 h / sessions after the last, and at
+// the floor a full batch no longer opens one either.
+inline TelemetryQueueParams plan_uplink(const DayPlan& d, TelemetryQueueParams q = {}) {
+  const uint32_t spacing = 86400u / (d.sessions ? d.sessions : 1);
+  for (size_t i = size_t(TelemetryPriority::kEvent); i < size_t(TelemetryPriority::kCount); ++i) {
+    if (q.deadline_s[i] < spacing) q.deadline_s[i] = spacing;
+  }
+  if (d.at_floor) q.batch_records = 0xffff;
+  return q;
+}
+
+}  // namespace agro
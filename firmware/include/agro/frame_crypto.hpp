@@ -0,0 +1,42 @@
+// Sealing uplink frames and opening downlink frames on the controller
+// (sealed_frame.hpp).
+//
+// The GcmKey (round keys and GHASH table), the frame counter and the
+// downlink replay window live in RTC memory: a deep-sleep wake seals its
+// first frame without loading or expanding anything. A cold boot reads the
+// device key from NVS and bumps the persisted epoch once. Counter mode runs
+// on the ESP32 AES accelerator; GHASH runs on the CPU from the table.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "agro/sealed_frame.hpp"
+#include "agro/session.hpp"
+
+namespace agro {
+
+// Counter mode on the AES accelerator, a drop-in for SoftwareCtr.
+struct Esp32AesCtr {
+  const GcmKey& key;
+  void operator()(const uint8_t ctr[16], uint8_t* data, size_t len) const;
+};
+
+enum class FrameCryptoStatus : uint8_t {
+  kOk = 0,
+  kNoKey,    // nothing provisioned in NVS
+  kStorage,  // NVS unreadable, or the epoch could not be persisted
+};
+
+// ESP32. Call once per wake before sealing; cold is true after a power-on
+// or a lost RTC state. Until it returns kOk nothing is sealed.
+FrameCryptoStatus frame_crypto_begin(bool cold);
+// Seals one telemetry packet for the uplink; 0 if it does not fit or no key.
+size_t frame_seal_uplink(const uint8_t* packet, size_t len, uint8_t* out, size_t capacity);
+// Opens a downlink frame in place; false if forged, replayed or not ours.
+bool frame_open_downlink(uint8_t* frame, size_t len, uint8_t** payload, size_t* payload_len);
+// The uplink session client (session.hpp) in RTC memory, so its ticket
+// survives deep sleep; keyed by frame_crypto_begin on a cold boot.
+SessionClient& frame_session();
+
+}  // namespace agro
@@ -0,0 +1,134 @@
+// NEO-6M position acquisition as a coroutine.
+//
+// The receiver drives TIMEPULSE only while it has a valid fix, so the
+// acquisition first sleeps on that edge instead of parsing a sentence a
+// second through the whole search. After the first pulse it drops the NMEA
+// that queued up meanwhile and waits for GGA fixes that meet the quality
+// thresholds. Without a TIMEPULSE line it parses GGA from the start.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include "agro/coro.hpp"
+
+namespace agro {
+
+struct GpsFix {
+  bool valid = false;
+  int32_t lat_e7 = 0;  // degrees * 1e7
+  int32_t lon_e7 = 0;
+  uint8_t satellites = 0;
+  uint16_t hdop_x10 = 0;
+  uint32_t ttff_ms = 0;  // from the start of acquisition
+};
+
+struct GpsAcquireConfig {
+  uint32_t timeout_ms = 90000;
+  uint16_t max_hdop_x10 = 30;
+  uint8_t min_satellites = 5;
+  uint8_t good_fixes = 3;  // consecutive GGA fixes within the thresholds
+};
+
+namespace gps_detail {
+
+inline int hex_digit(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+// ddmm.mmmm or dddmm.mmmm to degrees * 1e7, without floating point.
+inline bool parse_coord(const char* s, const char* end, char hemi, int32_t* out) {
+  const char* dot = s;
+  while (dot < end && *dot != '.') ++dot;
+  if (dot - s < 3) return false;
+  int64_t deg = 0;
+  for (const char* p = s; p < dot - 2; ++p) deg = deg * 10 + (*p - '0');
+  int64_t min_e5 = (dot[-2] - '0') * 10 + (dot[-1] - '0');
+  int frac_digits = 0;
+  for (const char* p = dot + 1; p < end && frac_digits < 5; ++p, ++frac_digits) min_e5 = min_e5 * 10 + (*p - '0');
+  for (; frac_digits < 5; ++frac_digits) min_e5 *= 10;
+  int64_t v = deg * 10000000 + min_e5 * 100 / 60;
+  if (hemi == 'S' || hemi == 'W') v = -v;
+  *out = static_cast<int32_t>(v);
+  return true;
+}
+
+}  // namespace gps_detail
+
+// Parses $GPGGA/$GNGGA with a valid checksum into fix; fix->valid is the GGA
+// quality indicator. Returns false for anything else.
+inline bool parse_gga(const char* line, size_t len, GpsFix* fix) {
+  using gps_detail::hex_digit;
+  if (len < 10 || line[0] != '$' || std::strncmp(line + 3, "GGA,", 4) != 0) return false;
+  const char* star = static_cast<const char*>(std::memchr(line, '*', len));
+  if (!star || star + 3 > line + len) return false;
+  uint8_t sum = 0;
+  for (const char* p = line + 1; p < star; ++p) sum ^= static_cast<uint8_t>(*p);
+  const int hi = hex_digit(star[1]), lo = hex_digit(star[2]);
+  if (hi < 0 || lo < 0 || sum != (hi << 4 | lo)) return false;
+
+  // Fields after "$GPGGA,": time, lat, N/S, lon, E/W, quality, sats, hdop.
+  const char* f[8];
+  const char* e[8];
+  const char* p = line + 7;
+  for (int i = 0; i < 8; ++i) {
+    f[i] = p;
+    while (p < star && *p != ',') ++p;
+    e[i] = p;
+    if (p == star && i < 7) return false;
+    ++p;
+  }
+  GpsFix out = *fix;
+  out.valid = e[5] > f[5] && *f[5] != '0';
+  if (out.valid) {
+    if (!gps_detail::parse_coord(f[1], e[1], *f[2], &out.lat_e7) ||
+        !gps_detail::parse_coord(f[3], e[3], *f[4], &out.lon_e7)) {
+      return false;
+    }
+  }
+  out.satellites = static_cast<uint8_t>(std::atoi(f[6]));
+  uint32_t hdop = 0;
+  int frac = -1;
+  for (const char* q = f[7]; q < e[7]; ++q) {
+    if (*q == '.') {
+      frac = 0;
+    } else if (frac < 1) {
+      hdop = hdop * 10 + uint32_t(*q - '0');
+      if (frac == 0) frac = 1;
+    }
+  }
+  if (frac < 1) hdop *= 10;
+  out.hdop_x10 = static_cast<uint16_t>(hdop);
+  *fix = out;
+  return true;
+}
+
+inline Task<GpsFix> gps_acquire(Scheduler& sched, LinePort& port, EdgeSignal* timepulse, const GpsAcquireConfig& cfg) {
+  const uint32_t start = sched.now_ms();
+  const uint32_t deadline = start + cfg.timeout_ms;
+  if (timepulse) {
+    if (!co_await sched.edge(*timepulse, cfg.timeout_ms)) co_return GpsFix{};
+    port.flush();
+  }
+  GpsFix fix;
+  uint8_t good = 0;
+  for (;;) {
+    const int32_t left = int32_t(deadline - sched.now_ms());
+    if (left <= 0) co_return GpsFix{};
+    const Line l = co_await sched.line(port, uint32_t(left));
+    if (!l) co_return GpsFix{};
+    if (!parse_gga(l.text, l.len, &fix)) continue;
+    const bool ok = fix.valid && fix.hdop_x10 <= cfg.max_hdop_x10 && fix.satellites >= cfg.min_satellites;
+    good = ok ? good + 1 : 0;
+    if (good >= cfg.good_fixes) {
+      fix.ttff_ms = sched.now_ms() - start;
+      co_return fix;
+    }
+  }
+}
+
+}  // namespace agro
@@ -0,0 +1,257 @@
+// NEO-6M power management between fixes.
+//
+// The receiver sits on the 3.3V rail without a switch and draws about 45 mA
+// while tracking. Between fixes the manager puts it into one of two u-blox
+// low-power states over UBX:
+//
+//   cyclic tracking  CFG-PM2 + CFG-RXM power save: the receiver keeps its
+//                    ephemeris by waking for a short on-time every update
+//                    period, so the next fix is a hot start within a second.
+//   backup           RXM-PMREQ: only the RTC and battery-backed RAM stay up.
+//                    The next start is hot while the ephemeris is still
+//                    valid (about two hours), warm after that.
+//
+// For the time until the scheduler's next fix it picks the state with the
+// lower expected charge. From backup the receiver is woken one learned
+// time-to-first-fix (plus a margin) before the fix is due, so the fix is
+// ready when the scheduler asks for it. TTFF is learned per start type as a
+// smoothed mean and mean deviation, the same way TCP estimates its
+// retransmit timeout.
+// Times are in seconds on the RTC clock; TTFF in ms, currents in uA.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace agro {
+
+enum class GpsMode : uint8_t {
+  kContinuous = 0,  // acquiring or tracking at full power
+  kCyclic,          // UBX power save mode, cyclic tracking
+  kBackup,          // RXM-PMREQ backup, RTC and BBR only
+  kCount,
+};
+
+enum class GpsStart : uint8_t {
+  kHot = 0,  // ephemeris valid
+  kWarm,     // time and almanac kept, ephemeris stale
+  kCold,     // nothing kept: power-on, or backup state unknown
+  kCount,
+};
+
+// Currents from the NEO-6 data sheet plus the breakout board's regulator;
+// TTFF seeds from the same data sheet with open-sky margin.
+struct GpsPowerParams {
+  uint32_t continuous_ua = 45000;
+  uint32_t cyclic_ua = 11000;         // 1 s on-time every 10 s, averaged
+  uint32_t backup_ua = 150;           // receiver 22 uA, LDO and pull-ups the rest
+  uint32_t cyclic_update_ms = 10000;  // CFG-PM2 updatePeriod
+  uint32_t ephemeris_valid_s = 7200;  // backup older than this starts warm
+  uint32_t ttff_seed_ms[static_cast<size_t>(GpsStart::kCount)] = {2000, 32000, 40000};
+  uint32_t min_lead_ms = 2000;        // never plan on less than this
+};
+
+// A plan for the time until the next fix.
+struct GpsPlan {
+  GpsMode mode = GpsMode::kContinuous;
+  GpsStart start = GpsStart::kCold;  // expected start type when the fix is due
+  uint32_t lead_ms = 0;              // how long before the fix is due to wake
+  uint32_t backup_ms = 0;            // PMREQ duration; 0 means until woken
+  uint64_t expected_uas = 0;         // charge until the fix is ready, uA*s
+};
+
+class GpsPowerManager {
+ public:
+  static constexpr uint32_t kNone = UINT32_MAX;
+
+  constexpr explicit GpsPowerManager(const GpsPowerParams& params = {}) : p_(params) {}
+
+  GpsMode mode() const { return mode_; }
+  uint32_t last_fix_s() const { return last_fix_s_; }
+
+  // Start type if the receiver were woken at now_s.
+  GpsStart start_at(uint32_t now_s) const {
+    if (!known_ || last_fix_s_ == kNone) return GpsStart::kCold;
+    if (mode_ != GpsMode::kBackup) return GpsStart::kHot;
+    return now_s - last_fix_s_ < p_.ephemeris_valid_s ? GpsStart::kHot : GpsStart::kWarm;
+  }
+
+  // Expected TTFF with a margin of four mean deviations.
+  uint32_t lead_ms(GpsStart s) const {
+    const Ttff& t = ttff_[static_cast<size_t>(s)];
+    const uint32_t lead = t.mean_ms + 4 * t.dev_ms;
+    return lead > p_.min_lead_ms ? lead : p_.min_lead_ms;
+  }
+
+  // What to do from now_s until the fix due at due_s (kNone: no fix
+  // scheduled). Backup unless cyclic tracking costs less over the gap, or the
+  // gap is too short to leave continuous at all.
+  GpsPlan plan(uint32_t now_s, uint32_t due_s) const {
+    GpsPlan backup;
+    backup.mode = GpsMode::kBackup;
+    if (due_s == kNone) {
+      backup.start = known_ && last_fix_s_ != kNone ? GpsStart::kWarm : GpsStart::kCold;
+      return backup;
+    }
+    const uint64_t gap_ms = due_s > now_s ? uint64_t(due_s - now_s) * 1000 : 0;
+
+    // Backup: the start type depends on how old the ephemeris will be.
+    const bool hot = known_ && last_fix_s_ != kNone && due_s - last_fix_s_ < p_.ephemeris_valid_s;
+    backup.start = !known_ || last_fix_s_ == kNone ? GpsStart::kCold : hot ? GpsStart::kHot : GpsStart::kWarm;
+    backup.lead_ms = lead_ms(backup.start);
+    GpsPlan cont;
+    cont.start = start_at(now_s) == GpsStart::kCold ? GpsStart::kCold : GpsStart::kHot;
+    cont.expected_uas = uint64_t(p_.continuous_ua) * gap_ms / 1000;
+    if (gap_ms <= backup.lead_ms) return cont;
+    backup.backup_ms = uint32_t(gap_ms - backup.lead_ms);
+    backup.expected_uas = (uint64_t(p_.backup_ua) * backup.backup_ms + uint64_t(p_.continuous_ua) * backup.lead_ms) / 1000;
+
+    // Cyclic tracking only pays if the receiver already has a fix to keep.
+    if (cont.start == GpsStart::kHot && gap_ms > p_.cyclic_update_ms) {
+      GpsPlan cyclic;
+      cyclic.mode = GpsMode::kCyclic;
+      cyclic.start = GpsStart::kHot;
+      cyclic.lead_ms = p_.cyclic_update_ms;  // back to continuous one update early
+      cyclic.expected_uas =
+          (uint64_t(p_.cyclic_ua) * (gap_ms - cyclic.lead_ms) + uint64_t(p_.continuous_ua) * cyclic.lead_ms) / 1000;
+      if (cyclic.expected_uas < backup.expected_uas) return cyclic;
+    }
+    return cont.expected_uas <= backup.expected_uas ? cont : backup;
+  }
+
+  // The receiver was put into mode at now_s (after the UBX was sent, or on
+  // waking from backup).
+  void entered(GpsMode mode, uint32_t now_s) {
+    account(now_s);
+    mode_ = mode;
+    known_ = true;
+  }
+
+  // A fix meeting the thresholds arrived ttff_ms after the receiver was
+  // woken for a start of the given type.
+  void observe_fix(GpsStart start, uint32_t ttff_ms, uint32_t now_s) {
+    Ttff& t = ttff_[static_cast<size_t>(start)];
+    if (t.samples == 0) {
+      t.mean_ms = ttff_ms;
+      t.dev_ms = ttff_ms / 2;
+    } else {
+      const uint32_t err = ttff_ms > t.mean_ms ? ttff_ms - t.mean_ms : t.mean_ms - ttff_ms;
+      t.dev_ms = t.dev_ms - t.dev_ms / 4 + err / 4;
+      t.mean_ms = uint32_t(int64_t(t.mean_ms) + (int64_t(ttff_ms) - int64_t(t.mean_ms)) / 8);
+    }
+    if (t.samples != UINT16_MAX) ++t.samples;
+    last_fix_s_ = now_s;
+  }
+
+  // Seconds spent in each mode and the charge they add up to, for the daily
+  // diagnostics record. Call with the current time before reading.
+  void account(uint32_t now_s) {
+    if (known_ && since_s_ != kNone && now_s > since_s_) {
+      const uint32_t dt = now_s - since_s_;
+      seconds_[static_cast<size_t>(mode_)] += dt;
+      uas_ += uint64_t(current_ua(mode_)) * dt;
+    }
+    since_s_ = now_s;
+  }
+  uint32_t seconds_in(GpsMode m) const { return seconds_[static_cast<size_t>(m)]; }
+  uint64_t charge_uas() const { return uas_; }
+  void reset_accounting() {
+    for (auto& s : seconds_) s = 0;
+    uas_ = 0;
+  }
+
+  uint32_t current_ua(GpsMode m) const {
+    return m == GpsMode::kBackup ? p_.backup_ua : m == GpsMode::kCyclic ? p_.cyclic_ua : p_.continuous_ua;
+  }
+  const GpsPowerParams& params() const { return p_; }
+
+ private:
+  struct Ttff {
+    uint32_t mean_ms;
+    uint32_t dev_ms;
+    uint16_t samples;
+  };
+
+  GpsPowerParams p_;
+  bool known_ = false;  // mode_ reflects the receiver; false until first entered()
+  GpsMode mode_ = GpsMode::kContinuous;
+  uint32_t last_fix_s_ = kNone;
+  uint32_t since_s_ = kNone;
+  Ttff ttff_[static_cast<size_t>(GpsStart::kCount)] = {
+      {p_.ttff_seed_ms[0], p_.ttff_seed_ms[0] / 2, 0},
+      {p_.ttff_seed_ms[1], p_.ttff_seed_ms[1] / 4, 0},
+      {p_.ttff_seed_ms[2], p_.ttff_seed_ms[2] / 4, 0},
+  };
+  uint32_t seconds_[static_cast<size_t>(GpsMode::kCount)] = {0, 0, 0};
+  uint64_t uas_ = 0;
+};
+
+// UBX frames, written to out (at least kUbxMaxFrame bytes); return the frame
+// length.
+inline constexpr size_t kUbxMaxFrame = 52;
+
+namespace ubx_detail {
+
+inline size_t frame(uint8_t cls, uint8_t id, const uint8_t* payload, uint16_t len, uint8_t* out) {
+  out[0] = 0xb5;
+  out[1] = 0x62;
+  out[2] = cls;
+  out[3] = id;
+  out[4] = uint8_t(len);
+  out[5] = uint8_t(len >> 8);
+  for (uint16_t i = 0; i < len; ++i) out[6 + i] = payload[i];
+  uint8_t a = 0, b = 0;
+  for (size_t i = 2; i < 6u + len; ++i) {
+    a = uint8_t(a + out[i]);
+    b = uint8_t(b + a);
+  }
+  out[6 + len] = a;
+  out[7 + len] = b;
+  return 8u + len;
+}
+
+inline void put_u32(uint8_t* p, uint32_t v) {
+  for (int i = 0; i < 4; ++i) p[i] = uint8_t(v >> (8 * i));
+}
+
+}  // namespace ubx_detail
+
+// CFG-PM2 for cyclic tracking: update every update_ms, search again every
+// search_ms after a loss, peak current limited, RTC and ephemeris updates on.
+inline size_t ubx_cfg_pm2(uint32_t update_ms, uint32_t search_ms, uint8_t* out) {
+  uint8_t p[44] = {};
+  p[0] = 1;  // version
+  constexpr uint32_t kLimitPeakCurrent = 1u << 8, kUpdateRtc = 1u << 11, kUpdateEph = 1u << 12;
+  ubx_detail::put_u32(p + 4, kLimitPeakCurrent | kUpdateRtc | kUpdateEph);
+  ubx_detail::put_u32(p + 8, update_ms);
+  ubx_detail::put_u32(p + 12, search_ms);
+  // gridOffset 0, onTime 0 (only as long as needed), minAcqTime 0.
+  return ubx_detail::frame(0x06, 0x3b, p, sizeof(p), out);
+}
+
+// CFG-RXM: power save (cyclic per CFG-PM2) or continuous.
+inline size_t ubx_cfg_rxm(bool power_save, uint8_t* out) {
+  const uint8_t p[2] = {8, uint8_t(power_save ? 1 : 0)};
+  return ubx_detail::frame(0x06, 0x11, p, sizeof(p), out);
+}
+
+// RXM-PMREQ into backup for duration_ms (0: until woken by UART RX activity).
+inline size_t ubx_rxm_pmreq(uint32_t duration_ms, uint8_t* out) {
+  uint8_t p[8] = {};
+  ubx_detail::put_u32(p, duration_ms);
+  ubx_detail::put_u32(p + 4, 1u << 1);  // backup
+  return ubx_detail::frame(0x02, 0x41, p, sizeof(p), out);
+}
+
+// ESP32. gps_power_park() applies a plan before the controller sleeps: the
+// UBX goes out on UART2 and the manager records the mode. The controller
+// sets its own wake-up plan.lead_ms before the fix is due and calls
+// gps_power_wake(), which brings the receiver back to continuous (UART
+// activity wakes it from backup; the PMREQ duration is only a backstop) and
+// returns the start type to pass to observe_fix() with the measured TTFF.
+// The manager lives in RTC memory, so a power-on reset is a cold start.
+void gps_power_park(const GpsPlan& plan, uint32_t now_s);
+GpsStart gps_power_wake(uint32_t now_s);
+GpsPowerManager& gps_power_manager();
+
+}  // namespace agro
@@ -0,0 +1,225 @@
+// Volume-controlled irrigation with flow feedback and valve diagnostics.
+//
+// A hall-effect flow meter on the valve outlet is counted by the PCNT
+// peripheral, so the CPU never sees individual pulses; the controller only
+// compares cumulative counts. A run closes the valve once the target volume
+// (less the learned coast-down after closing) has passed the meter, instead
+// of after a fixed time with a margin for low pressure.
+//
+// With the valve closed the same count exposes faults: flow right after a
+// close is coast-down, sustained full-rate flow means the valve is stuck open,
+// and a slow trickle over the leak window means a leaking seat or pipe.
+#pragma once
+
+#include <cstdint>
+#include <utility>
+
+namespace agro {
+
+struct IrrigationConfig {
+  // YF-S201 class meters give ~450 pulses per litre.
+  uint16_t pulses_per_liter = 450;
+  // Safety cap on a single run regardless of delivered volume.
+  uint32_t max_open_ms = 30u * 60u * 1000u;
+  // Flow must register within this time of opening, or the valve is stuck
+  // closed / the supply is dry.
+  uint32_t no_flow_ms = 15000;
+  // Coast-down after closing; pulses here train the close-ahead estimate.
+  uint32_t settle_ms = 3000;
+  // Observation window with the valve closed, after a run and while idle.
+  uint32_t leak_window_ms = 60000;
+  // Pulses within one window that count as a leak.
+  uint32_t leak_pulses = 10;
+  // Flow with the valve closed at or above this rate means stuck open.
+  uint32_t stuck_open_ml_per_min = 1500;
+};
+
+enum class ValveFault : uint8_t {
+  kNone = 0,
+  kNoFlow,     // opened, nothing reached the meter
+  kTimeout,    // max_open_ms elapsed before the target volume
+  kLeak,       // slow flow with the valve closed
+  kStuckOpen,  // full flow with the valve closed
+};
+
+enum class IrrigationState : uint8_t {
+  kIdle = 0,
+  kRunning,
+  kSettling,
+  kLeakCheck,
+};
+
+class IrrigationController {
+ public:
+  explicit IrrigationController(const IrrigationConfig& cfg) : cfg_(cfg) { reset_idle_window(0, 0); }
+
+  // Opens the valve for target_ml. Returns false if a run or post-run check
+  // is still in progress.
+  bool start(uint32_t target_ml, uint32_t pulses, uint32_t now_ms) {
+    if (state_ != IrrigationState::kIdle || target_ml == 0) return false;
+    state_ = IrrigationState::kRunning;
+    target_ml_ = target_ml;
+    run_start_pulses_ = pulses;
+    run_start_ms_ = now_ms;
+    delivered_pulses_ = 0;
+    last_open_ms_ = 0;
+    return true;
+  }
+
+  // Closes the valve early (operator stop, brownout, etc.).
+  void abort(uint32_t pulses, uint32_t now_ms) {
+    if (state_ == IrrigationState::kRunning) close(pulses, now_ms);
+  }
+
+  // Feeds the cumulative pulse count. Returns whether the valve should be
+  // energized. Call every ~100 ms while running and at least once per leak
+  // window otherwise.
+  bool update(uint32_t pulses, uint32_t now_ms) {
+    switch (state_) {
+      case IrrigationState::kRunning: {
+        delivered_pulses_ = pulses - run_start_pulses_;
+        const uint32_t elapsed = now_ms - run_start_ms_;
+        if (delivered_pulses_ == 0 && elapsed >= cfg_.no_flow_ms) {
+          raise(ValveFault::kNoFlow);
+          close(pulses, now_ms);
+        } else if (elapsed >= cfg_.max_open_ms) {
+          raise(ValveFault::kTimeout);
+          close(pulses, now_ms);
+        } else if (to_ml(delivered_pulses_) + coast_ml() >= target_ml_) {
+          close(pulses, now_ms);
+        }
+        break;
+      }
+      case IrrigationState::kSettling:
+        if (now_ms - phase_start_ms_ >= cfg_.settle_ms) {
+          const uint32_t coast_pulses = pulses - phase_start_pulses_;
+          delivered_pulses_ = pulses - run_start_pulses_;
+          // A valve still flowing at full rate is stuck, not coasting; learning
+          // from it would close every later run early.
+          if (stuck_open(coast_pulses, now_ms - phase_start_ms_)) {
+            raise(ValveFault::kStuckOpen);
+          } else {
+            // Slow EWMA so one gust of pressure does not swing the estimate;
+            // in 1/16 ml and rounded, so a small coast does not decay to 0.
+            const uint32_t coast_q4 = static_cast<uint32_t>(uint64_t{coast_pulses} * 16000u / cfg_.pulses_per_liter);
+            coast_q4_ = (coast_q4_ * 3 + coast_q4 + 2) / 4;
+          }
+          state_ = IrrigationState::kLeakCheck;
+          phase_start_ms_ = now_ms;
+          phase_start_pulses_ = pulses;
+        }
+        break;
+      case IrrigationState::kLeakCheck:
+        if (check_closed_flow(pulses, now_ms, phase_start_pulses_, phase_start_ms_)) {
+          state_ = IrrigationState::kIdle;
+          reset_idle_window(pulses, now_ms);
+        }
+        break;
+      case IrrigationState::kIdle:
+        if (check_closed_flow(pulses, now_ms, idle_start_pulses_, idle_start_ms_)) {
+          reset_idle_window(pulses, now_ms);
+        }
+        break;
+    }
+    return state_ == IrrigationState::kRunning;
+  }
+
+  IrrigationState state() const { return state_; }
+  bool valve_open() const { return state_ == IrrigationState::kRunning; }
+  uint32_t delivered_ml() const { return to_ml(delivered_pulses_); }
+  uint32_t last_open_ms() const { return last_open_ms_; }
+  uint32_t coast_ml() const { return (coast_q4_ + 8) >> 4; }
+  // Seeds the close-ahead estimate learned in an earlier wake.
+  void set_coast_ml(uint32_t ml) { coast_q4_ = ml << 4; }
+
+  // Latched fault for the next uplink; reading clears it.
+  ValveFault take_fault() { return std::exchange(fault_, ValveFault::kNone); }
+  ValveFault fault() const { return fault_; }
+
+ private:
+  uint32_t to_ml(uint32_t pulses) const {
+    return static_cast<uint32_t>(uint64_t{pulses} * 1000u / cfg_.pulses_per_liter);
+  }
+
+  void close(uint32_t pulses, uint32_t now_ms) {
+    last_open_ms_ = now_ms - run_start_ms_;
+    state_ = IrrigationState::kSettling;
+    phase_start_ms_ = now_ms;
+    phase_start_pulses_ = pulses;
+  }
+
+  // Judges flow seen since (start_pulses, start_ms) with the valve closed.
+  // Returns true once the window is over.
+  bool check_closed_flow(uint32_t pulses, uint32_t now_ms, uint32_t start_pulses, uint32_t start_ms) {
+    const uint32_t seen = pulses - start_pulses;
+    const uint32_t elapsed = now_ms - start_ms;
+    // Stuck open is obvious within seconds; do not wait out the window.
+    if (stuck_open(seen, elapsed)) {
+      raise(ValveFault::kStuckOpen);
+      return true;
+    }
+    if (elapsed < cfg_.leak_window_ms) return false;
+    if (seen >= cfg_.leak_pulses) raise(ValveFault::kLeak);
+    return true;
+  }
+
+  // Flow with the valve closed at the stuck-open rate, over at least 1 s.
+  bool stuck_open(uint32_t pulses, uint32_t elapsed_ms) const {
+    return elapsed_ms >= 1000 &&
+           uint64_t{to_ml(pulses)} * 60000u >= uint64_t{cfg_.stuck_open_ml_per_min} * elapsed_ms;
+  }
+
+  void reset_idle_window(uint32_t pulses, uint32_t now_ms) {
+    idle_start_pulses_ = pulses;
+    idle_start_ms_ = now_ms;
+  }
+
+  // Keeps the most severe fault until it is reported.
+  void raise(ValveFault f) {
+    if (static_cast<uint8_t>(f) > static_cast<uint8_t>(fault_)) fault_ = f;
+  }
+
+  IrrigationConfig cfg_;
+  IrrigationState state_ = IrrigationState::kIdle;
+  ValveFault fault_ = ValveFault::kNone;
+  uint32_t target_ml_ = 0;
+  uint32_t coast_q4_ = 0;  // close-ahead estimate, 1/16 ml
+  uint32_t run_start_pulses_ = 0;
+  uint32_t run_start_ms_ = 0;
+  uint32_t delivered_pulses_ = 0;
+  uint32_t last_open_ms_ = 0;
+  uint32_t phase_start_pulses_ = 0;
+  uint32_t phase_start_ms_ = 0;
+  uint32_t idle_start_pulses_ = 0;
+  uint32_t idle_start_ms_ = 0;
+};
+
+// ESP32 PCNT (pulse_cnt) driver for the flow meter. The 16-bit hardware
+// counter wraps at kHighLimit and raises one interrupt per wrap (~65 L),
+// never per pulse.
+class FlowMeter {
+ public:
+  static constexpr int16_t kHighLimit = 30000;
+
+  bool begin();
+  // Cumulative pulses since begin(); keeps counting through light sleep.
+  uint32_t pulses();
+
+ private:
+  void* unit_ = nullptr;  // pcnt_unit_handle_t
+  uint32_t last_ = 0;
+};
+
+// Relay driver for the solenoid valve through Q4. CoilMonitor
+// (coil_current.hpp) checks the coil current after each switch.
+class ValveRelay {
+ public:
+  bool begin();
+  void set(bool open);
+  bool is_open() const { return open_; }
+
+ private:
+  bool open_ = false;
+};
+
+}  // namespace agro
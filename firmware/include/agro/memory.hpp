@@ -0,0 +1,58 @@
+// Per-subsystem pools, sized at compile time.
+//
+// Everything the wake-cycle hot paths allocate comes from here, never from
+// the heap. reset_wake_pools() runs at the top of every wake so a leak in one
+// cycle cannot accumulate; the high-water marks survive the reset and go out
+// with the diagnostics uplink so the sizes below can be tuned from the field.
+#pragma once
+
+#include <cstddef>
+
+#include "agro/pool.hpp"
+#include "agro/telemetry.hpp"
+
+namespace agro::mem {
+
+// SIM800L: AT response lines and one outgoing payload under assembly.
+inline constexpr size_t kGsmLineBytes = 256;
+inline constexpr size_t kGsmLines = 8;
+inline constexpr size_t kGsmPayloadBytes = 1536;
+// NEO-6M: an NMEA sentence is at most 82 characters; UBX frames we parse
+// (NAV-PVT, RXM-PMREQ acks, CFG) stay under 128 bytes.
+inline constexpr size_t kGpsFrameBytes = 128;
+inline constexpr size_t kGpsFrames = 8;
+// Telemetry records batched between uplinks.
+inline constexpr size_t kTelemetryRecords = 256;
+// Coroutine frames for the UART drivers (coro.hpp): the modem session and
+// GPS acquisition with the AT helper they call, plus headroom. The largest,
+// modem_session, is ~500 B on a 64-bit host and smaller on the ESP32.
+inline constexpr size_t kCoroFrameBytes = 512;
+inline constexpr size_t kCoroFrames = 8;
+
+using GsmLinePool = FixedPool<kGsmLineBytes, kGsmLines>;
+using GsmPayloadArena = Arena<kGsmPayloadBytes>;
+using GpsFramePool = FixedPool<kGpsFrameBytes, kGpsFrames>;
+using TelemetryPool = ObjectPool<TelemetryRecord, kTelemetryRecords>;
+using CoroFramePool = FixedPool<kCoroFrameBytes, kCoroFrames>;
+
+GsmLinePool& gsm_lines();
+GsmPayloadArena& gsm_payload();
+GpsFramePool& gps_frames();
+TelemetryPool& telemetry();
+CoroFramePool& coro_frames();
+
+// Returns every wake-scoped pool to its empty state. Coroutine frames are not
+// wake-scoped: a driver coroutine may be suspended across the reset.
+void reset_wake_pools();
+
+struct PoolReport {
+  PoolStats gsm_lines;
+  PoolStats gsm_payload;
+  PoolStats gps_frames;
+  PoolStats telemetry;
+  PoolStats coro_frames;
+};
+
+PoolReport pool_report();
+
+}  // namespace agro::mem
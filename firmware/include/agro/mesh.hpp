@@ -0,0 +1,517 @@
+// Store-and-forward over ESP-NOW: controllers in radio range share one GSM
+// uplink.
+//
+// Time is cut into windows of window_period_ms. At the start of each window
+// the uplink node broadcasts a beacon, in beacon_copies copies since a
+// broadcast is not acknowledged; every other node (a member) wakes a guard
+// time early, hears it, and sends its batched telemetry (sealed frames, so
+// the uplink can neither read nor forge them) in its own slot:
+//
+//   | beacon | slot 0 | slot 1 | ... | slot n-1 | join slot |
+//
+// A unicast ESP-NOW frame is acknowledged by the receiver's MAC, so a member
+// drops what it sent once the send callback reports success. The uplink
+// stores what it collects with its own telemetry and runs one modem session
+// every uplink_every windows for all of it, earlier if its store could not
+// take another window; members keep their SIM800L off. The beacon gives
+// each member a byte budget from the room left, so the uplink never has to
+// refuse a frame the member already dropped.
+//
+// Members correct their RTC clock rate from the beacon intervals and learn
+// how far off the beacon still arrives, so the guard shrinks to a few
+// milliseconds; it widens again whenever the beacons may come from another
+// node's clock. The beacon lists the members by battery state of charge;
+// the list is both the slot order and the succession. In the beacon before
+// each upload the uplink hands the role to the fullest battery if that is
+// margin_permille above its own, so the modem charge rotates. If the beacons
+// stop, members upload their backlog themselves and the first node in the
+// last list takes over, the others after it in turn.
+//
+// A node that powers on listens for a full window period plus a random part
+// of one; if it hears nothing it starts a mesh of its own. When two uplinks
+// end up on one timeline (a false succession), the one that hears the
+// other's beacon, or its answer in the join slot, yields if its id is the
+// higher; an uplink whose members have all gone quiet searches again.
+//
+// Frames: u8 type, u16 mesh id, u32 sender id (big endian), then
+//   beacon  u32 round, u32 next uplink (0: none), u16 bytes each member may
+//           send, u8 copy, u8 n, u32 member ids[n]
+//   report  u32 round, u16 SoC permille, u8 flags (kReport*), frame bundle
+// Times are local RTC milliseconds.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "agro/frame_bundle.hpp"
+
+namespace agro {
+
+inline constexpr size_t kMeshFrameBytes = 250;  // ESP-NOW payload limit
+inline constexpr size_t kMeshHeaderBytes = 7;
+inline constexpr size_t kMeshReportHeaderBytes = kMeshHeaderBytes + 7;
+inline constexpr size_t kMaxMeshMembers = 16;
+inline constexpr size_t kBeaconFixedBytes = 12;
+inline constexpr uint8_t kReportCanUplink = 1;
+inline constexpr uint8_t kReportFromUplink = 2;
+
+enum class MeshFrame : uint8_t {
+  kBeacon = 1,
+  kReport,
+};
+
+enum class MeshRole : uint8_t {
+  kSearching = 0,  // powered on, listening for a beacon
+  kMember,
+  kUplink,
+};
+
+struct MeshParams {
+  uint16_t mesh_id = 1;
+  uint32_t window_period_ms = 15 * 60 * 1000;
+  uint8_t uplink_every = 4;         // windows per modem session
+  uint8_t beacon_copies = 3;        // each lost alone, so a beacon is rarely missed
+  uint8_t copy_spacing_ms = 1;
+  uint16_t beacon_gap_ms = 6;       // beacon copies and turnaround
+  uint16_t slot_ms = 10;            // up to three full frames with retries
+  uint8_t frames_per_slot = 3;
+  uint16_t guard_min_ms = 3;        // wake-up and radio start jitter
+  uint16_t guard_seed_ms = 500;     // before the rate is known: 500 ppm RC slow clock
+  uint8_t fallback_windows = 4;     // missed beacons before uploading alone
+  uint8_t forget_windows = 8;       // uplink drops members silent this long
+  uint16_t margin_permille = 100;   // SoC lead needed to take the role
+  uint16_t min_uplink_permille = 200;  // below this a node never takes it
+};
+
+namespace mesh_detail {
+
+inline void put_be16(uint8_t* p, uint16_t v) {
+  p[0] = uint8_t(v >> 8);
+  p[1] = uint8_t(v);
+}
+inline uint16_t get_be16(const uint8_t* p) { return uint16_t(p[0] << 8 | p[1]); }
+inline void put_be32(uint8_t* p, uint32_t v) {
+  put_be16(p, uint16_t(v >> 16));
+  put_be16(p + 2, uint16_t(v));
+}
+inline uint32_t get_be32(const uint8_t* p) { return uint32_t(get_be16(p)) << 16 | get_be16(p + 2); }
+
+inline size_t header(uint8_t* out, MeshFrame type, uint16_t mesh_id, uint32_t src) {
+  out[0] = uint8_t(type);
+  put_be16(out + 1, mesh_id);
+  put_be32(out + 3, src);
+  return kMeshHeaderBytes;
+}
+
+}  // namespace mesh_detail
+
+// Window timing against the uplink's clock. The beacon of round r is
+// expected at anchor + (r - anchor round) * period, with the period scaled
+// by the learned rate error of the local clock. The guard covers four mean
+// deviations of the arrival error per window elapsed.
+class MeshClock {
+ public:
+  bool synced() const { return synced_; }
+
+  uint32_t predict(uint32_t round, uint32_t period_ms) const {
+    const int64_t n = int64_t(round) - int64_t(anchor_round_);
+    const int64_t local = n * int64_t(period_ms) + n * int64_t(period_ms) * rate_ppm_ / 1000000;
+    return anchor_ms_ + uint32_t(local);
+  }
+
+  uint32_t guard_ms(uint32_t round, const MeshParams& p) const {
+    const uint32_t n = round > anchor_round_ ? round - anchor_round_ : 1;
+    const uint32_t per = dev_ms_ * 4 + p.guard_min_ms;
+    const uint64_t g = uint64_t(per) * n;
+    return g > p.window_period_ms / 4 ? p.window_period_ms / 4 : uint32_t(g);
+  }
+
+  // The beacon of round arrived at rx_ms.
+  void observe(uint32_t round, uint32_t rx_ms, uint32_t period_ms) {
+    if (synced_ && round > anchor_round_) {
+      const int32_t err = int32_t(rx_ms - predict(round, period_ms));
+      const int64_t elapsed = int64_t(round - anchor_round_) * period_ms;
+      // Rate: a quarter of the error per elapsed time; deviation: per window.
+      rate_ppm_ += int32_t(int64_t(err) * 1000000 / elapsed / 4);
+      const uint32_t per_window = uint32_t((err < 0 ? -err : err) / int32_t(round - anchor_round_));
+      dev_ms_ = samples_ == 0 ? per_window : dev_ms_ - dev_ms_ / 4 + per_window / 4;
+      if (samples_ != UINT16_MAX) ++samples_;
+    }
+    synced_ = true;
+    anchor_round_ = round;
+    anchor_ms_ = rx_ms;
+  }
+
+  // Taking over the timeline without a beacon (becoming the uplink): round
+  // starts at now_ms on this clock.
+  void set(uint32_t round, uint32_t now_ms) {
+    synced_ = true;
+    anchor_round_ = round;
+    anchor_ms_ = now_ms;
+  }
+
+  void seed(uint16_t dev_ms) {
+    if (samples_ == 0) dev_ms_ = dev_ms;
+  }
+  // The beacons will come from another clock (a new uplink): back to the
+  // seed deviation until the first one is heard; the rate is kept.
+  void widen(uint16_t dev_ms) {
+    dev_ms_ = dev_ms;
+    samples_ = 0;
+  }
+  void reset() { *this = MeshClock(); }
+  // Lost the timeline; keeps the learned rate and deviation.
+  void lose() { synced_ = false; }
+  int32_t rate_ppm() const { return rate_ppm_; }
+  uint32_t dev_ms() const { return dev_ms_; }
+
+ private:
+  bool synced_ = false;
+  uint32_t anchor_round_ = 0;
+  uint32_t anchor_ms_ = 0;
+  int32_t rate_ppm_ = 0;  // local clock runs fast by this much
+  uint32_t dev_ms_ = 0;
+  uint16_t samples_ = 0;
+};
+
+// What a node does in its next window.
+struct MeshWindow {
+  uint32_t round = 0;
+  uint32_t wake_ms = 0;    // power up the radio
+  uint32_t listen_ms = 0;  // keep it up this long (a member gives up on the beacon)
+  bool beacon = false;     // send the beacon at wake_ms
+};
+
+// Node logic, with storage for N bytes of sealed frames (its own and, as
+// the uplink, the members'). Constant-initializable for RTC memory.
+template <size_t N>
+class MeshNode {
+ public:
+  constexpr MeshNode() = default;
+
+  void begin(uint32_t self_id, const MeshParams& p, bool can_uplink) {
+    self_ = self_id;
+    p_ = p;
+    can_uplink_ = can_uplink;
+    role_ = MeshRole::kSearching;
+    clock_.reset();
+    clock_.seed(p.guard_seed_ms / 4);
+    members_n_ = 0;
+    listed_n_ = 0;
+  }
+
+  MeshRole role() const { return role_; }
+  uint32_t uplink_id() const { return role_ == MeshRole::kUplink ? self_ : uplink_; }
+  FrameBundle<N>& store() { return store_; }
+  const FrameBundle<N>& store() const { return store_; }
+  const MeshClock& clock() const { return clock_; }
+  uint32_t round() const { return round_; }
+
+  // Power-on (role kSearching, no window yet): how long to listen for an
+  // existing mesh; random_ms in [0, period / 2) spreads nodes that powered
+  // on together.
+  uint32_t search_ms(uint32_t random_ms) const { return p_.window_period_ms + random_ms; }
+
+  // The search heard nothing by now_ms: start a mesh with a window now.
+  void found_nothing(uint32_t now_ms) {
+    role_ = MeshRole::kUplink;
+    round_ = 0;
+    clock_.set(0, now_ms);
+    members_n_ = 0;
+    silent_ = 0;
+  }
+
+  MeshWindow window() const {
+    MeshWindow w;
+    w.round = round_;
+    const uint32_t at = clock_.predict(round_, p_.window_period_ms);
+    if (role_ == MeshRole::kUplink) {
+      w.wake_ms = at;
+      w.listen_ms = p_.beacon_gap_ms + uint32_t(members_n_ + 1) * p_.slot_ms;
+      w.beacon = true;
+    } else {
+      const uint32_t g = clock_.guard_ms(round_, p_);
+      w.wake_ms = at - g;
+      w.listen_ms = 2 * g + p_.beacon_gap_ms;
+    }
+    return w;
+  }
+
+  // Uplink: the beacon for the current window.
+  size_t beacon(uint8_t* out, size_t capacity) {
+    using namespace mesh_detail;
+    rank();
+    const size_t n = members_n_;
+    const size_t len = kMeshHeaderBytes + kBeaconFixedBytes + 4 * n;
+    if (capacity < len) return 0;
+    uint8_t* b = out + header(out, MeshFrame::kBeacon, p_.mesh_id, self_);
+    put_be32(b, round_);
+    // Hand over in the beacon before the upload, so this window's reports
+    // leave with it and the new uplink starts empty.
+    next_uplink_ = 0;
+    if (upload_due() && n > 0) {
+      const Member& best = members_[0];
+      if (best.can_uplink && best.soc_permille >= p_.min_uplink_permille &&
+          best.soc_permille >= soc_permille_ + p_.margin_permille) {
+        next_uplink_ = best.id;
+      }
+    }
+    put_be32(b + 4, next_uplink_);
+    // Room left, shared between the members and a joining node; what does
+    // not fit waits in the members' stores.
+    const size_t budget = (N - store_.bytes()) / (n + 1);
+    put_be16(b + 8, uint16_t(budget < 0xffff ? budget : 0xffff));
+    b[10] = 0;  // copy, see mark_copy
+    b[11] = uint8_t(n);
+    for (size_t i = 0; i < n; ++i) put_be32(b + kBeaconFixedBytes + 4 * i, members_[i].id);
+    reported_ = false;
+    received_ = 0;
+    return len;
+  }
+
+  // Member: the slot to report in, as an offset from the beacon's arrival.
+  uint32_t slot_offset_ms() const { return p_.beacon_gap_ms + uint32_t(slot_) * p_.slot_ms; }
+  uint8_t slot_frames() const { return slot_ == listed_n_ ? 1 : p_.frames_per_slot; }
+
+  // Member: the next report frame, with frames from the front of the store
+  // within the uplink's budget. *count is the number of sealed frames in
+  // it, for reported() once the MAC acknowledged it.
+  size_t report(uint8_t* out, size_t capacity, size_t* count) const {
+    using namespace mesh_detail;
+    *count = 0;
+    if (capacity < kMeshReportHeaderBytes) return 0;
+    uint8_t* b = out + header(out, MeshFrame::kReport, p_.mesh_id, self_);
+    put_be32(b, round_);
+    put_be16(b + 4, soc_permille_);
+    b[6] = uint8_t((can_uplink_ ? kReportCanUplink : 0) | (role_ == MeshRole::kUplink ? kReportFromUplink : 0));
+    size_t room = (capacity < kMeshFrameBytes ? capacity : kMeshFrameBytes) - kMeshReportHeaderBytes;
+    if (room > budget_) room = budget_;
+    const size_t n = store_.pack(out + kMeshReportHeaderBytes, room, count);
+    // An empty report still carries the SoC, once per window.
+    return kMeshReportHeaderBytes + n;
+  }
+  void reported(size_t count) {
+    const size_t bytes = store_.drop(count);
+    budget_ = bytes < budget_ ? uint16_t(budget_ - bytes) : 0;
+  }
+
+  // A frame received at rx_ms while the radio was up. Returns true if it
+  // was for this mesh. If an uplink is still the uplink after a beacon, it
+  // answers the sender with report() in the join slot, so that the one with
+  // the higher id gives way even if only one of them heard the other.
+  bool on_frame(const uint8_t* f, size_t len, uint32_t rx_ms) {
+    using namespace mesh_detail;
+    if (len < kMeshHeaderBytes || get_be16(f + 1) != p_.mesh_id) return false;
+    const uint32_t src = get_be32(f + 3);
+    const uint8_t* b = f + kMeshHeaderBytes;
+    const size_t body = len - kMeshHeaderBytes;
+    switch (MeshFrame(f[0])) {
+      case MeshFrame::kBeacon: {
+        if (body < kBeaconFixedBytes || b[11] > kMaxMeshMembers || body < kBeaconFixedBytes + 4 * size_t(b[11])) {
+          return false;
+        }
+        // Members and searching nodes take their timeline from it, dated
+        // back to the first copy. An uplink hears one only from another
+        // uplink in the same window.
+        budget_ = get_be16(b + 8);
+        on_beacon(src, get_be32(b), get_be32(b + 4), b + kBeaconFixedBytes, b[11],
+                  rx_ms - uint32_t(b[10]) * p_.copy_spacing_ms);
+        return true;
+      }
+      case MeshFrame::kReport: {
+        if (role_ != MeshRole::kUplink || body < 7) return false;
+        if ((b[6] & kReportFromUplink) && src != next_uplink_) {
+          // Another uplink heard our beacon; the lower id stays.
+          if (src < self_) follow(src);
+          return true;
+        }
+        if (get_be32(b) != round_) return false;
+        Member* m = member(src);
+        if (!m) return false;
+        m->soc_permille = get_be16(b + 4);
+        m->can_uplink = b[6] & kReportCanUplink;
+        m->last_round = round_;
+        const size_t before = store_.bytes();
+        store_.append(b + 7, body - 7);
+        received_ += uint16_t(store_.bytes() - before);
+        reported_ = true;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // The window is over. Returns true if a modem session is due now: the
+  // uplink's upload, or a member's own once the beacons stopped; either
+  // early if the store could not take another window's worth. Afterwards
+  // the role may be kSearching: the caller searches for search_ms, as after
+  // power-on.
+  bool window_done(bool heard_beacon) {
+    bool upload = false;
+    if (role_ == MeshRole::kUplink) {
+      upload = !store_.empty() && (upload_due() || N - store_.bytes() < size_t(received_) + N / 8);
+      silent_ = reported_ || members_n_ == 0 ? 0 : uint8_t(silent_ + 1);
+      if (silent_ >= p_.forget_windows) {
+        // All members gone quiet: maybe they follow another uplink, after a
+        // false succession while this one was still there. Search again.
+        // Lone uplinks never do, so the first node in a field does not pay
+        // for it.
+        role_ = MeshRole::kSearching;
+        clock_.lose();
+      }
+      // Handed over: a member of the new uplink, on our own timeline.
+      if (role_ == MeshRole::kUplink && next_uplink_ != 0) follow(next_uplink_);
+    } else if (role_ == MeshRole::kMember) {
+      missed_ = heard_beacon ? 0 : uint8_t(missed_ + 1);
+      // A successor may be running on its own clock by now.
+      if (missed_ == p_.fallback_windows) clock_.widen(p_.guard_seed_ms / 4);
+      // Succession: the node at rank r takes over after r more misses, with
+      // the last list as its members. A node not yet listed searches again.
+      const bool listed = rank_ < listed_n_;
+      if (!heard_beacon && listed && can_uplink_ && missed_ >= p_.fallback_windows + rank_) {
+        role_ = MeshRole::kUplink;
+        clock_.set(round_ + 1, clock_.predict(round_ + 1, p_.window_period_ms));
+        silent_ = 0;
+      } else if (!listed && missed_ >= p_.forget_windows) {
+        role_ = MeshRole::kSearching;
+        clock_.lose();
+      }
+      upload = !store_.empty() && (store_.bytes() > N * 3 / 4 ||
+                                   (missed_ >= p_.fallback_windows && (round_ + 1) % p_.uplink_every == 0));
+    }
+    ++round_;
+    return upload;
+  }
+  void set_soc(uint16_t permille) { soc_permille_ = permille; }
+
+  // The uplink sends the beacon beacon_copies times, copy_spacing_ms apart,
+  // numbering each copy before it goes out.
+  static void mark_copy(uint8_t* beacon, uint8_t copy) { beacon[kMeshHeaderBytes + 10] = copy; }
+
+ private:
+  struct Member {
+    uint32_t id;
+    uint16_t soc_permille;
+    bool can_uplink;
+    uint32_t last_round;
+  };
+
+  bool upload_due() const { return (round_ + 1) % p_.uplink_every == 0; }
+
+  // From uplink to member of id, which keeps our timeline.
+  void follow(uint32_t id) {
+    uplink_ = id;
+    role_ = MeshRole::kMember;
+    slot_ = listed_n_ = 0;
+    rank_ = kMaxMeshMembers;  // until its first beacon
+    missed_ = 0;
+    clock_.set(round_, clock_.predict(round_, p_.window_period_ms));
+    clock_.widen(p_.guard_seed_ms / 4);
+  }
+
+  void on_beacon(uint32_t src, uint32_t round, uint32_t next, const uint8_t* ids, size_t n, uint32_t rx_ms) {
+    using mesh_detail::get_be32;
+    // Two uplinks on one timeline (a false succession): the lower id stays.
+    if (role_ == MeshRole::kUplink && src >= self_) {
+      budget_ = 0;
+      return;
+    }
+    // Round numbers come from the uplink; a node that rejoins adopts them.
+    const bool same_timeline = clock_.synced() && uplink_ == src;
+    if (!same_timeline) clock_.set(round, rx_ms);
+    else clock_.observe(round, rx_ms, p_.window_period_ms);
+    role_ = next == self_ ? MeshRole::kUplink : MeshRole::kMember;
+    // The next uplink's clock has its own rate error.
+    if (next != 0 && next != src) clock_.widen(p_.guard_seed_ms / 4);
+    round_ = round;
+    uplink_ = next != 0 ? next : src;
+    missed_ = 0;
+    listed_n_ = uint8_t(n);
+    slot_ = uint8_t(n);  // the join slot unless listed
+    rank_ = uint8_t(n);
+    for (size_t i = 0; i < n; ++i) {
+      if (get_be32(ids + 4 * i) == self_) slot_ = rank_ = uint8_t(i);
+    }
+    // The list minus us plus the sender: our members if we take over.
+    members_n_ = 0;
+    add(src);
+    for (size_t i = 0; i < n; ++i) add(get_be32(ids + 4 * i));
+    silent_ = 0;
+  }
+
+  Member* member(uint32_t id) {
+    for (size_t i = 0; i < members_n_; ++i) {
+      if (members_[i].id == id) return &members_[i];
+    }
+    return add(id);
+  }
+  Member* add(uint32_t id) {
+    if (id == self_ || members_n_ == kMaxMeshMembers) return nullptr;
+    for (size_t i = 0; i < members_n_; ++i) {
+      if (members_[i].id == id) return &members_[i];
+    }
+    members_[members_n_] = Member{id, 0, false, round_};
+    return &members_[members_n_++];
+  }
+
+  // Drops members silent for forget_windows and sorts the rest by SoC,
+  // nodes that cannot uplink last.
+  void rank() {
+    size_t k = 0;
+    for (size_t i = 0; i < members_n_; ++i) {
+      if (round_ - members_[i].last_round <= p_.forget_windows) members_[k++] = members_[i];
+    }
+    members_n_ = uint8_t(k);
+    const auto before = [](const Member& a, const Member& b) {
+      if (a.can_uplink != b.can_uplink) return a.can_uplink;
+      return a.soc_permille > b.soc_permille;
+    };
+    for (size_t i = 1; i < k; ++i) {
+      const Member m = members_[i];
+      size_t j = i;
+      for (; j > 0 && before(m, members_[j - 1]); --j) members_[j] = members_[j - 1];
+      members_[j] = m;
+    }
+  }
+
+  uint32_t self_ = 0;
+  MeshParams p_ = {};
+  bool can_uplink_ = true;
+  MeshRole role_ = MeshRole::kSearching;
+  MeshClock clock_;
+  uint32_t round_ = 0;
+  uint16_t soc_permille_ = 0;
+  // Member side.
+  uint32_t uplink_ = 0;
+  uint8_t listed_n_ = 0;
+  uint8_t slot_ = 0;
+  uint8_t rank_ = 0;
+  uint8_t missed_ = 0;
+  uint16_t budget_ = 0;
+  // Uplink side.
+  Member members_[kMaxMeshMembers] = {};
+  uint8_t members_n_ = 0;
+  uint32_t next_uplink_ = 0;
+  bool reported_ = false;
+  uint16_t received_ = 0;  // bytes stored from reports this window
+  uint8_t silent_ = 0;
+  FrameBundle<N> store_;
+};
+
+// ESP32. The node, with room for 16 members' backlog, lives in RTC slow
+// memory; mesh_begin() runs once per power-on. mesh_run_window() waits for
+// the node's next window (the caller deep-sleeps until shortly before
+// mesh_node().window().wake_ms), brings up Wi-Fi in station mode on
+// kMeshChannel with ESP-NOW, runs the window or the search, and stops Wi-Fi
+// again. It returns true if a modem session is due: upload mesh_node().store()
+// in kGsmPayloadBytes bundles and drop() what the server acknowledged.
+// Node ids are the low four bytes of the station MAC.
+inline constexpr size_t kMeshStoreBytes = 4096;
+inline constexpr uint8_t kMeshChannel = 1;
+void mesh_begin(const MeshParams& p, bool can_uplink);
+bool mesh_run_window(uint16_t soc_permille);
+uint32_t mesh_now_ms();
+MeshNode<kMeshStoreBytes>& mesh_node();
+
+}  // namespace agro
@@ -0,0 +1,126 @@
+// SIM800L between sessions: hard power-off or AT+CSCLK sleep.
+//
+// Cutting POWER-ENABLE draws nothing while the controller sleeps, but the
+// next session has to boot the module and search for the network again;
+// at a weak site that is tens of seconds at over 100 mA. CSCLK sleep keeps
+// the registration and only needs a DTR pulse to wake, but the module pays
+// paging current the whole time, and the network can still drop it. Which
+// costs less depends on the idle time ahead and on this site:
+//
+//   sleep:  I_sleep * T + E_wake + p_drop * E_register
+//   off:    I_off * T   + E_boot + E_register
+//
+// ModemPowerPolicy measures registration time, sleep current and drop rate
+// on this device and sleeps whenever T is below the resulting break-even.
+// Charges are in mA*ms, currents in uA, with integer arithmetic only.
+#pragma once
+
+#include <cstdint>
+
+namespace agro {
+
+enum class ModemIdle : uint8_t {
+  kPowerOff = 0,  // POWER-ENABLE low through deep sleep
+  kSleep,         // AT+CSCLK=1, DTR high, POWER-ENABLE held on
+};
+
+// Fixed costs from the SIM800 hardware design guide; only the site-dependent
+// parts are learned.
+struct ModemPowerParams {
+  uint32_t boot_mams = 3500 * 55;     // power-up to first AT reply
+  uint16_t register_ma = 110;         // average during network search, with bursts
+  uint32_t wake_mams = 80 * 25;       // DTR low, 50 ms guard, AT resync
+  uint16_t off_ua = 5;                // POWER-ENABLE switch leakage
+  uint8_t learn_shift = 3;            // EWMA weight 1/8 once seeded
+};
+
+// Learned per device. Kept in RTC memory; starts from typical values for a
+// fair site after power-on.
+struct ModemPowerModel {
+  uint32_t register_ms = 15000;  // boot-to-registered, without the boot itself
+  uint16_t sleep_ua = 1500;      // module current in CSCLK sleep
+  uint16_t drop_permille = 50;   // sleeps that woke up unregistered
+  uint16_t registrations = 0;    // observations, saturating
+  uint16_t sleeps = 0;
+  uint16_t current_samples = 0;
+};
+
+class ModemPowerPolicy {
+ public:
+  static constexpr uint32_t kNever = UINT32_MAX;
+  static constexpr uint32_t kUnmeasured = UINT32_MAX;
+
+  // constexpr so an RTC_DATA_ATTR instance is constant-initialized and
+  // survives deep sleep instead of being reset by a startup constructor.
+  constexpr explicit ModemPowerPolicy(const ModemPowerParams& params = {}, const ModemPowerModel& model = {})
+      : p_(params), m_(model) {}
+
+  // Idle time in ms below which sleeping is cheaper; 0 if it never is, kNever
+  // if it always is.
+  uint32_t break_even_ms() const {
+    const uint64_t reg = uint64_t(p_.register_ma) * m_.register_ms;
+    const uint64_t saved = p_.boot_mams + reg - reg * m_.drop_permille / 1000;  // mA*ms
+    if (saved <= p_.wake_mams) return 0;
+    if (m_.sleep_ua <= p_.off_ua) return kNever;
+    const uint64_t ms = (saved - p_.wake_mams) * 1000 / (m_.sleep_ua - p_.off_ua);
+    return ms >= kNever ? kNever - 1 : uint32_t(ms);
+  }
+
+  // idle_ms until the next radio activity; kNever when none is scheduled.
+  ModemIdle decide(uint32_t idle_ms) const {
+    if (idle_ms == kNever) return ModemIdle::kPowerOff;
+    return idle_ms < break_even_ms() ? ModemIdle::kSleep : ModemIdle::kPowerOff;
+  }
+
+  // Network search time of a session that started from power-off (or from a
+  // sleep that lost its registration), first AT to CREG registered.
+  void observe_registration(uint32_t ms) {
+    m_.register_ms = blend(m_.register_ms, ms, m_.registrations);
+    bump(m_.registrations);
+  }
+
+  // A session that started from CSCLK sleep. module_mams is the module's
+  // charge over the slept interval (the battery coulomb count less the
+  // board's own sleep floor), or kUnmeasured.
+  void observe_sleep(uint32_t slept_ms, bool kept_registration, uint32_t module_mams = kUnmeasured) {
+    m_.drop_permille = uint16_t(blend(m_.drop_permille, kept_registration ? 0 : 1000, m_.sleeps));
+    bump(m_.sleeps);
+    // Short sleeps are dominated by wake transients and coulomb-count resolution.
+    if (module_mams == kUnmeasured || slept_ms < 60000) return;
+    const uint64_t ua = uint64_t(module_mams) * 1000 / slept_ms;
+    m_.sleep_ua = uint16_t(blend(m_.sleep_ua, ua > 0xffff ? 0xffff : uint32_t(ua), m_.current_samples));
+    bump(m_.current_samples);
+  }
+
+  const ModemPowerModel& model() const { return m_; }
+  const ModemPowerParams& params() const { return p_; }
+
+ private:
+  // Plain average over the first 2^learn_shift samples, then an EWMA, so the
+  // power-on defaults are forgotten quickly.
+  uint32_t blend(uint32_t old, uint32_t sample, uint16_t n) const {
+    const uint32_t window = 1u << p_.learn_shift;
+    const uint32_t k = n + 1u < window ? n + 1u : window;
+    if (n == 0) return sample;
+    return uint32_t((uint64_t(old) * (k - 1) + sample) / k);
+  }
+  static void bump(uint16_t& n) {
+    if (n != UINT16_MAX) ++n;
+  }
+
+  ModemPowerParams p_;
+  ModemPowerModel m_;
+};
+
+// ESP32. modem_power_on() drives POWER-ENABLE high with DTR low; the module
+// answers AT about 3 s later. Before esp_deep_sleep_start(), modem_park()
+// either cuts the rail or (after AT+CSCLK=1) raises DTR, and holds both pins
+// through deep sleep. modem_unpark() releases the holds on the next wake and
+// pulls DTR low, so a sleeping module is awake by the first AT.
+void modem_power_on();
+void modem_park(ModemIdle idle);
+void modem_unpark();
+// The learned model, kept in RTC memory across deep sleep.
+ModemPowerPolicy& modem_power_policy();
+
+}  // namespace agro
@@ -0,0 +1,271 @@
+// SIM800L TCP upload session as a coroutine.
+//
+// One session: sync autobaud, wait for network registration, bring up the
+// GPRS bearer, open a TCP connection, send one payload and shut everything
+// down again. Each step is an AT exchange with its own timeout; the
+// coroutine suspends between lines, so the driver task sleeps while the
+// modem works and other drivers on the same scheduler keep running.
+//
+// With a SecureUplink the payload goes out in a session (session.hpp)
+// instead: the modem buffers received data (AT+CIPRXGET=1) and the driver
+// reads it as hex lines, so server records come through the same LinePort.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "agro/coro.hpp"
+#include "agro/session.hpp"
+
+namespace agro {
+
+enum class AtResult : uint8_t {
+  kNoFrame = 0,  // the coroutine could not be started
+  kOk,
+  kError,
+  kTimeout,
+};
+
+enum class SessionResult : uint8_t {
+  kNoFrame = 0,
+  kSent,
+  kNoModem,        // no answer to AT
+  kNotRegistered,  // no home or roaming registration in time
+  kNoBearer,       // APN, CIICR or CIFSR failed
+  kConnectFailed,
+  kSendFailed,
+  kNoAck,  // session: the server did not authenticate or acknowledge
+};
+
+struct ModemSessionConfig {
+  const char* apn = "internet";
+  const char* host = nullptr;
+  uint16_t port = 0;
+  uint32_t register_timeout_ms = 60000;
+  uint32_t register_poll_ms = 2000;
+  uint32_t bearer_timeout_ms = 30000;
+  uint32_t connect_timeout_ms = 30000;
+  uint32_t send_timeout_ms = 20000;
+};
+
+// A session for modem_session. buf is scratch for records in both
+// directions, e.g. from the gsm_payload arena; half of it for each.
+struct SecureUplink {
+  SessionClient* client = nullptr;
+  uint32_t now_s = 0;
+  uint8_t random[kSessionRandomBytes] = {};
+  uint8_t* buf = nullptr;
+  size_t capacity = 0;
+};
+
+namespace modem_detail {
+
+inline bool is_error(const Line& l) {
+  return l.starts_with("ERROR") || l.starts_with("+CME ERROR") || l.starts_with("CONNECT FAIL") ||
+         l.starts_with("SEND FAIL") || l.starts_with("CLOSED");
+}
+
+inline int hex_digit(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  return -1;
+}
+
+}  // namespace modem_detail
+
+// Sends cmd and waits up to timeout_ms for a line starting with expect.
+// Other lines (echo, intermediate OK, URCs) are skipped. With capture set,
+// the first line starting with capture_prefix is copied there before expect
+// arrives (e.g. "+CREG:" before "OK").
+inline Task<AtResult> at_command(Scheduler& sched, LinePort& port, const char* cmd, const char* expect,
+                                 uint32_t timeout_ms, const char* capture_prefix = nullptr, char* capture = nullptr,
+                                 size_t capture_cap = 0) {
+  port.write(cmd);
+  port.write("\r");
+  const uint32_t deadline = sched.now_ms() + timeout_ms;
+  for (;;) {
+    const int32_t left = int32_t(deadline - sched.now_ms());
+    if (left <= 0) co_return AtResult::kTimeout;
+    const Line l = co_await sched.line(port, uint32_t(left));
+    if (!l) co_return AtResult::kTimeout;
+    if (capture && capture_cap && l.starts_with(capture_prefix)) {
+      const size_t n = l.len < capture_cap - 1 ? l.len : capture_cap - 1;
+      std::memcpy(capture, l.text, n);
+      capture[n] = '\0';
+      capture = nullptr;
+    }
+    if (l.starts_with(expect)) co_return AtResult::kOk;
+    if (modem_detail::is_error(l)) co_return AtResult::kError;
+  }
+}
+
+// Registration status from a "+CREG: <n>,<stat>" line: 1 home, 5 roaming.
+inline bool creg_registered(const char* line) {
+  const char* comma = std::strchr(line, ',');
+  return comma && (comma[1] == '1' || comma[1] == '5');
+}
+
+// Writes data on the open TCP connection; true once the modem reports
+// SEND OK.
+inline Task<bool> tcp_send(Scheduler& sched, LinePort& port, const ModemSessionConfig& cfg, const uint8_t* data,
+                           size_t len) {
+  char cmd[24];
+  std::snprintf(cmd, sizeof(cmd), "AT+CIPSEND=%u", static_cast<unsigned>(len));
+  if (co_await at_command(sched, port, cmd, "> ", 5000) != AtResult::kOk) co_return false;
+  port.write(data, len);
+  const uint32_t deadline = sched.now_ms() + cfg.send_timeout_ms;
+  for (;;) {
+    const int32_t left = int32_t(deadline - sched.now_ms());
+    const Line l = left > 0 ? co_await sched.line(port, uint32_t(left)) : Line{};
+    if (!l || modem_detail::is_error(l)) co_return false;
+    if (l.starts_with("SEND OK")) co_return true;
+  }
+}
+
+// Reads what the modem has buffered from the TCP connection into out (with
+// AT+CIPRXGET=1 set before CIPSTART), waiting until deadline_ms for the
+// "+CIPRXGET: 1" notice if nothing is there yet. Returns the bytes read.
+// Hex mode doubles the line, so each read asks for what fits in one.
+inline Task<size_t> tcp_receive(Scheduler& sched, LinePort& port, uint8_t* out, size_t capacity,
+                                uint32_t deadline_ms) {
+  constexpr size_t kChunk = (LinePort::kMaxLine - 1) / 2;
+  size_t got = 0;
+  bool notified = false;
+  for (;;) {
+    const size_t want = capacity - got < kChunk ? capacity - got : kChunk;
+    if (want == 0) co_return got;
+    char cmd[24];
+    std::snprintf(cmd, sizeof(cmd), "AT+CIPRXGET=3,%u", static_cast<unsigned>(want));
+    port.write(cmd);
+    port.write("\r");
+    // "+CIPRXGET: 3,<read>,<left>", the hex line if read > 0, then OK.
+    size_t read = 0, left = 0;
+    bool ok = false;
+    for (;;) {
+      const int32_t wait = int32_t(deadline_ms - sched.now_ms());
+      const Line l = co_await sched.line(port, wait > 5000 ? uint32_t(wait) : 5000u);
+      if (!l || modem_detail::is_error(l)) co_return got;
+      if (l.starts_with("+CIPRXGET: 1")) {
+        notified = true;
+      } else if (l.starts_with("+CIPRXGET: 3,")) {
+        unsigned r = 0, k = 0;
+        if (std::sscanf(l.text + 13, "%u,%u", &r, &k) == 2) {
+          read = r < want ? r : want;
+          left = k;
+        }
+      } else if (read > 0 && l.len == 2 * read) {
+        for (size_t i = 0; i < read; ++i) {
+          const int hi = modem_detail::hex_digit(l.text[2 * i]), lo = modem_detail::hex_digit(l.text[2 * i + 1]);
+          if (hi < 0 || lo < 0) co_return got;
+          out[got + i] = uint8_t(hi << 4 | lo);
+        }
+      } else if (l.starts_with("OK")) {
+        ok = true;
+        break;
+      }
+    }
+    if (!ok) co_return got;
+    got += read;
+    if (left > 0) continue;
+    if (got > 0) co_return got;
+    // Nothing buffered yet: wait for the notice, then read again.
+    while (!notified) {
+      const int32_t wait = int32_t(deadline_ms - sched.now_ms());
+      const Line l = wait > 0 ? co_await sched.line(port, uint32_t(wait)) : Line{};
+      if (!l || modem_detail::is_error(l)) co_return 0;
+      notified = l.starts_with("+CIPRXGET: 1");
+    }
+    notified = false;
+  }
+}
+
+// Runs one session over the open TCP connection: the client's first flight,
+// then server records until the payload is acknowledged. A NewTicket that
+// comes in the same read as the Ack is taken; one split off is lost and the
+// server sends another next time.
+inline Task<SessionResult> secure_exchange(Scheduler& sched, LinePort& port, const ModemSessionConfig& cfg,
+                                           SecureUplink& up, const uint8_t* payload, size_t len) {
+  SessionClient& client = *up.client;
+  uint8_t* tx = up.buf;
+  const size_t tx_cap = up.capacity / 2;
+  uint8_t* rx = up.buf + tx_cap;
+  const size_t rx_cap = up.capacity - tx_cap;
+  size_t rx_len = 0;
+  size_t n = client.begin(up.now_s, up.random, payload, len, tx, tx_cap);
+  const uint32_t deadline = sched.now_ms() + cfg.send_timeout_ms;
+  while (client.state() != SessionClient::State::kFailed) {
+    if (n > 0 && !co_await tcp_send(sched, port, cfg, tx, n)) co_return SessionResult::kSendFailed;
+    n = 0;
+    const size_t got = co_await tcp_receive(sched, port, rx + rx_len, rx_cap - rx_len, deadline);
+    if (got == 0) co_return SessionResult::kNoAck;
+    rx_len += got;
+    SessionRecord type;
+    const uint8_t* body;
+    size_t body_len, used = 0, k;
+    while ((k = next_record(rx + used, rx_len - used, &type, &body, &body_len)) != 0 && k != SIZE_MAX) {
+      used += k;
+      n += client.on_record(type, body, body_len, up.now_s, tx + n, tx_cap - n);
+    }
+    if (k == SIZE_MAX) break;
+    if (client.state() == SessionClient::State::kDone) co_return SessionResult::kSent;
+    std::memmove(rx, rx + used, rx_len - used);
+    rx_len -= used;
+  }
+  co_return SessionResult::kNoAck;
+}
+
+inline Task<SessionResult> modem_session(Scheduler& sched, LinePort& port, const ModemSessionConfig& cfg,
+                                         const uint8_t* payload, size_t len, SecureUplink* secure = nullptr) {
+  char cmd[96];
+
+  bool synced = false;
+  for (int i = 0; i < 5 && !synced; ++i) synced = co_await at_command(sched, port, "AT", "OK", 1000) == AtResult::kOk;
+  if (!synced) co_return SessionResult::kNoModem;
+  co_await at_command(sched, port, "ATE0", "OK", 1000);
+
+  const uint32_t reg_deadline = sched.now_ms() + cfg.register_timeout_ms;
+  for (;;) {
+    char creg[32] = "";
+    co_await at_command(sched, port, "AT+CREG?", "OK", 1000, "+CREG:", creg, sizeof(creg));
+    if (creg_registered(creg)) break;
+    if (int32_t(sched.now_ms() + cfg.register_poll_ms - reg_deadline) > 0) co_return SessionResult::kNotRegistered;
+    co_await sched.sleep(cfg.register_poll_ms);
+  }
+
+  std::snprintf(cmd, sizeof(cmd), "AT+CSTT=\"%s\"", cfg.apn);
+  if (co_await at_command(sched, port, cmd, "OK", 5000) != AtResult::kOk ||
+      co_await at_command(sched, port, "AT+CIICR", "OK", cfg.bearer_timeout_ms) != AtResult::kOk) {
+    co_await at_command(sched, port, "AT+CIPSHUT", "SHUT OK", 5000);
+    co_return SessionResult::kNoBearer;
+  }
+  // CIFSR answers with the bare IP address and no OK.
+  if (co_await at_command(sched, port, "AT+CIFSR", "", 5000) != AtResult::kOk) {
+    co_await at_command(sched, port, "AT+CIPSHUT", "SHUT OK", 5000);
+    co_return SessionResult::kNoBearer;
+  }
+
+  if (secure && co_await at_command(sched, port, "AT+CIPRXGET=1", "OK", 1000) != AtResult::kOk) {
+    co_await at_command(sched, port, "AT+CIPSHUT", "SHUT OK", 5000);
+    co_return SessionResult::kConnectFailed;
+  }
+  std::snprintf(cmd, sizeof(cmd), "AT+CIPSTART=\"TCP\",\"%s\",%u", cfg.host, unsigned{cfg.port});
+  if (co_await at_command(sched, port, cmd, "CONNECT OK", cfg.connect_timeout_ms) != AtResult::kOk) {
+    co_await at_command(sched, port, "AT+CIPSHUT", "SHUT OK", 5000);
+    co_return SessionResult::kConnectFailed;
+  }
+
+  SessionResult result = SessionResult::kSendFailed;
+  if (secure) {
+    result = co_await secure_exchange(sched, port, cfg, *secure, payload, len);
+  } else if (co_await tcp_send(sched, port, cfg, payload, len)) {
+    result = SessionResult::kSent;
+  }
+  co_await at_command(sched, port, "AT+CIPCLOSE=1", "CLOSE OK", 5000);
+  co_await at_command(sched, port, "AT+CIPSHUT", "SHUT OK", 5000);
+  co_return result;
+}
+
+}  // namespace agro
@@ -0,0 +1,160 @@
+// Compile-time-sized allocators for the firmware hot paths.
+//
+// FixedPool hands out equal blocks from a static array in O(1) through an
+// intrusive free list; blocks never returned are carved from a bump index, so
+// reset() is O(1) as well and every wake cycle starts from the same layout.
+// Arena is a bump allocator for variable-sized scratch that dies together.
+// ObjectPool wraps FixedPool with construction and destruction.
+//
+// None of these lock. Each pool belongs to one task; anything shared with an
+// ISR or the other core goes through a ring buffer instead.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace agro {
+
+struct PoolStats {
+  uint32_t capacity = 0;    // blocks, or bytes for an arena
+  uint32_t in_use = 0;
+  uint32_t high_water = 0;  // since construction; reset() keeps it
+  uint32_t failures = 0;    // allocations refused because the pool was full
+};
+
+template <size_t BlockSize, size_t BlockCount, size_t Align = alignof(std::max_align_t)>
+class FixedPool {
+  static_assert(BlockCount > 0 && BlockCount < 0xffff, "block index is 16 bits");
+  static constexpr size_t kMinBlock = BlockSize < sizeof(uint16_t) ? sizeof(uint16_t) : BlockSize;
+  static constexpr size_t kStride = (kMinBlock + Align - 1) / Align * Align;
+  static constexpr uint16_t kNone = 0xffff;
+
+ public:
+  static constexpr size_t kBlockSize = BlockSize;
+  static constexpr size_t kBlockCount = BlockCount;
+
+  void* allocate() {
+    uint16_t index;
+    if (free_head_ != kNone) {
+      index = free_head_;
+      free_head_ = load_next(index);
+    } else if (bump_ < BlockCount) {
+      index = bump_++;
+    } else {
+      ++failures_;
+      return nullptr;
+    }
+    if (++in_use_ > high_water_) high_water_ = in_use_;
+    return storage_ + size_t{index} * kStride;
+  }
+
+  void deallocate(void* p) {
+    if (p == nullptr) return;
+    const uint16_t index = static_cast<uint16_t>((static_cast<unsigned char*>(p) - storage_) / kStride);
+    store_next(index, free_head_);
+    free_head_ = index;
+    --in_use_;
+  }
+
+  bool owns(const void* p) const {
+    const auto* c = static_cast<const unsigned char*>(p);
+    return c >= storage_ && c < storage_ + sizeof(storage_);
+  }
+
+  // Forgets every outstanding block. Callers must not touch them afterwards.
+  void reset() {
+    free_head_ = kNone;
+    bump_ = 0;
+    in_use_ = 0;
+  }
+
+  PoolStats stats() const { return {BlockCount, in_use_, high_water_, failures_}; }
+
+ private:
+  // Free blocks hold the index of the next free block; memcpy because
+  // Align may be 1.
+  uint16_t load_next(uint16_t index) const {
+    uint16_t next;
+    std::memcpy(&next, storage_ + size_t{index} * kStride, sizeof(next));
+    return next;
+  }
+  void store_next(uint16_t index, uint16_t next) {
+    std::memcpy(storage_ + size_t{index} * kStride, &next, sizeof(next));
+  }
+
+  alignas(Align) unsigned char storage_[kStride * BlockCount];
+  uint16_t free_head_ = kNone;
+  uint16_t bump_ = 0;
+  uint32_t in_use_ = 0;
+  uint32_t high_water_ = 0;
+  uint32_t failures_ = 0;
+};
+
+template <size_t Bytes>
+class Arena {
+ public:
+  void* allocate(size_t size, size_t align = alignof(std::max_align_t)) {
+    const size_t start = (used_ + align - 1) & ~(align - 1);
+    if (start + size > Bytes) {
+      ++failures_;
+      return nullptr;
+    }
+    used_ = start + size;
+    if (used_ > high_water_) high_water_ = static_cast<uint32_t>(used_);
+    return storage_ + start;
+  }
+
+  template <class T>
+  T* allocate_array(size_t n) {
+    static_assert(std::is_trivially_destructible_v<T>, "arena memory is never destroyed");
+    return static_cast<T*>(allocate(n * sizeof(T), alignof(T)));
+  }
+
+  // Everything allocated after a mark goes away on rewind.
+  size_t mark() const { return used_; }
+  void rewind(size_t mark) { used_ = mark < used_ ? mark : used_; }
+  void reset() { used_ = 0; }
+
+  PoolStats stats() const {
+    return {static_cast<uint32_t>(Bytes), static_cast<uint32_t>(used_), high_water_, failures_};
+  }
+
+ private:
+  alignas(std::max_align_t) unsigned char storage_[Bytes];
+  size_t used_ = 0;
+  uint32_t high_water_ = 0;
+  uint32_t failures_ = 0;
+};
+
+template <class T, size_t Count>
+class ObjectPool {
+ public:
+  template <class... Args>
+  T* create(Args&&... args) {
+    void* p = pool_.allocate();
+    return p ? new (p) T(std::forward<Args>(args)...) : nullptr;
+  }
+
+  void destroy(T* obj) {
+    if (obj == nullptr) return;
+    obj->~T();
+    pool_.deallocate(obj);
+  }
+
+  // Only valid for trivially destructible T; otherwise destroy() each object.
+  void reset() {
+    static_assert(std::is_trivially_destructible_v<T>, "reset() would skip destructors");
+    pool_.reset();
+  }
+
+  PoolStats stats() const { return pool_.stats(); }
+
+ private:
+  FixedPool<sizeof(T), Count, alignof(T)> pool_;
+};
+
+}  // namespace agro
@@ -0,0 +1,248 @@
+// Peak-current sequencer for the +5V rail.
+//
+// The SIM800L draws up to 2 A in transmit bursts from the LM2596 output that
+// also feeds the ESP32, and the valve relay's pull-in and a GPS cold start
+// add their own surges. Any two of them together can pull the rail into the
+// buck's current limit and brown the ESP32 out, which costs a reboot, a
+// network re-registration and a GPS cold start.
+//
+// Every high-current action reserves a time window against the rail budget
+// before it starts. A reservation is granted at the earliest time its peak
+// fits next to everything already booked; higher-priority loads may push
+// lower-priority reservations that have not started yet further back. Waits
+// are bounded by a per-request deadline. Relay pull-in outranks the modem,
+// so a valve actuation delays a pending transmission by tens of
+// milliseconds and itself waits at most for a modem window already running.
+//
+// A booking runs from when may_start() first says so until it is released,
+// even past its booked duration: an overrunning load keeps being counted,
+// and bookings that have not started yet move back behind it.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace agro {
+
+enum class PowerLoad : uint8_t {
+  kModemPowerOn = 0,  // power-up and network search, with TX bursts
+  kModemTx,           // a data transmit window (AT+CIPSEND, AT+CMGS)
+  kRelayPullIn,       // relay coil inrush until the armature seats
+  kGpsStart,          // NEO-6M acquisition after power-up or backup
+  kCount,
+};
+
+struct LoadProfile {
+  uint16_t peak_ma;
+  uint16_t duration_ms;
+  uint8_t priority;  // higher wins
+};
+
+inline constexpr LoadProfile kLoadProfiles[] = {
+    {2000, 4000, 1},  // kModemPowerOn
+    {2000, 1500, 1},  // kModemTx
+    {450, 40, 3},     // kRelayPullIn
+    {150, 1000, 2},   // kGpsStart
+};
+static_assert(sizeof(kLoadProfiles) / sizeof(kLoadProfiles[0]) == static_cast<size_t>(PowerLoad::kCount));
+
+struct RailConfig {
+  // What the +5V rail can deliver without sagging below the ESP32's LDO
+  // dropout, and the current always drawn by the ESP32 and idle modules.
+  uint16_t budget_ma = 2400;
+  uint16_t baseline_ma = 150;
+};
+
+class PowerSequencer {
+ public:
+  // Slot index in the low byte, the slot's generation in the high byte, so
+  // a ticket kept past its release cannot end someone else's booking.
+  using Ticket = uint16_t;
+  static constexpr Ticket kNoTicket = 0xffff;
+  static constexpr uint32_t kNever = UINT32_MAX;
+  static constexpr uint8_t kMaxReservations = 16;
+  // How far an overrunning booking is extended at a time.
+  static constexpr uint32_t kOverrunStepMs = 100;
+
+  explicit PowerSequencer(const RailConfig& rail = {}) : rail_(rail) {}
+
+  // Books load to start at or after now_ms and no later than now_ms +
+  // max_defer_ms. duration_ms of 0 uses the load's profile. Returns the
+  // granted start time, or kNever (and kNoTicket) if no slot opens in time.
+  uint32_t reserve(PowerLoad load, uint32_t now_ms, uint32_t max_defer_ms, Ticket* ticket, uint32_t duration_ms = 0) {
+    *ticket = kNoTicket;
+    expire(now_ms);
+    uint8_t slot = kMaxReservations;
+    for (uint8_t i = 0; i < kMaxReservations; ++i) {
+      if (!res_[i].used) {
+        slot = i;
+        break;
+      }
+    }
+    if (slot == kMaxReservations) return kNever;
+
+    const LoadProfile& p = kLoadProfiles[static_cast<size_t>(load)];
+    Reservation& r = res_[slot];
+    r = Reservation{true, false, static_cast<uint8_t>(r.generation + 1), p.priority, p.peak_ma,
+                    duration_ms ? duration_ms : p.duration_ms, now_ms, now_ms + max_defer_ms, kNever};
+    r.start = find_slot(slot, now_ms);
+    if (r.start == kNever) {
+      r.used = false;
+      return kNever;
+    }
+    *ticket = static_cast<Ticket>(r.generation << 8 | slot);
+    reshuffle(r.priority - 1, now_ms);
+    return r.start;
+  }
+
+  // Start time of a booking. It can move later while the booking has not
+  // started if a load of higher priority or one already running claims the
+  // slot, and becomes kNever if it was pushed past its deadline (the caller
+  // must release it and reserve again). kNever for a released ticket.
+  uint32_t start_of(Ticket t) const {
+    const Reservation* r = find(t);
+    return r ? r->start : kNever;
+  }
+
+  // True once the booking may start. From then on it is running: it stays
+  // where it is and holds the rail until released.
+  bool may_start(Ticket t, uint32_t now_ms) {
+    const uint32_t s = start_of(t);
+    if (s == kNever || int32_t(now_ms - s) < 0) return false;
+    res_[t & 0xff].running = true;
+    return true;
+  }
+
+  // Ends a booking, early, on time or late; cancels it if it never started.
+  // A ticket already released is ignored.
+  void release(Ticket t) {
+    if (find(t)) res_[t & 0xff].used = false;
+  }
+
+  // Booked current at time t, including the baseline.
+  uint32_t load_at(uint32_t t) const {
+    uint32_t ma = rail_.baseline_ma;
+    for (const Reservation& r : res_) {
+      if (r.used && r.start != kNever && covers(r, t)) ma += r.peak_ma;
+    }
+    return ma;
+  }
+
+  // Extends running bookings that have reached the end of their window
+  // without being released, and moves back what no longer fits next to
+  // them. Call it as time passes; reserve() does.
+  void expire(uint32_t now_ms) {
+    bool overran = false;
+    for (Reservation& r : res_) {
+      if (!r.used || !r.running) continue;
+      if (int32_t(now_ms - (r.start + r.duration_ms)) >= 0) {
+        r.duration_ms = now_ms - r.start + kOverrunStepMs;
+        overran = true;
+      }
+    }
+    if (overran) reshuffle(UINT8_MAX, now_ms);
+  }
+
+  const RailConfig& rail() const { return rail_; }
+
+ private:
+  struct Reservation {
+    bool used = false;
+    bool running = false;    // may_start() said so; fixed from then on
+    uint8_t generation = 0;  // bumped each time the slot is booked
+    uint8_t priority = 0;
+    uint16_t peak_ma = 0;
+    uint32_t duration_ms = 0;
+    uint32_t earliest = 0;
+    uint32_t deadline = 0;
+    uint32_t start = kNever;
+  };
+
+  const Reservation* find(Ticket t) const {
+    const uint8_t slot = t & 0xff;
+    if (slot >= kMaxReservations || !res_[slot].used || res_[slot].generation != t >> 8) return nullptr;
+    return &res_[slot];
+  }
+
+  static bool covers(const Reservation& r, uint32_t t) {
+    return int32_t(t - r.start) >= 0 && int32_t(t - (r.start + r.duration_ms)) < 0;
+  }
+
+  // Whether reservation `self` blocks on `other`: running bookings and
+  // bookings of equal or higher priority are fixed; lower ones yield.
+  static bool blocks(const Reservation& other, const Reservation& self) {
+    if (!other.used || other.start == kNever) return false;
+    return other.running || other.priority >= self.priority;
+  }
+
+  bool fits(uint8_t self, uint32_t start) const {
+    const Reservation& me = res_[self];
+    const uint32_t end = start + me.duration_ms;
+    // The booked load only rises at a booking's start, so checking at our
+    // start and at every start inside our window finds the peak.
+    auto load_with_me = [&](uint32_t t) {
+      uint32_t ma = rail_.baseline_ma + me.peak_ma;
+      bool alone = true;
+      for (uint8_t i = 0; i < kMaxReservations; ++i) {
+        if (i == self || !blocks(res_[i], me) || !covers(res_[i], t)) continue;
+        ma += res_[i].peak_ma;
+        alone = false;
+      }
+      // A load that exceeds the budget on its own may still run alone.
+      return alone ? 0u : ma;
+    };
+    if (load_with_me(start) > rail_.budget_ma) return false;
+    for (uint8_t i = 0; i < kMaxReservations; ++i) {
+      const Reservation& o = res_[i];
+      if (i == self || !blocks(o, me)) continue;
+      if (int32_t(o.start - start) > 0 && int32_t(o.start - end) < 0 && load_with_me(o.start) > rail_.budget_ma) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Earliest start at or after max(earliest, now) that fits; candidates are
+  // that time and the end of every blocking booking.
+  uint32_t find_slot(uint8_t self, uint32_t now_ms) const {
+    const Reservation& me = res_[self];
+    const uint32_t from = int32_t(me.earliest - now_ms) > 0 ? me.earliest : now_ms;
+    uint32_t best = kNever;
+    auto consider = [&](uint32_t t) {
+      if (int32_t(t - from) < 0 || int32_t(t - me.deadline) > 0) return;
+      if (best != kNever && int32_t(t - best) >= 0) return;
+      if (fits(self, t)) best = t;
+    };
+    consider(from);
+    for (uint8_t i = 0; i < kMaxReservations; ++i) {
+      if (i != self && blocks(res_[i], me)) consider(res_[i].start + res_[i].duration_ms);
+    }
+    return best;
+  }
+
+  // Moves any not-yet-started booking of priority up to max_priority that
+  // now overloads the rail, highest priority first: after a booking of
+  // max_priority + 1 is placed, or after a running one overran.
+  void reshuffle(int max_priority, uint32_t now_ms) {
+    for (int prio = max_priority; prio >= 0; --prio) {
+      for (uint8_t i = 0; i < kMaxReservations; ++i) {
+        Reservation& r = res_[i];
+        if (!r.used || r.running || r.priority != prio || r.start == kNever) continue;
+        if (fits(i, r.start)) continue;
+        r.start = find_slot(i, now_ms);
+      }
+    }
+  }
+
+  RailConfig rail_;
+  Reservation res_[kMaxReservations];
+};
+
+// Process-wide sequencer for the +5V rail (ESP32; thread-safe wrapper, from
+// tasks only: it takes a mutex).
+// Blocks the calling task until the load may start. Returns the ticket to
+// release when the action ends, or PowerSequencer::kNoTicket on timeout.
+PowerSequencer::Ticket power_acquire(PowerLoad load, uint32_t max_defer_ms, uint32_t duration_ms = 0);
+void power_release(PowerSequencer::Ticket ticket);
+
+}  // namespace agro
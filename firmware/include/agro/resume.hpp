@@ -0,0 +1,187 @@
+// Warm resume across deep sleep.
+//
+// Before sleeping, each subsystem's state goes into one ResumeSnapshot in RTC
+// slow memory, sealed with a CRC-32. The deep-sleep wake stub checks the CRC
+// from RTC fast memory before the app is even loaded; app_main then takes the
+// restored state as it is instead of probing the SIM800L and NEO-6M again,
+// re-estimating the battery and rescanning the zone programs. Anything that
+// does not check out (power-on, brownout, a changed config image, a
+// firmware with a different layout) falls back to a cold start.
+//
+// WakeTimeline records the milestones of every wake so the uplink can report
+// wake-to-first-action latency, warm and cold.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "agro/crc32.hpp"
+
+namespace agro {
+
+inline constexpr uint32_t kResumeMagic = 0x4D535241;  // "ARSM"
+// Bump on any change to ResumeState; a mismatch means a cold start.
+inline constexpr uint16_t kResumeVersion = 1;
+
+enum class ModemPower : uint8_t {
+  kOff = 0,    // rail switched off; needs power-up and registration
+  kSleeping,   // left in AT+CSCLK sleep, registered
+  kOn,
+};
+
+enum class GpsPower : uint8_t {
+  kOff = 0,  // no backup power: cold start
+  kBackup,   // ephemeris and RTC kept: hot or warm start
+};
+
+struct ModemResume {
+  ModemPower power = ModemPower::kOff;
+  uint8_t creg_stat = 0;       // last +CREG stat; 1 home, 5 roaming
+  uint8_t failed_uploads = 0;  // consecutive; drives the SMS fallback
+  uint8_t sms_epoch = 0;       // SmsFallbackUplink::boot_epoch(), from NVS on cold boot
+  uint32_t baud = 0;           // locked with AT+IPR; 0 = autobaud needed
+  uint16_t sms_seq = 0;        // SmsFallbackUplink::next_seq()
+  uint16_t register_ms = 0;    // registration time last session, for timeouts
+};
+
+struct GpsResume {
+  GpsPower power = GpsPower::kOff;
+  uint8_t reserved = 0;
+  uint16_t last_ttff_s = 0;
+  uint32_t last_fix_unix = 0;  // ephemeris age decides hot vs warm start
+  int32_t lat_e7 = 0;
+  int32_t lon_e7 = 0;
+};
+
+struct ScheduleResume {
+  uint32_t config_generation = 0;  // cursor is stale if the image changed
+  uint8_t next_program = 0xff;     // ScheduleCursor::index
+  uint8_t reserved = 0;
+  uint16_t next_minute_of_week = 0;
+  uint32_t coast_ml = 0;           // IrrigationController close-ahead estimate
+};
+
+struct EnergyResume {
+  uint16_t soc_permille = 0;
+  uint16_t battery_mv = 0;
+  int32_t charge_mas = 0;  // coulomb count since the last rest-voltage fix, mA*s
+};
+
+struct TelemetryResume {
+  uint16_t next_seq = 0;    // uplink packet sequence
+  uint16_t pending = 0;     // records queued but not acknowledged
+  uint32_t oldest_unix = 0;
+};
+
+struct ResumeState {
+  uint32_t unix_at_sleep = 0;
+  uint32_t sleep_ms = 0;
+  ScheduleResume schedule;
+  ModemResume modem;
+  GpsResume gps;
+  EnergyResume energy;
+  TelemetryResume telemetry;
+};
+
+// Fully initialized so an RTC_DATA_ATTR instance is constant-initialized:
+// a startup constructor would run on every wake, after the wake stub.
+struct ResumeSnapshot {
+  uint32_t magic = 0;
+  uint16_t version = 0;
+  uint16_t state_bytes = 0;
+  uint32_t sequence = 0;  // incremented on every seal
+  ResumeState state;
+  uint32_t crc = 0;       // over everything above
+};
+// No padding anywhere, so the CRC covers only defined bytes.
+static_assert(sizeof(ResumeState) == 64 && sizeof(ResumeSnapshot) == 80);
+
+inline uint32_t resume_crc(const ResumeSnapshot& s) { return crc32(&s, offsetof(ResumeSnapshot, crc)); }
+
+inline void resume_seal(ResumeSnapshot* s, const ResumeState& state) {
+  const uint32_t seq = s->magic == kResumeMagic ? s->sequence + 1 : 0;
+  std::memset(static_cast<void*>(s), 0, sizeof(*s));  // padding is part of the CRC
+  s->magic = kResumeMagic;
+  s->version = kResumeVersion;
+  s->state_bytes = sizeof(ResumeState);
+  s->sequence = seq;
+  s->state = state;
+  s->crc = resume_crc(*s);
+}
+
+inline bool resume_valid(const ResumeSnapshot& s) {
+  return s.magic == kResumeMagic && s.version == kResumeVersion && s.state_bytes == sizeof(ResumeState) &&
+         s.crc == resume_crc(s);
+}
+
+// Marks the snapshot as consumed so a crash before the next seal can never
+// resume from it twice. The sequence number survives for the next seal.
+inline void resume_invalidate(ResumeSnapshot* s) { s->crc = ~resume_crc(*s); }
+
+enum class WakeMark : uint8_t {
+  kStub = 0,     // wake stub entered (ROM has loaded RTC fast memory)
+  kApp,          // app_main entered
+  kReady,        // state restored or re-initialized, drivers usable
+  kFirstAction,  // first useful action: valve switched, sample or uplink started
+  kCount,
+};
+
+// Milestones of one wake in microseconds since the wake-up event.
+class WakeTimeline {
+ public:
+  static constexpr uint32_t kUnset = UINT32_MAX;
+
+  void begin(bool warm) {
+    warm_ = warm;
+    for (auto& t : at_us_) t = kUnset;
+  }
+  // Only the first mark of each kind counts.
+  void mark(WakeMark m, uint32_t us) {
+    uint32_t& t = at_us_[static_cast<size_t>(m)];
+    if (t == kUnset) t = us;
+  }
+  uint32_t at(WakeMark m) const { return at_us_[static_cast<size_t>(m)]; }
+  bool warm() const { return warm_; }
+  uint32_t first_action_us() const { return at(WakeMark::kFirstAction); }
+
+ private:
+  bool warm_ = false;
+  uint32_t at_us_[static_cast<size_t>(WakeMark::kCount)] = {kUnset, kUnset, kUnset, kUnset};
+};
+
+// Running wake-to-first-action statistics, kept in RTC memory across wakes
+// and sent with the diagnostics uplink.
+struct WakeLatencyStats {
+  struct Series {
+    uint32_t count = 0;
+    uint32_t last_us = 0;
+    uint32_t max_us = 0;
+    uint32_t ewma_us = 0;  // 1/8 weight
+
+    void add(uint32_t us) {
+      ewma_us = count ? ewma_us - ewma_us / 8 + us / 8 : us;
+      last_us = us;
+      if (us > max_us) max_us = us;
+      ++count;
+    }
+  };
+  Series warm;
+  Series cold;
+
+  void add(const WakeTimeline& t) {
+    if (t.first_action_us() == WakeTimeline::kUnset) return;
+    (t.warm() ? warm : cold).add(t.first_action_us());
+  }
+};
+
+// ESP32. Call resume_begin() first thing in app_main: it returns true with
+// *state filled for a warm resume. Mark milestones as they happen, and seal
+// the final state with resume_commit() right before esp_deep_sleep_start().
+bool resume_begin(ResumeState* state);
+void resume_mark(WakeMark m);
+void resume_commit(const ResumeState& state);
+const WakeTimeline& resume_timeline();
+const WakeLatencyStats& resume_latency_stats();
+
+}  // namespace agro
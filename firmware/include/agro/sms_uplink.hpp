@@ -0,0 +1,126 @@
+// SMS fallback uplink for when GPRS is unavailable.
+//
+// Telemetry is packed with TelemetryPacker into the full 140-octet user data
+// of an 8-bit (DCS 0x04) PDU-mode SMS-SUBMIT. Every message is a
+// self-contained packet with its own sequence number rather than a part of a
+// concatenated SMS: a concatenation header would cost 6 octets per part, a
+// packet header costs about as much, and a lost message then loses only its
+// own records. The server orders and de-duplicates by sequence number.
+//
+// The user data is one octet of boot epoch, then the packet. A device that
+// loses its RTC state restarts its sequence at 0 under a new epoch, so the
+// server starts the stream over instead of taking the new packets for
+// duplicates of old ones.
+//
+// Sending one message on the SIM800L:
+//   AT+CMGF=0           once per session
+//   AT+CMGS=<tpdu_len>  wait for '>'
+//   <hex>\x1a           wait for +CMGS: <mr>
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+#include "agro/telemetry_codec.hpp"
+
+namespace agro {
+
+inline constexpr size_t kSmsUserDataMax = 140;
+inline constexpr size_t kSmsEpochBytes = 1;  // before the packet
+// First octet, MR, DA length/type/10 digit octets (20 digits), PID, DCS, UDL.
+inline constexpr size_t kSmsSubmitHeaderMax = 1 + 1 + 1 + 1 + 10 + 1 + 1 + 1;
+
+struct SmsPdu {
+  // Hex of the whole PDU including the leading "00" (use the SIM's SMSC).
+  char hex[2 * (1 + kSmsSubmitHeaderMax + kSmsUserDataMax) + 1];
+  // Octets after the SMSC field, as AT+CMGS wants them.
+  uint8_t tpdu_len;
+};
+
+namespace sms_detail {
+
+inline char hex_digit(uint8_t v) { return "0123456789ABCDEF"[v & 0x0f]; }
+
+inline void put_hex(char*& out, uint8_t v) {
+  *out++ = hex_digit(v >> 4);
+  *out++ = hex_digit(v);
+}
+
+}  // namespace sms_detail
+
+// Encodes an SMS-SUBMIT with 8-bit data coding. dest is "+<digits>" for an
+// international number or plain digits for a national one.
+inline bool build_submit_pdu(const char* dest, const uint8_t* ud, size_t ud_len, SmsPdu* out) {
+  using sms_detail::put_hex;
+  if (ud_len > kSmsUserDataMax) return false;
+  uint8_t type = 0x81;
+  if (*dest == '+') {
+    type = 0x91;
+    ++dest;
+  }
+  uint8_t digits[20];
+  size_t ndigits = 0;
+  for (const char* p = dest; *p; ++p) {
+    if (*p < '0' || *p > '9' || ndigits == sizeof(digits)) return false;
+    digits[ndigits++] = static_cast<uint8_t>(*p - '0');
+  }
+  if (ndigits == 0) return false;
+
+  char* h = out->hex;
+  put_hex(h, 0x00);  // SMSC length: use the one stored on the SIM
+  put_hex(h, 0x01);  // SMS-SUBMIT, no validity period, no UDH
+  put_hex(h, 0x00);  // message reference assigned by the modem
+  put_hex(h, static_cast<uint8_t>(ndigits));
+  put_hex(h, type);
+  for (size_t i = 0; i < ndigits; i += 2) {
+    const uint8_t hi = i + 1 < ndigits ? digits[i + 1] : 0x0f;
+    put_hex(h, static_cast<uint8_t>(hi << 4 | digits[i]));
+  }
+  put_hex(h, 0x00);  // PID
+  put_hex(h, 0x04);  // DCS: 8-bit data
+  put_hex(h, static_cast<uint8_t>(ud_len));
+  for (size_t i = 0; i < ud_len; ++i) put_hex(h, ud[i]);
+  *h = '\0';
+
+  out->tpdu_len = static_cast<uint8_t>((h - out->hex) / 2 - 1);
+  return true;
+}
+
+inline int format_cmgs(const SmsPdu& pdu, char* buf, size_t cap) {
+  return std::snprintf(buf, cap, "AT+CMGS=%u\r", static_cast<unsigned>(pdu.tpdu_len));
+}
+
+class SmsFallbackUplink {
+ public:
+  // server_number must outlive the uplink. boot_epoch changes on every cold
+  // boot (the low byte of a counter kept in NVS, such as the sealed-frame
+  // epoch) and next_seq then starts at 0; within a boot, persist both across
+  // deep sleep so the stream continues.
+  SmsFallbackUplink(const char* server_number, uint8_t boot_epoch, uint16_t next_seq)
+      : server_number_(server_number), boot_epoch_(boot_epoch), next_seq_(next_seq) {}
+
+  // Packs as many of recs as fit into one message. Returns the number of
+  // records consumed, 0 if n is 0 or the destination is invalid.
+  size_t encode_next(const TelemetryRecord* recs, size_t n, SmsPdu* out) {
+    if (n == 0) return 0;
+    uint8_t ud[kSmsUserDataMax];
+    ud[0] = boot_epoch_;
+    TelemetryPacker packer(ud + kSmsEpochBytes, sizeof(ud) - kSmsEpochBytes, next_seq_, recs[0].time);
+    size_t used = 0;
+    while (used < n && packer.add(recs[used])) ++used;
+    if (used == 0 || !build_submit_pdu(server_number_, ud, kSmsEpochBytes + packer.size(), out)) return 0;
+    ++next_seq_;
+    return used;
+  }
+
+  uint8_t boot_epoch() const { return boot_epoch_; }
+  uint16_t next_seq() const { return next_seq_; }
+
+ private:
+  const char* server_number_;
+  uint8_t boot_epoch_;
+  uint16_t next_seq_;
+};
+
+}  // namespace agro
@@ -0,0 +1,148 @@
+// Capacitive soil moisture sensing, sampled by the ULP coprocessor during
+// deep sleep.
+//
+// The ULP program powers the probe from an RTC GPIO, oversamples ADC1, keeps
+// a three-deep history and median-filters it, and only wakes the main cores
+// when the filtered reading crosses the dry threshold. After a wake it stays
+// disarmed until the soil reads wet again, so a dry field with irrigation
+// disabled does not wake the CPU every period.
+//
+// SoilUlpModel is a bit-exact C++ model of that program; the host simulator
+// runs it, and SoilMoistureSensor (ESP32 only) emits the real instructions.
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+namespace agro {
+
+struct SoilProbeConfig {
+  // Raw 12-bit ADC readings in air and in water, from field calibration.
+  // Capacitive probes read higher when drier.
+  uint16_t air_raw = 3300;
+  uint16_t water_raw = 1400;
+  // Filtered reading at or above which the valve should open (wakes the CPU).
+  uint16_t dry_raw = 2600;
+  // Filtered reading at or below which the ULP re-arms for the next wake.
+  uint16_t wet_raw = 2200;
+  // log2 of samples averaged per cycle. The ULP accumulates in a 16-bit
+  // register, so 16 samples of 12 bits is the ceiling.
+  uint8_t oversample_shift = 4;
+  // Probe settling time after power-up; one I_DELAY covers up to ~8 ms.
+  uint16_t settle_us = 2000;
+  // ULP wakeup period.
+  uint32_t period_us = 5u * 60u * 1000000u;
+};
+
+inline constexpr uint8_t kSoilMaxOversampleShift = 4;
+
+// Word offsets into RTC slow memory shared by the ULP program and the main
+// cores. Only the low 16 bits of each word are meaningful.
+enum SoilUlpVar : uint8_t {
+  kSoilVarArmed = 0,
+  kSoilVarLastRaw,
+  kSoilVarHist0,
+  kSoilVarHist1,
+  kSoilVarHist2,
+  kSoilVarMedian,
+  kSoilVarCycles,
+  kSoilVarWakeups,
+  kSoilVarCount,
+};
+
+// The program is loaded right after the variable block.
+inline constexpr size_t kSoilUlpProgramOffset = 16;
+static_assert(kSoilVarCount <= kSoilUlpProgramOffset);
+
+// Maps a filtered raw reading onto 0 (air) .. 1000 (water) permille.
+inline uint16_t soil_raw_to_permille(const SoilProbeConfig& cfg, uint16_t raw) {
+  if (cfg.air_raw <= cfg.water_raw) return 0;
+  const int span = cfg.air_raw - cfg.water_raw;
+  const int clamped = std::clamp<int>(raw, cfg.water_raw, cfg.air_raw);
+  return static_cast<uint16_t>((cfg.air_raw - clamped) * 1000 / span);
+}
+
+// Host model of one ULP cycle, matching the instruction sequence emitted by
+// SoilMoistureSensor::load_program().
+class SoilUlpModel {
+ public:
+  explicit SoilUlpModel(const SoilProbeConfig& cfg) : cfg_(cfg) {}
+
+  // Seeds the history the way SoilMoistureSensor::arm() does before sleep.
+  void arm(uint16_t current_raw) {
+    vars_[kSoilVarHist0] = vars_[kSoilVarHist1] = vars_[kSoilVarHist2] = current_raw;
+    vars_[kSoilVarMedian] = current_raw;
+    vars_[kSoilVarArmed] = current_raw < cfg_.dry_raw ? 1 : 0;
+  }
+
+  // Runs one cycle over 2^oversample_shift raw samples. Returns true when the
+  // program would execute I_WAKE.
+  bool run(const uint16_t* samples) {
+    const uint8_t shift = std::min(cfg_.oversample_shift, kSoilMaxOversampleShift);
+    uint16_t acc = 0;
+    for (size_t i = 0; i < (size_t{1} << shift); ++i) acc = static_cast<uint16_t>(acc + samples[i]);
+    const uint16_t mean = static_cast<uint16_t>(acc >> shift);
+
+    vars_[kSoilVarLastRaw] = mean;
+    vars_[kSoilVarHist2] = vars_[kSoilVarHist1];
+    vars_[kSoilVarHist1] = vars_[kSoilVarHist0];
+    vars_[kSoilVarHist0] = mean;
+    vars_[kSoilVarCycles] = static_cast<uint16_t>(vars_[kSoilVarCycles] + 1);
+
+    uint16_t a = vars_[kSoilVarHist0], b = vars_[kSoilVarHist1], c = vars_[kSoilVarHist2];
+    if (b < a) std::swap(a, b);
+    if (c < b) std::swap(b, c);
+    if (b < a) std::swap(a, b);
+    vars_[kSoilVarMedian] = b;
+
+    if (vars_[kSoilVarArmed] == 0) {
+      if (b <= cfg_.wet_raw) vars_[kSoilVarArmed] = 1;
+      return false;
+    }
+    if (b < cfg_.dry_raw) return false;
+    vars_[kSoilVarArmed] = 0;
+    vars_[kSoilVarWakeups] = static_cast<uint16_t>(vars_[kSoilVarWakeups] + 1);
+    return true;
+  }
+
+  uint16_t var(SoilUlpVar v) const { return vars_[v]; }
+  size_t samples_per_cycle() const {
+    return size_t{1} << std::min(cfg_.oversample_shift, kSoilMaxOversampleShift);
+  }
+
+ private:
+  SoilProbeConfig cfg_;
+  uint16_t vars_[kSoilVarCount] = {};
+};
+
+// ESP32 driver: configures ADC1 and the probe power pin for the ULP, loads the
+// program into RTC slow memory and reads back its results after a wake.
+class SoilMoistureSensor {
+ public:
+  explicit SoilMoistureSensor(const SoilProbeConfig& cfg) : cfg_(cfg) {}
+
+  // One-time setup after a cold boot. Returns false if the ULP program does
+  // not fit.
+  bool begin();
+  // Seeds the filter from a direct reading and starts the ULP; call once,
+  // right before entering deep sleep. False if the ADC cannot be read or
+  // routed to the ULP.
+  bool arm();
+  // Filtered reading from the last ULP cycle.
+  uint16_t median_raw() const;
+  uint16_t moisture_permille() const { return soil_raw_to_permille(cfg_, median_raw()); }
+  uint16_t ulp_cycles() const;
+  // True if the current boot was caused by the ULP's threshold wake.
+  static bool woke_on_threshold();
+
+  const SoilProbeConfig& config() const { return cfg_; }
+
+ private:
+  bool load_program();
+  bool sample_direct(uint16_t* raw) const;
+
+  SoilProbeConfig cfg_;
+};
+
+}  // namespace agro
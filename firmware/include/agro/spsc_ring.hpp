@@ -0,0 +1,134 @@
+// Wait-free single-producer single-consumer ring buffer.
+//
+// Built for the UART receive paths: the RX interrupt is the only producer and
+// one parser task (possibly on the other core) is the only consumer. Neither
+// side ever blocks or retries; a full ring makes the producer write less, an
+// empty one makes the consumer read nothing.
+//
+// The producer and consumer indices live on separate cache lines, and each
+// side keeps a private copy of the other's index so the shared line is only
+// read again when the cached value says the ring looks full (or empty).
+// Indices run free and are masked on access, so Capacity must be a power of
+// two and all of it is usable.
+//
+// write_span()/commit() and read_span()/consume() expose the contiguous
+// region directly, letting the ISR drain the hardware FIFO straight into the
+// ring and a parser scan bytes in place without an intermediate copy.
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+
+namespace agro {
+
+#if defined(ESP_PLATFORM)
+inline constexpr size_t kCacheLine = 32;
+#else
+inline constexpr size_t kCacheLine = 64;
+#endif
+
+template <class T, size_t Capacity>
+class SpscRing {
+  static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+  static_assert(std::is_trivially_copyable_v<T>, "elements are moved with memcpy");
+  static constexpr size_t kMask = Capacity - 1;
+
+ public:
+  static constexpr size_t kCapacity = Capacity;
+
+  // Producer side.
+
+  bool push(const T& v) {
+    const size_t head = head_.load(std::memory_order_relaxed);
+    if (head - cached_tail_ == Capacity) {
+      cached_tail_ = tail_.load(std::memory_order_acquire);
+      if (head - cached_tail_ == Capacity) return false;
+    }
+    buf_[head & kMask] = v;
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Writes up to n elements; returns how many fit.
+  size_t write(const T* src, size_t n) {
+    size_t done = 0;
+    while (done < n) {
+      T* dst;
+      const size_t room = write_span(&dst);
+      if (room == 0) break;
+      const size_t k = std::min(room, n - done);
+      std::memcpy(dst, src + done, k * sizeof(T));
+      commit(k);
+      done += k;
+    }
+    return done;
+  }
+
+  // Contiguous free region at the write position; fill it, then commit().
+  size_t write_span(T** dst) {
+    const size_t head = head_.load(std::memory_order_relaxed);
+    size_t free = Capacity - (head - cached_tail_);
+    if (free == 0) {
+      cached_tail_ = tail_.load(std::memory_order_acquire);
+      free = Capacity - (head - cached_tail_);
+    }
+    *dst = &buf_[head & kMask];
+    return std::min(free, Capacity - (head & kMask));
+  }
+
+  void commit(size_t n) { head_.store(head_.load(std::memory_order_relaxed) + n, std::memory_order_release); }
+
+  // Consumer side.
+
+  bool pop(T* out) {
+    const size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail == cached_head_) {
+      cached_head_ = head_.load(std::memory_order_acquire);
+      if (tail == cached_head_) return false;
+    }
+    *out = buf_[tail & kMask];
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Reads up to n elements; returns how many were available.
+  size_t read(T* dst, size_t n) {
+    size_t done = 0;
+    while (done < n) {
+      const T* src;
+      const size_t avail = read_span(&src);
+      if (avail == 0) break;
+      const size_t k = std::min(avail, n - done);
+      std::memcpy(dst + done, src, k * sizeof(T));
+      consume(k);
+      done += k;
+    }
+    return done;
+  }
+
+  // Contiguous readable region at the read position; use it, then consume().
+  size_t read_span(const T** src) {
+    const size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail == cached_head_) cached_head_ = head_.load(std::memory_order_acquire);
+    *src = &buf_[tail & kMask];
+    return std::min(cached_head_ - tail, Capacity - (tail & kMask));
+  }
+
+  void consume(size_t n) { tail_.store(tail_.load(std::memory_order_relaxed) + n, std::memory_order_release); }
+
+  // Either side; exact only when the other side is idle.
+  size_t size() const { return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire); }
+  bool empty() const { return size() == 0; }
+
+ private:
+  alignas(kCacheLine) std::atomic<size_t> head_{0};
+  size_t cached_tail_ = 0;
+  alignas(kCacheLine) std::atomic<size_t> tail_{0};
+  size_t cached_head_ = 0;
+  alignas(kCacheLine) T buf_[Capacity];
+};
+
+}  // namespace agro
@@ -0,0 +1,239 @@
+// Telemetry waiting for the next SIM800L session, by priority and deadline.
+//
+// Powering the modem costs a boot and a network search (modem_power.hpp),
+// so a session is only worth it when something cannot wait: every record
+// carries a deadline, by default from its class,
+//
+//   alarm    geofence breach, faults           send now
+//   event    valve runs, flow totals           within 2 h
+//   routine  soil, battery, position           within 12 h, or on a full batch
+//
+// and session_due() says whether any deadline has passed; next_deadline()
+// sets the wake timer so the controller is up when one does. After failed
+// sessions the retries back off, but a queued alarm never waits out the
+// long backoff of a routine batch. Whatever session
+// opens carries everything queued, most urgent first, so routine readings
+// ride along with an alarm instead of costing their own session.
+//
+// When the queue is full the oldest routine readings are merged pairwise
+// into summaries (kRecordSummary: the mean of a and b, the newest time) and
+// only then dropped; alarms are dropped last of all, and only for a newer
+// alarm.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "agro/telemetry.hpp"
+
+namespace agro {
+
+enum class TelemetryPriority : uint8_t {
+  kAlarm = 0,
+  kEvent,
+  kRoutine,
+  kCount,
+};
+
+inline TelemetryPriority telemetry_priority(RecordKind kind) {
+  switch (kind) {
+    case RecordKind::kFault:
+    case RecordKind::kGeofence:
+      return TelemetryPriority::kAlarm;
+    case RecordKind::kValve:
+    case RecordKind::kFlow:
+      return TelemetryPriority::kEvent;
+    default:
+      return TelemetryPriority::kRoutine;
+  }
+}
+
+struct TelemetryQueueParams {
+  uint32_t deadline_s[size_t(TelemetryPriority::kCount)] = {0, 2 * 3600, 12 * 3600};
+  // A batch this large is worth a session even before any deadline.
+  uint16_t batch_records = 96;
+  // After a failed session, back off from retry_min_s doubling to
+  // retry_max_s, so a dead network does not keep the modem booting. With an
+  // alarm queued the wait is at most alarm_retry_max_s.
+  uint32_t retry_min_s = 120;
+  uint32_t retry_max_s = 3600;
+  uint32_t alarm_retry_max_s = 600;
+};
+
+struct TelemetryQueueStats {
+  uint32_t queued[size_t(TelemetryPriority::kCount)] = {};
+  uint32_t dropped[size_t(TelemetryPriority::kCount)] = {};
+  uint32_t summarized = 0;  // readings folded into another
+};
+
+template <size_t Capacity>
+class TelemetryQueue {
+  static_assert(Capacity > 1 && Capacity < 0xffff, "index is 16 bits");
+
+ public:
+  static constexpr uint32_t kNoDeadline = UINT32_MAX;
+
+  // constexpr so an RTC_DATA_ATTR instance keeps its records through deep
+  // sleep instead of being reset by a startup constructor.
+  constexpr explicit TelemetryQueue(const TelemetryQueueParams& params = {}) : p_(params) {}
+
+  // Queues r with its class deadline, or an explicit absolute one (unix s).
+  // Returns true if a session is now due.
+  bool push(const TelemetryRecord& r, uint32_t now) {
+    const TelemetryPriority prio = telemetry_priority(r.kind);
+    return push(r, now + p_.deadline_s[size_t(prio)], now);
+  }
+
+  bool push(const TelemetryRecord& r, uint32_t deadline, uint32_t now) {
+    const TelemetryPriority prio = telemetry_priority(r.kind);
+    if (count_ == Capacity && !make_room(prio)) {
+      ++stats_.dropped[size_t(prio)];
+      return session_due(now);
+    }
+    items_[count_++] = Entry{r, deadline, prio};
+    ++stats_.queued[size_t(prio)];
+    return session_due(now);
+  }
+
+  // A deadline has passed or the batch is large enough, and no retry
+  // backoff is running.
+  bool session_due(uint32_t now) const {
+    return now >= retry_at() && (count_ >= p_.batch_records || next_deadline() <= now);
+  }
+
+  // Earliest deadline, for the wake timer; kNoDeadline when empty.
+  uint32_t next_deadline() const {
+    uint32_t d = kNoDeadline;
+    for (size_t i = 0; i < count_; ++i) {
+      if (items_[i].deadline < d) d = items_[i].deadline;
+    }
+    const uint32_t retry = retry_at();
+    return d == kNoDeadline || d >= retry ? d : retry;
+  }
+
+  // Copies up to cap records into out for an open session: by priority,
+  // oldest first within each. They stay queued until acknowledge(), so a
+  // failed upload loses nothing; push() may run in between.
+  size_t collect(TelemetryRecord* out, size_t cap) {
+    // Insertion sort: stable, in place, and the queue is nearly in order.
+    for (size_t i = 1; i < count_; ++i) {
+      const Entry e = items_[i];
+      size_t j = i;
+      for (; j > 0 && before(e, items_[j - 1]); --j) items_[j] = items_[j - 1];
+      items_[j] = e;
+    }
+    in_flight_ = count_ < cap ? count_ : cap;
+    for (size_t i = 0; i < in_flight_; ++i) out[i] = items_[i].rec;
+    return in_flight_;
+  }
+
+  // The server acknowledged the first n records of the last collect().
+  void acknowledge(size_t n) {
+    if (n > in_flight_) n = in_flight_;
+    std::memmove(items_, items_ + n, (count_ - n) * sizeof(Entry));
+    count_ -= n;
+    in_flight_ = 0;
+    backoff_s_ = 0;
+    failed_at_ = 0;
+  }
+
+  // No session: whatever was collected stays queued for the next one.
+  void session_failed(uint32_t now) {
+    in_flight_ = 0;
+    backoff_s_ = backoff_s_ == 0 ? p_.retry_min_s : backoff_s_ * 2;
+    if (backoff_s_ > p_.retry_max_s) backoff_s_ = p_.retry_max_s;
+    failed_at_ = now;
+  }
+
+  size_t size() const { return count_; }
+  bool empty() const { return count_ == 0; }
+  size_t count(TelemetryPriority prio) const {
+    size_t n = 0;
+    for (size_t i = 0; i < count_; ++i) n += items_[i].prio == prio;
+    return n;
+  }
+  const TelemetryQueueStats& stats() const { return stats_; }
+  const TelemetryQueueParams& params() const { return p_; }
+  // For records pushed from now on; queued ones keep their deadlines.
+  void set_params(const TelemetryQueueParams& p) { p_ = p; }
+
+ private:
+  struct Entry {
+    TelemetryRecord rec;
+    uint32_t deadline = 0;
+    TelemetryPriority prio = TelemetryPriority::kRoutine;
+  };
+
+  // End of the backoff after the last failed session; an alarm queued since
+  // (or before) cuts it short.
+  uint32_t retry_at() const {
+    if (backoff_s_ == 0) return 0;
+    uint32_t wait = backoff_s_;
+    if (wait > p_.alarm_retry_max_s && count(TelemetryPriority::kAlarm) > 0) wait = p_.alarm_retry_max_s;
+    return failed_at_ + wait;
+  }
+
+  static bool before(const Entry& x, const Entry& y) {
+    return x.prio != y.prio ? x.prio < y.prio : x.rec.time < y.rec.time;
+  }
+
+  static uint32_t weight(const TelemetryRecord& r) {
+    return r.flags & kRecordSummary ? r.flags & ~kRecordSummary : 1;
+  }
+
+  // Frees one slot for a record of class incoming. Records being uploaded
+  // (the first in_flight_) are left alone.
+  bool make_room(TelemetryPriority incoming) {
+    // Summarize: the oldest routine reading with a later one of the same
+    // kind and zone.
+    for (size_t i = in_flight_; i < count_; ++i) {
+      const Entry& x = items_[i];
+      if (x.prio != TelemetryPriority::kRoutine) continue;
+      for (size_t j = i + 1; j < count_; ++j) {
+        Entry& y = items_[j];
+        if (y.prio != x.prio || y.rec.kind != x.rec.kind || y.rec.zone != x.rec.zone) continue;
+        merge(x.rec, &y.rec);
+        if (x.deadline < y.deadline) y.deadline = x.deadline;
+        erase(i);
+        ++stats_.summarized;
+        return true;
+      }
+    }
+    // Drop: the oldest of the least urgent class, if not above incoming.
+    size_t victim = count_;
+    for (size_t i = in_flight_; i < count_; ++i) {
+      if (victim == count_ || items_[i].prio > items_[victim].prio ||
+          (items_[i].prio == items_[victim].prio && items_[i].rec.time < items_[victim].rec.time)) {
+        victim = i;
+      }
+    }
+    if (victim == count_ || items_[victim].prio < incoming) return false;
+    ++stats_.dropped[size_t(items_[victim].prio)];
+    erase(victim);
+    return true;
+  }
+
+  static void merge(const TelemetryRecord& older, TelemetryRecord* newer) {
+    const uint32_t wo = weight(older), wn = weight(*newer);
+    const uint32_t w = wo + wn;
+    newer->a = int32_t((int64_t(older.a) * wo + int64_t(newer->a) * wn) / w);
+    newer->b = int32_t((int64_t(older.b) * wo + int64_t(newer->b) * wn) / w);
+    newer->flags = uint16_t(kRecordSummary | (w < kRecordSummary ? w : kRecordSummary - 1));
+  }
+
+  void erase(size_t i) {
+    std::memmove(items_ + i, items_ + i + 1, (count_ - i - 1) * sizeof(Entry));
+    --count_;
+  }
+
+  TelemetryQueueParams p_;
+  TelemetryQueueStats stats_;
+  Entry items_[Capacity] = {};
+  size_t count_ = 0;
+  size_t in_flight_ = 0;
+  uint32_t backoff_s_ = 0;
+  uint32_t failed_at_ = 0;
+};
+
+}  // namespace agro
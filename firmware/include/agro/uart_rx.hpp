@@ -0,0 +1,110 @@
+// UART receive paths for the NEO-6M and the SIM800L.
+//
+// Each UART gets its own interrupt handler that drains the hardware RX FIFO
+// directly into an SpscRing and pokes the parser task with a task
+// notification. There is no driver queue, event copy or mutex between the
+// ISR and the NMEA/AT parsers; the parser pulls complete lines out of the
+// ring with LineSplitter.
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "agro/spsc_ring.hpp"
+
+namespace agro {
+
+// 1 KiB covers ~1 s of 9600 baud, far longer than a parser is ever delayed.
+inline constexpr size_t kUartRxRingBytes = 1024;
+using UartRxRing = SpscRing<uint8_t, kUartRxRingBytes>;
+
+// Splits a byte stream into CR/LF-terminated lines. Blank lines are skipped,
+// lines longer than MaxLine are truncated and counted. The SIM800L's "> "
+// data prompt has no terminator, so it is returned as a line of its own.
+template <size_t MaxLine>
+class LineSplitter {
+ public:
+  // Returns true with a NUL-terminated line when one completes.
+  template <class Ring>
+  bool next(Ring& ring, const char** line, size_t* len) {
+    const uint8_t* src;
+    size_t avail;
+    while ((avail = ring.read_span(&src)) != 0) {
+      size_t i = 0;
+      for (; i < avail; ++i) {
+        const char c = static_cast<char>(src[i]);
+        if (c == '\r' || c == '\n') {
+          if (len_ == 0) continue;
+          ring.consume(i + 1);
+          return finish(line, len);
+        }
+        if (len_ < MaxLine) {
+          buf_[len_++] = c;
+        } else {
+          truncated_ = true;
+        }
+        if (len_ == 2 && buf_[0] == '>' && buf_[1] == ' ') {
+          ring.consume(i + 1);
+          return finish(line, len);
+        }
+      }
+      ring.consume(i);
+    }
+    return false;
+  }
+
+  uint32_t truncated_lines() const { return truncated_count_; }
+
+ private:
+  bool finish(const char** line, size_t* len) {
+    if (truncated_) ++truncated_count_;
+    buf_[len_] = '\0';
+    *line = buf_;
+    *len = len_;
+    len_ = 0;
+    truncated_ = false;
+    return true;
+  }
+
+  char buf_[MaxLine + 1];
+  size_t len_ = 0;
+  bool truncated_ = false;
+  uint32_t truncated_count_ = 0;
+};
+
+// ESP32 UART with a ring-buffer RX path. TX writes straight into the
+// hardware FIFO; commands are short and the modem is slow to answer anyway.
+class UartRx {
+ public:
+  UartRx(int uart_num, int rx_pin, int tx_pin, uint32_t baud)
+      : uart_num_(uart_num), rx_pin_(rx_pin), tx_pin_(tx_pin), baud_(baud) {}
+
+  // consumer is the task notified (xTaskNotifyGive) when bytes arrive.
+  bool begin(void* consumer_task);
+  void end();
+  size_t write(const uint8_t* data, size_t len);
+  size_t write(const char* s);
+
+  UartRxRing& ring() { return ring_; }
+  // Bytes lost because the ring or the hardware FIFO was full.
+  uint32_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+ private:
+  static void isr(void* arg);
+
+  int uart_num_;
+  int rx_pin_;
+  int tx_pin_;
+  uint32_t baud_;
+  void* consumer_ = nullptr;
+  void* intr_handle_ = nullptr;
+  std::atomic<uint32_t> dropped_{0};
+  UartRxRing ring_;
+};
+
+// The two links from the schematic: NEO-6M on UART2, SIM800L on UART1.
+UartRx& gps_uart();
+UartRx& gsm_uart();
+
+}  // namespace agro
@@ -0,0 +1,75 @@
+#include "agro/coil_current.hpp"
+
+#if defined(ESP_PLATFORM)
+
+#include <esp_adc/adc_continuous.h>
+
+#include "agro/board.hpp"
+
+namespace agro {
+namespace {
+
+// One DMA block: 32 samples of two bytes, 1.6 ms at 20 kHz.
+constexpr uint32_t kBlockBytes = 64;
+constexpr uint32_t kBlocks = 8;
+constexpr adc_channel_t kShuntChannel = static_cast<adc_channel_t>(board::kValveShuntAdcChannel);
+
+}  // namespace
+
+bool CoilMonitor::begin() {
+  // The driver is set up per burst; only check the channel is an ADC1 pin.
+  int io = -1;
+  return adc_continuous_channel_to_io(ADC_UNIT_1, kShuntChannel, &io) == ESP_OK;
+}
+
+CoilVerdict CoilMonitor::check(bool energized) {
+  adc_continuous_handle_cfg_t handle_cfg = {};
+  handle_cfg.max_store_buf_size = kBlockBytes * kBlocks;
+  handle_cfg.conv_frame_size = kBlockBytes;
+  adc_continuous_handle_t adc = nullptr;
+  if (adc_continuous_new_handle(&handle_cfg, &adc) != ESP_OK) return CoilVerdict::kPending;
+
+  adc_digi_pattern_config_t pattern = {};
+  pattern.atten = ADC_ATTEN_DB_12;
+  pattern.channel = kShuntChannel;
+  pattern.unit = ADC_UNIT_1;
+  pattern.bit_width = SOC_ADC_DIGI_MAX_BITWIDTH;
+  adc_continuous_config_t dig = {};
+  dig.pattern_num = 1;
+  dig.adc_pattern = &pattern;
+  dig.sample_freq_hz = cfg_.sample_hz;
+  dig.conv_mode = ADC_CONV_SINGLE_UNIT_1;
+  dig.format = ADC_DIGI_OUTPUT_FORMAT_TYPE1;
+  if (adc_continuous_config(adc, &dig) != ESP_OK || adc_continuous_start(adc) != ESP_OK) {
+    adc_continuous_deinit(adc);
+    return CoilVerdict::kPending;
+  }
+
+  // Blocks are classified as the DMA fills them, so a clear verdict stops
+  // the burst early; the classifier itself ends it at burst_ms.
+  CoilClassifier c(cfg_, energized);
+  uint8_t block[kBlockBytes];
+  uint16_t raw[kBlockBytes / SOC_ADC_DIGI_RESULT_BYTES];
+  while (c.verdict() == CoilVerdict::kPending) {
+    uint32_t got = 0;
+    if (adc_continuous_read(adc, block, sizeof(block), &got, cfg_.burst_ms) != ESP_OK) break;
+    size_t n = 0;
+    for (uint32_t i = 0; i + SOC_ADC_DIGI_RESULT_BYTES <= got; i += SOC_ADC_DIGI_RESULT_BYTES) {
+      const auto* d = reinterpret_cast<const adc_digi_output_data_t*>(block + i);
+      if (d->type1.channel == board::kValveShuntAdcChannel) raw[n++] = uint16_t(d->type1.data);
+    }
+    c.feed(raw, n);
+  }
+  adc_continuous_stop(adc);
+  adc_continuous_deinit(adc);
+
+  last_peak_ma_ = c.peak_ma();
+  const CoilVerdict v = c.verdict();
+  // Keeps the most severe fault until it is reported, as the flow checks do.
+  if (v != CoilVerdict::kPending && uint8_t(v) > uint8_t(fault_)) fault_ = v;
+  return v;
+}
+
+}  // namespace agro
+
+#endif  // ESP_PLATFORM
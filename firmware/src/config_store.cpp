@@ -0,0 +1,62 @@
+#include "agro/config_store.hpp"
+
+#if defined(ESP_PLATFORM)
+
+#include <esp_attr.h>
+#include <esp_partition.h>
+#include <spi_flash_mmap.h>
+
+namespace agro {
+namespace {
+
+// partitions.csv: agrocfg, data, 0x40, , 0x1000
+constexpr esp_partition_subtype_t kConfigSubtype = static_cast<esp_partition_subtype_t>(0x40);
+constexpr const char* kConfigLabel = "agrocfg";
+
+// CRC of the last image that passed the full check; survives deep sleep.
+RTC_DATA_ATTR uint32_t g_verified_crc = 0;
+RTC_DATA_ATTR bool g_verified = false;
+
+ConfigView g_view;
+ConfigStatus g_status = ConfigStatus::kTooShort;
+bool g_loaded = false;
+
+void load() {
+  g_loaded = true;
+  const esp_partition_t* part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, kConfigSubtype, kConfigLabel);
+  if (part == nullptr) return;
+  const void* image = nullptr;
+  spi_flash_mmap_handle_t handle;
+  // The mapping is never released: the view points into it for the rest of
+  // the wake.
+  if (esp_partition_mmap(part, 0, part->size, SPI_FLASH_MMAP_DATA, &image, &handle) != ESP_OK) return;
+
+  // Trust the image without the CRC pass only if its header still carries
+  // the CRC we verified; anything rewritten since gets the full check.
+  const auto* header = static_cast<const ConfigHeader*>(image);
+  const bool known = g_verified && header->crc32 == g_verified_crc;
+  g_status = g_view.open(image, part->size, !known);
+  if (g_status == ConfigStatus::kOk) {
+    g_verified_crc = g_view.crc();
+    g_verified = true;
+  } else {
+    g_view = ConfigView();
+    g_verified = false;
+  }
+}
+
+}  // namespace
+
+const ConfigView& boot_config() {
+  if (!g_loaded) load();
+  return g_view;
+}
+
+ConfigStatus boot_config_status() {
+  if (!g_loaded) load();
+  return g_status;
+}
+
+}  // namespace agro
+
+#endif  // ESP_PLATFORM
@@ -0,0 +1,139 @@
+#include "agro/core_runtime.hpp"
+
+#if defined(ESP_PLATFORM)
+
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+namespace agro {
+namespace {
+
+constexpr BaseType_t kRadioCore = 0;
+constexpr BaseType_t kControlCore = 1;
+constexpr UBaseType_t kRadioPriority = 5;
+constexpr UBaseType_t kControlPriority = 10;
+constexpr uint32_t kRadioStackBytes = 6144;
+constexpr uint32_t kControlStackBytes = 4096;
+constexpr UBaseType_t kMaxTasksForStats = 24;
+// Longest the radio task sleeps between steps with nothing from the control
+// core; bounds how late it notices modem and GPS input.
+constexpr uint32_t kRadioIdleMs = 20;
+
+struct Runtime {
+  CoreLinks links;
+  FlowMeter flow;
+  ValveRelay relay;
+  RadioStep radio_step = nullptr;
+  IrrigationConfig cfg;
+  // Published once each task exists; either task may already be running and
+  // sending to the other before that.
+  std::atomic<TaskHandle_t> radio_task{nullptr};
+  std::atomic<TaskHandle_t> control_task{nullptr};
+  std::atomic<uint32_t> valve_latency_max_us{0};
+  std::atomic<uint32_t> dropped{0};
+  std::atomic<uint32_t> control_dropped{0};
+};
+
+Runtime g_rt;
+
+uint64_t now_us() { return static_cast<uint64_t>(esp_timer_get_time()); }
+
+void set_relay(void* ctx, bool open) { static_cast<ValveRelay*>(ctx)->set(open); }
+
+// A message sent before its receiver's handle is published is picked up on
+// the receiver's next tick or step instead.
+void notify(const std::atomic<TaskHandle_t>& task) {
+  if (TaskHandle_t t = task.load(std::memory_order_acquire)) xTaskNotifyGive(t);
+}
+
+void note_latency(uint32_t us) {
+  uint32_t prev = g_rt.valve_latency_max_us.load(std::memory_order_relaxed);
+  while (us > prev && !g_rt.valve_latency_max_us.compare_exchange_weak(prev, us, std::memory_order_relaxed)) {
+  }
+}
+
+void control_task(void*) {
+  static ControlLoop loop(g_rt.links, g_rt.cfg, &set_relay, &g_rt.relay);
+  uint64_t due_us = now_us();
+  for (;;) {
+    const uint64_t t0 = now_us();
+    // Lateness against the scheduled tick is the valve actuation latency:
+    // the relay is switched inside this step.
+    if (t0 > due_us) note_latency(static_cast<uint32_t>(t0 - due_us));
+    if (loop.step(static_cast<uint32_t>(t0 / 1000), g_rt.flow.pulses())) notify(g_rt.radio_task);
+    g_rt.control_dropped.store(loop.dropped(), std::memory_order_relaxed);
+
+    due_us = t0 + loop.next_tick_ms() * 1000u;
+    // A command from the radio core wakes us early; that step is not late.
+    if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(loop.next_tick_ms())) > 0) due_us = now_us();
+  }
+}
+
+void radio_task(void*) {
+  for (;;) {
+    g_rt.radio_step(g_rt.links);
+    // Block rather than yield: taskYIELD() leaves the core to nothing below
+    // this priority, including the idle task the watchdog and core_stats()
+    // rely on. A message posted while the step ran is already counted, so
+    // the next step follows at once.
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(kRadioIdleMs));
+  }
+}
+
+}  // namespace
+
+bool start_core_runtime(RadioStep radio_step, const IrrigationConfig& cfg) {
+  g_rt.radio_step = radio_step;
+  g_rt.cfg = cfg;
+  if (!g_rt.flow.begin() || !g_rt.relay.begin()) return false;
+  TaskHandle_t task = nullptr;
+  if (xTaskCreatePinnedToCore(&control_task, "control", kControlStackBytes, nullptr, kControlPriority, &task,
+                              kControlCore) != pdPASS) {
+    return false;
+  }
+  g_rt.control_task.store(task, std::memory_order_release);
+  if (xTaskCreatePinnedToCore(&radio_task, "radio", kRadioStackBytes, nullptr, kRadioPriority, &task, kRadioCore) !=
+      pdPASS) {
+    return false;
+  }
+  g_rt.radio_task.store(task, std::memory_order_release);
+  return true;
+}
+
+CoreLinks& core_links() { return g_rt.links; }
+
+bool post_to_control(const CoreMessage& m) {
+  if (!g_rt.links.to_control.push(m)) {
+    g_rt.dropped.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  notify(g_rt.control_task);
+  return true;
+}
+
+// Per-core load from the idle tasks' run time; needs
+// CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS with the esp_timer clock (us).
+CoreStats core_stats() {
+  CoreStats s;
+  TaskStatus_t tasks[kMaxTasksForStats];
+  uint32_t total = 0;
+  const UBaseType_t n = uxTaskGetSystemState(tasks, kMaxTasksForStats, &total);
+  uint64_t idle[2] = {total, total};
+  for (UBaseType_t i = 0; i < n; ++i) {
+    for (BaseType_t core = 0; core < 2; ++core) {
+      if (tasks[i].xHandle == xTaskGetIdleTaskHandleForCPU(core)) idle[core] = tasks[i].ulRunTimeCounter;
+    }
+  }
+  s.wall_us = total;
+  s.busy_us[kRadioCore] = total - idle[kRadioCore];
+  s.busy_us[kControlCore] = total - idle[kControlCore];
+  s.valve_latency_max_us = g_rt.valve_latency_max_us.load(std::memory_order_relaxed);
+  s.dropped = g_rt.dropped.load(std::memory_order_relaxed);
+  s.control_dropped = g_rt.control_dropped.load(std::memory_order_relaxed);
+  return s;
+}
+
+}  // namespace agro
+
+#endif  // ESP_PLATFORM
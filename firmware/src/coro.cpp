@@ -0,0 +1,127 @@
+#include "agro/coro.hpp"
+
+#if defined(ESP_PLATFORM)
+
+#include <driver/gpio.h>
+#include <esp_cpu.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+namespace agro {
+namespace {
+
+constexpr int kMaxEdgePins = 40;
+EdgeSignal* g_edge_signals[kMaxEdgePins] = {};
+bool g_isr_service_installed = false;
+
+uint32_t now_ms() { return static_cast<uint32_t>(esp_timer_get_time() / 1000); }
+
+void edge_isr(void* arg) {
+  auto* signal = static_cast<EdgeSignal*>(arg);
+  signal->fire();
+  if (signal->notify_task) {
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(static_cast<TaskHandle_t>(signal->notify_task), &woken);
+    portYIELD_FROM_ISR(woken);
+  }
+}
+
+// Switch-cost measurement: one coroutine yielding back to the scheduler
+// versus two tasks handing a notification back and forth.
+Task<void> yielder(Scheduler& sched, uint32_t rounds) {
+  for (uint32_t i = 0; i < rounds; ++i) co_await sched.yield();
+}
+
+struct PingPong {
+  TaskHandle_t ping = nullptr;
+  TaskHandle_t pong = nullptr;
+  uint32_t rounds = 0;
+  uint32_t cycles = 0;
+  TaskHandle_t done = nullptr;
+};
+
+void pong_task(void* arg) {
+  auto* pp = static_cast<PingPong*>(arg);
+  for (uint32_t i = 0; i < pp->rounds; ++i) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    xTaskNotifyGive(pp->ping);
+  }
+  vTaskDelete(nullptr);
+}
+
+void ping_task(void* arg) {
+  auto* pp = static_cast<PingPong*>(arg);
+  const uint32_t t0 = esp_cpu_get_cycle_count();
+  for (uint32_t i = 0; i < pp->rounds; ++i) {
+    xTaskNotifyGive(pp->pong);
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+  }
+  pp->cycles = esp_cpu_get_cycle_count() - t0;
+  xTaskNotifyGive(pp->done);
+  vTaskDelete(nullptr);
+}
+
+}  // namespace
+
+void run_drivers(Scheduler& sched) {
+  while (!sched.idle()) {
+    const uint32_t wait_ms = sched.poll(now_ms());
+    if (wait_ms == 0) continue;
+    ulTaskNotifyTake(pdTRUE, wait_ms == Scheduler::kForever ? portMAX_DELAY : pdMS_TO_TICKS(wait_ms) + 1);
+  }
+}
+
+bool attach_edge(EdgeSignal& signal, int pin, bool rising) {
+  if (pin < 0 || pin >= kMaxEdgePins) return false;
+  const auto gpio = static_cast<gpio_num_t>(pin);
+  signal.notify_task = xTaskGetCurrentTaskHandle();
+  if (!g_isr_service_installed) {
+    const esp_err_t err = gpio_install_isr_service(0);
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) return false;
+    g_isr_service_installed = true;
+  }
+  gpio_set_direction(gpio, GPIO_MODE_INPUT);
+  gpio_set_intr_type(gpio, rising ? GPIO_INTR_POSEDGE : GPIO_INTR_NEGEDGE);
+  if (gpio_isr_handler_add(gpio, &edge_isr, &signal) != ESP_OK) return false;
+  g_edge_signals[pin] = &signal;
+  return gpio_intr_enable(gpio) == ESP_OK;
+}
+
+void detach_edge(int pin) {
+  if (pin < 0 || pin >= kMaxEdgePins || !g_edge_signals[pin]) return;
+  const auto gpio = static_cast<gpio_num_t>(pin);
+  gpio_intr_disable(gpio);
+  gpio_isr_handler_remove(gpio);
+  g_edge_signals[pin] = nullptr;
+}
+
+SwitchCost measure_switch_cost(uint32_t rounds) {
+  SwitchCost cost = {};
+  if (rounds == 0) return cost;
+
+  Scheduler sched;
+  if (sched.spawn(yielder(sched, rounds))) {
+    const uint32_t t0 = esp_cpu_get_cycle_count();
+    while (!sched.idle()) sched.poll(0);
+    cost.coroutine_cycles = (esp_cpu_get_cycle_count() - t0) / rounds;
+  }
+
+  // Both tasks on the caller's core at the caller's priority, so every
+  // hand-off is a full context switch.
+  static PingPong pp;
+  pp = PingPong{};
+  pp.rounds = rounds;
+  pp.done = xTaskGetCurrentTaskHandle();
+  const BaseType_t core = xPortGetCoreID();
+  const UBaseType_t prio = uxTaskPriorityGet(nullptr);
+  if (xTaskCreatePinnedToCore(&pong_task, "pong", 2048, &pp, prio, &pp.pong, core) != pdPASS) return cost;
+  if (xTaskCreatePinnedToCore(&ping_task, "ping", 2048, &pp, prio, &pp.ping, core) != pdPASS) return cost;
+  ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+  cost.task_cycles = pp.cycles / rounds;
+  return cost;
+}
+
+}  // namespace agro
+
+#endif  // ESP_PLATFORM
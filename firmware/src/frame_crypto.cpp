@@ -0,0 +1,109 @@
+#include "agro/frame_crypto.hpp"
+
+#if defined(ESP_PLATFORM)
+
+#include <aes/esp_aes.h>
+#include <esp_attr.h>
+#include <nvs.h>
+
+namespace agro {
+namespace {
+
+// Provisioned in the "agrokeys" namespace of the encrypted NVS partition:
+// "device_id" (u32), "key" (16-byte blob), "key_id" (u8). "epoch" (u32) is
+// written here.
+constexpr const char* kNamespace = "agrokeys";
+
+// Every member initialized, so the RTC_DATA_ATTR instance below is
+// constant-initialized: a startup constructor would run on every wake,
+// zero the counter but leave ready set, and reuse nonces. constinit makes
+// that a compile error rather than a field failure.
+struct CryptoState {
+  bool ready = false;
+  uint8_t key_id = 0;
+  uint32_t device_id = 0;
+  GcmKey key = {};
+  FrameCounter uplink;
+  ReplayWindow downlink;
+};
+
+RTC_DATA_ATTR constinit CryptoState g_state;
+RTC_DATA_ATTR constinit SessionClient g_session;
+
+FrameCryptoStatus load() {
+  nvs_handle_t h;
+  if (nvs_open(kNamespace, NVS_READWRITE, &h) != ESP_OK) return FrameCryptoStatus::kStorage;
+  uint8_t key[16];
+  size_t key_len = sizeof(key);
+  uint32_t device_id = 0, epoch = 0;
+  uint8_t key_id = 0;
+  FrameCryptoStatus status = FrameCryptoStatus::kNoKey;
+  if (nvs_get_blob(h, "key", key, &key_len) == ESP_OK && key_len == sizeof(key) &&
+      nvs_get_u32(h, "device_id", &device_id) == ESP_OK) {
+    nvs_get_u8(h, "key_id", &key_id);
+    nvs_get_u32(h, "epoch", &epoch);  // absent before the first boot
+    // Persist the bump before sealing anything under the new epoch.
+    status = epoch < kMaxEpoch && nvs_set_u32(h, "epoch", epoch + 1) == ESP_OK && nvs_commit(h) == ESP_OK
+                 ? FrameCryptoStatus::kOk
+                 : FrameCryptoStatus::kStorage;
+  }
+  nvs_close(h);
+  if (status != FrameCryptoStatus::kOk) return status;
+
+  g_state = CryptoState();
+  gcm_init(&g_state.key, key);
+  g_state.key_id = key_id;
+  g_state.device_id = device_id;
+  g_state.uplink.epoch = epoch + 1;
+  g_state.ready = true;
+  g_session.set_device(device_id, key_id, key);
+  return status;
+}
+
+}  // namespace
+
+void Esp32AesCtr::operator()(const uint8_t ctr[16], uint8_t* data, size_t len) const {
+  // The accelerator expands the key itself; setkey only loads 16 bytes.
+  esp_aes_context ctx;
+  esp_aes_init(&ctx);
+  esp_aes_setkey(&ctx, key.key, 128);
+  uint8_t counter[16], stream[16];
+  for (int i = 0; i < 16; ++i) counter[i] = ctr[i];
+  size_t off = 0;
+  esp_aes_crypt_ctr(&ctx, len, &off, counter, stream, data, data);
+  esp_aes_free(&ctx);
+}
+
+FrameCryptoStatus frame_crypto_begin(bool cold) {
+  if (!cold && g_state.ready) return FrameCryptoStatus::kOk;
+  return load();
+}
+
+size_t frame_seal_uplink(const uint8_t* packet, size_t len, uint8_t* out, size_t capacity) {
+  if (!g_state.ready) return 0;
+  SealedHeader h;
+  h.dir = FrameDir::kUplink;
+  h.key_id = g_state.key_id;
+  h.device_id = g_state.device_id;
+  if (!g_state.uplink.next(&h)) return 0;
+  return seal_frame(g_state.key, Esp32AesCtr{g_state.key}, h, packet, len, out, capacity);
+}
+
+bool frame_open_downlink(uint8_t* frame, size_t len, uint8_t** payload, size_t* payload_len) {
+  SealedHeader h;
+  if (!g_state.ready || !parse_sealed_header(frame, len, &h)) return false;
+  if (h.dir != FrameDir::kDownlink || h.device_id != g_state.device_id || h.key_id != g_state.key_id) return false;
+  // Downlinks are sealed under our current uplink epoch, so nothing sent to
+  // an earlier boot is accepted even though the window restarts empty.
+  if (h.epoch != g_state.uplink.epoch) return false;
+  if (!g_state.downlink.fresh(h.epoch, h.counter)) return false;
+  if (!open_frame(g_state.key, Esp32AesCtr{g_state.key}, frame, len, h, payload, payload_len)) return false;
+  g_state.downlink.accept(h.epoch, h.counter);
+  return true;
+}
+
+SessionClient& frame_session() { return g_session; }
+
+}  // namespace agro
+
+#endif  // ESP_PLATFORM
@@ -0,0 +1,62 @@
+#include "agro/gps_power.hpp"
+
+#if defined(ESP_PLATFORM)
+
+#include <esp_attr.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include "agro/uart_rx.hpp"
+
+namespace agro {
+namespace {
+
+// constinit: survives deep sleep, reset only by a power-on, which also loses
+// the receiver's state unless V_BCKP is fitted.
+RTC_DATA_ATTR constinit GpsPowerManager g_manager;
+
+void send(const uint8_t* frame, size_t len) { gps_uart().write(frame, len); }
+
+}  // namespace
+
+void gps_power_park(const GpsPlan& plan, uint32_t now_s) {
+  uint8_t frame[kUbxMaxFrame];
+  switch (plan.mode) {
+    case GpsMode::kContinuous:
+      send(frame, ubx_cfg_rxm(false, frame));
+      break;
+    case GpsMode::kCyclic:
+      send(frame, ubx_cfg_pm2(g_manager.params().cyclic_update_ms, 60000, frame));
+      send(frame, ubx_cfg_rxm(true, frame));
+      break;
+    case GpsMode::kBackup:
+      send(frame, ubx_rxm_pmreq(plan.backup_ms, frame));
+      break;
+    case GpsMode::kCount:
+      return;
+  }
+  g_manager.entered(plan.mode, now_s);
+}
+
+GpsStart gps_power_wake(uint32_t now_s) {
+  const GpsStart start = g_manager.start_at(now_s);
+  if (g_manager.mode() == GpsMode::kBackup) {
+    // Any edge on the receiver's RX wakes it from backup; it ignores UART
+    // input for a moment while it boots, so the CFG-RXM follows after that.
+    static const uint8_t kPoke[8] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+    send(kPoke, sizeof(kPoke));
+    vTaskDelay(pdMS_TO_TICKS(100));
+  }
+  if (g_manager.mode() != GpsMode::kContinuous) {
+    uint8_t frame[kUbxMaxFrame];
+    send(frame, ubx_cfg_rxm(false, frame));
+  }
+  g_manager.entered(GpsMode::kContinuous, now_s);
+  return start;
+}
+
+GpsPowerManager& gps_power_manager() { return g_manager; }
+
+}  // namespace agro
+
+#endif  // ESP_PLATFORM
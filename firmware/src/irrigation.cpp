@@ -0,0 +1,74 @@
+#include "agro/irrigation.hpp"
+
+#if defined(ESP_PLATFORM)
+
+#include <driver/gpio.h>
+#include <driver/pulse_cnt.h>
+
+#include "agro/board.hpp"
+
+namespace agro {
+namespace {
+
+// Glitch filter: ~12.7 us (just under the 1023 APB cycles the filter
+// holds) rejects relay-coil ringing while the meter's fastest pulses are
+// milliseconds apart.
+constexpr uint32_t kFilterNs = 12700;
+
+}  // namespace
+
+bool FlowMeter::begin() {
+  // The driver extends the 16-bit counter itself: with accum_count it adds
+  // kHighLimit in its interrupt each time the watch point at the limit
+  // resets the hardware count.
+  pcnt_unit_config_t unit_cfg = {};
+  unit_cfg.low_limit = -1;  // must be negative; the count never falls
+  unit_cfg.high_limit = kHighLimit;
+  unit_cfg.flags.accum_count = 1;
+  pcnt_unit_handle_t unit = nullptr;
+  if (pcnt_new_unit(&unit_cfg, &unit) != ESP_OK) return false;
+  unit_ = unit;
+
+  pcnt_glitch_filter_config_t filter = {};
+  filter.max_glitch_ns = kFilterNs;
+  if (pcnt_unit_set_glitch_filter(unit, &filter) != ESP_OK) return false;
+
+  pcnt_chan_config_t chan_cfg = {};
+  chan_cfg.edge_gpio_num = board::kFlowMeterPin;
+  chan_cfg.level_gpio_num = -1;
+  pcnt_channel_handle_t chan = nullptr;
+  if (pcnt_new_channel(unit, &chan_cfg, &chan) != ESP_OK) return false;
+  if (pcnt_channel_set_edge_action(chan, PCNT_CHANNEL_EDGE_ACTION_INCREASE, PCNT_CHANNEL_EDGE_ACTION_HOLD) != ESP_OK) {
+    return false;
+  }
+  if (pcnt_unit_add_watch_point(unit, kHighLimit) != ESP_OK) return false;
+
+  return pcnt_unit_enable(unit) == ESP_OK && pcnt_unit_clear_count(unit) == ESP_OK && pcnt_unit_start(unit) == ESP_OK;
+}
+
+uint32_t FlowMeter::pulses() {
+  int count = 0;
+  if (!unit_ || pcnt_unit_get_count(static_cast<pcnt_unit_handle_t>(unit_), &count) != ESP_OK) return last_;
+  const uint32_t total = static_cast<uint32_t>(count);
+  // The counter resets at the limit a moment before the driver's interrupt
+  // adds the wrap; hold the last value rather than report a step backwards.
+  if (total < last_) return last_;
+  return last_ = total;
+}
+
+bool ValveRelay::begin() {
+  const gpio_num_t pin = static_cast<gpio_num_t>(board::kValveRelayPin);
+  if (gpio_reset_pin(pin) != ESP_OK) return false;
+  if (gpio_set_direction(pin, GPIO_MODE_OUTPUT) != ESP_OK) return false;
+  set(false);
+  return true;
+}
+
+void ValveRelay::set(bool open) {
+  gpio_set_level(static_cast<gpio_num_t>(board::kValveRelayPin), open ? 1 : 0);
+  open_ = open;
+}
+
+}  // namespace agro
+
+#endif  // ESP_PLATFORM
@@ -0,0 +1,31 @@
+#include "agro/memory.hpp"
+
+namespace agro::mem {
+namespace {
+
+GsmLinePool g_gsm_lines;
+GsmPayloadArena g_gsm_payload;
+GpsFramePool g_gps_frames;
+TelemetryPool g_telemetry;
+CoroFramePool g_coro_frames;
+
+}  // namespace
+
+GsmLinePool& gsm_lines() { return g_gsm_lines; }
+GsmPayloadArena& gsm_payload() { return g_gsm_payload; }
+GpsFramePool& gps_frames() { return g_gps_frames; }
+TelemetryPool& telemetry() { return g_telemetry; }
+CoroFramePool& coro_frames() { return g_coro_frames; }
+
+void reset_wake_pools() {
+  g_gsm_lines.reset();
+  g_gsm_payload.reset();
+  g_gps_frames.reset();
+  g_telemetry.reset();
+}
+
+PoolReport pool_report() {
+  return {g_gsm_lines.stats(), g_gsm_payload.stats(), g_gps_frames.stats(), g_telemetry.stats(), g_coro_frames.stats()};
+}
+
+}  // namespace agro::mem
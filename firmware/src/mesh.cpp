@@ -0,0 +1,205 @@
+#include "agro/mesh.hpp"
+
+#if defined(ESP_PLATFORM)
+
+#include <esp_attr.h>
+#include <esp_now.h>
+#include <esp_private/esp_clk.h>
+#include <esp_rom_sys.h>
+#include <esp_system.h>
+#include <esp_wifi.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+
+namespace agro {
+namespace {
+
+// Constant-initialized: the node keeps its role, timeline, learned clock and
+// store across deep sleep; a power-on starts over with mesh_begin().
+RTC_DATA_ATTR constinit MeshNode<kMeshStoreBytes> g_node;
+RTC_DATA_ATTR constinit MeshParams g_params;
+
+const uint8_t kBroadcast[ESP_NOW_ETH_ALEN] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+
+struct Rx {
+  uint8_t mac[ESP_NOW_ETH_ALEN];
+  uint8_t len;
+  uint8_t data[kMeshFrameBytes];
+  uint32_t ms;
+};
+
+QueueHandle_t g_rx = nullptr;
+QueueHandle_t g_sent = nullptr;  // one bool per send callback
+
+// Both callbacks run in the Wi-Fi task.
+void on_recv(const esp_now_recv_info_t* info, const uint8_t* data, int len) {
+  if (len <= 0 || len > int(kMeshFrameBytes)) return;
+  Rx rx;
+  rx.ms = mesh_now_ms();
+  std::memcpy(rx.mac, info->src_addr, ESP_NOW_ETH_ALEN);
+  rx.len = uint8_t(len);
+  std::memcpy(rx.data, data, size_t(len));
+  xQueueSend(g_rx, &rx, 0);
+}
+
+void on_sent(const uint8_t*, esp_now_send_status_t status) {
+  const bool ok = status == ESP_NOW_SEND_SUCCESS;
+  xQueueSend(g_sent, &ok, 0);
+}
+
+// Wi-Fi and ESP-NOW for the length of one window.
+class Radio {
+ public:
+  Radio() : ok_(start()) {}
+  ~Radio() {
+    // Each fails harmlessly if its init never ran.
+    esp_now_deinit();
+    esp_wifi_stop();
+    esp_wifi_deinit();
+  }
+
+  // False if Wi-Fi or ESP-NOW failed to come up: nothing is sent or heard.
+  bool ok() const { return ok_; }
+
+  // True once the MAC acknowledged it (broadcasts: once it went out).
+  bool send(const uint8_t* mac, const uint8_t* frame, size_t len) {
+    bool ok = false;
+    return ok_ && add_peer(mac) && esp_now_send(mac, frame, len) == ESP_OK &&
+           xQueueReceive(g_sent, &ok, pdMS_TO_TICKS(50)) == pdTRUE && ok;
+  }
+
+  // The next frame received before end_ms.
+  bool receive(Rx* rx, uint32_t end_ms) {
+    if (!ok_) return false;
+    const int32_t left = int32_t(end_ms - mesh_now_ms());
+    if (left <= 0) return xQueueReceive(g_rx, rx, 0) == pdTRUE;
+    return xQueueReceive(g_rx, rx, pdMS_TO_TICKS(left) + 1) == pdTRUE;
+  }
+
+ private:
+  static bool start() {
+    if (!g_rx) {
+      g_rx = xQueueCreate(8, sizeof(Rx));
+      g_sent = xQueueCreate(4, sizeof(bool));
+    }
+    if (!g_rx || !g_sent) return false;
+    xQueueReset(g_rx);
+    xQueueReset(g_sent);
+    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+    return esp_wifi_init(&cfg) == ESP_OK && esp_wifi_set_storage(WIFI_STORAGE_RAM) == ESP_OK &&
+           esp_wifi_set_mode(WIFI_MODE_STA) == ESP_OK && esp_wifi_start() == ESP_OK &&
+           esp_wifi_set_channel(kMeshChannel, WIFI_SECOND_CHAN_NONE) == ESP_OK && esp_now_init() == ESP_OK &&
+           esp_now_register_recv_cb(on_recv) == ESP_OK && esp_now_register_send_cb(on_sent) == ESP_OK &&
+           add_peer(kBroadcast);
+  }
+
+  static bool add_peer(const uint8_t* mac) {
+    if (esp_now_is_peer_exist(mac)) return true;
+    esp_now_peer_info_t peer = {};
+    std::memcpy(peer.peer_addr, mac, ESP_NOW_ETH_ALEN);
+    peer.channel = kMeshChannel;
+    peer.ifidx = WIFI_IF_STA;
+    return esp_now_add_peer(&peer) == ESP_OK;
+  }
+
+  bool ok_;
+};
+
+// Slots are a tick or less: sleep whole ticks, spin the rest.
+void wait_until(uint32_t ms) {
+  const int32_t left = int32_t(ms - mesh_now_ms());
+  const TickType_t ticks = left > 0 ? pdMS_TO_TICKS(uint32_t(left)) : 0;
+  if (ticks > 1) vTaskDelay(ticks - 1);
+  while (int32_t(ms - mesh_now_ms()) > 0) esp_rom_delay_us(100);
+}
+
+bool is_beacon(const Rx& rx) { return rx.len > 0 && MeshFrame(rx.data[0]) == MeshFrame::kBeacon; }
+
+// A member's report after the beacon in rx: its own slot, then as many
+// frames as the slot and the budget allow.
+void report(Radio& radio, const Rx& rx) {
+  const uint32_t beacon_ms = rx.ms - uint32_t(rx.data[kMeshHeaderBytes + 10]) * g_params.copy_spacing_ms;
+  wait_until(beacon_ms + g_node.slot_offset_ms());
+  uint8_t frame[kMeshFrameBytes];
+  for (uint8_t k = 0; k < g_node.slot_frames(); ++k) {
+    size_t count;
+    const size_t len = g_node.report(frame, sizeof(frame), &count);
+    if (len == 0 || !radio.send(rx.mac, frame, len)) break;
+    g_node.reported(count);
+    if (g_node.store().empty()) break;
+  }
+}
+
+bool uplink_window(Radio& radio, const MeshWindow& w) {
+  uint8_t frame[kMeshFrameBytes];
+  const size_t len = g_node.beacon(frame, sizeof(frame));
+  for (uint8_t c = 0; c < g_params.beacon_copies; ++c) {
+    MeshNode<kMeshStoreBytes>::mark_copy(frame, c);
+    radio.send(kBroadcast, frame, len);
+  }
+  Rx rx;
+  while (radio.receive(&rx, w.wake_ms + w.listen_ms)) {
+    if (!g_node.on_frame(rx.data, rx.len, rx.ms) || !is_beacon(rx)) continue;
+    // Another uplink's beacon: if we are still the uplink, tell it.
+    if (g_node.role() == MeshRole::kUplink) {
+      size_t count;
+      const size_t n = g_node.report(frame, sizeof(frame), &count);
+      radio.send(rx.mac, frame, n);
+    }
+  }
+  return g_node.window_done(false);
+}
+
+}  // namespace
+
+void mesh_begin(const MeshParams& p, bool can_uplink) {
+  uint8_t mac[6];
+  esp_read_mac(mac, ESP_MAC_WIFI_STA);
+  g_params = p;
+  g_node.begin(uint32_t(mac[2]) << 24 | uint32_t(mac[3]) << 16 | uint32_t(mac[4]) << 8 | mac[5], p, can_uplink);
+}
+
+bool mesh_run_window(uint16_t soc_permille) {
+  g_node.set_soc(soc_permille);
+  if (g_node.role() == MeshRole::kUplink) {
+    const MeshWindow w = g_node.window();
+    wait_until(w.wake_ms);
+    Radio radio;
+    return uplink_window(radio, w);
+  }
+
+  Rx rx;
+  bool heard = false;
+  if (g_node.role() == MeshRole::kSearching) {
+    Radio radio;
+    // Hearing nothing with the radio down is no reason to become an uplink.
+    if (!radio.ok()) return false;
+    const uint32_t end = mesh_now_ms() + g_node.search_ms(esp_random() % (g_params.window_period_ms / 2));
+    while (!heard && radio.receive(&rx, end)) heard = g_node.on_frame(rx.data, rx.len, rx.ms) && is_beacon(rx);
+    if (!heard) {
+      // Nobody around: this node's first window as uplink is now.
+      g_node.found_nothing(mesh_now_ms());
+      return false;
+    }
+    report(radio, rx);
+    return g_node.window_done(true);
+  }
+
+  const MeshWindow w = g_node.window();
+  wait_until(w.wake_ms);
+  Radio radio;
+  while (!heard && radio.receive(&rx, w.wake_ms + w.listen_ms)) {
+    heard = g_node.on_frame(rx.data, rx.len, rx.ms) && is_beacon(rx);
+  }
+  if (heard) report(radio, rx);
+  return g_node.window_done(heard);
+}
+
+uint32_t mesh_now_ms() { return uint32_t(esp_clk_rtc_time() / 1000); }
+
+MeshNode<kMeshStoreBytes>& mesh_node() { return g_node; }
+
+}  // namespace agro
+
+#endif  // ESP_PLATFORM
@@ -0,0 +1,66 @@
+#include "agro/modem_power.hpp"
+
+#if defined(ESP_PLATFORM)
+
+#include <driver/gpio.h>
+#include <driver/rtc_io.h>
+#include <esp_attr.h>
+
+#include "agro/board.hpp"
+
+namespace agro {
+namespace {
+
+constexpr gpio_num_t kPowerPin = static_cast<gpio_num_t>(board::kGsmPowerEnablePin);
+constexpr gpio_num_t kDtrPin = static_cast<gpio_num_t>(board::kGsmDtrPin);
+
+// constinit, so it keeps what it learned across deep sleep and is reset to
+// the defaults only by a power-on.
+RTC_DATA_ATTR constinit ModemPowerPolicy g_policy;
+RTC_DATA_ATTR constinit ModemIdle g_parked = ModemIdle::kPowerOff;
+
+void drive(gpio_num_t pin, int level) {
+  gpio_set_direction(pin, GPIO_MODE_OUTPUT);
+  gpio_set_level(pin, level);
+}
+
+}  // namespace
+
+void modem_power_on() {
+  drive(kDtrPin, 0);
+  drive(kPowerPin, 1);
+}
+
+void modem_park(ModemIdle idle) {
+  // GPIO23 is a digital pad: its hold needs the deep-sleep hold enabled too.
+  // GPIO32 is an RTC pad and holds on its own.
+  if (idle == ModemIdle::kSleep) {
+    drive(kPowerPin, 1);
+    drive(kDtrPin, 1);
+  } else {
+    drive(kPowerPin, 0);
+    drive(kDtrPin, 0);  // no back-feeding the unpowered module through DTR
+  }
+  gpio_hold_en(kPowerPin);
+  rtc_gpio_hold_en(kDtrPin);
+  gpio_deep_sleep_hold_en();
+  g_parked = idle;
+}
+
+void modem_unpark() {
+  // Load the held level into the pad registers before releasing, so the rail
+  // does not glitch off under a sleeping module.
+  drive(kPowerPin, g_parked == ModemIdle::kSleep ? 1 : 0);
+  gpio_deep_sleep_hold_dis();
+  gpio_hold_dis(kPowerPin);
+  rtc_gpio_hold_dis(kDtrPin);
+  rtc_gpio_deinit(kDtrPin);
+  drive(kDtrPin, 0);
+  g_parked = ModemIdle::kPowerOff;
+}
+
+ModemPowerPolicy& modem_power_policy() { return g_policy; }
+
+}  // namespace agro
+
+#endif  // ESP_PLATFORM
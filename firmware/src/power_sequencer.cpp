@@ -0,0 +1,70 @@
+#include "agro/power_sequencer.hpp"
+
+#if defined(ESP_PLATFORM)
+
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+namespace agro {
+namespace {
+
+PowerSequencer g_sequencer;
+
+// Tasks on both cores reserve; the sequencer itself is not thread-safe. A
+// mutex, not a critical section: reserve() searches the whole table, far
+// too long to run with this core's interrupts masked. Task context only.
+class Locked {
+ public:
+  Locked() { xSemaphoreTake(mutex(), portMAX_DELAY); }
+  ~Locked() { xSemaphoreGive(mutex()); }
+
+ private:
+  static SemaphoreHandle_t mutex() {
+    static StaticSemaphore_t storage;
+    static const SemaphoreHandle_t m = xSemaphoreCreateMutexStatic(&storage);
+    return m;
+  }
+};
+
+uint32_t now_ms() { return static_cast<uint32_t>(esp_timer_get_time() / 1000); }
+
+}  // namespace
+
+PowerSequencer::Ticket power_acquire(PowerLoad load, uint32_t max_defer_ms, uint32_t duration_ms) {
+  PowerSequencer::Ticket ticket;
+  const uint32_t requested = now_ms();
+  uint32_t start;
+  {
+    Locked lock;
+    start = g_sequencer.reserve(load, requested, max_defer_ms, &ticket, duration_ms);
+  }
+  if (start == PowerSequencer::kNever) return PowerSequencer::kNoTicket;
+
+  for (;;) {
+    const uint32_t now = now_ms();
+    bool go;
+    {
+      Locked lock;
+      g_sequencer.expire(now);
+      start = g_sequencer.start_of(ticket);
+      go = g_sequencer.may_start(ticket, now);
+      if (start == PowerSequencer::kNever) g_sequencer.release(ticket);
+    }
+    if (go) return ticket;
+    // Pushed past its deadline by a higher-priority load.
+    if (start == PowerSequencer::kNever) return PowerSequencer::kNoTicket;
+    const TickType_t wait = pdMS_TO_TICKS(start - now);
+    vTaskDelay(wait > 0 ? wait : 1);
+  }
+}
+
+void power_release(PowerSequencer::Ticket ticket) {
+  Locked lock;
+  g_sequencer.release(ticket);
+}
+
+}  // namespace agro
+
+#endif  // ESP_PLATFORM
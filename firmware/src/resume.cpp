@@ -0,0 +1,92 @@
+#include "agro/resume.hpp"
+
+#if defined(ESP_PLATFORM)
+
+#include <esp32/rom/crc.h>
+#include <esp_attr.h>
+#include <esp_private/esp_clk.h>
+#include <esp_sleep.h>
+#include <soc/rtc.h>
+#include <soc/rtc_cntl_reg.h>
+
+#include "agro/config_store.hpp"
+
+namespace agro {
+namespace {
+
+enum StubVerdict : uint32_t { kNotRun = 0, kValid, kInvalid };
+
+// constinit: a startup constructor would wipe what the wake stub checked.
+RTC_DATA_ATTR constinit ResumeSnapshot g_snapshot;
+RTC_DATA_ATTR constinit WakeLatencyStats g_stats;
+RTC_DATA_ATTR uint32_t g_stub_verdict = kNotRun;
+RTC_DATA_ATTR uint64_t g_stub_ticks = 0;
+
+WakeTimeline g_timeline;
+
+inline uint64_t RTC_IRAM_ATTR rtc_ticks() {
+  SET_PERI_REG_MASK(RTC_CNTL_TIME_UPDATE_REG, RTC_CNTL_TIME_UPDATE);
+  while (GET_PERI_REG_MASK(RTC_CNTL_TIME_UPDATE_REG, RTC_CNTL_TIME_VALID) == 0) {
+  }
+  return READ_PERI_REG(RTC_CNTL_TIME0_REG) | (uint64_t(READ_PERI_REG(RTC_CNTL_TIME1_REG)) << 32);
+}
+
+uint32_t us_since_stub() {
+  const uint64_t ticks = rtc_ticks() - g_stub_ticks;
+  return static_cast<uint32_t>(rtc_time_slowclk_to_us(ticks, esp_clk_slowclk_cal_get()));
+}
+
+}  // namespace
+}  // namespace agro
+
+// Runs from RTC fast memory before the bootloader loads the app. Only ROM
+// functions and RTC-resident code are usable here: the CRC is the ROM's
+// crc32_le, which matches agro::crc32 (both invert on entry and exit).
+extern "C" void RTC_IRAM_ATTR esp_wake_deep_sleep(void) {
+  esp_default_wake_deep_sleep();
+  using namespace agro;
+  g_stub_ticks = rtc_ticks();
+  const ResumeSnapshot& s = g_snapshot;
+  const bool ok = s.magic == kResumeMagic && s.version == kResumeVersion && s.state_bytes == sizeof(ResumeState) &&
+                  crc32_le(0, reinterpret_cast<const uint8_t*>(&s), offsetof(ResumeSnapshot, crc)) == s.crc;
+  g_stub_verdict = ok ? kValid : kInvalid;
+}
+
+namespace agro {
+
+bool resume_begin(ResumeState* state) {
+  const bool woke = esp_sleep_get_wakeup_cause() != ESP_SLEEP_WAKEUP_UNDEFINED;
+  const bool warm = woke && g_stub_verdict == kValid;
+  if (!woke) g_stub_ticks = rtc_ticks();  // no stub: count from here
+  g_stub_verdict = kNotRun;
+  g_timeline.begin(warm);
+  g_timeline.mark(WakeMark::kStub, 0);
+  g_timeline.mark(WakeMark::kApp, us_since_stub());
+  if (!warm) {
+    *state = ResumeState();
+    resume_invalidate(&g_snapshot);
+    return false;
+  }
+  *state = g_snapshot.state;
+  resume_invalidate(&g_snapshot);
+  // A reflashed config image invalidates the schedule cursor, nothing else.
+  if (state->schedule.config_generation != boot_config().generation()) {
+    state->schedule.next_program = ScheduleCursor::kNone;
+    state->schedule.config_generation = boot_config().generation();
+  }
+  return true;
+}
+
+void resume_mark(WakeMark m) { g_timeline.mark(m, us_since_stub()); }
+
+void resume_commit(const ResumeState& state) {
+  g_stats.add(g_timeline);
+  resume_seal(&g_snapshot, state);
+}
+
+const WakeTimeline& resume_timeline() { return g_timeline; }
+const WakeLatencyStats& resume_latency_stats() { return g_stats; }
+
+}  // namespace agro
+
+#endif  // ESP_PLATFORM
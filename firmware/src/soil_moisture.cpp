@@ -0,0 +1,214 @@
+#include "agro/soil_moisture.hpp"
+
+#if defined(ESP_PLATFORM)
+
+#include <driver/rtc_io.h>
+#include <esp32/ulp.h>
+#include <esp_adc/adc_oneshot.h>
+#include <esp_rom_sys.h>
+#include <esp_sleep.h>
+#include <soc/rtc_cntl_reg.h>
+#include <soc/rtc_io_reg.h>
+#include <ulp_adc.h>
+
+#include "agro/board.hpp"
+
+namespace agro {
+namespace {
+
+constexpr adc_channel_t kAdcChannel = static_cast<adc_channel_t>(board::kSoilProbeAdcChannel);
+// 0-3.1 V; the probe divider tops out below that.
+constexpr adc_atten_t kAdcAtten = ADC_ATTEN_DB_12;
+constexpr gpio_num_t kPowerPin = static_cast<gpio_num_t>(board::kSoilProbePowerPin);
+
+// ULP-FSM labels.
+enum : uint32_t {
+  kLabelSample = 1,
+  kLabelSwap1,
+  kLabelSort1Done,
+  kLabelSwap2,
+  kLabelSort2Done,
+  kLabelSwap3,
+  kLabelSort3Done,
+  kLabelRearm,
+  kLabelDone,
+};
+
+}  // namespace
+
+bool SoilMoistureSensor::begin() {
+  if (cfg_.oversample_shift > kSoilMaxOversampleShift) cfg_.oversample_shift = kSoilMaxOversampleShift;
+
+  rtc_gpio_init(kPowerPin);
+  rtc_gpio_set_direction(kPowerPin, RTC_GPIO_MODE_OUTPUT_ONLY);
+  rtc_gpio_set_level(kPowerPin, 0);
+  rtc_gpio_hold_dis(kPowerPin);
+
+  for (size_t i = 0; i < kSoilVarCount; ++i) RTC_SLOW_MEM[i] = 0;
+  return load_program();
+}
+
+bool SoilMoistureSensor::load_program() {
+  const int rtc_io = rtc_io_number_get(kPowerPin);
+  const uint32_t on_bit = RTC_GPIO_OUT_DATA_W1TS_S + rtc_io;
+  const uint32_t off_bit = RTC_GPIO_OUT_DATA_W1TC_S + rtc_io;
+  // I_DELAY counts 8 MHz RTC_FAST_CLK cycles in a 16-bit field.
+  const uint32_t settle_cycles = std::min<uint32_t>(cfg_.settle_us * 8u, 0xffff);
+  const uint32_t samples = 1u << cfg_.oversample_shift;
+
+  // R3 stays zero as the base register for the variable block. A sort step
+  // orders (x, y) by subtracting and branching on the ALU overflow flag,
+  // which the FSM sets when the result would be negative.
+  const ulp_insn_t program[] = {
+      // Power the probe and let it settle.
+      I_WR_REG(RTC_GPIO_OUT_W1TS_REG, on_bit, on_bit, 1),
+      I_DELAY(settle_cycles),
+
+      // Oversample into R0.
+      I_MOVI(R0, 0),
+      I_STAGE_RST(),
+      M_LABEL(kLabelSample),
+      I_ADC(R1, 0, kAdcChannel),
+      I_ADDR(R0, R0, R1),
+      I_STAGE_INC(1),
+      M_BSLT(kLabelSample, samples),
+      I_RSHI(R0, R0, cfg_.oversample_shift),
+
+      I_WR_REG(RTC_GPIO_OUT_W1TC_REG, off_bit, off_bit, 1),
+
+      // Shift the history and count the cycle.
+      I_MOVI(R3, 0),
+      I_ST(R0, R3, kSoilVarLastRaw),
+      I_LD(R1, R3, kSoilVarHist1),
+      I_ST(R1, R3, kSoilVarHist2),
+      I_LD(R1, R3, kSoilVarHist0),
+      I_ST(R1, R3, kSoilVarHist1),
+      I_ST(R0, R3, kSoilVarHist0),
+      I_LD(R1, R3, kSoilVarCycles),
+      I_ADDI(R1, R1, 1),
+      I_ST(R1, R3, kSoilVarCycles),
+
+      // Median of three: sort (R1, R2), (R2, R3), (R1, R2); R2 is the median.
+      I_LD(R1, R3, kSoilVarHist0),
+      I_LD(R2, R3, kSoilVarHist1),
+      I_LD(R3, R3, kSoilVarHist2),
+      I_SUBR(R0, R2, R1),
+      M_BXF(kLabelSwap1),
+      M_BX(kLabelSort1Done),
+      M_LABEL(kLabelSwap1),
+      I_MOVR(R0, R1),
+      I_MOVR(R1, R2),
+      I_MOVR(R2, R0),
+      M_LABEL(kLabelSort1Done),
+      I_SUBR(R0, R3, R2),
+      M_BXF(kLabelSwap2),
+      M_BX(kLabelSort2Done),
+      M_LABEL(kLabelSwap2),
+      I_MOVR(R0, R2),
+      I_MOVR(R2, R3),
+      I_MOVR(R3, R0),
+      M_LABEL(kLabelSort2Done),
+      I_SUBR(R0, R2, R1),
+      M_BXF(kLabelSwap3),
+      M_BX(kLabelSort3Done),
+      M_LABEL(kLabelSwap3),
+      I_MOVR(R0, R1),
+      I_MOVR(R1, R2),
+      I_MOVR(R2, R0),
+      M_LABEL(kLabelSort3Done),
+      I_MOVI(R3, 0),
+      I_ST(R2, R3, kSoilVarMedian),
+
+      // Disarmed: re-arm once the soil reads wet, never wake.
+      I_LD(R0, R3, kSoilVarArmed),
+      M_BL(kLabelRearm, 1),
+
+      // Armed: wake the main cores on a dry reading.
+      I_MOVR(R0, R2),
+      M_BL(kLabelDone, cfg_.dry_raw),
+      I_MOVI(R0, 0),
+      I_ST(R0, R3, kSoilVarArmed),
+      I_LD(R0, R3, kSoilVarWakeups),
+      I_ADDI(R0, R0, 1),
+      I_ST(R0, R3, kSoilVarWakeups),
+      I_WAKE(),
+      M_BX(kLabelDone),
+
+      M_LABEL(kLabelRearm),
+      I_MOVR(R0, R2),
+      M_BGE(kLabelDone, cfg_.wet_raw + 1u),
+      I_MOVI(R0, 1),
+      I_ST(R0, R3, kSoilVarArmed),
+
+      M_LABEL(kLabelDone),
+      I_HALT(),
+  };
+
+  size_t size = sizeof(program) / sizeof(ulp_insn_t);
+  return ulp_process_macros_and_load(kSoilUlpProgramOffset, program, &size) == ESP_OK;
+}
+
+bool SoilMoistureSensor::sample_direct(uint16_t* raw) const {
+  // A oneshot unit only for this reading: ulp_adc_init() needs SAR1 free.
+  adc_oneshot_unit_handle_t adc = nullptr;
+  adc_oneshot_unit_init_cfg_t unit_cfg = {};
+  unit_cfg.unit_id = ADC_UNIT_1;
+  if (adc_oneshot_new_unit(&unit_cfg, &adc) != ESP_OK) return false;
+  adc_oneshot_chan_cfg_t chan_cfg = {};
+  chan_cfg.atten = kAdcAtten;
+  chan_cfg.bitwidth = ADC_BITWIDTH_12;
+  bool ok = adc_oneshot_config_channel(adc, kAdcChannel, &chan_cfg) == ESP_OK;
+
+  rtc_gpio_set_level(kPowerPin, 1);
+  esp_rom_delay_us(cfg_.settle_us);
+  uint32_t acc = 0;
+  const uint32_t samples = 1u << cfg_.oversample_shift;
+  for (uint32_t i = 0; ok && i < samples; ++i) {
+    int v = 0;
+    ok = adc_oneshot_read(adc, kAdcChannel, &v) == ESP_OK;
+    acc += static_cast<uint32_t>(v);
+  }
+  rtc_gpio_set_level(kPowerPin, 0);
+  adc_oneshot_del_unit(adc);
+  *raw = static_cast<uint16_t>(acc >> cfg_.oversample_shift);
+  return ok;
+}
+
+bool SoilMoistureSensor::arm() {
+  uint16_t raw;
+  if (!sample_direct(&raw)) return false;
+  RTC_SLOW_MEM[kSoilVarHist0] = raw;
+  RTC_SLOW_MEM[kSoilVarHist1] = raw;
+  RTC_SLOW_MEM[kSoilVarHist2] = raw;
+  RTC_SLOW_MEM[kSoilVarMedian] = raw;
+  RTC_SLOW_MEM[kSoilVarArmed] = raw < cfg_.dry_raw ? 1 : 0;
+
+  // Routes SAR1 to the ULP FSM's I_ADC. It keeps the unit until the next
+  // boot, which is why arm() runs once, last thing before deep sleep.
+  ulp_adc_cfg_t adc_cfg = {};
+  adc_cfg.adc_n = ADC_UNIT_1;
+  adc_cfg.channel = kAdcChannel;
+  adc_cfg.atten = kAdcAtten;
+  adc_cfg.width = ADC_BITWIDTH_12;
+  adc_cfg.ulp_mode = ADC_ULP_MODE_FSM;
+  if (ulp_adc_init(&adc_cfg) != ESP_OK) return false;
+  if (ulp_set_wakeup_period(0, cfg_.period_us) != ESP_OK) return false;
+  if (esp_sleep_enable_ulp_wakeup() != ESP_OK) return false;
+  return ulp_run(kSoilUlpProgramOffset) == ESP_OK;
+}
+
+uint16_t SoilMoistureSensor::median_raw() const {
+  return static_cast<uint16_t>(RTC_SLOW_MEM[kSoilVarMedian] & 0xffff);
+}
+
+uint16_t SoilMoistureSensor::ulp_cycles() const {
+  return static_cast<uint16_t>(RTC_SLOW_MEM[kSoilVarCycles] & 0xffff);
+}
+
+bool SoilMoistureSensor::woke_on_threshold() {
+  return esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_ULP;
+}
+
+}  // namespace agro
+
+#endif  // ESP_PLATFORM
@@ -0,0 +1,133 @@
+#include "agro/uart_rx.hpp"
+
+#if defined(ESP_PLATFORM)
+
+#include <cstring>
+
+#include <driver/uart.h>
+#include <esp_intr_alloc.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <hal/uart_ll.h>
+#include <soc/uart_periph.h>
+
+#include "agro/board.hpp"
+
+namespace agro {
+namespace {
+
+// Interrupt once the FIFO is half full, or after ~10 byte times of silence so
+// the tail of a sentence or AT response is not left sitting in hardware.
+constexpr uint8_t kRxFullThreshold = 64;
+constexpr uint8_t kRxTimeoutSymbols = 10;
+constexpr uint32_t kRxInterrupts = UART_INTR_RXFIFO_FULL | UART_INTR_RXFIFO_TOUT | UART_INTR_RXFIFO_OVF;
+
+uart_dev_t* hw_for(int uart_num) { return UART_LL_GET_HW(uart_num); }
+
+}  // namespace
+
+bool UartRx::begin(void* consumer_task) {
+  consumer_ = consumer_task;
+  const auto port = static_cast<uart_port_t>(uart_num_);
+  uart_config_t cfg = {};
+  cfg.baud_rate = static_cast<int>(baud_);
+  cfg.data_bits = UART_DATA_8_BITS;
+  cfg.parity = UART_PARITY_DISABLE;
+  cfg.stop_bits = UART_STOP_BITS_1;
+  cfg.flow_ctrl = UART_HW_FLOWCTRL_DISABLE;
+  cfg.source_clk = UART_SCLK_DEFAULT;
+  if (uart_param_config(port, &cfg) != ESP_OK) return false;
+  if (uart_set_pin(port, tx_pin_, rx_pin_, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE) != ESP_OK) return false;
+
+  uart_dev_t* hw = hw_for(uart_num_);
+  uart_ll_disable_intr_mask(hw, UART_LL_INTR_MASK);
+  uart_ll_clr_intsts_mask(hw, UART_LL_INTR_MASK);
+  uart_ll_rxfifo_rst(hw);
+  uart_ll_set_rxfifo_full_thr(hw, kRxFullThreshold);
+  uart_ll_set_rx_tout(hw, kRxTimeoutSymbols);
+
+  // No driver is installed, so the handler goes straight onto the UART's
+  // interrupt source. Not ESP_INTR_FLAG_IRAM: the ring is in DRAM but the
+  // handler is in flash, so RX pauses during flash writes, which only happen
+  // at provisioning.
+  intr_handle_t handle = nullptr;
+  if (esp_intr_alloc(uart_periph_signal[uart_num_].irq, 0, &UartRx::isr, this, &handle) != ESP_OK) return false;
+  intr_handle_ = handle;
+  uart_ll_ena_intr_mask(hw, kRxInterrupts);
+  return true;
+}
+
+void UartRx::end() {
+  uart_ll_disable_intr_mask(hw_for(uart_num_), UART_LL_INTR_MASK);
+  if (intr_handle_) {
+    esp_intr_free(static_cast<intr_handle_t>(intr_handle_));
+    intr_handle_ = nullptr;
+  }
+}
+
+void UartRx::isr(void* arg) {
+  auto* self = static_cast<UartRx*>(arg);
+  uart_dev_t* hw = hw_for(self->uart_num_);
+  const uint32_t status = uart_ll_get_intsts_mask(hw);
+
+  uint32_t avail = uart_ll_get_rxfifo_len(hw);
+  while (avail > 0) {
+    uint8_t* dst;
+    const size_t room = self->ring_.write_span(&dst);
+    if (room == 0) {
+      uint8_t discard[16];
+      const uint32_t n = avail < sizeof(discard) ? avail : sizeof(discard);
+      uart_ll_read_rxfifo(hw, discard, n);
+      self->dropped_.fetch_add(n, std::memory_order_relaxed);
+      avail -= n;
+      continue;
+    }
+    const uint32_t n = avail < room ? avail : static_cast<uint32_t>(room);
+    uart_ll_read_rxfifo(hw, dst, n);
+    self->ring_.commit(n);
+    avail -= n;
+  }
+  if (status & UART_INTR_RXFIFO_OVF) {
+    uart_ll_rxfifo_rst(hw);
+    self->dropped_.fetch_add(1, std::memory_order_relaxed);
+  }
+  uart_ll_clr_intsts_mask(hw, status);
+
+  if (self->consumer_) {
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(static_cast<TaskHandle_t>(self->consumer_), &woken);
+    portYIELD_FROM_ISR(woken);
+  }
+}
+
+size_t UartRx::write(const uint8_t* data, size_t len) {
+  uart_dev_t* hw = hw_for(uart_num_);
+  size_t done = 0;
+  while (done < len) {
+    const uint32_t room = uart_ll_get_txfifo_len(hw);
+    if (room == 0) {
+      taskYIELD();
+      continue;
+    }
+    const uint32_t n = room < len - done ? room : static_cast<uint32_t>(len - done);
+    uart_ll_write_txfifo(hw, data + done, n);
+    done += n;
+  }
+  return done;
+}
+
+size_t UartRx::write(const char* s) { return write(reinterpret_cast<const uint8_t*>(s), std::strlen(s)); }
+
+UartRx& gps_uart() {
+  static UartRx uart(UART_NUM_2, board::kGpsRxPin, board::kGpsTxPin, board::kGpsBaud);
+  return uart;
+}
+
+UartRx& gsm_uart() {
+  static UartRx uart(UART_NUM_1, board::kGsmRxPin, board::kGsmTxPin, board::kGsmBaud);
+  return uart;
+}
+
+}  // namespace agro
+
+#endif  // ESP_PLATFORM
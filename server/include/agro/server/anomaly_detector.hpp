@@ -0,0 +1,127 @@
+// Streaming anomaly detection over decoded fleet telemetry.
+//
+// Every record is checked against its own device's history on arrival, in
+// constant time, and the history is updated in the same step:
+//
+//   battery   mV against a per-hour-of-day baseline: an EWMA and a mean
+//             absolute residual per hour, so the weather's swing in the
+//             charging hours does not hide the quiet night. A sustained
+//             negative residual is a failing battery: capacity fade shows
+//             as a sag at night long before the controller browns out.
+//   valve     delivered ml per minute open, per zone, against a streaming
+//             median and MAD. A run far off the median is a stuck or
+//             blocked valve; far above it, a burst line.
+//   position  distance of each fix from the device's streaming median
+//             position, smoothed. The controllers do not move, so a
+//             growing distance is a drifting or failing GPS.
+//
+// The median/MAD sketches are frugal quantile estimators: a step towards
+// each sample sized by the current spread, two floats per series. All state
+// of a device is one 256-byte block in a flat array; each worker thread
+// owns the devices hashed to it, so a batch is evaluated on every core
+// without locks and the result does not depend on the thread count.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "agro/telemetry.hpp"
+
+namespace agro::server {
+
+struct FleetRecord {
+  uint32_t device_id = 0;
+  TelemetryRecord rec;
+};
+
+enum class AlertKind : uint8_t {
+  kBatteryFailing = 0,
+  kValveLowFlow,   // stuck closed, blocked line, failing coil
+  kValveHighFlow,  // burst or disconnected line
+  kGpsDrift,
+  kCount,
+};
+
+struct Alert {
+  uint32_t device_id = 0;
+  uint32_t time = 0;
+  AlertKind kind = AlertKind::kBatteryFailing;
+  uint8_t zone = 0;
+  float score = 0;   // standard deviations, or metres for kGpsDrift
+  size_t index = 0;  // of the record in the batch
+};
+
+struct AnomalyConfig {
+  // Samples per series before it may alert.
+  uint16_t battery_warmup = 336;  // two weeks of hourly readings
+  uint16_t valve_warmup = 12;    // per zone
+  uint16_t gps_warmup = 16;
+  float battery_sigma = 3.0f;    // smoothed residual, in residual deviations
+  float valve_mads = 7.0f;       // robust z: |x - median| / (1.4826 MAD)
+  float gps_drift_m = 25.0f;
+  uint16_t hold_h = 6;           // per device and kind, after an alert
+};
+
+class AnomalyDetector {
+ public:
+  struct Stats {
+    uint64_t records = 0;
+    uint64_t devices = 0;
+    uint64_t alerts[size_t(AlertKind::kCount)] = {};
+  };
+
+  // threads = 0 uses every hardware thread.
+  explicit AnomalyDetector(const AnomalyConfig& cfg = {}, unsigned threads = 0);
+
+  // Evaluates a batch, each device's records in batch order, and appends
+  // alerts to out in batch order.
+  void evaluate(const std::vector<FleetRecord>& batch, std::vector<Alert>* out);
+
+  const Stats& stats() const { return stats_; }
+  unsigned threads() const { return threads_; }
+
+  // Per-device state; 256 bytes so a device is four whole cache lines.
+  struct alignas(64) DeviceState {
+    float hour_mv[24];              // battery baseline by hour of day (UTC)
+    uint16_t hour_dev[24];          // mean absolute residual, 1/8 mV; 0: no baseline
+    float battery_score;            // smoothed standardized residual
+    float valve_median[kMaxZones];  // ml per minute open
+    float valve_mad[kMaxZones];
+    int32_t home_lat, home_lon;     // 1e-7 degrees, streaming median
+    float lon_m;                    // metres per 1e-7 degrees of longitude here
+    float gps_drift;                // smoothed distance from home, m
+    uint16_t last_alert[size_t(AlertKind::kCount)];  // hour, wrapping; 0: never
+    uint16_t battery_n;
+    uint16_t gps_n;
+    uint8_t valve_n[kMaxZones];     // saturating
+    uint32_t device_id;
+  };
+  static_assert(sizeof(DeviceState) == 256);
+
+ private:
+  // One thread's devices.
+  struct Shard {
+    std::unordered_map<uint32_t, uint32_t> slots;
+    std::vector<DeviceState> states;
+    std::vector<Alert> alerts;
+    uint64_t records = 0;
+  };
+
+  size_t shard_of(uint32_t device_id) const;
+  void run_shard(Shard& s, const std::vector<FleetRecord>& batch, const std::vector<std::vector<uint32_t>>& parts,
+                 size_t shard) const;
+  bool check(DeviceState& d, const TelemetryRecord& r, Alert* a) const;
+  bool raise(DeviceState& d, AlertKind kind, uint32_t time, float score, Alert* a) const;
+
+  AnomalyConfig cfg_;
+  unsigned threads_;
+  std::vector<Shard> shards_;
+  // parts_[chunk * threads_ + shard]: indices of that chunk's records for
+  // that shard, in batch order.
+  std::vector<std::vector<uint32_t>> parts_;
+  Stats stats_;
+};
+
+}  // namespace agro::server
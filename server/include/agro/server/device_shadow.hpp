@@ -0,0 +1,83 @@
+// Latest known state of every controller, for dashboards and command logic
+// that ask "what is device X doing now" many times a second.
+//
+// ShadowStore is an open-addressing hash index keyed by IMEI over a dense
+// array of fixed-size records. Keys are claimed with one CAS and never
+// removed, so a probe ends at the first empty slot and lookups take no lock.
+// Each record is one cache line under a seqlock: the ingestion path merges a
+// telemetry record into it between two bumps of the sequence, and readers
+// copy it out and check the sequence did not move. Readers write nothing
+// shared; they retry only when that device's record changed under them.
+// Writers to the same device take turns on the sequence's odd bit.
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "agro/telemetry.hpp"
+
+namespace agro::server {
+
+// One device's shadow; fields stay zero until a record of their kind
+// arrives. Older records than the one shown are ignored field by field.
+struct DeviceShadow {
+  uint32_t device_id = 0;
+  uint32_t updated_s = 0;  // newest record merged, any kind
+  uint32_t battery_s = 0;
+  int32_t battery_mv = 0;
+  uint32_t position_s = 0;
+  int32_t lat = 0, lon = 0;  // 1e-7 degrees
+  uint32_t valve_s = 0;      // last valve run
+  int32_t valve_ml = 0;
+  uint32_t fault_s = 0;
+  uint16_t soc_permille = 0;
+  uint16_t soil_permille = 0;
+  uint16_t fault_code = 0;
+  uint8_t valve_zone = 0;
+  uint8_t soil_zone = 0;
+};
+static_assert(sizeof(DeviceShadow) == 48);
+
+// Merges r into s; false if nothing changed.
+bool merge_record(DeviceShadow* s, const TelemetryRecord& r);
+
+class ShadowStore {
+ public:
+  // Room for capacity devices; the index is kept at most 3/4 full.
+  explicit ShadowStore(size_t capacity);
+
+  // Merges r into the device's shadow, creating it on first sight. False
+  // if the store is full. Safe from any number of threads.
+  bool update(uint64_t imei, uint32_t device_id, const TelemetryRecord& r);
+  // Copies the device's shadow; false if it has never been updated.
+  bool read(uint64_t imei, DeviceShadow* out) const;
+
+  size_t size() const { return count_.load(std::memory_order_relaxed); }
+  size_t capacity() const { return capacity_; }
+  size_t memory_bytes() const;
+
+ private:
+  static constexpr size_t kWords = sizeof(DeviceShadow) / 8;
+  static constexpr uint32_t kUnpublished = UINT32_MAX;
+
+  struct alignas(64) Record {
+    std::atomic<uint32_t> seq{0};  // odd while a writer is inside
+    std::atomic<uint64_t> words[kWords] = {};
+  };
+
+  // Slot of imei in the index, or of the empty slot where it would go.
+  size_t probe(uint64_t imei) const;
+  // Record of imei, kUnpublished if unknown.
+  uint32_t find(uint64_t imei) const;
+
+  size_t capacity_;
+  size_t mask_;
+  std::unique_ptr<std::atomic<uint64_t>[]> keys_;      // 0: empty
+  std::unique_ptr<std::atomic<uint32_t>[]> indices_;   // into records_, per key slot
+  std::unique_ptr<Record[]> records_;
+  std::atomic<uint32_t> count_{0};
+};
+
+}  // namespace agro::server
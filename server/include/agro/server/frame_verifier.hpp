@@ -0,0 +1,97 @@
+// Server side of the sealed telemetry frames: per-device keys and replay
+// windows, batch verification across worker threads, and downlink sealing.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "agro/sealed_frame.hpp"
+
+namespace agro::server {
+
+enum class FrameVerdict : uint8_t {
+  kOk = 0,
+  kMalformed,      // short, wrong version or direction
+  kUnknownDevice,  // no key for the device id, or a retired key id
+  kBadTag,         // forged or corrupted
+  kReplay,         // authentic, but already seen or older than the window
+};
+
+struct VerifiedFrame {
+  FrameVerdict verdict = FrameVerdict::kMalformed;
+  SealedHeader header;
+  std::vector<uint8_t> payload;  // the telemetry packet, only for kOk
+};
+
+class FrameVerifier {
+ public:
+  struct Stats {
+    uint64_t ok = 0;
+    uint64_t malformed = 0;
+    uint64_t unknown_device = 0;
+    uint64_t bad_tag = 0;
+    uint64_t replayed = 0;
+  };
+
+  // threads = 0 uses every hardware thread.
+  explicit FrameVerifier(unsigned threads = 0);
+  ~FrameVerifier();
+  FrameVerifier(const FrameVerifier&) = delete;
+  FrameVerifier& operator=(const FrameVerifier&) = delete;
+
+  // Keeps the downlink counter reservations in path, an append-only file of
+  // (device, epoch, counter limit) records, so neither a restart nor a
+  // re-provisioned key reuses a downlink nonce. Call before any downlink is
+  // sealed; without it reservations last only as long as this object. False
+  // with errno set on failure.
+  bool open_downlink_log(const char* path);
+
+  // Expands the key once; replaces any previous key and its replay state but
+  // not the downlink reservations, which outlive the key.
+  void set_key(uint32_t device_id, uint8_t key_id, const uint8_t key[16]);
+
+  // Authenticates and decrypts a batch of uplink frames, in parallel when the
+  // batch is large enough, then applies the replay windows in batch order.
+  // (*out)[i] is the result for frames[i].
+  void verify(const std::vector<std::vector<uint8_t>>& frames, std::vector<VerifiedFrame>* out);
+
+  // Seals a command for the device under the epoch of its latest verified
+  // uplink, with a counter past every one reserved for that epoch before.
+  // False if the device is unknown, has not been heard from since set_key,
+  // was last heard in an epoch older than one already used for downlinks,
+  // or the reservation could not be logged.
+  bool seal_downlink(uint32_t device_id, const uint8_t* payload, size_t len, std::vector<uint8_t>* out);
+
+  const Stats& stats() const { return stats_; }
+  unsigned threads() const { return threads_; }
+
+ private:
+  struct Device {
+    uint8_t key_id = 0;
+    GcmKey key;
+    ReplayWindow window;
+    bool heard = false;
+    uint32_t uplink_epoch = 0;
+  };
+  // Downlink counters below limit are reserved (logged) for epoch; next is
+  // the first one not yet used.
+  struct Downlink {
+    uint32_t epoch = 0;
+    uint32_t next = 0;
+    uint32_t limit = 0;
+  };
+
+  void verify_range(const std::vector<std::vector<uint8_t>>& frames, std::vector<VerifiedFrame>* out, size_t begin,
+                    size_t end) const;
+
+  unsigned threads_;
+  std::unordered_map<uint32_t, Device> devices_;
+  std::unordered_map<uint32_t, Downlink> downlinks_;
+  int log_fd_ = -1;
+  uint64_t log_end_ = 0;
+  Stats stats_;
+};
+
+}  // namespace agro::server
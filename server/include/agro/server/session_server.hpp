@@ -0,0 +1,102 @@
+// Server side of the uplink sessions (session.hpp): full handshakes, ticket
+// issue and resumption, and the data frames of a session.
+//
+// Tickets are sealed under one server ticket key and carry the whole session
+// state, so a resumed connection needs nothing but the per-device record the
+// server keeps anyway: the device key, the next ticket sequence number and
+// the replay window.
+//
+// The replay windows live in memory only. What makes a restart safe is the
+// ticket log: ticket sequence numbers are reserved in it ahead of use, and
+// after a restart every ticket issued before it is refused, so a captured
+// Resume and Data flight cannot be replayed into the empty windows. Each
+// device pays one full handshake per server restart for that.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "agro/session.hpp"
+
+namespace agro::server {
+
+class SessionServer {
+ public:
+  struct Config {
+    uint32_t ticket_lifetime_s = 7 * 86400;
+  };
+  struct Stats {
+    uint64_t full_handshakes = 0;
+    uint64_t resumptions = 0;
+    uint64_t rejected_tickets = 0;
+    uint64_t new_tickets = 0;
+    uint64_t frames = 0;
+    uint64_t replayed = 0;
+    uint64_t bad = 0;  // failed authentication or malformed
+  };
+
+  // State of one TCP connection.
+  struct Connection {
+    enum class State : uint8_t { kNew = 0, kSession, kRejected, kClosed };
+    State state = State::kNew;
+    uint32_t device_id = 0;
+    uint8_t key_id = 0;
+    uint32_t seq = 0;
+    uint32_t issued_s = 0;
+    bool renewed = false;
+    GcmKey key = {};
+  };
+
+  SessionServer(const uint8_t ticket_key[16], const Config& cfg);
+  ~SessionServer();
+  SessionServer(const SessionServer&) = delete;
+  SessionServer& operator=(const SessionServer&) = delete;
+
+  // Keeps the ticket sequence reservations in path, an append-only file of
+  // (device, sequence limit) records. Call before set_device_key. Without
+  // it a restarted server accepts tickets issued before the restart, and so
+  // replays of their first flights. False with errno set on failure.
+  bool open_ticket_log(const char* path);
+
+  // Tickets issued under an earlier key (or before a restart, with the log)
+  // are refused; sequence numbers carry on.
+  void set_device_key(uint32_t device_id, uint8_t key_id, const uint8_t key[16]);
+
+  // Handles one record received on c at now_s. Reply bytes are appended to
+  // reply, decrypted payloads to payloads. A protocol error closes c.
+  void on_record(Connection& c, SessionRecord type, const uint8_t* body, size_t len, uint32_t now_s,
+                 std::vector<uint8_t>* reply, std::vector<std::vector<uint8_t>>* payloads);
+
+  const Stats& stats() const { return stats_; }
+
+ private:
+  struct Device {
+    uint8_t key_id = 0;
+    GcmKey key = {};
+    uint32_t next_seq = 1;
+    uint32_t seq_limit = 1;     // sequence numbers below are reserved (logged)
+    uint32_t resume_floor = 1;  // tickets below were issued before set_device_key
+    ReplayWindow window;
+  };
+
+  static void random(uint8_t* out, size_t len);
+  // Issues a ticket for c's session into grant (kTicketGrantBytes) with the
+  // given server random; sets c.seq and c.issued_s. False if the sequence
+  // number could not be reserved.
+  bool grant(Connection& c, Device& d, const uint8_t server_random[kSessionRandomBytes], uint32_t now_s,
+             uint8_t* out);
+  bool open_ticket(const uint8_t* ticket, Connection* c);
+  void close(Connection& c);
+
+  GcmKey ticket_key_;
+  Config cfg_;
+  std::unordered_map<uint32_t, Device> devices_;
+  std::unordered_map<uint32_t, uint32_t> logged_limits_;  // from the log, by device
+  int log_fd_ = -1;
+  uint64_t log_end_ = 0;
+  Stats stats_;
+};
+
+}  // namespace agro::server
@@ -0,0 +1,72 @@
+// Server side of the SMS fallback uplink: PDU decoding and per-device
+// reassembly of the packet stream into ordered telemetry.
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "agro/telemetry.hpp"
+
+namespace agro::server {
+
+struct SmsDeliver {
+  std::string sender;  // "+<digits>" or national digits
+  std::vector<uint8_t> user_data;
+};
+
+// Parses an SMS-DELIVER PDU as hex (as read from AT+CMGR/+CMT in PDU mode or
+// an SMPP gateway). Accepts only 8-bit data coding; skips any UDH.
+bool parse_deliver_pdu(std::string_view hex, SmsDeliver* out);
+
+// Orders each device's packets by sequence number, drops duplicates, and
+// gives up on a missing packet once a later one has waited gap_timeout_s.
+class SmsReassembler {
+ public:
+  struct Stats {
+    uint64_t packets = 0;
+    uint64_t duplicates = 0;
+    uint64_t malformed = 0;
+    uint64_t lost = 0;      // sequence numbers skipped after the gap timeout
+    uint64_t restarts = 0;  // streams started over under a new boot epoch
+    uint64_t stale = 0;     // packets from a boot epoch before the current one
+  };
+
+  explicit SmsReassembler(uint32_t gap_timeout_s = 6 * 3600) : gap_timeout_s_(gap_timeout_s) {}
+
+  // Accepts one message's user data (boot epoch, packet) received at now_s
+  // and appends every record that is now in order to out.
+  void accept(const std::string& sender, const std::vector<uint8_t>& packet, uint32_t now_s,
+              std::vector<TelemetryRecord>* out);
+  // Releases packets held behind gaps older than the timeout.
+  void expire(uint32_t now_s, std::vector<std::pair<std::string, TelemetryRecord>>* out);
+
+  const Stats& stats() const { return stats_; }
+
+ private:
+  struct Pending {
+    uint32_t received_s;
+    std::vector<TelemetryRecord> records;
+  };
+  struct Stream {
+    bool started = false;
+    uint8_t epoch = 0;
+    uint16_t next_seq = 0;
+    // Keyed by sequence number; only a handful are ever held.
+    std::map<uint16_t, Pending> pending;
+  };
+
+  void drain(Stream& s, std::vector<TelemetryRecord>* out);
+  // Releases everything held, gaps and all, in sequence order.
+  void flush(Stream& s, std::vector<TelemetryRecord>* out);
+  bool skip_gap(Stream& s, uint32_t now_s);
+
+  uint32_t gap_timeout_s_;
+  std::unordered_map<std::string, Stream> streams_;
+  Stats stats_;
+};
+
+}  // namespace agro::server
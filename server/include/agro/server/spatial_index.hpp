@@ -0,0 +1,133 @@
+// Spatial queries over the fleet: which field a position falls in, the
+// devices nearest a point, and the devices inside a field or region.
+//
+// FieldIndex keeps the field polygons in an R-tree bulk-loaded by
+// Sort-Tile-Recursive packing: the polygon boxes are sorted by longitude
+// into vertical slices, each slice by latitude, and cut into nodes of 16;
+// each level above is packed the same way from the one below. Every node
+// but the last of a level is full and a level is one array, so a lookup
+// reads a few dozen boxes in a handful of cache lines per level. Polygons
+// are stored flat in leaf order.
+//
+// DeviceGrid keeps device positions sorted by the Morton code of their
+// fine grid cell (about 11 m). A cell of every coarser grid, 2x, 4x, ...
+// the size, is then one contiguous run of that array, so the grids form a
+// quadtree that costs nothing to store: nearest-device search is best-first
+// over cells, polygon search descends only into cells on the polygon's
+// outline and takes the runs of cells wholly inside it.
+//
+// Both are bulk-loaded and read-only after; the controllers stay where they
+// were installed, so positions are reloaded, not updated one by one.
+// Coordinates are 1e-7 degrees, as in the telemetry records; distances are
+// metres on the equirectangular projection at the query point, good to
+// 0.1% across a district.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace agro::server {
+
+struct GeoPoint {
+  int32_t lat = 0;  // 1e-7 degrees
+  int32_t lon = 0;
+};
+
+struct GeoBox {
+  int32_t min_lat = INT32_MAX, min_lon = INT32_MAX;
+  int32_t max_lat = INT32_MIN, max_lon = INT32_MIN;
+
+  bool contains(GeoPoint p) const {
+    return p.lat >= min_lat && p.lat <= max_lat && p.lon >= min_lon && p.lon <= max_lon;
+  }
+  bool intersects(const GeoBox& b) const {
+    return b.min_lat <= max_lat && b.max_lat >= min_lat && b.min_lon <= max_lon && b.max_lon >= min_lon;
+  }
+  void extend(GeoPoint p);
+  void extend(const GeoBox& b);
+};
+
+GeoBox bounds(const GeoPoint* vertices, size_t n);
+
+// Crossing-number test; points on the outline may go either way. The
+// polygon is closed implicitly and must not cross itself.
+bool inside_polygon(GeoPoint p, const GeoPoint* vertices, size_t n);
+
+class FieldIndex {
+ public:
+  static constexpr size_t kFanout = 16;
+
+  // Polygons are collected, then build() packs the tree once; queries
+  // before build() see nothing, polygons added after it are ignored.
+  void add(uint32_t field_id, const GeoPoint* vertices, size_t n);
+  void build();
+
+  // Appends the ids of the fields containing p.
+  void fields_at(GeoPoint p, std::vector<uint32_t>* out) const;
+  // Appends the ids of the fields whose bounding box meets box.
+  void fields_in(const GeoBox& box, std::vector<uint32_t>* out) const;
+
+  size_t size() const { return ids_.size(); }
+  size_t levels() const { return levels_.size(); }
+
+ private:
+  struct Node {
+    GeoBox box;
+    uint32_t first = 0;  // child in the level below, or vertex for a polygon
+    uint32_t count = 0;
+  };
+
+  static std::vector<Node> pack(std::vector<Node>* items);
+  template <typename Hit, typename Leaf>
+  void search(const Hit& hit, const Leaf& leaf) const;
+
+  // levels_[0]: one box per polygon, in leaf order; levels_.back(): the
+  // root's children, at most kFanout.
+  std::vector<std::vector<Node>> levels_;
+  std::vector<uint32_t> ids_;  // per polygon, in leaf order once built
+  std::vector<GeoPoint> vertices_;
+  std::vector<uint32_t> starts_;  // per slot, into vertices_, until build()
+};
+
+struct DevicePosition {
+  uint32_t device_id = 0;
+  GeoPoint pos;
+};
+
+class DeviceGrid {
+ public:
+  static constexpr int kCellShift = 10;  // fine cell: 1024e-7 degrees, 11 m of latitude
+
+  struct Neighbor {
+    uint32_t device_id = 0;
+    float distance_m = 0;
+  };
+
+  void build(std::vector<DevicePosition> devices);
+
+  // The k devices nearest p, nearest first.
+  void nearest(GeoPoint p, size_t k, std::vector<Neighbor>* out) const;
+  // Appends the ids of the devices inside the polygon.
+  void inside(const GeoPoint* vertices, size_t n, std::vector<uint32_t>* out) const;
+
+  size_t size() const { return devices_.size(); }
+
+ private:
+  // A cell at some level of the grid and its run of devices.
+  struct Cell {
+    int level = 0;
+    uint64_t code = 0;
+    uint32_t begin = 0, end = 0;
+  };
+
+  Cell root() const;
+  // Splits c into its four quadrants; empty ones get begin == end.
+  void split(const Cell& c, Cell quads[4]) const;
+  static GeoBox cell_box(const Cell& c);
+
+  std::vector<uint64_t> codes_;  // Morton code of the fine cell, ascending
+  std::vector<DevicePosition> devices_;  // in code order
+};
+
+}  // namespace agro::server
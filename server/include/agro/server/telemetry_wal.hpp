@@ -0,0 +1,116 @@
+// Write-ahead log for telemetry batches, so a frame is acked only once
+// what it carried would survive a crash; an ack lost to a crash costs the
+// device a resend over GSM, an ack given too early loses the data.
+//
+// Group commit: producers append batches into the open group under a
+// mutex and return at once. One writer thread takes the whole open group,
+// writes it at the log's tail and makes it durable with one fdatasync,
+// while the next group fills; then it hands every cookie of the group to
+// the durable callback, which releases the acks. The busier the log, the
+// more batches share a sync.
+//
+// The write and the sync go to the kernel as one linked pair on an
+// io_uring: one system call per group, and the sync queued behind the
+// write without a round trip. Where io_uring is unavailable (old kernel,
+// container seccomp, io_uring_disabled), lacks IORING_OP_WRITE (before
+// 5.6) or fails, it falls back to pwrite and fdatasync for good. The file
+// grows by fallocate in large steps, so most syncs write no size change.
+//
+// On disk, each batch is u32 length, u32 CRC-32 of the length and payload,
+// then the payload, little endian. Recovery reads records until a zero
+// length, a short record or a bad CRC: the torn tail of a crash.
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace agro::server {
+
+inline constexpr size_t kWalRecordHeader = 8;
+
+struct WalConfig {
+  std::string path;
+  size_t max_group_bytes = 4 << 20;  // appends wait while the open group is this full
+  size_t grow_bytes = 64 << 20;      // fallocate step
+  bool io_uring = true;              // false: always pwrite + fdatasync
+};
+
+class TelemetryWal {
+ public:
+  struct Stats {
+    uint64_t appends = 0;
+    uint64_t groups = 0;  // one sync each
+    uint64_t bytes = 0;
+    uint64_t largest_group = 0;  // appends
+    bool io_uring = false;       // still in use
+  };
+
+  // Called on the writer thread once per group: the cookies of its batches,
+  // in append order, and 0 once they are durable or the errno that failed
+  // the group. After a failure nothing more is written; appends fail.
+  using Durable = std::function<void(const uint64_t* cookies, size_t n, int error)>;
+
+  TelemetryWal(const WalConfig& cfg, Durable durable);
+  // Commits what has been appended, then stops.
+  ~TelemetryWal();
+
+  // Opens or creates the log, recovering existing records through replay
+  // (may be empty) and appending after them; false with errno set on
+  // failure.
+  bool open(const std::function<void(const uint8_t* data, size_t len)>& replay = {});
+
+  // Queues a batch; returns the log position just past it, to wait() on,
+  // or 0 if the log is closed or failed. Safe from any number of threads.
+  uint64_t append(const uint8_t* data, size_t len, uint64_t cookie);
+  // Blocks until everything up to lsn is durable; false if it never will be.
+  bool wait(uint64_t lsn);
+  // Commits what has been appended and stops the writer.
+  void close();
+
+  uint64_t durable_lsn() const;
+  int error() const;
+  Stats stats() const;
+
+  // Reads the records of a log file until its torn tail; returns the
+  // offset just past the last good record, or -1 with errno set.
+  static int64_t recover(const std::string& path, const std::function<void(const uint8_t* data, size_t len)>& fn);
+
+ private:
+  struct Group {
+    std::vector<uint8_t> bytes;
+    std::vector<uint64_t> cookies;
+  };
+  class Ring;  // io_uring, in the .cpp
+
+  void run();
+  // Writes bytes at off and syncs; 0 or an errno.
+  int commit(const std::vector<uint8_t>& bytes, uint64_t off);
+
+  WalConfig cfg_;
+  Durable durable_;
+  int fd_ = -1;
+  std::unique_ptr<Ring> ring_;
+  std::thread writer_;
+
+  mutable std::mutex mu_;
+  std::condition_variable work_cv_;   // writer: the open group has data, or closing
+  std::condition_variable space_cv_;  // appenders: the open group was taken
+  std::condition_variable done_cv_;   // waiters: durable_lsn_ moved
+  Group open_, flushing_;
+  uint64_t tail_ = 0;         // log position after the open group
+  uint64_t durable_lsn_ = 0;
+  uint64_t allocated_ = 0;    // writer only
+  int error_ = 0;
+  bool closing_ = true;
+  bool running_ = false;      // the writer has not exited
+  Stats stats_;
+};
+
+}  // namespace agro::server
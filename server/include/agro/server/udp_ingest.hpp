@@ -0,0 +1,173 @@
+// UDP front end for controllers that send each sealed telemetry frame
+// (sealed_frame.hpp) as one datagram, without a TCP session.
+//
+// One worker per core, each with its own socket bound to the shared port
+// with SO_REUSEPORT, so the kernel spreads source addresses across workers
+// and no socket is shared. A worker takes up to a batch of datagrams per
+// recvmmsg into a slab allocated once at start, opens each frame in place,
+// decodes its telemetry packet into a reused record buffer and hands the
+// records to the sink. Acks for the batch go back in one sendmmsg.
+//
+// Every authentic frame is acked, including a replay: the device retries
+// until it hears an ack, so a lost ack must not strand it. Only fresh frames
+// reach the sink. Acks are sealed downlink frames carrying the acked
+// counter, under derive_ack_key() of the device key (sealed_frame.hpp), so
+// they never share a nonce with the commands FrameVerifier seals. Replay
+// windows are per device behind a per-device lock; a NAT rebinding can move
+// a device to another worker, so the windows cannot be per worker.
+//
+// With a write-ahead log attached (telemetry_wal.hpp), a fresh frame is
+// appended to it and its ack held until the log reports it durable; only
+// then does the device's replay window take the counter and the sink get
+// the records. A retry that arrives while the original is still being
+// logged is dropped, not acked early; the original's ack answers it. A frame
+// whose group fails is neither acked nor delivered, so the device's resend
+// is delivered once.
+#pragma once
+
+#include <netinet/in.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "agro/sealed_frame.hpp"
+#include "agro/telemetry.hpp"
+
+namespace agro::server {
+
+inline constexpr size_t kUdpMaxDatagram = 512;  // well above a SIM800L packet
+inline constexpr size_t kUdpAckBytes = kSealedOverhead + 4;
+// A frame's entry in the write-ahead log: u32 device id, u32 epoch, u32
+// counter, little endian, then its telemetry packet.
+inline constexpr size_t kUdpWalHeader = 12;
+
+class TelemetryWal;
+
+struct UdpIngestConfig {
+  std::string address = "0.0.0.0";
+  uint16_t port = 0;        // 0: any free port, see UdpIngest::port()
+  unsigned workers = 0;     // 0: one per hardware thread
+  unsigned batch = 64;      // datagrams per recvmmsg
+  int rcvbuf_bytes = 4 << 20;
+  bool pin = true;          // pin worker i to CPU i
+};
+
+class UdpIngest {
+ public:
+  struct Stats {
+    uint64_t datagrams = 0;
+    uint64_t batches = 0;       // recvmmsg calls that returned data
+    uint64_t records = 0;       // delivered to the sink
+    uint64_t acks = 0;
+    uint64_t replayed = 0;      // authentic, acked again, not delivered
+    uint64_t retried = 0;       // a retry of a frame still being logged, dropped
+    uint64_t held = 0;          // acks held for the write-ahead log
+    uint64_t unlogged = 0;      // the log failed: neither delivered nor acked
+    uint64_t malformed = 0;     // short, truncated, wrong version or direction, bad packet
+    uint64_t unknown_device = 0;
+    uint64_t bad_tag = 0;
+    uint64_t cpu_us = 0;        // worker thread CPU time, once stopped
+  };
+
+  // Called once per fresh frame: from the workers, concurrently, or with a
+  // log attached from the log's writer thread once the frame is durable,
+  // with the index of the worker that received it.
+  using Sink = std::function<void(unsigned worker, uint32_t device_id, const TelemetryRecord* records, size_t n)>;
+
+  UdpIngest(const UdpIngestConfig& cfg, Sink sink);
+  ~UdpIngest();
+
+  // Before start() only.
+  void set_key(uint32_t device_id, uint8_t key_id, const uint8_t key[16]);
+
+  // Before start() only. Holds each fresh frame's ack until wal reports it
+  // durable; wal's Durable callback must call on_durable(). Close the log
+  // before stopping the ingest, so the acks it still holds go out.
+  void attach_wal(TelemetryWal* wal) { wal_ = wal; }
+  // TelemetryWal::Durable for the attached log: delivers the frames and
+  // sends the held acks, or drops both if the log failed.
+  void on_durable(const uint64_t* cookies, size_t n, int error);
+  // Before start() only, from the attached log's replay: marks the entry's
+  // frame as seen and hands its records to the sink as worker 0. Like
+  // on_durable(), skips a frame no longer fresh in log order, such as one
+  // logged again after its group failed. False if the entry is malformed or
+  // for an unknown device.
+  bool restore(const uint8_t* entry, size_t len);
+
+  // Opens the sockets and starts the workers; false (errno set) if a socket
+  // cannot be opened or bound.
+  bool start();
+  // Stops the workers within about 50 ms and closes the sockets.
+  void stop();
+
+  uint16_t port() const { return port_; }
+  unsigned workers() const { return unsigned(workers_.size()); }
+  Stats stats() const;
+  Stats stats(unsigned worker) const;
+
+ private:
+  struct Device {
+    uint8_t key_id = 0;
+    GcmKey key;
+    GcmKey ack_key;
+    std::mutex mu;
+    ReplayWindow window;
+    std::vector<uint64_t> logging;  // epoch << 32 | counter, appended, not yet durable
+  };
+  struct Counters {
+    std::atomic<uint64_t> datagrams{0}, batches{0}, records{0}, acks{0}, replayed{0}, retried{0}, held{0},
+        unlogged{0}, malformed{0}, unknown_device{0}, bad_tag{0}, cpu_us{0};
+  };
+  // A frame and its ack waiting for the log; the cookie is worker << 32 |
+  // slot.
+  struct HeldAck {
+    uint32_t device_id = 0;
+    uint32_t epoch = 0;
+    uint32_t counter = 0;
+    sockaddr_in to = {};
+    uint8_t ack[kUdpAckBytes] = {};
+    uint16_t packet_len = 0;
+    uint8_t packet[kUdpMaxDatagram];  // the telemetry packet
+  };
+  struct alignas(64) Worker {
+    int fd = -1;
+    std::thread thread;
+    Counters counters;
+    std::mutex held_mu;
+    std::vector<HeldAck> held;    // slots, reused through free_slots
+    std::vector<uint32_t> free_slots;
+    std::vector<HeldAck> released;  // on_durable() only
+  };
+
+  void run(unsigned index);
+  // Opens one datagram in place; writes its ack to ack and returns true if
+  // it is to be acked now.
+  bool handle(unsigned index, uint8_t* frame, size_t len, const sockaddr_in& from,
+              std::vector<TelemetryRecord>* records, Stats* local, uint8_t ack[kUdpAckBytes]);
+  // Decodes a telemetry packet into records and hands them to the sink;
+  // false if it does not decode (what did is still delivered).
+  bool deliver(unsigned worker, uint32_t device_id, const uint8_t* packet, size_t len,
+               std::vector<TelemetryRecord>* records);
+  // Appends a fresh frame to the log with its ack held; false if the log
+  // refused it.
+  bool log_frame(unsigned index, const SealedHeader& h, const uint8_t* payload, size_t payload_len,
+                 const sockaddr_in& from, const uint8_t ack[kUdpAckBytes]);
+
+  UdpIngestConfig cfg_;
+  Sink sink_;
+  TelemetryWal* wal_ = nullptr;
+  std::unordered_map<uint32_t, Device> devices_;
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::atomic<bool> stop_{false};
+  uint16_t port_ = 0;
+};
+
+}  // namespace agro::server
@@ -0,0 +1,138 @@
+// When each controller will next have its SIM800L up, so downlink commands
+// are staged before it connects rather than waiting a whole cycle.
+//
+// WakeScheduler learns every device's check-in period and jitter from the
+// times its sessions open: an EWMA of the interval, skipped sessions
+// counted as whole periods, and a slower EWMA of the absolute error. A few
+// intervals in a row off the model (a new energy plan) restart learning. The
+// next window is the last check-in plus the period, widened by a guard of
+// a few jitters; a pre-stage event fires lead_s before it opens. A device that
+// does not show is carried to the window after, so its commands stay
+// staged.
+//
+// The timers are a hierarchical timing wheel: four levels of 256 one-second
+// slots (256 s, 18 h, 194 days, all of uint32 time), an intrusive doubly
+// linked list per slot and an occupancy bitmap per level. Arming and
+// cancelling are O(1); advancing visits occupied level-0 slots and one
+// cascade per 256 s, whatever the number of devices.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace agro::server {
+
+class TimingWheel {
+ public:
+  static constexpr int kLevels = 4;
+  static constexpr int kSlotBits = 8;
+  static constexpr uint32_t kSlots = 1u << kSlotBits;
+
+  explicit TimingWheel(uint32_t now_s = 0);
+
+  // Arms timer id to fire at t, moving it if armed; t <= now() fires on the
+  // next advance. Ids are small dense integers; storage grows to the
+  // largest.
+  void arm(uint32_t id, uint32_t t);
+  void cancel(uint32_t id);
+  bool armed(uint32_t id) const { return id < nodes_.size() && nodes_[id].where != kUnarmed; }
+
+  // Fires every timer due by now_s, appending ids in time order.
+  void advance(uint32_t now_s, std::vector<uint32_t>* out);
+
+  uint32_t now() const { return now_; }
+  size_t memory_bytes() const { return sizeof(*this) + nodes_.capacity() * sizeof(Node); }
+
+ private:
+  static constexpr uint32_t kNil = UINT32_MAX;
+  static constexpr uint16_t kUnarmed = UINT16_MAX;
+
+  struct Node {
+    uint32_t expires = 0;
+    uint32_t next = kNil, prev = kNil;
+    uint16_t where = kUnarmed;  // level << kSlotBits | slot
+  };
+
+  void link(uint32_t id);
+  void unlink(uint32_t id);
+  // Re-arms the timers of a higher-level slot whose time has come.
+  void cascade(int level, uint32_t slot);
+  // The next occupied slot of a level after slot, or kSlots.
+  uint32_t next_occupied(int level, uint32_t slot) const;
+
+  std::vector<Node> nodes_;
+  uint32_t heads_[kLevels][kSlots];
+  uint64_t occupied_[kLevels][kSlots / 64] = {};
+  uint32_t now_;  // every timer up to here has fired
+};
+
+struct WakeParams {
+  uint32_t lead_s = 60;              // pre-stage this long before a window opens
+  uint32_t first_period_s = 3600;    // until a device's interval is learned
+  uint32_t min_guard_s = 10;         // half window: this
+  uint8_t guard_jitters = 3;         // plus as many learned jitters
+  uint8_t learn_shift = 3;           // EWMA weight 1/8 once seeded
+};
+
+class WakeScheduler {
+ public:
+  struct Event {
+    uint32_t device_id = 0;
+    uint32_t open_s = 0;   // predicted window
+    uint32_t close_s = 0;
+    bool missed = false;   // the device did not show in the window before
+  };
+  struct Stats {
+    uint64_t check_ins = 0;
+    uint64_t events = 0;
+    uint64_t missed = 0;  // windows carried forward
+  };
+
+  explicit WakeScheduler(const WakeParams& params = {}, uint32_t now_s = 0);
+
+  // A session from device_id opened at t: learns the interval and arms the
+  // pre-stage event of the next window.
+  void check_in(uint32_t device_id, uint32_t t);
+  // Stops tracking a device, e.g. decommissioned.
+  void forget(uint32_t device_id);
+
+  // Advances to now_s and appends the pre-stage events due, in time order.
+  void advance(uint32_t now_s, std::vector<Event>* out);
+
+  // The predicted next window of a device; false if it has not checked in.
+  bool window(uint32_t device_id, uint32_t* open_s, uint32_t* close_s) const;
+
+  size_t size() const { return slots_.size(); }
+  size_t memory_bytes() const;
+  const Stats& stats() const { return stats_; }
+
+ private:
+  struct Device {
+    uint32_t device_id = 0;
+    uint32_t last_s = 0;    // last check-in
+    uint32_t period_q4 = 0;  // 1/16 s
+    uint32_t jitter_q4 = 0;  // mean absolute error of the interval
+    uint32_t open_s = 0;    // predicted window
+    uint32_t close_s = 0;
+    uint16_t samples = 0;   // intervals learned, saturating
+    uint8_t missed = 0;     // windows in a row without a session
+    uint8_t off = 0;        // intervals in a row off the model
+    bool staged = false;    // pre-stage fired; the timer now marks the close
+  };
+
+  // Sets the window one period after from_s and arms its pre-stage event.
+  void predict(Device& d, uint32_t from_s);
+  static uint32_t blend(uint32_t old, uint32_t sample, uint16_t n, uint8_t shift);
+
+  WakeParams p_;
+  TimingWheel wheel_;
+  std::vector<Device> devices_;  // by timer id
+  std::vector<uint32_t> free_;   // forgotten timer ids
+  std::unordered_map<uint32_t, uint32_t> slots_;
+  std::vector<uint32_t> fired_;
+  Stats stats_;
+};
+
+}  // namespace agro::server
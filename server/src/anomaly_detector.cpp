@@ -0,0 +1,195 @@
+#include "agro/server/anomaly_detector.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+namespace agro::server {
+namespace {
+
+// Below this many records per thread, starting threads costs more than the
+// records (tens of ns each) they would take over.
+constexpr size_t kMinRecordsPerThread = 16384;
+
+constexpr float kHourAlpha = 1.0f / 16;  // per hour-of-day baseline, ~two weeks
+constexpr float kDevAlpha = 1.0f / 64;
+constexpr float kScoreAlpha = 1.0f / 16;
+constexpr float kClip = 2.0f;            // residual deviations
+constexpr float kFirstDev = 50.0f;       // mV, until an hour has history
+constexpr float kMinBatterySd = 10.0f;   // mV, ADC resolution
+constexpr float kDevToSd = 1.2533f;      // mean absolute deviation of a normal
+constexpr float kMadToSd = 1.4826f;
+constexpr float kSketchStep = 1.0f / 16;  // of the spread, per sample
+constexpr float kDriftAlpha = 1.0f / 4;
+constexpr float kLatM = 0.011132f;        // metres per 1e-7 degrees of latitude
+constexpr int32_t kHomeStepWarm = 90;     // 1e-7 degrees, about 1 m
+constexpr int32_t kHomeStep = 9;          // after warm-up: the controllers do not move
+
+// Runs fn(0) .. fn(n - 1), fn(0) on the calling thread.
+template <typename Fn>
+void parallel(size_t n, const Fn& fn) {
+  std::vector<std::thread> pool;
+  for (size_t i = 1; i < n; ++i) pool.emplace_back([&fn, i] { fn(i); });
+  fn(0);
+  for (std::thread& t : pool) t.join();
+}
+
+// Frugal median step: towards x by at most step.
+float toward(float m, float x, float step) {
+  if (x > m) return m + std::min(step, x - m);
+  return m - std::min(step, m - x);
+}
+
+}  // namespace
+
+AnomalyDetector::AnomalyDetector(const AnomalyConfig& cfg, unsigned threads) : cfg_(cfg), threads_(threads) {
+  if (threads_ == 0) threads_ = std::thread::hardware_concurrency();
+  if (threads_ == 0) threads_ = 1;
+  shards_.resize(threads_);
+  parts_.resize(size_t{threads_} * threads_);
+}
+
+size_t AnomalyDetector::shard_of(uint32_t device_id) const {
+  // Fibonacci hashing: consecutive ids spread over the shards.
+  return size_t(uint64_t(device_id * 2654435761u) * threads_ >> 32);
+}
+
+bool AnomalyDetector::raise(DeviceState& d, AlertKind kind, uint32_t time, float score, Alert* a) const {
+  const uint16_t hour = uint16_t(time / 3600) | 1;  // never 0; odd hours are close enough
+  uint16_t& last = d.last_alert[size_t(kind)];
+  if (last != 0 && uint16_t(hour - last) < cfg_.hold_h) return false;
+  last = hour;
+  a->device_id = d.device_id;
+  a->time = time;
+  a->kind = kind;
+  a->score = score;
+  return true;
+}
+
+bool AnomalyDetector::check(DeviceState& d, const TelemetryRecord& r, Alert* a) const {
+  switch (r.kind) {
+    case RecordKind::kBattery: {
+      const float mv = float(r.a);
+      const unsigned h = r.time % 86400 / 3600;
+      uint16_t& dev = d.hour_dev[h];
+      if (d.battery_n < UINT16_MAX) ++d.battery_n;
+      if (dev == 0) {
+        d.hour_mv[h] = mv;
+        dev = uint16_t(kFirstDev * 8);
+        return false;
+      }
+      const float res = mv - d.hour_mv[h];
+      const float sd = std::max(kDevToSd * dev / 8, kMinBatterySd);
+      const float z = res / sd;
+      // Plain means over the first days, then EWMAs; both learn from clipped
+      // residuals, so a sag builds up in the score faster than in the baseline.
+      // Days are counted in samples as if hourly; a device reporting more
+      // often than that starts on its first day, not on a division by zero.
+      const float days = float(std::max(d.battery_n / 24, 1));
+      const float clipped = std::clamp(res, -kClip * sd, kClip * sd);
+      d.hour_mv[h] += clipped * std::max(1 / days, kHourAlpha);
+      dev = uint16_t(std::clamp(dev + (std::fabs(clipped) * 8 - dev) * std::max(1 / days, kDevAlpha), 1.0f, 65535.0f));
+      d.battery_score += (z - d.battery_score) * kScoreAlpha;
+      if (d.battery_n < cfg_.battery_warmup || d.battery_score > -cfg_.battery_sigma) return false;
+      return raise(d, AlertKind::kBatteryFailing, r.time, d.battery_score, a);
+    }
+    case RecordKind::kValve: {
+      if (r.b <= 0 || r.zone >= kMaxZones) return false;
+      const uint8_t zone = r.zone;
+      const float x = float(r.a) * 60000.0f / float(r.b);
+      float& m = d.valve_median[zone];
+      float& mad = d.valve_mad[zone];
+      if (d.valve_n[zone] == 0) {
+        m = x;
+        mad = std::max(x * 0.05f, 1.0f);
+        d.valve_n[zone] = 1;
+        return false;
+      }
+      const float spread = kMadToSd * std::max(mad, 0.01f * std::fabs(m) + 1.0f);
+      const float z = (x - m) / spread;
+      m = toward(m, x, spread * kSketchStep);
+      mad = std::max(toward(mad, std::fabs(x - m), mad * kSketchStep / 2), 0.5f);
+      if (d.valve_n[zone] < UINT8_MAX) ++d.valve_n[zone];
+      if (d.valve_n[zone] < cfg_.valve_warmup || std::fabs(z) < cfg_.valve_mads) return false;
+      if (!raise(d, z < 0 ? AlertKind::kValveLowFlow : AlertKind::kValveHighFlow, r.time, z, a)) return false;
+      a->zone = zone;
+      return true;
+    }
+    case RecordKind::kPosition: {
+      if (d.gps_n == 0) {
+        d.home_lat = r.a;
+        d.home_lon = r.b;
+        d.lon_m = kLatM * std::cos(float(r.a) * 1e-7f * 3.14159265f / 180.0f);
+        d.gps_n = 1;
+        return false;
+      }
+      const float dy = float(r.a - d.home_lat) * kLatM;
+      const float dx = float(r.b - d.home_lon) * d.lon_m;
+      d.gps_drift += (std::sqrt(dx * dx + dy * dy) - d.gps_drift) * kDriftAlpha;
+      const int32_t step = d.gps_n < cfg_.gps_warmup ? kHomeStepWarm : kHomeStep;
+      d.home_lat += std::clamp(r.a - d.home_lat, -step, step);
+      d.home_lon += std::clamp(r.b - d.home_lon, -step, step);
+      if (d.gps_n < UINT16_MAX) ++d.gps_n;
+      if (d.gps_n < cfg_.gps_warmup || d.gps_drift < cfg_.gps_drift_m) return false;
+      return raise(d, AlertKind::kGpsDrift, r.time, d.gps_drift, a);
+    }
+    default:
+      return false;
+  }
+}
+
+void AnomalyDetector::run_shard(Shard& s, const std::vector<FleetRecord>& batch,
+                                const std::vector<std::vector<uint32_t>>& parts, size_t shard) const {
+  s.alerts.clear();
+  for (size_t chunk = 0; chunk < threads_; ++chunk) {
+    for (uint32_t i : parts[chunk * threads_ + shard]) {
+      const FleetRecord& f = batch[i];
+      const auto [it, fresh] = s.slots.try_emplace(f.device_id, uint32_t(s.states.size()));
+      if (fresh) {
+        s.states.emplace_back();
+        s.states.back().device_id = f.device_id;
+      }
+      Alert a;
+      if (check(s.states[it->second], f.rec, &a)) {
+        a.index = i;
+        s.alerts.push_back(a);
+      }
+    }
+    s.records += parts[chunk * threads_ + shard].size();
+  }
+}
+
+void AnomalyDetector::evaluate(const std::vector<FleetRecord>& batch, std::vector<Alert>* out) {
+  const size_t chunk = (batch.size() + threads_ - 1) / threads_;
+  // Phase 1: each chunk of the batch split by shard. Phase 2: each shard
+  // takes its records from every chunk, in chunk order.
+  const auto split = [&](size_t c) {
+    for (size_t s = 0; s < threads_; ++s) parts_[c * threads_ + s].clear();
+    const size_t end = std::min(batch.size(), (c + 1) * chunk);
+    for (size_t i = c * chunk; i < end; ++i) {
+      parts_[c * threads_ + shard_of(batch[i].device_id)].push_back(uint32_t(i));
+    }
+  };
+  const auto run = [&](size_t s) { run_shard(shards_[s], batch, parts_, s); };
+  if (threads_ == 1 || batch.size() < 2 * kMinRecordsPerThread) {
+    for (size_t c = 0; c < threads_; ++c) split(c);
+    for (size_t s = 0; s < threads_; ++s) run(s);
+  } else {
+    parallel(threads_, split);
+    parallel(threads_, run);
+  }
+
+  const size_t first = out->size();
+  uint64_t records = 0, devices = 0;
+  for (const Shard& s : shards_) {
+    out->insert(out->end(), s.alerts.begin(), s.alerts.end());
+    records += s.records;
+    devices += s.states.size();
+  }
+  std::sort(out->begin() + first, out->end(), [](const Alert& x, const Alert& y) { return x.index < y.index; });
+  for (size_t i = first; i < out->size(); ++i) ++stats_.alerts[size_t((*out)[i].kind)];
+  stats_.records = records;
+  stats_.devices = devices;
+}
+
+}  // namespace agro::server
@@ -0,0 +1,154 @@
+#include "agro/server/device_shadow.hpp"
+
+#include <cstring>
+#include <thread>
+
+namespace agro::server {
+namespace {
+
+constexpr uint32_t kFull = UINT32_MAX - 1;  // key claimed after the records ran out
+
+size_t index_size(size_t capacity) {
+  size_t n = 16;
+  while (n * 3 < capacity * 4) n *= 2;
+  return n;
+}
+
+}  // namespace
+
+bool merge_record(DeviceShadow* s, const TelemetryRecord& r) {
+  bool changed = false;
+  if (r.time > s->updated_s) {
+    s->updated_s = r.time;
+    changed = true;
+  }
+  switch (r.kind) {
+    case RecordKind::kBattery:
+      if (r.time < s->battery_s) break;
+      s->battery_s = r.time;
+      s->battery_mv = r.a;
+      s->soc_permille = uint16_t(r.b);
+      return true;
+    case RecordKind::kPosition:
+      if (r.time < s->position_s) break;
+      s->position_s = r.time;
+      s->lat = r.a;
+      s->lon = r.b;
+      return true;
+    case RecordKind::kValve:
+      if (r.time < s->valve_s) break;
+      s->valve_s = r.time;
+      s->valve_ml = r.a;
+      s->valve_zone = r.zone;
+      return true;
+    case RecordKind::kSoil:
+      // No time of its own: stale if older than anything merged.
+      if (r.time < s->updated_s) break;
+      s->soil_permille = uint16_t(r.a);
+      s->soil_zone = r.zone;
+      return true;
+    case RecordKind::kFault:
+      if (r.time < s->fault_s) break;
+      s->fault_s = r.time;
+      s->fault_code = uint16_t(r.a);
+      return true;
+    default:
+      break;
+  }
+  return changed;
+}
+
+ShadowStore::ShadowStore(size_t capacity)
+    : capacity_(capacity),
+      mask_(index_size(capacity) - 1),
+      keys_(new std::atomic<uint64_t>[mask_ + 1]),
+      indices_(new std::atomic<uint32_t>[mask_ + 1]),
+      records_(new Record[capacity]) {
+  for (size_t i = 0; i <= mask_; ++i) {
+    keys_[i].store(0, std::memory_order_relaxed);
+    indices_[i].store(kUnpublished, std::memory_order_relaxed);
+  }
+}
+
+size_t ShadowStore::probe(uint64_t imei) const {
+  // Fibonacci hashing: IMEIs of one batch share their first 8 digits.
+  size_t i = size_t((imei * 0x9e3779b97f4a7c15ull) >> 32) & mask_;
+  for (size_t n = 0; n <= mask_; ++n, i = (i + 1) & mask_) {
+    const uint64_t k = keys_[i].load(std::memory_order_acquire);
+    if (k == imei || k == 0) return i;
+  }
+  return mask_ + 1;
+}
+
+uint32_t ShadowStore::find(uint64_t imei) const {
+  const size_t i = probe(imei);
+  if (i > mask_ || keys_[i].load(std::memory_order_acquire) != imei) return kUnpublished;
+  return indices_[i].load(std::memory_order_acquire);
+}
+
+bool ShadowStore::update(uint64_t imei, uint32_t device_id, const TelemetryRecord& r) {
+  if (imei == 0) return false;
+  size_t i = probe(imei);
+  while (i <= mask_) {
+    uint64_t k = 0;
+    if (keys_[i].compare_exchange_strong(k, imei, std::memory_order_acq_rel)) {
+      const uint32_t index = count_.fetch_add(1, std::memory_order_relaxed);
+      indices_[i].store(index < capacity_ ? index : kFull, std::memory_order_release);
+      break;
+    }
+    if (k == imei) break;
+    i = probe(imei);  // another device took the slot: it is no longer empty
+  }
+  if (i > mask_) return false;
+  uint32_t index;
+  while ((index = indices_[i].load(std::memory_order_acquire)) == kUnpublished) std::this_thread::yield();
+  if (index == kFull) return false;
+
+  Record& rec = records_[index];
+  uint32_t seq = rec.seq.load(std::memory_order_relaxed);
+  for (;;) {
+    if (seq & 1) {
+      std::this_thread::yield();
+      seq = rec.seq.load(std::memory_order_relaxed);
+    } else if (rec.seq.compare_exchange_weak(seq, seq + 1, std::memory_order_acquire, std::memory_order_relaxed)) {
+      break;
+    }
+  }
+  // The odd sequence is visible before any word changes.
+  std::atomic_thread_fence(std::memory_order_release);
+  uint64_t words[kWords];
+  for (size_t w = 0; w < kWords; ++w) words[w] = rec.words[w].load(std::memory_order_relaxed);
+  DeviceShadow s;
+  std::memcpy(&s, words, sizeof(s));
+  s.device_id = device_id;
+  merge_record(&s, r);
+  std::memcpy(words, &s, sizeof(s));
+  for (size_t w = 0; w < kWords; ++w) rec.words[w].store(words[w], std::memory_order_relaxed);
+  rec.seq.store(seq + 2, std::memory_order_release);
+  return true;
+}
+
+bool ShadowStore::read(uint64_t imei, DeviceShadow* out) const {
+  const uint32_t index = find(imei);
+  if (index >= kFull) return false;
+  const Record& rec = records_[index];
+  uint64_t words[kWords];
+  for (;;) {
+    const uint32_t seq = rec.seq.load(std::memory_order_acquire);
+    if (seq & 1) {
+      std::this_thread::yield();
+      continue;
+    }
+    for (size_t w = 0; w < kWords; ++w) words[w] = rec.words[w].load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (rec.seq.load(std::memory_order_relaxed) == seq) break;
+  }
+  std::memcpy(out, words, sizeof(*out));
+  return true;
+}
+
+size_t ShadowStore::memory_bytes() const {
+  return sizeof(*this) + (mask_ + 1) * (sizeof(keys_[0]) + sizeof(indices_[0])) + capacity_ * sizeof(Record);
+}
+
+}  // namespace agro::server
@@ -0,0 +1,191 @@
+#include "agro/server/frame_verifier.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <thread>
+
+#include "agro/crc32.hpp"
+
+namespace agro::server {
+namespace {
+
+// Below this many frames per thread, starting a thread costs more than the
+// frames (about 1 us each) it would take over.
+constexpr size_t kMinFramesPerThread = 256;
+
+// Downlink counters reserved per log record, so the log is written once per
+// this many downlinks to a device rather than for each. A restart skips at
+// most this many.
+constexpr uint32_t kDownlinkReserve = 1024;
+// LE device id, epoch, counter limit, then the CRC-32 of those 12 bytes.
+constexpr size_t kDownlinkRecordBytes = 16;
+
+void put_le32(uint8_t* p, uint32_t v) {
+  p[0] = uint8_t(v);
+  p[1] = uint8_t(v >> 8);
+  p[2] = uint8_t(v >> 16);
+  p[3] = uint8_t(v >> 24);
+}
+uint32_t get_le32(const uint8_t* p) {
+  return uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 | uint32_t(p[3]) << 24;
+}
+
+}  // namespace
+
+FrameVerifier::FrameVerifier(unsigned threads) : threads_(threads) {
+  if (threads_ == 0) threads_ = std::thread::hardware_concurrency();
+  if (threads_ == 0) threads_ = 1;
+}
+
+FrameVerifier::~FrameVerifier() {
+  if (log_fd_ >= 0) ::close(log_fd_);
+}
+
+bool FrameVerifier::open_downlink_log(const char* path) {
+  const int fd = ::open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (fd < 0) return false;
+  // Records up to the first torn or corrupt one; a crash can only tear the
+  // last, and whatever it reserved was never used.
+  uint64_t end = 0;
+  uint8_t r[kDownlinkRecordBytes];
+  while (pread(fd, r, sizeof(r), off_t(end)) == ssize_t(sizeof(r)) && crc32(r, 12) == get_le32(r + 12)) {
+    Downlink& dl = downlinks_[get_le32(r)];
+    const uint32_t epoch = get_le32(r + 4), limit = get_le32(r + 8);
+    if (epoch > dl.epoch || (epoch == dl.epoch && limit > dl.limit)) dl = Downlink{epoch, limit, limit};
+    end += sizeof(r);
+  }
+  if (ftruncate(fd, off_t(end)) != 0 || fdatasync(fd) != 0) {
+    const int e = errno;
+    ::close(fd);
+    errno = e;
+    return false;
+  }
+  if (log_fd_ >= 0) ::close(log_fd_);
+  log_fd_ = fd;
+  log_end_ = end;
+  return true;
+}
+
+void FrameVerifier::set_key(uint32_t device_id, uint8_t key_id, const uint8_t key[16]) {
+  Device& d = devices_[device_id];
+  d = Device();
+  d.key_id = key_id;
+  gcm_init(&d.key, key);
+}
+
+void FrameVerifier::verify_range(const std::vector<std::vector<uint8_t>>& frames, std::vector<VerifiedFrame>* out,
+                                 size_t begin, size_t end) const {
+  for (size_t i = begin; i < end; ++i) {
+    VerifiedFrame& v = (*out)[i];
+    const std::vector<uint8_t>& f = frames[i];
+    if (!parse_sealed_header(f.data(), f.size(), &v.header) || v.header.dir != FrameDir::kUplink) {
+      v.verdict = FrameVerdict::kMalformed;
+      continue;
+    }
+    const auto it = devices_.find(v.header.device_id);
+    if (it == devices_.end() || it->second.key_id != v.header.key_id) {
+      v.verdict = FrameVerdict::kUnknownDevice;
+      continue;
+    }
+    // Against the windows as they were before the batch: cheap rejection of
+    // stale frames without touching the cipher. The final check is serial.
+    if (!it->second.window.fresh(v.header.epoch, v.header.counter)) {
+      v.verdict = FrameVerdict::kReplay;
+      continue;
+    }
+    v.payload.assign(f.begin(), f.end());
+    uint8_t* payload;
+    size_t len;
+    if (!open_frame(it->second.key, v.payload.data(), v.payload.size(), v.header, &payload, &len)) {
+      v.verdict = FrameVerdict::kBadTag;
+      v.payload.clear();
+      continue;
+    }
+    v.payload.erase(v.payload.begin(), v.payload.begin() + (payload - v.payload.data()));
+    v.payload.resize(len);
+    v.verdict = FrameVerdict::kOk;
+  }
+}
+
+void FrameVerifier::verify(const std::vector<std::vector<uint8_t>>& frames, std::vector<VerifiedFrame>* out) {
+  out->assign(frames.size(), VerifiedFrame());
+  // Workers only read devices_ and write disjoint slices of out.
+  size_t workers = frames.size() / kMinFramesPerThread;
+  if (workers > threads_) workers = threads_;
+  if (workers <= 1) {
+    verify_range(frames, out, 0, frames.size());
+  } else {
+    std::vector<std::thread> pool;
+    const size_t chunk = (frames.size() + workers - 1) / workers;
+    for (size_t w = 1; w < workers; ++w) {
+      const size_t begin = w * chunk, end = std::min(frames.size(), begin + chunk);
+      pool.emplace_back([this, &frames, out, begin, end] { verify_range(frames, out, begin, end); });
+    }
+    verify_range(frames, out, 0, chunk);
+    for (std::thread& t : pool) t.join();
+  }
+
+  for (VerifiedFrame& v : *out) {
+    if (v.verdict == FrameVerdict::kOk) {
+      Device& d = devices_[v.header.device_id];
+      if (!d.window.fresh(v.header.epoch, v.header.counter)) {
+        v.verdict = FrameVerdict::kReplay;
+        v.payload.clear();
+      } else {
+        d.window.accept(v.header.epoch, v.header.counter);
+        if (!d.heard || v.header.epoch > d.uplink_epoch) {
+          d.heard = true;
+          d.uplink_epoch = v.header.epoch;
+        }
+      }
+    }
+    switch (v.verdict) {
+      case FrameVerdict::kOk: ++stats_.ok; break;
+      case FrameVerdict::kMalformed: ++stats_.malformed; break;
+      case FrameVerdict::kUnknownDevice: ++stats_.unknown_device; break;
+      case FrameVerdict::kBadTag: ++stats_.bad_tag; break;
+      case FrameVerdict::kReplay: ++stats_.replayed; break;
+    }
+  }
+}
+
+bool FrameVerifier::seal_downlink(uint32_t device_id, const uint8_t* payload, size_t len, std::vector<uint8_t>* out) {
+  const auto it = devices_.find(device_id);
+  if (it == devices_.end() || !it->second.heard) return false;
+  Device& d = it->second;
+  // The nonce is (device, epoch, counter) under a key that outlives both this
+  // process and set_key, so counters only ever move forward per epoch. An
+  // uplink from an older epoch (replayed after a restart, when the window is
+  // empty) gets nothing: its counters may already have been used.
+  Downlink& dl = downlinks_[device_id];
+  if (d.uplink_epoch < dl.epoch) return false;
+  if (d.uplink_epoch > dl.epoch) dl = Downlink{d.uplink_epoch, 0, 0};
+  if (dl.next == UINT32_MAX) return false;
+  if (dl.next == dl.limit) {
+    // Log the reservation before using any counter in it.
+    const uint32_t limit = dl.limit > UINT32_MAX - kDownlinkReserve ? UINT32_MAX : dl.limit + kDownlinkReserve;
+    if (log_fd_ >= 0) {
+      uint8_t r[kDownlinkRecordBytes];
+      put_le32(r, device_id);
+      put_le32(r + 4, dl.epoch);
+      put_le32(r + 8, limit);
+      put_le32(r + 12, crc32(r, 12));
+      if (pwrite(log_fd_, r, sizeof(r), off_t(log_end_)) != ssize_t(sizeof(r)) || fdatasync(log_fd_) != 0) return false;
+      log_end_ += sizeof(r);
+    }
+    dl.limit = limit;
+  }
+  SealedHeader h;
+  h.dir = FrameDir::kDownlink;
+  h.key_id = d.key_id;
+  h.device_id = device_id;
+  h.epoch = dl.epoch;
+  h.counter = dl.next++;
+  out->resize(len + kSealedOverhead);
+  return seal_frame(d.key, h, payload, len, out->data(), out->size()) != 0;
+}
+
+}  // namespace agro::server
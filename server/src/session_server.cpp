@@ -0,0 +1,253 @@
+#include "agro/server/session_server.hpp"
+
+#include <fcntl.h>
+#include <sys/random.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+
+#include "agro/crc32.hpp"
+
+namespace agro::server {
+namespace {
+
+using session_detail::get_be32;
+using session_detail::put_be32;
+
+// Ticket sequence numbers reserved per log record; a restart skips at most
+// this many per device.
+constexpr uint32_t kSeqReserve = 64;
+// BE device id, sequence limit, then the CRC-32 of those 8 bytes.
+constexpr size_t kTicketRecordBytes = 12;
+
+void append_record(std::vector<uint8_t>* out, SessionRecord type, const uint8_t* body, size_t len) {
+  uint8_t header[kRecordHeaderBytes];
+  session_detail::record_header(header, type, len);
+  out->insert(out->end(), header, header + kRecordHeaderBytes);
+  out->insert(out->end(), body, body + len);
+}
+
+}  // namespace
+
+SessionServer::SessionServer(const uint8_t ticket_key[16], const Config& cfg) : cfg_(cfg) {
+  gcm_init(&ticket_key_, ticket_key);
+}
+
+SessionServer::~SessionServer() {
+  if (log_fd_ >= 0) ::close(log_fd_);
+}
+
+bool SessionServer::open_ticket_log(const char* path) {
+  const int fd = ::open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (fd < 0) return false;
+  // Records up to the first torn or corrupt one; a crash can only tear the
+  // last, and no ticket was issued from what it reserved.
+  uint64_t end = 0;
+  uint8_t r[kTicketRecordBytes];
+  while (pread(fd, r, sizeof(r), off_t(end)) == ssize_t(sizeof(r)) && crc32(r, 8) == get_be32(r + 8)) {
+    uint32_t& limit = logged_limits_[get_be32(r)];
+    limit = std::max(limit, get_be32(r + 4));
+    end += sizeof(r);
+  }
+  if (ftruncate(fd, off_t(end)) != 0 || fdatasync(fd) != 0) {
+    const int e = errno;
+    ::close(fd);
+    errno = e;
+    return false;
+  }
+  if (log_fd_ >= 0) ::close(log_fd_);
+  log_fd_ = fd;
+  log_end_ = end;
+  return true;
+}
+
+void SessionServer::set_device_key(uint32_t device_id, uint8_t key_id, const uint8_t key[16]) {
+  Device& d = devices_[device_id];
+  const auto logged = logged_limits_.find(device_id);
+  const uint32_t next = std::max(d.next_seq, logged == logged_limits_.end() ? 1u : logged->second);
+  d = Device();
+  d.key_id = key_id;
+  gcm_init(&d.key, key);
+  d.next_seq = d.seq_limit = d.resume_floor = next;
+}
+
+void SessionServer::random(uint8_t* out, size_t len) {
+  // Server randoms feed the session keys and ticket nonces: the kernel
+  // CSPRNG, never a seeded generator. It only fails before the pool is
+  // initialized at boot, when blocking is the right thing, or on EINTR.
+  while (len > 0) {
+    const ssize_t n = getrandom(out, len, 0);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      std::abort();
+    }
+    out += n;
+    len -= size_t(n);
+  }
+}
+
+bool SessionServer::grant(Connection& c, Device& d, const uint8_t server_random[kSessionRandomBytes], uint32_t now_s,
+                          uint8_t* out) {
+  if (d.next_seq == d.seq_limit) {
+    // Log the reservation before issuing any ticket in it.
+    const uint32_t limit = d.seq_limit + kSeqReserve;
+    if (log_fd_ >= 0) {
+      uint8_t r[kTicketRecordBytes];
+      put_be32(r, c.device_id);
+      put_be32(r + 4, limit);
+      put_be32(r + 8, crc32(r, 8));
+      if (pwrite(log_fd_, r, sizeof(r), off_t(log_end_)) != ssize_t(sizeof(r)) || fdatasync(log_fd_) != 0) {
+        return false;
+      }
+      log_end_ += sizeof(r);
+    }
+    d.seq_limit = limit;
+  }
+  c.seq = d.next_seq++ & kMaxEpoch;
+  c.issued_s = now_s;
+  put_be32(out, cfg_.ticket_lifetime_s);
+  put_be32(out + 4, c.seq);
+  std::memcpy(out + 8, server_random, kSessionRandomBytes);
+  uint8_t* t = out + 8 + kSessionRandomBytes;
+  random(t, kGcmNonceBytes);
+  uint8_t* p = t + kGcmNonceBytes;
+  put_be32(p, c.device_id);
+  p[4] = c.key_id;
+  put_be32(p + 5, c.issued_s);
+  put_be32(p + 9, c.seq);
+  std::memcpy(p + 13, c.key.key, 16);
+  gcm_seal(ticket_key_, t, nullptr, 0, p, kTicketPlainBytes, p + kTicketPlainBytes);
+  return true;
+}
+
+bool SessionServer::open_ticket(const uint8_t* ticket, Connection* c) {
+  uint8_t buf[kTicketBytes];
+  std::memcpy(buf, ticket, kTicketBytes);
+  uint8_t* p = buf + kGcmNonceBytes;
+  if (!gcm_open(ticket_key_, buf, nullptr, 0, p, kTicketPlainBytes, p + kTicketPlainBytes)) return false;
+  c->device_id = get_be32(p);
+  c->key_id = p[4];
+  c->issued_s = get_be32(p + 5);
+  c->seq = get_be32(p + 9);
+  gcm_init(&c->key, p + 13);
+  return true;
+}
+
+void SessionServer::close(Connection& c) {
+  ++stats_.bad;
+  c.state = Connection::State::kClosed;
+}
+
+void SessionServer::on_record(Connection& c, SessionRecord type, const uint8_t* body, size_t len, uint32_t now_s,
+                              std::vector<uint8_t>* reply, std::vector<std::vector<uint8_t>>* payloads) {
+  using State = Connection::State;
+  if (c.state == State::kClosed) return;
+  switch (type) {
+    case SessionRecord::kHello: {
+      if ((c.state != State::kNew && c.state != State::kRejected) || len != kHelloBodyBytes) return close(c);
+      const uint32_t device_id = get_be32(body);
+      const auto it = devices_.find(device_id);
+      if (it == devices_.end() || it->second.key_id != body[4]) return close(c);
+      Device& d = it->second;
+      const uint8_t* client_random = body + 5;
+      if (!gcm_open(d.key, client_random, body, 5 + kSessionRandomBytes, nullptr, 0, body + 5 + kSessionRandomBytes)) {
+        return close(c);
+      }
+      uint8_t server_random[kSessionRandomBytes], key[16];
+      random(server_random, sizeof(server_random));
+      derive_session_key(d.key, client_random, server_random, key);
+      c.device_id = device_id;
+      c.key_id = d.key_id;
+      gcm_init(&c.key, key);
+      uint8_t out[kHelloReplyBodyBytes];
+      if (!grant(c, d, server_random, now_s, out)) return close(c);
+      uint8_t nonce[kGcmNonceBytes];
+      std::memcpy(nonce, client_random, kGcmNonceBytes);
+      nonce[0] ^= 0x80;
+      gcm_seal(d.key, nonce, client_random, kSessionRandomBytes, out, kTicketGrantBytes, out + kTicketGrantBytes);
+      append_record(reply, SessionRecord::kHelloReply, out, sizeof(out));
+      c.state = State::kSession;
+      ++stats_.full_handshakes;
+      return;
+    }
+    case SessionRecord::kResume: {
+      if (c.state != State::kNew || len != kTicketBytes) return close(c);
+      Connection t;
+      const bool ok = open_ticket(body, &t);
+      const auto it = ok ? devices_.find(t.device_id) : devices_.end();
+      if (!ok || it == devices_.end() || it->second.key_id != t.key_id || t.seq < it->second.resume_floor ||
+          now_s - t.issued_s >= cfg_.ticket_lifetime_s) {
+        // Data sealed under this ticket follows in the same flight and is
+        // dropped; the client retries with Hello.
+        ++stats_.rejected_tickets;
+        c.state = State::kRejected;
+        append_record(reply, SessionRecord::kReject, nullptr, 0);
+        return;
+      }
+      c = t;
+      c.state = State::kSession;
+      ++stats_.resumptions;
+      return;
+    }
+    case SessionRecord::kData: {
+      if (c.state == State::kRejected) return;
+      if (c.state != State::kSession || len < kSealedOverhead) return close(c);
+      std::vector<uint8_t> frame(body, body + len);
+      SealedHeader h;
+      if (!parse_sealed_header(frame.data(), frame.size(), &h) || h.dir != FrameDir::kUplink ||
+          h.device_id != c.device_id || h.epoch != c.seq) {
+        return close(c);
+      }
+      Device& d = devices_[c.device_id];
+      if (!d.window.fresh(h.epoch, h.counter)) {
+        ++stats_.replayed;
+        return;
+      }
+      uint8_t* payload;
+      size_t payload_len;
+      if (!open_frame(c.key, frame.data(), frame.size(), h, &payload, &payload_len)) return close(c);
+      d.window.accept(h.epoch, h.counter);
+      payloads->emplace_back(payload, payload + payload_len);
+      ++stats_.frames;
+
+      // Ack under the session key; its counter is the acked one, and a new
+      // ticket uses the same with the top bit set, so the server needs no
+      // downlink counter per session.
+      SealedHeader down;
+      down.dir = FrameDir::kDownlink;
+      down.key_id = c.key_id;
+      down.device_id = c.device_id;
+      down.epoch = c.seq;
+      down.counter = h.counter;
+      uint8_t acked[4], ack[kAckBodyBytes];
+      put_be32(acked, h.counter);
+      seal_frame(c.key, down, acked, sizeof(acked), ack, sizeof(ack));
+      append_record(reply, SessionRecord::kAck, ack, sizeof(ack));
+
+      if (!c.renewed && now_s - c.issued_s >= cfg_.ticket_lifetime_s / 2) {
+        c.renewed = true;
+        const GcmKey old = c.key;
+        const uint8_t zero[kSessionRandomBytes] = {};
+        uint8_t server_random[kSessionRandomBytes], key[16];
+        random(server_random, sizeof(server_random));
+        derive_session_key(old, zero, server_random, key);
+        Connection next = c;
+        gcm_init(&next.key, key);
+        uint8_t g[kTicketGrantBytes], out[kNewTicketBodyBytes];
+        // Unlogged, the old ticket simply stays in use.
+        if (!grant(next, d, server_random, now_s, g)) return;
+        down.counter = h.counter | 0x80000000u;
+        seal_frame(old, down, g, sizeof(g), out, sizeof(out));
+        append_record(reply, SessionRecord::kNewTicket, out, sizeof(out));
+        ++stats_.new_tickets;
+      }
+      return;
+    }
+    default:
+      return close(c);
+  }
+}
+
+}  // namespace agro::server
@@ -0,0 +1,141 @@
+#include "agro/server/sms_ingest.hpp"
+
+#include "agro/telemetry_codec.hpp"
+
+namespace agro::server {
+namespace {
+
+int hex_value(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  return -1;
+}
+
+bool decode_hex(std::string_view hex, std::vector<uint8_t>* out) {
+  if (hex.size() % 2) return false;
+  out->resize(hex.size() / 2);
+  for (size_t i = 0; i < out->size(); ++i) {
+    const int hi = hex_value(hex[2 * i]), lo = hex_value(hex[2 * i + 1]);
+    if (hi < 0 || lo < 0) return false;
+    (*out)[i] = static_cast<uint8_t>(hi << 4 | lo);
+  }
+  return true;
+}
+
+uint16_t distance(uint16_t from, uint16_t to) { return static_cast<uint16_t>(to - from); }
+
+}  // namespace
+
+bool parse_deliver_pdu(std::string_view hex, SmsDeliver* out) {
+  std::vector<uint8_t> pdu;
+  if (!decode_hex(hex, &pdu) || pdu.empty()) return false;
+  size_t pos = 1 + pdu[0];  // skip SMSC
+  if (pos + 2 > pdu.size()) return false;
+  const uint8_t first = pdu[pos++];
+  if ((first & 0x03) != 0x00) return false;  // not SMS-DELIVER
+  const bool has_udh = first & 0x40;
+
+  const uint8_t oa_digits = pdu[pos++];
+  if (pos + 1 + (oa_digits + 1) / 2 > pdu.size()) return false;
+  const uint8_t oa_type = pdu[pos++];
+  out->sender.clear();
+  if ((oa_type & 0x70) == 0x10) out->sender.push_back('+');
+  for (uint8_t i = 0; i < oa_digits; ++i) {
+    const uint8_t octet = pdu[pos + i / 2];
+    const uint8_t d = i % 2 ? octet >> 4 : octet & 0x0f;
+    if (d > 9) return false;
+    out->sender.push_back(static_cast<char>('0' + d));
+  }
+  pos += (oa_digits + 1) / 2;
+
+  if (pos + 1 + 1 + 7 + 1 > pdu.size()) return false;
+  ++pos;  // PID
+  const uint8_t dcs = pdu[pos++];
+  if ((dcs & 0xc0) != 0x00 || (dcs & 0x0c) != 0x04) return false;  // 8-bit only
+  pos += 7;  // service centre timestamp
+  const uint8_t udl = pdu[pos++];
+  if (pos + udl > pdu.size()) return false;
+
+  size_t skip = 0;
+  if (has_udh) {
+    if (udl == 0) return false;
+    skip = 1u + pdu[pos];
+    if (skip > udl) return false;
+  }
+  out->user_data.assign(pdu.begin() + pos + skip, pdu.begin() + pos + udl);
+  return true;
+}
+
+void SmsReassembler::accept(const std::string& sender, const std::vector<uint8_t>& packet, uint32_t now_s,
+                            std::vector<TelemetryRecord>* out) {
+  Pending p{now_s, {}};
+  uint16_t seq = 0;
+  if (packet.size() < 2 || !unpack_telemetry(packet.data() + 1, packet.size() - 1, &seq,
+                                             [&](const TelemetryRecord& r) { p.records.push_back(r); })) {
+    ++stats_.malformed;
+    return;
+  }
+  ++stats_.packets;
+
+  // The device restarts its sequence at 0 under a new boot epoch; a packet
+  // of an earlier epoch is a late one from before that boot.
+  const uint8_t epoch = packet[0];
+  Stream& s = streams_[sender];
+  if (s.started && epoch != s.epoch) {
+    if (static_cast<uint8_t>(epoch - s.epoch) >= 0x80) {
+      ++stats_.stale;
+      return;
+    }
+    flush(s, out);
+    s.epoch = epoch;
+    s.next_seq = 0;
+    ++stats_.restarts;
+  } else if (!s.started) {
+    s.started = true;
+    s.epoch = epoch;
+    s.next_seq = seq;
+  }
+  if (distance(s.next_seq, seq) >= 0x8000 || s.pending.count(seq)) {
+    ++stats_.duplicates;
+    return;
+  }
+  s.pending.emplace(seq, std::move(p));
+  drain(s, out);
+}
+
+void SmsReassembler::expire(uint32_t now_s, std::vector<std::pair<std::string, TelemetryRecord>>* out) {
+  std::vector<TelemetryRecord> released;
+  for (auto& [sender, s] : streams_) {
+    while (skip_gap(s, now_s)) drain(s, &released);
+    for (const TelemetryRecord& r : released) out->emplace_back(sender, r);
+    released.clear();
+  }
+}
+
+void SmsReassembler::drain(Stream& s, std::vector<TelemetryRecord>* out) {
+  for (auto it = s.pending.find(s.next_seq); it != s.pending.end(); it = s.pending.find(s.next_seq)) {
+    out->insert(out->end(), it->second.records.begin(), it->second.records.end());
+    s.pending.erase(it);
+    ++s.next_seq;
+  }
+}
+
+void SmsReassembler::flush(Stream& s, std::vector<TelemetryRecord>* out) {
+  while (skip_gap(s, UINT32_MAX)) drain(s, out);
+}
+
+bool SmsReassembler::skip_gap(Stream& s, uint32_t now_s) {
+  auto oldest = s.pending.end();
+  for (auto it = s.pending.begin(); it != s.pending.end(); ++it) {
+    if (oldest == s.pending.end() || distance(s.next_seq, it->first) < distance(s.next_seq, oldest->first)) {
+      oldest = it;
+    }
+  }
+  if (oldest == s.pending.end() || now_s - oldest->second.received_s < gap_timeout_s_) return false;
+  stats_.lost += distance(s.next_seq, oldest->first);
+  s.next_seq = oldest->first;
+  return true;
+}
+
+}  // namespace agro::server
@@ -0,0 +1,343 @@
+#include "agro/server/spatial_index.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace agro::server {
+namespace {
+
+constexpr double kLatM = 0.011132;  // metres per 1e-7 degrees of latitude
+constexpr int64_t kLonBias = 1800000000;
+constexpr int64_t kLatBias = 900000000;
+// Runs this short are scanned rather than split: 32 positions are two cache
+// lines of codes and four of devices.
+constexpr uint32_t kLeafRun = 32;
+
+// Bits 0..21 of v to the even bits of the result.
+uint64_t spread(uint32_t v) {
+  uint64_t x = v;
+  x = (x | x << 16) & 0x0000ffff0000ffffull;
+  x = (x | x << 8) & 0x00ff00ff00ff00ffull;
+  x = (x | x << 4) & 0x0f0f0f0f0f0f0f0full;
+  x = (x | x << 2) & 0x3333333333333333ull;
+  x = (x | x << 1) & 0x5555555555555555ull;
+  return x;
+}
+
+uint32_t squeeze(uint64_t x) {
+  x &= 0x5555555555555555ull;
+  x = (x | x >> 1) & 0x3333333333333333ull;
+  x = (x | x >> 2) & 0x0f0f0f0f0f0f0f0full;
+  x = (x | x >> 4) & 0x00ff00ff00ff00ffull;
+  x = (x | x >> 8) & 0x0000ffff0000ffffull;
+  x = (x | x >> 16) & 0x00000000ffffffffull;
+  return uint32_t(x);
+}
+
+uint64_t fine_code(GeoPoint p) {
+  const uint32_t x = uint32_t((p.lon + kLonBias) >> DeviceGrid::kCellShift);
+  const uint32_t y = uint32_t((p.lat + kLatBias) >> DeviceGrid::kCellShift);
+  return spread(x) | spread(y) << 1;
+}
+
+int32_t clamp32(int64_t v) { return int32_t(std::clamp<int64_t>(v, INT32_MIN, INT32_MAX)); }
+
+// Squared distance in m^2 from p to the nearest point of b; lon_m is metres
+// per 1e-7 degrees of longitude at p.
+double distance2(GeoPoint p, const GeoBox& b, double lon_m) {
+  const int64_t dlat = std::max<int64_t>({0, int64_t(b.min_lat) - p.lat, int64_t(p.lat) - b.max_lat});
+  const int64_t dlon = std::max<int64_t>({0, int64_t(b.min_lon) - p.lon, int64_t(p.lon) - b.max_lon});
+  const double y = double(dlat) * kLatM, x = double(dlon) * lon_m;
+  return x * x + y * y;
+}
+
+// Whether the segment a-c may meet the box. False only when it certainly
+// does not: its box misses, or all four corners are on one side of its line.
+bool edge_meets(const GeoBox& b, GeoPoint a, GeoPoint c) {
+  if (std::max(a.lat, c.lat) < b.min_lat || std::min(a.lat, c.lat) > b.max_lat) return false;
+  if (std::max(a.lon, c.lon) < b.min_lon || std::min(a.lon, c.lon) > b.max_lon) return false;
+  const double dlat = double(c.lat) - a.lat, dlon = double(c.lon) - a.lon;
+  const int32_t lats[2] = {b.min_lat, b.max_lat}, lons[2] = {b.min_lon, b.max_lon};
+  int above = 0, below = 0;
+  for (int32_t lat : lats) {
+    for (int32_t lon : lons) {
+      const double s = dlon * (double(lat) - a.lat) - dlat * (double(lon) - a.lon);
+      // Rounding margin: products reach 1e19, doubles carry 53 bits.
+      if (s > 1e4) ++above;
+      else if (s < -1e4) ++below;
+      else return true;
+    }
+  }
+  return above != 0 && below != 0;
+}
+
+}  // namespace
+
+void GeoBox::extend(GeoPoint p) {
+  min_lat = std::min(min_lat, p.lat);
+  max_lat = std::max(max_lat, p.lat);
+  min_lon = std::min(min_lon, p.lon);
+  max_lon = std::max(max_lon, p.lon);
+}
+
+void GeoBox::extend(const GeoBox& b) {
+  min_lat = std::min(min_lat, b.min_lat);
+  max_lat = std::max(max_lat, b.max_lat);
+  min_lon = std::min(min_lon, b.min_lon);
+  max_lon = std::max(max_lon, b.max_lon);
+}
+
+GeoBox bounds(const GeoPoint* vertices, size_t n) {
+  GeoBox b;
+  for (size_t i = 0; i < n; ++i) b.extend(vertices[i]);
+  return b;
+}
+
+bool inside_polygon(GeoPoint p, const GeoPoint* v, size_t n) {
+  bool in = false;
+  for (size_t i = 0, j = n - 1; i < n; j = i++) {
+    const GeoPoint a = v[i], b = v[j];
+    if ((a.lat > p.lat) == (b.lat > p.lat)) continue;
+    // p.lon < lon of the edge at p.lat, multiplied out; spans up to 360
+    // degrees by 180 still fit in 63 bits.
+    const int64_t lhs = (int64_t(p.lon) - a.lon) * (int64_t(b.lat) - a.lat);
+    const int64_t rhs = (int64_t(b.lon) - a.lon) * (int64_t(p.lat) - a.lat);
+    if (b.lat > a.lat ? lhs < rhs : lhs > rhs) in = !in;
+  }
+  return in;
+}
+
+// ---- FieldIndex ----
+
+void FieldIndex::add(uint32_t field_id, const GeoPoint* vertices, size_t n) {
+  if (levels_.size() > 1) return;
+  if (levels_.empty()) levels_.emplace_back();
+  Node node;
+  node.box = bounds(vertices, n);
+  node.first = uint32_t(ids_.size());  // slot until build()
+  node.count = uint32_t(n);
+  levels_[0].push_back(node);
+  starts_.push_back(uint32_t(vertices_.size()));
+  ids_.push_back(field_id);
+  vertices_.insert(vertices_.end(), vertices, vertices + n);
+}
+
+std::vector<FieldIndex::Node> FieldIndex::pack(std::vector<Node>* items) {
+  std::vector<Node>& v = *items;
+  const size_t nodes = (v.size() + kFanout - 1) / kFanout;
+  const size_t per_slice = size_t(std::ceil(std::sqrt(double(nodes)))) * kFanout;
+  const auto lon = [](const Node& a) { return int64_t(a.box.min_lon) + a.box.max_lon; };
+  const auto lat = [](const Node& a) { return int64_t(a.box.min_lat) + a.box.max_lat; };
+  std::sort(v.begin(), v.end(), [&](const Node& a, const Node& b) { return lon(a) < lon(b); });
+  for (size_t s = 0; s < v.size(); s += per_slice) {
+    std::sort(v.begin() + s, v.begin() + std::min(v.size(), s + per_slice),
+              [&](const Node& a, const Node& b) { return lat(a) < lat(b); });
+  }
+  std::vector<Node> up(nodes);
+  for (size_t i = 0; i < nodes; ++i) {
+    Node& u = up[i];
+    u.first = uint32_t(i * kFanout);
+    u.count = uint32_t(std::min(kFanout, v.size() - u.first));
+    for (uint32_t c = u.first; c < u.first + u.count; ++c) u.box.extend(v[c].box);
+  }
+  return up;
+}
+
+void FieldIndex::build() {
+  if (levels_.size() != 1) return;  // nothing added, or built already
+  std::vector<Node> up = pack(&levels_[0]);
+  // Polygons to leaf order, so a leaf's vertices are read in one sweep.
+  std::vector<uint32_t> ids(ids_.size());
+  std::vector<GeoPoint> vertices;
+  vertices.reserve(vertices_.size());
+  for (size_t i = 0; i < levels_[0].size(); ++i) {
+    Node& n = levels_[0][i];
+    ids[i] = ids_[n.first];
+    const uint32_t start = starts_[n.first];
+    n.first = uint32_t(vertices.size());
+    vertices.insert(vertices.end(), vertices_.begin() + start, vertices_.begin() + start + n.count);
+  }
+  ids_ = std::move(ids);
+  vertices_ = std::move(vertices);
+  starts_ = {};
+  while (up.size() > kFanout) {
+    levels_.push_back(std::move(up));
+    up = pack(&levels_.back());
+  }
+  levels_.push_back(std::move(up));
+}
+
+template <typename Hit, typename Leaf>
+void FieldIndex::search(const Hit& hit, const Leaf& leaf) const {
+  if (levels_.size() < 2) return;
+  // Depth first; at most kFanout entries wait per level.
+  struct Item {
+    uint32_t level, index;
+  };
+  Item stack[kFanout * 16];
+  size_t depth = 0;
+  const std::vector<Node>& top = levels_.back();
+  for (uint32_t i = 0; i < top.size(); ++i) {
+    if (hit(top[i].box)) stack[depth++] = {uint32_t(levels_.size() - 1), i};
+  }
+  while (depth != 0) {
+    const Item it = stack[--depth];
+    const Node& n = levels_[it.level][it.index];
+    if (it.level == 0) {
+      leaf(it.index, n);
+      continue;
+    }
+    const std::vector<Node>& below = levels_[it.level - 1];
+    for (uint32_t c = n.first; c < n.first + n.count; ++c) {
+      if (hit(below[c].box)) stack[depth++] = {it.level - 1, c};
+    }
+  }
+}
+
+void FieldIndex::fields_at(GeoPoint p, std::vector<uint32_t>* out) const {
+  search([p](const GeoBox& b) { return b.contains(p); },
+         [&](uint32_t i, const Node& n) {
+           if (inside_polygon(p, &vertices_[n.first], n.count)) out->push_back(ids_[i]);
+         });
+}
+
+void FieldIndex::fields_in(const GeoBox& box, std::vector<uint32_t>* out) const {
+  search([&box](const GeoBox& b) { return b.intersects(box); },
+         [&](uint32_t i, const Node&) { out->push_back(ids_[i]); });
+}
+
+// ---- DeviceGrid ----
+
+void DeviceGrid::build(std::vector<DevicePosition> devices) {
+  std::vector<std::pair<uint64_t, uint32_t>> order(devices.size());
+  for (size_t i = 0; i < devices.size(); ++i) order[i] = {fine_code(devices[i].pos), uint32_t(i)};
+  std::sort(order.begin(), order.end());
+  codes_.resize(order.size());
+  devices_.resize(order.size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    codes_[i] = order[i].first;
+    devices_[i] = devices[order[i].second];
+  }
+}
+
+DeviceGrid::Cell DeviceGrid::root() const {
+  // The smallest cell holding every device: where the first and last codes
+  // part.
+  Cell c;
+  if (codes_.empty()) return c;
+  while ((codes_.front() >> 2 * c.level) != (codes_.back() >> 2 * c.level)) ++c.level;
+  c.code = codes_.front() >> 2 * c.level;
+  c.end = uint32_t(codes_.size());
+  return c;
+}
+
+void DeviceGrid::split(const Cell& c, Cell quads[4]) const {
+  const int shift = 2 * (c.level - 1);
+  uint32_t begin = c.begin;
+  for (int q = 0; q < 4; ++q) {
+    const uint64_t code = c.code * 4 + q;
+    const uint32_t end = q == 3 ? c.end
+                                : uint32_t(std::lower_bound(codes_.begin() + begin, codes_.begin() + c.end,
+                                                            (code + 1) << shift) -
+                                           codes_.begin());
+    quads[q] = Cell{c.level - 1, code, begin, end};
+    begin = end;
+  }
+}
+
+GeoBox DeviceGrid::cell_box(const Cell& c) {
+  const int64_t size = int64_t{1} << (c.level + kCellShift);
+  const int64_t lon = int64_t(squeeze(c.code)) * size - kLonBias;
+  const int64_t lat = int64_t(squeeze(c.code >> 1)) * size - kLatBias;
+  GeoBox b;
+  b.min_lon = clamp32(lon);
+  b.max_lon = clamp32(lon + size - 1);
+  b.min_lat = clamp32(lat);
+  b.max_lat = clamp32(lat + size - 1);
+  return b;
+}
+
+void DeviceGrid::nearest(GeoPoint p, size_t k, std::vector<Neighbor>* out) const {
+  out->clear();
+  if (k == 0 || devices_.empty()) return;
+  const double lon_m = kLatM * std::cos(p.lat * 1e-7 * 3.14159265358979 / 180);
+  // Best first: cells by distance from p in a min-heap, the k nearest
+  // devices so far in a max-heap. Stops when no cell left can beat them.
+  struct Pending {
+    double d2;
+    Cell cell;
+    bool operator<(const Pending& o) const { return d2 > o.d2; }
+  };
+  std::vector<Pending> cells;
+  std::vector<std::pair<double, uint32_t>> best;
+  best.reserve(k + 1);
+  cells.push_back({0, root()});
+  while (!cells.empty()) {
+    std::pop_heap(cells.begin(), cells.end());
+    const Pending next = cells.back();
+    cells.pop_back();
+    if (best.size() == k && next.d2 >= best.front().first) break;
+    const Cell& c = next.cell;
+    if (c.level == 0 || c.end - c.begin <= kLeafRun) {
+      for (uint32_t i = c.begin; i < c.end; ++i) {
+        const GeoPoint q = devices_[i].pos;
+        const double d2 = distance2(p, GeoBox{q.lat, q.lon, q.lat, q.lon}, lon_m);
+        if (best.size() == k) {
+          if (d2 >= best.front().first) continue;
+          std::pop_heap(best.begin(), best.end());
+          best.pop_back();
+        }
+        best.emplace_back(d2, i);
+        std::push_heap(best.begin(), best.end());
+      }
+      continue;
+    }
+    Cell quads[4];
+    split(c, quads);
+    for (const Cell& q : quads) {
+      if (q.begin == q.end) continue;
+      cells.push_back({distance2(p, cell_box(q), lon_m), q});
+      std::push_heap(cells.begin(), cells.end());
+    }
+  }
+  std::sort_heap(best.begin(), best.end());
+  out->reserve(best.size());
+  for (const auto& [d2, i] : best) out->push_back({devices_[i].device_id, float(std::sqrt(d2))});
+}
+
+void DeviceGrid::inside(const GeoPoint* v, size_t n, std::vector<uint32_t>* out) const {
+  if (n < 3 || devices_.empty()) return;
+  const GeoBox pb = bounds(v, n);
+  std::vector<Cell> stack{root()};
+  while (!stack.empty()) {
+    const Cell c = stack.back();
+    stack.pop_back();
+    const GeoBox box = cell_box(c);
+    if (!box.intersects(pb)) continue;
+    if (c.level == 0 || c.end - c.begin <= kLeafRun) {
+      for (uint32_t i = c.begin; i < c.end; ++i) {
+        const GeoPoint q = devices_[i].pos;
+        if (pb.contains(q) && inside_polygon(q, v, n)) out->push_back(devices_[i].device_id);
+      }
+      continue;
+    }
+    // Off the outline a cell is wholly in or wholly out; its centre says which.
+    bool outline = false;
+    for (size_t i = 0, j = n - 1; i < n && !outline; j = i++) outline = edge_meets(box, v[j], v[i]);
+    if (!outline) {
+      const GeoPoint centre{int32_t((int64_t(box.min_lat) + box.max_lat) / 2),
+                            int32_t((int64_t(box.min_lon) + box.max_lon) / 2)};
+      if (inside_polygon(centre, v, n)) {
+        for (uint32_t i = c.begin; i < c.end; ++i) out->push_back(devices_[i].device_id);
+      }
+      continue;
+    }
+    Cell quads[4];
+    split(c, quads);
+    for (const Cell& q : quads) {
+      if (q.begin != q.end) stack.push_back(q);
+    }
+  }
+}
+
+}  // namespace agro::server
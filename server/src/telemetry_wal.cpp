@@ -0,0 +1,334 @@
+#include "agro/server/telemetry_wal.hpp"
+
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include "agro/crc32.hpp"
+
+namespace agro::server {
+namespace {
+
+void put_le32(uint8_t* p, uint32_t v) {
+  p[0] = uint8_t(v);
+  p[1] = uint8_t(v >> 8);
+  p[2] = uint8_t(v >> 16);
+  p[3] = uint8_t(v >> 24);
+}
+uint32_t get_le32(const uint8_t* p) {
+  return uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 | uint32_t(p[3]) << 24;
+}
+
+int pwrite_all(int fd, const uint8_t* p, size_t len, uint64_t off) {
+  while (len > 0) {
+    const ssize_t n = pwrite(fd, p, len, off_t(off));
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return n < 0 ? errno : EIO;
+    p += n;
+    len -= size_t(n);
+    off += uint64_t(n);
+  }
+  return 0;
+}
+
+}  // namespace
+
+// Just enough of io_uring for a linked write and fdatasync, on the raw
+// system calls (no liburing): one submitter, one pair in flight.
+class TelemetryWal::Ring {
+ public:
+  ~Ring() {
+    if (sq_ != MAP_FAILED) munmap(sq_, sq_bytes_);
+    if (cq_ != MAP_FAILED && cq_ != sq_) munmap(cq_, cq_bytes_);
+    if (sqes_ != MAP_FAILED) munmap(sqes_, sqes_bytes_);
+    if (fd_ >= 0) ::close(fd_);
+  }
+
+  bool init() {
+    io_uring_params p = {};
+    fd_ = int(syscall(__NR_io_uring_setup, 4, &p));
+    if (fd_ < 0) return false;
+    sq_bytes_ = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+    cq_bytes_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) sq_bytes_ = cq_bytes_ = std::max(sq_bytes_, cq_bytes_);
+    sq_ = mmap(nullptr, sq_bytes_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+    if (sq_ == MAP_FAILED) return false;
+    cq_ = (p.features & IORING_FEAT_SINGLE_MMAP)
+              ? sq_
+              : mmap(nullptr, cq_bytes_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+    sqes_bytes_ = p.sq_entries * sizeof(io_uring_sqe);
+    sqes_ = mmap(nullptr, sqes_bytes_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+    if (cq_ == MAP_FAILED || sqes_ == MAP_FAILED) return false;
+    auto* sq = static_cast<uint8_t*>(sq_);
+    auto* cq = static_cast<uint8_t*>(cq_);
+    sq_tail_ = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+    sq_mask_ = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+    cq_head_ = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+    cq_mask_ = *reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+    // IORING_OP_WRITE and the probe both came in 5.6; on 5.1-5.5 the probe
+    // fails and the ring is not used, rather than failing every write.
+    std::vector<uint64_t> buf((sizeof(io_uring_probe) + IORING_OP_LAST * sizeof(io_uring_probe_op) + 7) / 8);
+    auto* probe = reinterpret_cast<io_uring_probe*>(buf.data());
+    if (syscall(__NR_io_uring_register, fd_, IORING_REGISTER_PROBE, probe, IORING_OP_LAST) < 0) return false;
+    auto supported = [&](unsigned op) {
+      return op <= probe->last_op && (probe->ops[op].flags & IO_URING_OP_SUPPORTED) != 0;
+    };
+    return supported(IORING_OP_WRITE) && supported(IORING_OP_FSYNC);
+  }
+
+  // Writes len bytes at off, then fdatasync, linked so the sync only runs
+  // after a complete write. Results as the kernel gives them: bytes or
+  // -errno for the write, 0 or -errno (-ECANCELED after a short write) for
+  // the sync. False if the ring itself failed.
+  bool write_sync(int fd, const uint8_t* p, uint32_t len, uint64_t off, int* write_res, int* sync_res) {
+    auto* sqes = static_cast<io_uring_sqe*>(sqes_);
+    const unsigned tail = *sq_tail_;  // only this thread moves it
+    for (unsigned k = 0; k < 2; ++k) {
+      const unsigned i = (tail + k) & sq_mask_;
+      io_uring_sqe& e = sqes[i];
+      std::memset(&e, 0, sizeof(e));
+      e.fd = fd;
+      e.user_data = k;
+      if (k == 0) {
+        e.opcode = IORING_OP_WRITE;
+        e.flags = IOSQE_IO_LINK;
+        e.addr = uint64_t(uintptr_t(p));
+        e.len = len;
+        e.off = off;
+      } else {
+        e.opcode = IORING_OP_FSYNC;
+        e.fsync_flags = IORING_FSYNC_DATASYNC;
+      }
+      sq_array_[i] = i;
+    }
+    __atomic_store_n(sq_tail_, tail + 2, __ATOMIC_RELEASE);
+    unsigned submit = 2, reaped = 0;
+    while (reaped < 2) {
+      const long r = syscall(__NR_io_uring_enter, fd_, submit, 2 - reaped, IORING_ENTER_GETEVENTS, nullptr, 0);
+      if (r < 0 && errno != EINTR) return false;
+      if (r > 0) submit -= std::min(submit, unsigned(r));
+      unsigned head = *cq_head_;
+      const unsigned ctail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+      for (; head != ctail; ++head, ++reaped) {
+        const io_uring_cqe& c = cqes_[head & cq_mask_];
+        *(c.user_data == 0 ? write_res : sync_res) = c.res;
+      }
+      __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+    }
+    return true;
+  }
+
+ private:
+  int fd_ = -1;
+  void* sq_ = MAP_FAILED;
+  void* cq_ = MAP_FAILED;
+  void* sqes_ = MAP_FAILED;
+  size_t sq_bytes_ = 0, cq_bytes_ = 0, sqes_bytes_ = 0;
+  unsigned* sq_tail_ = nullptr;
+  unsigned sq_mask_ = 0;
+  unsigned* sq_array_ = nullptr;
+  unsigned* cq_head_ = nullptr;
+  unsigned* cq_tail_ = nullptr;
+  unsigned cq_mask_ = 0;
+  io_uring_cqe* cqes_ = nullptr;
+};
+
+TelemetryWal::TelemetryWal(const WalConfig& cfg, Durable durable) : cfg_(cfg), durable_(std::move(durable)) {}
+
+TelemetryWal::~TelemetryWal() { close(); }
+
+int64_t TelemetryWal::recover(const std::string& path, const std::function<void(const uint8_t*, size_t)>& fn) {
+  const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return errno == ENOENT ? 0 : -1;
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    const int e = errno;
+    ::close(fd);
+    errno = e;
+    return -1;
+  }
+  const uint64_t size = uint64_t(st.st_size);
+  std::vector<uint8_t> buf(1 << 20);
+  size_t begin = 0, end = 0;
+  uint64_t off = 0;
+  // Makes at least need bytes available at buf[begin]; false at the end.
+  auto fill = [&](size_t need) {
+    if (end - begin >= need) return true;
+    std::memmove(buf.data(), buf.data() + begin, end - begin);
+    end -= begin;
+    begin = 0;
+    if (buf.size() < need) buf.resize(need);
+    while (end < need) {
+      const ssize_t n = read(fd, buf.data() + end, buf.size() - end);
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) return false;
+      end += size_t(n);
+    }
+    return true;
+  };
+  while (fill(kWalRecordHeader)) {
+    const uint32_t len = get_le32(buf.data() + begin);
+    if (len == 0 || off + kWalRecordHeader + len > size || !fill(kWalRecordHeader + len)) break;
+    const uint8_t* rec = buf.data() + begin;
+    if (crc32(rec + kWalRecordHeader, len, crc32(rec, 4)) != get_le32(rec + 4)) break;
+    if (fn) fn(rec + kWalRecordHeader, len);
+    begin += kWalRecordHeader + len;
+    off += kWalRecordHeader + len;
+  }
+  ::close(fd);
+  return int64_t(off);
+}
+
+bool TelemetryWal::open(const std::function<void(const uint8_t*, size_t)>& replay) {
+  if (fd_ >= 0) return true;
+  const int64_t end = recover(cfg_.path, replay);
+  if (end < 0) return false;
+  fd_ = ::open(cfg_.path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+  // Drop the torn tail, so records of an earlier run past it can never
+  // line up behind new ones.
+  if (fd_ < 0 || ftruncate(fd_, off_t(end)) != 0 || fdatasync(fd_) != 0) {
+    const int e = errno;
+    if (fd_ >= 0) ::close(fd_);
+    fd_ = -1;
+    errno = e;
+    return false;
+  }
+  if (cfg_.io_uring) {
+    ring_ = std::make_unique<Ring>();
+    if (!ring_->init()) ring_.reset();
+  }
+  allocated_ = uint64_t(end);
+  tail_ = durable_lsn_ = uint64_t(end);
+  error_ = 0;
+  closing_ = false;
+  running_ = true;
+  stats_ = Stats();
+  stats_.io_uring = ring_ != nullptr;
+  writer_ = std::thread(&TelemetryWal::run, this);
+  return true;
+}
+
+uint64_t TelemetryWal::append(const uint8_t* data, size_t len, uint64_t cookie) {
+  if (len == 0 || len > UINT32_MAX - kWalRecordHeader) return 0;
+  uint8_t header[kWalRecordHeader];
+  put_le32(header, uint32_t(len));
+  put_le32(header + 4, crc32(data, len, crc32(header, 4)));
+  std::unique_lock<std::mutex> lock(mu_);
+  space_cv_.wait(lock, [&] { return closing_ || error_ != 0 || open_.bytes.size() < cfg_.max_group_bytes; });
+  if (closing_ || error_ != 0) return 0;
+  const bool wake = open_.bytes.empty();
+  open_.bytes.insert(open_.bytes.end(), header, header + kWalRecordHeader);
+  open_.bytes.insert(open_.bytes.end(), data, data + len);
+  open_.cookies.push_back(cookie);
+  tail_ += kWalRecordHeader + len;
+  const uint64_t lsn = tail_;
+  lock.unlock();
+  if (wake) work_cv_.notify_one();
+  return lsn;
+}
+
+bool TelemetryWal::wait(uint64_t lsn) {
+  std::unique_lock<std::mutex> lock(mu_);
+  done_cv_.wait(lock, [&] { return durable_lsn_ >= lsn || error_ != 0 || !running_ || lsn > tail_; });
+  return durable_lsn_ >= lsn;
+}
+
+void TelemetryWal::close() {
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    closing_ = true;
+  }
+  work_cv_.notify_all();
+  space_cv_.notify_all();
+  if (writer_.joinable()) writer_.join();
+  ring_.reset();
+  if (fd_ >= 0) ::close(fd_);
+  fd_ = -1;
+}
+
+uint64_t TelemetryWal::durable_lsn() const {
+  std::lock_guard<std::mutex> lock(mu_);
+  return durable_lsn_;
+}
+
+int TelemetryWal::error() const {
+  std::lock_guard<std::mutex> lock(mu_);
+  return error_;
+}
+
+TelemetryWal::Stats TelemetryWal::stats() const {
+  std::lock_guard<std::mutex> lock(mu_);
+  return stats_;
+}
+
+int TelemetryWal::commit(const std::vector<uint8_t>& bytes, uint64_t off) {
+  const uint64_t end = off + bytes.size();
+  if (end > allocated_) {
+    const uint64_t grow = std::max<uint64_t>(cfg_.grow_bytes, end - allocated_);
+    // Not every file system has it; the writes then extend the file.
+    if (fallocate(fd_, 0, off_t(allocated_), off_t(grow)) == 0) allocated_ += grow;
+  }
+  size_t done = 0;
+  if (ring_ && bytes.size() <= UINT32_MAX) {
+    int write_res = 0, sync_res = 0;
+    if (!ring_->write_sync(fd_, bytes.data(), uint32_t(bytes.size()), off, &write_res, &sync_res)) {
+      // In an unknown state; closing it waits out anything still queued,
+      // and rewriting the same bytes below is harmless.
+      ring_.reset();
+    } else if (write_res == -EINVAL || write_res == -EOPNOTSUPP) {
+      ring_.reset();  // the kernel cannot do this write on a ring after all
+    } else {
+      if (write_res < 0) return -write_res;
+      if (size_t(write_res) == bytes.size()) return sync_res < 0 ? -sync_res : 0;
+      done = size_t(write_res);  // short write: the sync was cancelled
+    }
+  }
+  if (const int e = pwrite_all(fd_, bytes.data() + done, bytes.size() - done, off + done)) return e;
+  return fdatasync(fd_) == 0 ? 0 : errno;
+}
+
+void TelemetryWal::run() {
+  std::unique_lock<std::mutex> lock(mu_);
+  for (;;) {
+    work_cv_.wait(lock, [&] { return closing_ || !open_.bytes.empty(); });
+    if (open_.bytes.empty()) break;  // closing, everything committed
+    std::swap(open_, flushing_);
+    const uint64_t end = tail_;
+    const int failed = error_;
+    lock.unlock();
+    space_cv_.notify_all();
+
+    const int e = failed ? failed : commit(flushing_.bytes, end - flushing_.bytes.size());
+    durable_(flushing_.cookies.data(), flushing_.cookies.size(), e);
+
+    lock.lock();
+    if (e != 0) {
+      error_ = e;
+    } else {
+      durable_lsn_ = end;
+    }
+    stats_.appends += flushing_.cookies.size();
+    stats_.groups += 1;
+    stats_.bytes += flushing_.bytes.size();
+    stats_.largest_group = std::max<uint64_t>(stats_.largest_group, flushing_.cookies.size());
+    stats_.io_uring = ring_ != nullptr;
+    flushing_.bytes.clear();
+    flushing_.cookies.clear();
+    done_cv_.notify_all();
+    if (e != 0) space_cv_.notify_all();
+  }
+  running_ = false;
+  done_cv_.notify_all();
+}
+
+}  // namespace agro::server
@@ -0,0 +1,427 @@
+#include "agro/server/udp_ingest.hpp"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+
+#include "agro/server/telemetry_wal.hpp"
+#include "agro/telemetry_codec.hpp"
+
+namespace agro::server {
+namespace {
+
+constexpr int kPollMs = 50;  // how long a worker can take to notice stop()
+
+int open_socket(const UdpIngestConfig& cfg, uint16_t port) {
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  if (inet_pton(AF_INET, cfg.address.c_str(), &addr.sin_addr) != 1) {
+    errno = EINVAL;
+    return -1;
+  }
+  const int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) return -1;
+  const int one = 1;
+  const timeval timeout = {0, kPollMs * 1000};
+  if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) != 0 ||
+      setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) != 0 ||
+      bind(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0) {
+    const int e = errno;
+    close(fd);
+    errno = e;
+    return -1;
+  }
+  // Best effort: the kernel caps it at net.core.rmem_max.
+  setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &cfg.rcvbuf_bytes, sizeof(cfg.rcvbuf_bytes));
+  return fd;
+}
+
+void put_le32(uint8_t* p, uint32_t v) {
+  p[0] = uint8_t(v);
+  p[1] = uint8_t(v >> 8);
+  p[2] = uint8_t(v >> 16);
+  p[3] = uint8_t(v >> 24);
+}
+uint32_t get_le32(const uint8_t* p) {
+  return uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 | uint32_t(p[3]) << 24;
+}
+
+// Returns how many went out; an unsent ack costs the device a retry,
+// nothing more.
+unsigned send_all(int fd, mmsghdr* msgs, unsigned n) {
+  unsigned sent = 0;
+  while (sent < n) {
+    const int m = sendmmsg(fd, msgs + sent, n - sent, 0);
+    if (m <= 0) {
+      if (m < 0 && errno == EINTR) continue;
+      break;
+    }
+    sent += unsigned(m);
+  }
+  return sent;
+}
+
+uint64_t thread_cpu_us() {
+  timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return uint64_t(ts.tv_sec) * 1000000 + uint64_t(ts.tv_nsec) / 1000;
+}
+
+}  // namespace
+
+UdpIngest::UdpIngest(const UdpIngestConfig& cfg, Sink sink) : cfg_(cfg), sink_(std::move(sink)) {
+  if (cfg_.workers == 0) cfg_.workers = std::thread::hardware_concurrency();
+  if (cfg_.workers == 0) cfg_.workers = 1;
+  if (cfg_.batch == 0) cfg_.batch = 1;
+}
+
+UdpIngest::~UdpIngest() { stop(); }
+
+void UdpIngest::set_key(uint32_t device_id, uint8_t key_id, const uint8_t key[16]) {
+  Device& d = devices_[device_id];
+  d.key_id = key_id;
+  d.window = ReplayWindow();
+  d.logging.clear();
+  gcm_init(&d.key, key);
+  derive_ack_key(d.key, &d.ack_key);
+}
+
+bool UdpIngest::start() {
+  if (!workers_.empty() && workers_[0]->fd >= 0) return true;
+  workers_.clear();
+  stop_ = false;
+  uint16_t port = cfg_.port;
+  for (unsigned i = 0; i < cfg_.workers; ++i) {
+    const int fd = open_socket(cfg_, port);
+    if (fd < 0) {
+      const int e = errno;
+      stop();
+      workers_.clear();
+      errno = e;
+      return false;
+    }
+    if (port == 0) {
+      sockaddr_in addr = {};
+      socklen_t len = sizeof(addr);
+      getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len);
+      port = ntohs(addr.sin_port);
+    }
+    workers_.push_back(std::make_unique<Worker>());
+    workers_.back()->fd = fd;
+  }
+  port_ = port;
+  for (unsigned i = 0; i < workers_.size(); ++i) workers_[i]->thread = std::thread(&UdpIngest::run, this, i);
+  return true;
+}
+
+void UdpIngest::stop() {
+  stop_ = true;
+  for (const std::unique_ptr<Worker>& w : workers_) {
+    if (w->thread.joinable()) w->thread.join();
+  }
+  for (const std::unique_ptr<Worker>& w : workers_) {
+    if (w->fd >= 0) close(w->fd);
+    w->fd = -1;
+  }
+}
+
+UdpIngest::Stats UdpIngest::stats(unsigned worker) const {
+  const Counters& c = workers_[worker]->counters;
+  Stats s;
+  s.datagrams = c.datagrams.load(std::memory_order_relaxed);
+  s.batches = c.batches.load(std::memory_order_relaxed);
+  s.records = c.records.load(std::memory_order_relaxed);
+  s.acks = c.acks.load(std::memory_order_relaxed);
+  s.replayed = c.replayed.load(std::memory_order_relaxed);
+  s.retried = c.retried.load(std::memory_order_relaxed);
+  s.held = c.held.load(std::memory_order_relaxed);
+  s.unlogged = c.unlogged.load(std::memory_order_relaxed);
+  s.malformed = c.malformed.load(std::memory_order_relaxed);
+  s.unknown_device = c.unknown_device.load(std::memory_order_relaxed);
+  s.bad_tag = c.bad_tag.load(std::memory_order_relaxed);
+  s.cpu_us = c.cpu_us.load(std::memory_order_relaxed);
+  return s;
+}
+
+UdpIngest::Stats UdpIngest::stats() const {
+  Stats total;
+  for (unsigned i = 0; i < workers_.size(); ++i) {
+    const Stats s = stats(i);
+    total.datagrams += s.datagrams;
+    total.batches += s.batches;
+    total.records += s.records;
+    total.acks += s.acks;
+    total.replayed += s.replayed;
+    total.retried += s.retried;
+    total.held += s.held;
+    total.unlogged += s.unlogged;
+    total.malformed += s.malformed;
+    total.unknown_device += s.unknown_device;
+    total.bad_tag += s.bad_tag;
+    total.cpu_us += s.cpu_us;
+  }
+  return total;
+}
+
+bool UdpIngest::handle(unsigned index, uint8_t* frame, size_t len, const sockaddr_in& from,
+                       std::vector<TelemetryRecord>* records, Stats* local, uint8_t ack[kUdpAckBytes]) {
+  SealedHeader h;
+  if (!parse_sealed_header(frame, len, &h) || h.dir != FrameDir::kUplink) {
+    ++local->malformed;
+    return false;
+  }
+  const auto it = devices_.find(h.device_id);
+  if (it == devices_.end() || it->second.key_id != h.key_id) {
+    ++local->unknown_device;
+    return false;
+  }
+  Device& d = it->second;
+  uint8_t* payload;
+  size_t payload_len;
+  if (!open_frame(d.key, frame, len, h, &payload, &payload_len)) {
+    ++local->bad_tag;
+    return false;
+  }
+  bool fresh;
+  {
+    std::lock_guard<std::mutex> lock(d.mu);
+    fresh = d.window.fresh(h.epoch, h.counter);
+    if (fresh && wal_) {
+      // The window takes the counter once the frame is durable.
+      const uint64_t id = uint64_t(h.epoch) << 32 | h.counter;
+      if (std::find(d.logging.begin(), d.logging.end(), id) != d.logging.end()) {
+        ++local->retried;
+        return false;
+      }
+      d.logging.push_back(id);
+    } else if (fresh) {
+      d.window.accept(h.epoch, h.counter);
+    }
+  }
+
+  SealedHeader down = h;
+  down.dir = FrameDir::kDownlink;
+  uint8_t acked[4];
+  sealed_detail::put_be32(acked, h.counter);
+  seal_frame(d.ack_key, down, acked, sizeof(acked), ack, kUdpAckBytes);
+
+  if (fresh && wal_) {
+    // Delivered from on_durable().
+    if (log_frame(index, h, payload, payload_len, from, ack)) {
+      ++local->held;
+    } else {
+      ++local->unlogged;
+    }
+    return false;
+  }
+  if (fresh) {
+    // An authentic packet that does not decode is a firmware bug; it is
+    // still acked, or the device would resend it forever.
+    if (!deliver(index, h.device_id, payload, payload_len, records)) ++local->malformed;
+    local->records += records->size();
+  } else {
+    ++local->replayed;
+  }
+  return true;
+}
+
+bool UdpIngest::deliver(unsigned worker, uint32_t device_id, const uint8_t* packet, size_t len,
+                        std::vector<TelemetryRecord>* records) {
+  records->clear();
+  uint16_t seq;
+  const bool ok = unpack_telemetry(packet, len, &seq, [&](const TelemetryRecord& r) { records->push_back(r); });
+  if (!records->empty()) sink_(worker, device_id, records->data(), records->size());
+  return ok;
+}
+
+bool UdpIngest::log_frame(unsigned index, const SealedHeader& h, const uint8_t* payload, size_t payload_len,
+                          const sockaddr_in& from, const uint8_t ack[kUdpAckBytes]) {
+  Worker& w = *workers_[index];
+  uint32_t slot;
+  {
+    std::lock_guard<std::mutex> lock(w.held_mu);
+    if (w.free_slots.empty()) {
+      w.free_slots.push_back(uint32_t(w.held.size()));
+      w.held.emplace_back();
+    }
+    slot = w.free_slots.back();
+    w.free_slots.pop_back();
+    HeldAck& a = w.held[slot];
+    a.device_id = h.device_id;
+    a.epoch = h.epoch;
+    a.counter = h.counter;
+    a.to = from;
+    std::memcpy(a.ack, ack, kUdpAckBytes);
+    a.packet_len = uint16_t(payload_len);
+    std::memcpy(a.packet, payload, payload_len);
+  }
+  uint8_t entry[kUdpWalHeader + kUdpMaxDatagram];
+  put_le32(entry, h.device_id);
+  put_le32(entry + 4, h.epoch);
+  put_le32(entry + 8, h.counter);
+  std::memcpy(entry + kUdpWalHeader, payload, payload_len);
+  // Registered first: the log may call on_durable() before append returns.
+  if (wal_->append(entry, kUdpWalHeader + payload_len, uint64_t(index) << 32 | slot) != 0) return true;
+
+  {
+    std::lock_guard<std::mutex> lock(w.held_mu);
+    w.free_slots.push_back(slot);
+  }
+  Device& d = devices_.find(h.device_id)->second;
+  std::lock_guard<std::mutex> lock(d.mu);
+  d.logging.erase(std::find(d.logging.begin(), d.logging.end(), uint64_t(h.epoch) << 32 | h.counter));
+  return false;
+}
+
+void UdpIngest::on_durable(const uint64_t* cookies, size_t n, int error) {
+  // Only the log's writer thread calls this, so released is its own.
+  std::vector<TelemetryRecord> records;
+  for (size_t i = 0; i < n; ++i) {
+    const unsigned index = unsigned(cookies[i] >> 32);
+    const uint32_t slot = uint32_t(cookies[i]);
+    if (index >= workers_.size()) continue;
+    Worker& w = *workers_[index];
+    HeldAck a;
+    {
+      std::lock_guard<std::mutex> lock(w.held_mu);
+      if (slot >= w.held.size()) continue;
+      a = w.held[slot];
+      w.free_slots.push_back(slot);
+    }
+    const auto it = devices_.find(a.device_id);
+    if (it == devices_.end()) continue;
+    Device& d = it->second;
+    // Checked again in log order, as restore() will: a frame another one
+    // overtook by a window's width or an epoch is acked but not delivered.
+    bool fresh = false;
+    {
+      std::lock_guard<std::mutex> lock(d.mu);
+      const uint64_t id = uint64_t(a.epoch) << 32 | a.counter;
+      const auto pos = std::find(d.logging.begin(), d.logging.end(), id);
+      if (pos != d.logging.end()) d.logging.erase(pos);
+      fresh = error == 0 && d.window.fresh(a.epoch, a.counter);
+      if (fresh) d.window.accept(a.epoch, a.counter);
+    }
+    if (error == 0) {
+      if (fresh) {
+        const bool decoded = deliver(index, a.device_id, a.packet, a.packet_len, &records);
+        w.counters.records.fetch_add(records.size(), std::memory_order_relaxed);
+        if (!decoded) w.counters.malformed.fetch_add(1, std::memory_order_relaxed);
+      } else {
+        w.counters.replayed.fetch_add(1, std::memory_order_relaxed);
+      }
+      w.released.push_back(a);
+    } else {
+      w.counters.unlogged.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+  if (error != 0) return;
+
+  std::vector<mmsghdr> out;
+  std::vector<iovec> iov;
+  for (const std::unique_ptr<Worker>& w : workers_) {
+    if (w->released.empty()) continue;
+    const size_t m = w->released.size();
+    out.assign(m, mmsghdr{});
+    iov.resize(m);
+    for (size_t k = 0; k < m; ++k) {
+      HeldAck& a = w->released[k];
+      iov[k] = {a.ack, kUdpAckBytes};
+      out[k].msg_hdr.msg_iov = &iov[k];
+      out[k].msg_hdr.msg_iovlen = 1;
+      out[k].msg_hdr.msg_name = &a.to;
+      out[k].msg_hdr.msg_namelen = sizeof(a.to);
+    }
+    w->counters.acks.fetch_add(send_all(w->fd, out.data(), unsigned(m)), std::memory_order_relaxed);
+    w->released.clear();
+  }
+}
+
+bool UdpIngest::restore(const uint8_t* entry, size_t len) {
+  if (len < kUdpWalHeader) return false;
+  const uint32_t device_id = get_le32(entry);
+  const auto it = devices_.find(device_id);
+  if (it == devices_.end()) return false;
+  ReplayWindow& window = it->second.window;
+  const uint32_t epoch = get_le32(entry + 4), counter = get_le32(entry + 8);
+  if (!window.fresh(epoch, counter)) return true;
+  window.accept(epoch, counter);
+  std::vector<TelemetryRecord> records;
+  return deliver(0, device_id, entry + kUdpWalHeader, len - kUdpWalHeader, &records);
+}
+
+void UdpIngest::run(unsigned index) {
+  Worker& w = *workers_[index];
+  if (cfg_.pin) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(index % std::max(1u, std::thread::hardware_concurrency()), &cpus);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+  }
+  // Everything the loop touches, allocated once.
+  const unsigned batch = cfg_.batch;
+  std::unique_ptr<uint8_t[]> rx(new uint8_t[batch * kUdpMaxDatagram]);
+  std::unique_ptr<uint8_t[]> tx(new uint8_t[batch * kUdpAckBytes]);
+  std::vector<mmsghdr> in(batch), out(batch);
+  std::vector<iovec> in_iov(batch), out_iov(batch);
+  std::vector<sockaddr_in> from(batch);
+  std::vector<TelemetryRecord> records;
+  records.reserve(kUdpMaxDatagram);
+  for (unsigned i = 0; i < batch; ++i) {
+    in_iov[i] = {rx.get() + i * kUdpMaxDatagram, kUdpMaxDatagram};
+    in[i] = {};
+    in[i].msg_hdr.msg_iov = &in_iov[i];
+    in[i].msg_hdr.msg_iovlen = 1;
+    in[i].msg_hdr.msg_name = &from[i];
+  }
+
+  while (!stop_.load(std::memory_order_relaxed)) {
+    for (unsigned i = 0; i < batch; ++i) in[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+    // Blocks for the first datagram, then takes whatever else is queued.
+    const int n = recvmmsg(w.fd, in.data(), batch, MSG_WAITFORONE, nullptr);
+    if (n <= 0) continue;  // timeout or EINTR: look at stop_ again
+    Stats local;
+    local.datagrams = unsigned(n);
+    unsigned acks = 0;
+    for (int i = 0; i < n; ++i) {
+      if (in[i].msg_hdr.msg_flags & MSG_TRUNC) {
+        ++local.malformed;
+        continue;
+      }
+      uint8_t* ack = tx.get() + acks * kUdpAckBytes;
+      if (!handle(index, rx.get() + i * kUdpMaxDatagram, in[i].msg_len, from[i], &records, &local, ack)) continue;
+      out_iov[acks] = {ack, kUdpAckBytes};
+      out[acks] = {};
+      out[acks].msg_hdr.msg_iov = &out_iov[acks];
+      out[acks].msg_hdr.msg_iovlen = 1;
+      out[acks].msg_hdr.msg_name = &from[i];
+      out[acks].msg_hdr.msg_namelen = in[i].msg_hdr.msg_namelen;
+      ++acks;
+    }
+    local.acks = send_all(w.fd, out.data(), acks);
+    Counters& c = w.counters;
+    c.datagrams.fetch_add(local.datagrams, std::memory_order_relaxed);
+    c.batches.fetch_add(1, std::memory_order_relaxed);
+    c.records.fetch_add(local.records, std::memory_order_relaxed);
+    c.acks.fetch_add(local.acks, std::memory_order_relaxed);
+    c.replayed.fetch_add(local.replayed, std::memory_order_relaxed);
+    c.retried.fetch_add(local.retried, std::memory_order_relaxed);
+    c.held.fetch_add(local.held, std::memory_order_relaxed);
+    c.unlogged.fetch_add(local.unlogged, std::memory_order_relaxed);
+    c.malformed.fetch_add(local.malformed, std::memory_order_relaxed);
+    c.unknown_device.fetch_add(local.unknown_device, std::memory_order_relaxed);
+    c.bad_tag.fetch_add(local.bad_tag, std::memory_order_relaxed);
+  }
+  w.counters.cpu_us.store(thread_cpu_us(), std::memory_order_relaxed);
+}
+
+}  // namespace agro::server
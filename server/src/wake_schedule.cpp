@@ -0,0 +1,232 @@
+#include "agro/server/wake_schedule.hpp"
+
+#include <algorithm>
+
+namespace agro::server {
+namespace {
+
+// Intervals in a row that skip sessions or miss the period by a quarter
+// before the period is learned afresh.
+constexpr uint8_t kRelearnAfter = 3;
+
+}  // namespace
+
+// ---- TimingWheel ----
+
+TimingWheel::TimingWheel(uint32_t now_s) : now_(now_s) {
+  for (auto& level : heads_) std::fill(std::begin(level), std::end(level), kNil);
+}
+
+void TimingWheel::link(uint32_t id) {
+  Node& n = nodes_[id];
+  // Placed relative to the next second to fire: the level is the highest
+  // byte in which the two differ, so a slot is reached, by firing or by
+  // cascading, exactly when its time comes.
+  const uint32_t base = now_ + 1;
+  const uint32_t at = std::max(n.expires, base);
+  const uint32_t diff = at ^ base;
+  int level = 0;
+  while (level < kLevels - 1 && (diff >> (kSlotBits * (level + 1))) != 0) ++level;
+  const uint32_t slot = (at >> (kSlotBits * level)) & (kSlots - 1);
+  uint32_t& head = heads_[level][slot];
+  n.where = uint16_t(level << kSlotBits | slot);
+  n.prev = kNil;
+  n.next = head;
+  if (head != kNil) nodes_[head].prev = id;
+  head = id;
+  occupied_[level][slot / 64] |= uint64_t{1} << (slot % 64);
+}
+
+void TimingWheel::unlink(uint32_t id) {
+  Node& n = nodes_[id];
+  const int level = n.where >> kSlotBits;
+  const uint32_t slot = n.where & (kSlots - 1);
+  if (n.prev != kNil) nodes_[n.prev].next = n.next;
+  else heads_[level][slot] = n.next;
+  if (n.next != kNil) nodes_[n.next].prev = n.prev;
+  if (heads_[level][slot] == kNil) occupied_[level][slot / 64] &= ~(uint64_t{1} << (slot % 64));
+  n.where = kUnarmed;
+}
+
+void TimingWheel::arm(uint32_t id, uint32_t t) {
+  if (id >= nodes_.size()) nodes_.resize(size_t{id} + 1);
+  if (nodes_[id].where != kUnarmed) unlink(id);
+  nodes_[id].expires = t;
+  link(id);
+}
+
+void TimingWheel::cancel(uint32_t id) {
+  if (armed(id)) unlink(id);
+}
+
+void TimingWheel::cascade(int level, uint32_t slot) {
+  uint32_t id = heads_[level][slot];
+  heads_[level][slot] = kNil;
+  occupied_[level][slot / 64] &= ~(uint64_t{1} << (slot % 64));
+  while (id != kNil) {
+    const uint32_t next = nodes_[id].next;
+    link(id);
+    id = next;
+  }
+}
+
+uint32_t TimingWheel::next_occupied(int level, uint32_t slot) const {
+  for (uint32_t w = (slot + 1) / 64; w < kSlots / 64; ++w) {
+    uint64_t bits = occupied_[level][w];
+    if (w == (slot + 1) / 64) bits &= ~uint64_t{0} << ((slot + 1) % 64);
+    if (bits != 0) return w * 64 + uint32_t(__builtin_ctzll(bits));
+  }
+  return kSlots;
+}
+
+void TimingWheel::advance(uint32_t now_s, std::vector<uint32_t>* out) {
+  while (now_ < now_s) {
+    // now_ stays at t - 1 until t has fired: cascading links relative to t.
+    const uint32_t t = now_ + 1;
+    if ((t & (kSlots - 1)) == 0) {
+      for (int level = 1; level < kLevels; ++level) {
+        const uint32_t slot = (t >> (kSlotBits * level)) & (kSlots - 1);
+        cascade(level, slot);
+        if (slot != 0) break;
+      }
+    }
+    const uint32_t slot = t & (kSlots - 1);
+    uint32_t id = heads_[0][slot];
+    heads_[0][slot] = kNil;
+    occupied_[0][slot / 64] &= ~(uint64_t{1} << (slot % 64));
+    while (id != kNil) {
+      Node& n = nodes_[id];
+      const uint32_t next = n.next;
+      n.where = kUnarmed;
+      out->push_back(id);
+      id = next;
+    }
+    // Straight to the next occupied slot, or to the end of the rotation for
+    // the next cascade.
+    const uint32_t s = next_occupied(0, slot);
+    const uint64_t stop = s < kSlots ? uint64_t(t - slot) + s : (uint64_t(t) | (kSlots - 1)) + 1;
+    now_ = uint32_t(std::min<uint64_t>(stop - 1, now_s));
+  }
+}
+
+// ---- WakeScheduler ----
+
+WakeScheduler::WakeScheduler(const WakeParams& params, uint32_t now_s) : p_(params), wheel_(now_s) {}
+
+void WakeScheduler::predict(Device& d, uint32_t from_s) {
+  const uint32_t guard = p_.min_guard_s + (uint32_t(p_.guard_jitters) * d.jitter_q4 >> 4);
+  const uint32_t centre = from_s + (d.period_q4 >> 4);
+  d.open_s = centre > guard ? centre - guard : 0;
+  d.close_s = centre + guard;
+  d.staged = false;
+  wheel_.arm(uint32_t(&d - devices_.data()), d.open_s > p_.lead_s ? d.open_s - p_.lead_s : 0);
+}
+
+void WakeScheduler::check_in(uint32_t device_id, uint32_t t) {
+  ++stats_.check_ins;
+  const auto [it, fresh] = slots_.try_emplace(device_id, 0);
+  if (fresh) {
+    if (free_.empty()) {
+      it->second = uint32_t(devices_.size());
+      devices_.emplace_back();
+    } else {
+      it->second = free_.back();
+      free_.pop_back();
+    }
+    Device& d = devices_[it->second];
+    d = Device();
+    d.device_id = device_id;
+    d.last_s = t;
+    d.period_q4 = p_.first_period_s << 4;
+    d.jitter_q4 = p_.first_period_s << 1;  // an eighth: a wide first window
+    predict(d, t);
+    return;
+  }
+  Device& d = devices_[it->second];
+  d.missed = 0;
+  if (t <= d.last_s) {
+    // A second session inside one wake: nothing to learn, the window stays.
+    return;
+  }
+  // In sixteenths of a second, so the EWMAs do not round away drift.
+  const uint32_t raw = std::min<uint32_t>(t - d.last_s, UINT32_MAX >> 5) << 4;
+  d.last_s = t;
+  if (d.samples == 0) {
+    d.period_q4 = raw;
+    d.jitter_q4 = raw / 32;
+    d.samples = 1;
+    predict(d, t);
+    return;
+  }
+  // Sessions skipped to save energy count as whole periods.
+  const uint32_t n = std::max<uint32_t>(1, (raw + d.period_q4 / 2) / d.period_q4);
+  const uint32_t interval = raw / n;
+  const uint32_t err = interval > d.period_q4 ? interval - d.period_q4 : d.period_q4 - interval;
+  const bool outlier = err > d.period_q4 / 4;
+  d.off = n > 1 || outlier ? uint8_t(d.off + 1) : 0;
+  if (d.off >= kRelearnAfter) {
+    // Off the model every time: a new period, e.g. a new energy plan.
+    d.period_q4 = raw;
+    d.jitter_q4 = std::min(d.jitter_q4, raw / 32);
+    d.samples = 1;
+    d.off = 0;
+  } else if (!outlier) {
+    d.period_q4 = blend(d.period_q4, interval, d.samples, p_.learn_shift);
+    // The spread settles slower than the mean: one short run must not
+    // narrow the window.
+    d.jitter_q4 = blend(d.jitter_q4, err, d.samples, p_.learn_shift + 1);
+    if (d.samples != UINT16_MAX) ++d.samples;
+  }
+  predict(d, t);
+}
+
+uint32_t WakeScheduler::blend(uint32_t old, uint32_t sample, uint16_t n, uint8_t shift) {
+  const uint32_t window = 1u << shift;
+  const uint32_t k = n + 1u < window ? n + 1u : window;
+  return uint32_t((uint64_t(old) * (k - 1) + sample) / k);
+}
+
+void WakeScheduler::forget(uint32_t device_id) {
+  const auto it = slots_.find(device_id);
+  if (it == slots_.end()) return;
+  wheel_.cancel(it->second);
+  free_.push_back(it->second);
+  slots_.erase(it);
+}
+
+void WakeScheduler::advance(uint32_t now_s, std::vector<Event>* out) {
+  fired_.clear();
+  wheel_.advance(now_s, &fired_);
+  for (uint32_t id : fired_) {
+    Device& d = devices_[id];
+    if (!d.staged) {
+      out->push_back({d.device_id, d.open_s, d.close_s, d.missed != 0});
+      ++stats_.events;
+      d.staged = true;
+      wheel_.arm(id, d.close_s + 1);
+      continue;
+    }
+    // The window closed without a session: carry the device to the next.
+    ++stats_.missed;
+    if (d.missed != UINT8_MAX) ++d.missed;
+    predict(d, d.open_s + (d.close_s - d.open_s) / 2);
+  }
+}
+
+bool WakeScheduler::window(uint32_t device_id, uint32_t* open_s, uint32_t* close_s) const {
+  const auto it = slots_.find(device_id);
+  if (it == slots_.end()) return false;
+  *open_s = devices_[it->second].open_s;
+  *close_s = devices_[it->second].close_s;
+  return true;
+}
+
+size_t WakeScheduler::memory_bytes() const {
+  // The map's nodes: key, value and next pointer, plus the cached hash.
+  const size_t node = sizeof(std::pair<const uint32_t, uint32_t>) + 2 * sizeof(void*);
+  return sizeof(*this) + wheel_.memory_bytes() - sizeof(wheel_) + devices_.capacity() * sizeof(Device) +
+         free_.capacity() * sizeof(uint32_t) + fired_.capacity() * sizeof(uint32_t) +
+         slots_.bucket_count() * sizeof(void*) + slots_.size() * node;
+}
+
+}  // namespace agro::server
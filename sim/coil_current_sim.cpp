@@ -0,0 +1,185 @@
+// Host model of the valve solenoid's inrush current as the shunt ADC sees
+// it, run through CoilClassifier (coil_current.hpp) for healthy coils and
+// each fault.
+//
+//   g++ -std=c++17 -O2 -Icommon/include -Ifirmware/include sim/coil_current_sim.cpp -o coil_current_sim
+//   ./coil_current_sim [trials]
+//
+// The coil is an inductance that grows as the plunger closes its air gap;
+// the plunger moves once the magnetic force beats the spring and the water
+// pressure. The supply is the battery through the relay, whose contacts
+// bounce for the first millisecond or so. The ADC adds Gaussian noise. Coil,
+// plunger and relay figures are typical for 12 V irrigation solenoids and
+// small signal relays, not measurements of a particular part.
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "agro/coil_current.hpp"
+
+namespace {
+
+using agro::CoilVerdict;
+
+constexpr double kStepS = 1e-6;
+constexpr double kTravelM = 1.5e-3;
+constexpr double kMassKg = 0.005;
+constexpr double kNoiseCounts = 6.0;
+constexpr size_t kBlockSamples = 32;  // one DMA block
+
+enum class Case { kNormal, kLowBattery, kHotCoil, kPlungerStuck, kOpen, kShort, kRelayStuck };
+
+struct Scenario {
+  const char* name;
+  Case c;
+  CoilVerdict expect;
+};
+
+constexpr Scenario kScenarios[] = {
+    {"healthy, 12.6 V", Case::kNormal, CoilVerdict::kNormal},
+    {"healthy, 11.2 V battery", Case::kLowBattery, CoilVerdict::kNormal},
+    {"healthy, hot coil +25% R", Case::kHotCoil, CoilVerdict::kNormal},
+    {"plunger jammed", Case::kPlungerStuck, CoilVerdict::kPlungerStuck},
+    {"coil open", Case::kOpen, CoilVerdict::kOpen},
+    {"coil shorted", Case::kShort, CoilVerdict::kShort},
+    {"relay welded (off)", Case::kRelayStuck, CoilVerdict::kRelayStuck},
+};
+
+struct Coil {
+  double volts, ohms, l0, l1, force_n;  // force_n: spring plus water pressure
+  bool jammed = false, open = false;
+};
+
+Coil make_coil(Case c, std::mt19937& rng) {
+  std::normal_distribution<double> z(0.0, 1.0);
+  Coil k;
+  k.volts = 12.6 + 0.2 * z(rng);
+  k.ohms = 34 * (1 + 0.05 * z(rng));
+  k.l0 = 0.12 * (1 + 0.1 * z(rng));
+  k.l1 = 2 * k.l0;
+  k.force_n = 1.0 * (1 + 0.2 * z(rng));
+  switch (c) {
+    case Case::kLowBattery: k.volts = 11.2 + 0.1 * z(rng); break;
+    case Case::kHotCoil: k.ohms *= 1.25; break;
+    case Case::kPlungerStuck: k.jammed = true; break;
+    case Case::kOpen: k.open = true; break;
+    case Case::kShort:
+      // Most of the winding bridged: little resistance, less inductance.
+      k.ohms *= 0.2 + 0.1 * std::abs(z(rng));
+      k.l0 *= 0.1;
+      k.l1 *= 0.1;
+      break;
+    default: break;
+  }
+  return k;
+}
+
+// ADC samples of the supply current from the relay switching, at the
+// configured rate, for burst_ms.
+std::vector<uint16_t> capture(const Coil& k, bool energize, bool welded, const agro::CoilCurrentConfig& cfg,
+                              std::mt19937& rng) {
+  std::normal_distribution<double> z(0.0, 1.0);
+  std::uniform_real_distribution<double> u(0.0, 1.0);
+  // Contact bounce on closing: a few gaps in the first 1.5 ms.
+  std::vector<std::pair<double, double>> gaps;
+  for (int i = 0, n = int(u(rng) * 4); i < n; ++i) {
+    const double at = u(rng) * 1.5e-3;
+    gaps.push_back({at, at + 50e-6 + u(rng) * 150e-6});
+  }
+  const double dt_sample = 1.0 / cfg.sample_hz;
+  const double end = cfg.burst_ms * 1e-3;
+  const double dldx = (k.l1 - k.l0) / kTravelM;
+  // Switching off: the coil had been on (steady, plunger in); the flyback
+  // diode takes its current, so the shunt sees only what still comes from
+  // the supply.
+  double i = energize ? 0 : k.volts / k.ohms, x = energize ? 0 : kTravelM, v = 0;
+  std::vector<uint16_t> out;
+  double next_sample = 0;
+  for (double t = 0; t < end; t += kStepS) {
+    bool closed = energize || welded;
+    for (const auto& g : gaps) closed = closed && !(energize && t >= g.first && t < g.second);
+    const double l = k.l0 + dldx * x;
+    double supply = 0;
+    if (k.open) {
+      i = 0;
+    } else {
+      const double emf = (closed ? k.volts : -0.7) - i * k.ohms - i * dldx * v;  // diode when open
+      i = std::max(0.0, i + emf / l * kStepS);
+      supply = closed ? i : 0;
+    }
+    if (!k.jammed && x < kTravelM) {
+      const double f = 0.5 * i * i * dldx - k.force_n;
+      if (f > 0 || v > 0) {
+        v = std::max(0.0, v + f / kMassKg * kStepS);
+        x = std::min(kTravelM, x + v * kStepS);
+        if (x >= kTravelM) v = 0;
+      }
+    }
+    if (t >= next_sample) {
+      next_sample += dt_sample;
+      const double counts = supply * cfg.counts_per_amp + kNoiseCounts * z(rng);
+      out.push_back(uint16_t(std::clamp(counts, 0.0, 4095.0)));
+    }
+  }
+  return out;
+}
+
+const char* verdict_name(CoilVerdict v) {
+  switch (v) {
+    case CoilVerdict::kPending: return "pending";
+    case CoilVerdict::kNormal: return "normal";
+    case CoilVerdict::kPlungerStuck: return "plunger stuck";
+    case CoilVerdict::kOpen: return "open";
+    case CoilVerdict::kShort: return "short";
+    case CoilVerdict::kRelayStuck: return "relay stuck";
+  }
+  return "?";
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  const int trials = argc > 1 ? std::max(1, std::atoi(argv[1])) : 300;
+  const agro::CoilCurrentConfig cfg;
+  std::mt19937 rng(11);
+  std::printf("coil current classification, %d trials per case, %u Hz, burst limit %u ms\n", trials,
+              unsigned(cfg.sample_hz), unsigned(cfg.burst_ms));
+  std::printf("  %-26s %8s %10s %10s %10s  %s\n", "case", "correct", "ADC ms", "peak mA", "dip ms", "wrong as");
+  bool ok = true;
+  for (const Scenario& s : kScenarios) {
+    int correct = 0, counts[8] = {};
+    double adc_ms = 0, peak = 0, dip = 0;
+    for (int n = 0; n < trials; ++n) {
+      const Coil k = make_coil(s.c, rng);
+      const bool energize = s.c != Case::kRelayStuck;
+      const std::vector<uint16_t> raw = capture(k, energize, s.c == Case::kRelayStuck, cfg, rng);
+      agro::CoilClassifier c(cfg, energize);
+      for (size_t off = 0; off < raw.size() && c.verdict() == CoilVerdict::kPending; off += kBlockSamples) {
+        c.feed(raw.data() + off, std::min(kBlockSamples, raw.size() - off));
+      }
+      correct += c.verdict() == s.expect;
+      ++counts[int(c.verdict())];
+      // The DMA stops at the end of the block that decided.
+      adc_ms += double((c.samples() + kBlockSamples - 1) / kBlockSamples * kBlockSamples) * 1000 / cfg.sample_hz;
+      peak += c.peak_ma();
+      dip += c.dip_ms();
+    }
+    char wrong[96] = "";
+    for (int v = 0; v < 8; ++v) {
+      if (counts[v] && CoilVerdict(v) != s.expect) {
+        const size_t len = std::strlen(wrong);
+        std::snprintf(wrong + len, sizeof(wrong) - len, "%s%s %d", len ? ", " : "", verdict_name(CoilVerdict(v)),
+                      counts[v]);
+      }
+    }
+    std::printf("  %-26s %7.1f%% %10.1f %10.0f %10.1f  %s\n", s.name, 100.0 * correct / trials, adc_ms / trials,
+                peak / trials, dip / trials, wrong);
+    ok = ok && correct * 100 >= trials * 99;
+  }
+  std::printf("classification %s\n", ok ? "passed" : "FAILED");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,212 @@
+// Host energy model of the NEO-6M between fixes: left on (the schematic as
+// drawn), cyclic tracking, backup woken a data-sheet TTFF early, and
+// GpsPowerManager choosing per gap with learned TTFF.
+//
+//   g++ -std=c++17 -O2 -Ifirmware/include sim/gps_power_sim.cpp -o gps_power_sim
+//   ./gps_power_sim [days]
+//
+// The scheduler needs a fix at given times. A fix is ready when the receiver
+// has tracked for the three good GGA fixes the acquisition asks for (that is
+// the TTFF gps_acquire() reports and the manager learns); it is late if that
+// is after the due time. TTFF per start type is lognormal,
+// scaled by the site's sky view (open field or under tree cover). Currents
+// are GpsPowerParams, TTFF distributions model assumptions from the NEO-6
+// data sheet and field logs, not measurements on this board.
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "agro/gps_power.hpp"
+
+namespace {
+
+constexpr uint32_t kHoldMs = 3000;  // three 1 Hz GGA fixes after the first
+constexpr uint32_t kDay = 86400;
+
+struct Site {
+  const char* name;
+  double scale;  // TTFF multiplier for the sky view
+};
+constexpr Site kSites[] = {{"open", 1.0}, {"trees", 1.8}};
+
+// Median TTFF in ms per GpsStart and the lognormal sigma.
+constexpr double kTtffMedianMs[] = {1200, 29000, 36000};
+constexpr double kTtffSigma[] = {0.35, 0.25, 0.25};
+
+enum class Schedule { kHourly, k4PerDay, kIrrigation, kTheftWatch };
+constexpr const char* kScheduleNames[] = {"hourly uploads", "4/day uploads", "irrigation runs", "theft watch"};
+
+// Fix due times over days, in seconds.
+std::vector<uint32_t> due_times(Schedule s, int days) {
+  std::vector<uint32_t> t;
+  for (int d = 0; d < days; ++d) {
+    const uint32_t base = uint32_t(d) * kDay;
+    switch (s) {
+      case Schedule::kHourly:
+        for (uint32_t h = 0; h < 24; ++h) t.push_back(base + h * 3600 + 120);
+        break;
+      case Schedule::k4PerDay:
+        for (uint32_t h = 0; h < 24; h += 6) t.push_back(base + h * 3600 + 120);
+        break;
+      case Schedule::kIrrigation:
+        // Hourly uploads, plus a position check every minute during the
+        // two 30-minute valve runs.
+        for (uint32_t h = 0; h < 24; ++h) t.push_back(base + h * 3600 + 120);
+        for (uint32_t run : {5 * 3600 + 1800, 19 * 3600 + 1800}) {
+          for (uint32_t m = 0; m < 30; ++m) t.push_back(base + run + m * 60);
+        }
+        break;
+      case Schedule::kTheftWatch:
+        // 4/day, and every third night two hours of fixes every 20 s.
+        for (uint32_t h = 0; h < 24; h += 6) t.push_back(base + h * 3600 + 120);
+        if (d % 3 == 2) {
+          for (uint32_t x = 0; x < 7200; x += 20) t.push_back(base + 2 * 3600 + 600 + x);
+        }
+        break;
+    }
+  }
+  std::sort(t.begin(), t.end());
+  t.erase(std::unique(t.begin(), t.end()), t.end());
+  return t;
+}
+
+enum class Strategy { kAlwaysOn, kCyclic, kBackupDatasheet, kManaged };
+constexpr const char* kStrategyNames[] = {"always on", "cyclic", "backup (data sheet lead)", "managed"};
+
+struct Result {
+  double uas = 0;
+  uint32_t mode_s[3] = {0, 0, 0};
+  long fixes = 0, late = 0;
+  std::vector<uint32_t> late_ms;
+};
+
+Result simulate(const Site& site, Schedule sched, Strategy strat, int days) {
+  std::mt19937 rng(11);
+  std::normal_distribution<double> z(0.0, 1.0);
+  agro::GpsPowerManager mgr;
+  const agro::GpsPowerParams& p = mgr.params();
+  const auto ttff = [&](agro::GpsStart s) {
+    const size_t i = size_t(s);
+    return uint32_t(kTtffMedianMs[i] * site.scale * std::exp(kTtffSigma[i] * z(rng)));
+  };
+  const auto spend = [&](Result& r, agro::GpsMode m, double ms) {
+    r.uas += double(mgr.current_ua(m)) * ms / 1000.0;
+    r.mode_s[size_t(m)] += uint32_t(ms / 1000.0);
+  };
+
+  const std::vector<uint32_t> due = due_times(sched, days);
+  Result r;
+  // Power-on: cold start for the first fix, receiver on from t = 0.
+  double now_ms = 0, wake_ms = 0;
+  bool tracking = false;
+  agro::GpsStart start = agro::GpsStart::kCold;     // what the receiver does
+  agro::GpsStart believed = agro::GpsStart::kCold;  // what the manager thinks
+  uint32_t last_fix_s = 0;
+  mgr.entered(agro::GpsMode::kContinuous, 0);
+  for (size_t i = 0; i < due.size(); ++i) {
+    const double due_ms = double(due[i]) * 1000.0;
+    const uint32_t took_ms = tracking ? 0 : ttff(start) + kHoldMs;
+    const double ready_ms = tracking ? due_ms : wake_ms + took_ms;
+    const double done_ms = std::max(due_ms, ready_ms);
+    spend(r, agro::GpsMode::kContinuous, done_ms - now_ms);
+    if (ready_ms > due_ms) {
+      ++r.late;
+      r.late_ms.push_back(uint32_t(ready_ms - due_ms));
+    }
+    ++r.fixes;
+    const uint32_t done_s = uint32_t(done_ms / 1000.0);
+    if (strat == Strategy::kManaged && !tracking) mgr.observe_fix(believed, took_ms, done_s);
+    last_fix_s = done_s;
+    now_ms = done_ms;
+    if (i + 1 == due.size()) break;
+
+    // Between this fix and the next.
+    const uint32_t next_s = due[i + 1];
+    const double gap_ms = std::max(0.0, double(next_s) * 1000.0 - now_ms);
+    agro::GpsMode mode = agro::GpsMode::kContinuous;
+    double lead_ms = 0;
+    const bool eph_valid = next_s - last_fix_s < p.ephemeris_valid_s;
+    switch (strat) {
+      case Strategy::kAlwaysOn:
+        break;
+      case Strategy::kCyclic:
+        if (gap_ms > p.cyclic_update_ms) mode = agro::GpsMode::kCyclic;
+        lead_ms = p.cyclic_update_ms;
+        break;
+      case Strategy::kBackupDatasheet:
+        mode = agro::GpsMode::kBackup;
+        lead_ms = eph_valid ? 1000 : 28000;  // NEO-6 data sheet hot/warm TTFF
+        break;
+      case Strategy::kManaged: {
+        const agro::GpsPlan plan = mgr.plan(done_s, next_s);
+        mode = plan.mode;
+        lead_ms = plan.lead_ms;
+        mgr.entered(mode, done_s);
+        break;
+      }
+    }
+    if (mode == agro::GpsMode::kContinuous || lead_ms >= gap_ms) {
+      tracking = true;  // the next fix is there at once
+      mode = agro::GpsMode::kContinuous;
+      lead_ms = gap_ms;
+    }
+    spend(r, mode, gap_ms - lead_ms);
+    now_ms += gap_ms - lead_ms;
+    if (mode == agro::GpsMode::kContinuous) continue;
+    // Woken (or back to continuous from cyclic) lead_ms before the fix.
+    wake_ms = now_ms;
+    tracking = false;
+    start = mode == agro::GpsMode::kCyclic || eph_valid ? agro::GpsStart::kHot : agro::GpsStart::kWarm;
+    if (strat == Strategy::kManaged) {
+      const uint32_t wake_s = uint32_t(now_ms / 1000.0);
+      believed = mgr.start_at(wake_s);
+      mgr.entered(agro::GpsMode::kContinuous, wake_s);
+    }
+  }
+  mgr.account(uint32_t(now_ms / 1000.0));
+  return r;
+}
+
+uint32_t pct(std::vector<uint32_t> v, int p) {
+  if (v.empty()) return 0;
+  std::sort(v.begin(), v.end());
+  return v[std::min(v.size() - 1, v.size() * size_t(p) / 100)];
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  const int days = argc > 1 ? std::max(1, std::atoi(argv[1])) : 30;
+  std::printf("NEO-6M charge, %d days: mAh/day, hours/day on/cyclic/backup, late fixes\n", days);
+  bool ok = true;
+  for (const Site& site : kSites) {
+    for (int s = 0; s < 4; ++s) {
+      std::printf("  %s sky, %s (%zu fixes/day)\n", site.name, kScheduleNames[s],
+                  due_times(Schedule(s), days).size() / size_t(days));
+      double on = 0, managed = 0, best_other = 1e30;
+      double late_managed = 0;
+      for (int k = 0; k < 4; ++k) {
+        const Result r = simulate(site, Schedule(s), Strategy(k), days);
+        const double mah = r.uas / 3600.0 / 1000.0 / days;
+        const double late = 100.0 * r.late / std::max(1L, r.fixes);
+        std::printf("    %-26s %7.2f mAh/day  %5.1f/%5.1f/%5.1f h  late %5.1f%% (by p95 %5.1f s)\n", kStrategyNames[k], mah,
+                    r.mode_s[0] / 3600.0 / days, r.mode_s[1] / 3600.0 / days, r.mode_s[2] / 3600.0 / days, late,
+                    pct(r.late_ms, 95) / 1000.0);
+        if (k == int(Strategy::kAlwaysOn)) on = mah;
+        if (k == int(Strategy::kManaged)) {
+          managed = mah;
+          late_managed = late;
+        } else if (k != int(Strategy::kBackupDatasheet)) {
+          best_other = std::min(best_other, mah);
+        }
+      }
+      // Managed must beat leaving the receiver on and the plain cyclic mode,
+      // and almost never be late.
+      ok = ok && managed < on && managed <= best_other * 1.02 && late_managed < 5.0;
+    }
+  }
+  return ok ? 0 : 1;
+}
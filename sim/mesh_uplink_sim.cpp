@@ -0,0 +1,408 @@
+// Host model of a field of controllers sharing one GSM uplink over ESP-NOW
+// (mesh.hpp), against every node running its own modem session.
+//
+//   g++ -std=c++17 -O2 -Icommon/include -Ifirmware/include sim/mesh_uplink_sim.cpp -o mesh_uplink_sim
+//   ./mesh_uplink_sim [nodes] [days]
+//
+// Every node seals one telemetry frame per 15-minute window. Alone, a node
+// uploads its frames hourly. In the mesh the real MeshNode logic runs on
+// each node: clocks are the ESP32's calibrated RC slow clock, with a fixed
+// rate error per node and a daily temperature swing, and every ESP-NOW
+// frame is lost with a fixed probability (MAC retries included). Batteries
+// charge from solar panels in different shade; the uplink role rotates by
+// state of charge. One node is dead for a day and a half, which exercises
+// the succession. Currents are SIM800L and ESP32 data-sheet figures; clock,
+// loss and solar figures are model assumptions, not measurements.
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "agro/mesh.hpp"
+
+namespace {
+
+constexpr double kPi = 3.14159265358979;
+constexpr double kDayMs = 86400.0 * 1000;
+constexpr size_t kStoreBytes = 4096;
+constexpr size_t kTelemetryBytes = 56;  // sealed frame of one telemetry packet
+
+// Modem session: boot, registration (lognormal), bearer, TCP, upload.
+constexpr double kBootS = 3.5, kBootMa = 55;
+constexpr double kRegisterMedianS = 15, kRegisterMa = 110;
+constexpr double kConnectedS = 6.0, kConnectedMa = 120;  // bearer, connect, exchange, close
+constexpr double kUplinkBps = 12000;
+constexpr double kSessionFailure = 0.02;
+// ESP-NOW: Wi-Fi start from deep sleep, then receive or transmit.
+constexpr double kRadioStartMs = 60, kRadioStartMa = 50;
+constexpr double kRxMa = 95, kTxMa = 180, kAirMsPerByte = 8.0 / 1000;  // 1 Mbit/s
+constexpr double kFrameLoss = 0.05;
+// Battery and solar.
+constexpr double kBatteryMah = 3000, kBaseMahPerDay = 25, kSolarMahPerDay = 45;
+
+struct Stats {
+  double modem_s = 0, modem_mah = 0, radio_mah = 0;
+  long sessions = 0;
+};
+
+struct Node {
+  uint32_t id = 0;
+  // Local clock: offset, fixed rate error, temperature swing.
+  double offset_ms = 0, ppm = 0, swing_ppm = 0, phase = 0;
+  double shade = 1;
+  double soc_mah = 0;
+  bool dead = false;
+  double dead_from = 0, dead_until = 0;
+  agro::MeshNode<kStoreBytes> mesh;
+  double next_ms = 0;  // real time of the next event
+  Stats stats;
+  uint32_t seq = 0;
+
+  double local(double t) const {
+    const double w = 2 * kPi / kDayMs;
+    return offset_ms + t + ppm * 1e-6 * t + swing_ppm * 1e-6 / w * (std::cos(phase) - std::cos(w * t + phase));
+  }
+  double real(uint32_t l) const {
+    // local() is monotonic with slope within 1e-3 of 1; Newton from l.
+    double t = double(l) - offset_ms;
+    const double target = double(l);
+    for (int i = 0; i < 3; ++i) {
+      double d = target - std::fmod(local(t), 4294967296.0);
+      if (d > 2147483648.0) d -= 4294967296.0;
+      if (d < -2147483648.0) d += 4294967296.0;
+      t += d;
+    }
+    return t;
+  }
+  uint32_t now(double t) const { return uint32_t(uint64_t(local(t)) & 0xffffffffu); }
+};
+
+struct Fleet {
+  std::vector<Node> nodes;
+  std::mt19937 rng{17};
+  std::normal_distribution<double> z{0.0, 1.0};
+  std::uniform_real_distribution<double> u{0.0, 1.0};
+  std::vector<double> latency_s;
+  std::vector<uint8_t> seen;  // per (node, seq) frame, for duplicates
+  long delivered = 0, duplicates = 0, generated = 0, beacons = 0, heard = 0, searches = 0;
+  std::vector<uint32_t> guards;
+
+  void spend(Node& n, double mah, bool modem) {
+    n.soc_mah -= mah;
+    (modem ? n.stats.modem_mah : n.stats.radio_mah) += mah;
+  }
+
+  // A modem session at real time t uploading bytes; true if delivered.
+  bool session(Node& n, double t, size_t bytes) {
+    const double reg = kRegisterMedianS * std::exp(0.4 * z(rng));
+    const double on = kBootS + reg + kConnectedS + double(bytes) * 8 / kUplinkBps;
+    n.stats.modem_s += on;
+    ++n.stats.sessions;
+    spend(n, (kBootS * kBootMa + reg * kRegisterMa + (on - kBootS - reg) * kConnectedMa) / 3600, true);
+    return u(rng) >= kSessionFailure && t >= 0;
+  }
+
+  void telemetry(Node& n, double t) {
+    uint8_t f[kTelemetryBytes] = {};
+    const uint64_t at = uint64_t(t);
+    std::memcpy(f, &n.id, 4);
+    std::memcpy(f + 4, &n.seq, 4);
+    std::memcpy(f + 8, &at, 8);
+    ++n.seq;
+    ++generated;
+    n.mesh.store().push(f, sizeof(f));
+  }
+
+  void uploaded(const uint8_t* bundle, size_t len, double t) {
+    size_t off = 0, k, n;
+    const uint8_t* f;
+    while ((k = agro::next_bundled(bundle + off, len - off, &f, &n)) != 0) {
+      off += k;
+      uint32_t id, seq;
+      uint64_t at;
+      std::memcpy(&id, f, 4);
+      std::memcpy(&seq, f + 4, 4);
+      std::memcpy(&at, f + 8, 8);
+      const size_t key = size_t(id) * 100000 + seq;
+      if (key >= seen.size()) seen.resize(key + 1, 0);
+      if (seen[key]++) {
+        ++duplicates;
+        continue;
+      }
+      ++delivered;
+      latency_s.push_back((t - double(at)) / 1000);
+    }
+  }
+
+  // Uploads the whole store of n in as many sessions as it takes.
+  void upload(Node& n, double t) {
+    uint8_t buf[kStoreBytes];
+    size_t count;
+    const size_t len = n.mesh.store().pack(buf, sizeof(buf), &count);
+    if (len == 0 || !session(n, t, len)) return;
+    uploaded(buf, len, t + 30000);
+    n.mesh.store().drop(count);
+  }
+
+  bool lost() { return u(rng) < kFrameLoss; }
+};
+
+void solar(Fleet& fleet, double from, double to) {
+  // Harvest spread over daylight hours, crudely as a daily average.
+  for (Node& n : fleet.nodes) {
+    const double mah = (kSolarMahPerDay * n.shade - kBaseMahPerDay) * (to - from) / kDayMs;
+    n.soc_mah = std::clamp(n.soc_mah + mah, 0.0, kBatteryMah);
+  }
+}
+
+uint16_t soc_permille(const Node& n) { return uint16_t(std::clamp(n.soc_mah / kBatteryMah, 0.0, 1.0) * 1000); }
+
+Fleet make_fleet(int count) {
+  Fleet f;
+  f.nodes.resize(size_t(count));
+  for (int i = 0; i < count; ++i) {
+    Node& n = f.nodes[size_t(i)];
+    n.id = 0x100 + uint32_t(i);
+    n.offset_ms = f.u(f.rng) * 1e6;
+    n.ppm = 150 * f.z(f.rng);
+    n.swing_ppm = 40 + 20 * f.u(f.rng);
+    n.phase = 0.3 * f.z(f.rng);
+    n.shade = 0.6 + 0.6 * f.u(f.rng);
+    n.soc_mah = kBatteryMah * (0.5 + 0.3 * f.u(f.rng));
+  }
+  // The node most likely to win the first election dies for a while.
+  f.nodes[0].dead_from = 3.0 * kDayMs;
+  f.nodes[0].dead_until = 4.5 * kDayMs;
+  return f;
+}
+
+// Every node uploads its own frames every hour.
+Fleet run_alone(int count, int days) {
+  Fleet fleet = make_fleet(count);
+  const agro::MeshParams p;
+  double last = 0;
+  for (uint32_t w = 1; double(w) * p.window_period_ms < days * kDayMs; ++w) {
+    const double t = double(w) * p.window_period_ms;
+    solar(fleet, last, t);
+    last = t;
+    for (Node& n : fleet.nodes) {
+      if (t >= n.dead_from && t < n.dead_until) continue;
+      fleet.telemetry(n, t);
+      if (w % p.uplink_every == 0) fleet.upload(n, t);
+    }
+  }
+  return fleet;
+}
+
+Fleet run_mesh(int count, int days) {
+  Fleet fleet = make_fleet(count);
+  agro::MeshParams p;
+  const double period = p.window_period_ms;
+  for (Node& n : fleet.nodes) {
+    n.mesh.begin(n.id, p, true);
+    n.mesh.set_soc(soc_permille(n));
+    // Power-on within a minute of each other, then the search.
+    const double on = fleet.u(fleet.rng) * 60000;
+    n.next_ms = on + n.mesh.search_ms(uint32_t(fleet.u(fleet.rng) * period / 2));
+    n.stats.radio_mah += (n.next_ms - on) * kRxMa / 3.6e6;
+    n.soc_mah -= (n.next_ms - on) * kRxMa / 3.6e6;
+  }
+  const auto event_at = [&](Node& n) {
+    const agro::MeshWindow w = n.mesh.window();
+    return n.mesh.role() == agro::MeshRole::kUplink ? n.real(w.wake_ms) : n.real(w.wake_ms + w.listen_ms);
+  };
+  const auto search = [&](Node& n, double t) {
+    n.next_ms = t + n.mesh.search_ms(uint32_t(fleet.u(fleet.rng) * period / 2));
+    fleet.spend(n, (n.next_ms - t) * kRxMa / 3.6e6, false);
+    ++fleet.searches;
+  };
+  const auto next_window = [&](Node& n, double t) {
+    if (n.mesh.role() == agro::MeshRole::kSearching) return search(n, t);
+    n.next_ms = std::max(event_at(n), t + 1);
+  };
+  const auto alive = [](const Node& n, double t) { return t < n.dead_from || t >= n.dead_until; };
+  std::vector<double> last_window(fleet.nodes.size(), 0);
+  double last_solar = 0;
+  uint8_t frame[agro::kMeshFrameBytes], rep[agro::kMeshFrameBytes];
+  for (;;) {
+    Node* next = &fleet.nodes[0];
+    for (Node& n : fleet.nodes) {
+      if (n.next_ms < next->next_ms) next = &n;
+    }
+    Node& n = *next;
+    const double t = n.next_ms;
+    if (t >= days * kDayMs) break;
+    solar(fleet, last_solar, t);
+    last_solar = t;
+    n.mesh.set_soc(soc_permille(n));
+    const size_t idx = size_t(&n - fleet.nodes.data());
+
+    if (!alive(n, t)) {
+      // Brown-out: back at the end with RTC memory lost.
+      n.next_ms = n.dead_until + 1;
+      n.dead = true;
+      continue;
+    }
+    if (n.dead) {
+      n.dead = false;
+      n.mesh.begin(n.id, p, true);
+      search(n, t);
+      continue;
+    }
+    if (n.mesh.role() == agro::MeshRole::kSearching) {
+      n.mesh.found_nothing(n.now(t));
+      n.next_ms = event_at(n);
+      continue;
+    }
+    // One telemetry frame per window.
+    if (t - last_window[idx] > period / 2) {
+      fleet.telemetry(n, t);
+      last_window[idx] = t;
+    }
+
+    if (n.mesh.role() == agro::MeshRole::kUplink) {
+      const agro::MeshWindow w = n.mesh.window();
+      const size_t blen = n.mesh.beacon(frame, sizeof(frame));
+      const double air = double(blen) * kAirMsPerByte;
+      fleet.spend(n, double(p.beacon_copies) * air * kTxMa / 3.6e6, false);
+      const double end = n.real(w.wake_ms + w.listen_ms);
+      ++fleet.beacons;
+      // Every node listening now hears it (searching nodes listen throughout).
+      for (Node& m : fleet.nodes) {
+        if (&m == &n || !alive(m, t) || m.dead) continue;
+        double from, to;
+        if (m.mesh.role() == agro::MeshRole::kSearching) {
+          from = 0;
+          to = m.next_ms;
+        } else if (m.mesh.role() == agro::MeshRole::kMember) {
+          const agro::MeshWindow mw = m.mesh.window();
+          from = m.real(mw.wake_ms);
+          to = m.real(mw.wake_ms + mw.listen_ms);
+          fleet.guards.push_back(m.mesh.clock().guard_ms(mw.round, p));
+        } else {
+          // Another uplink hears it if it falls in its own window.
+          const agro::MeshWindow mw = m.mesh.window();
+          from = m.real(mw.wake_ms);
+          to = m.real(mw.wake_ms + mw.listen_ms);
+        }
+        // The first copy that arrives while m listens.
+        double rx = 0;
+        bool got = false;
+        for (uint8_t c = 0; c < p.beacon_copies && !got; ++c) {
+          rx = t + c * p.copy_spacing_ms + air;
+          got = rx >= from && rx <= to && !fleet.lost();
+          agro::MeshNode<kStoreBytes>::mark_copy(frame, c);
+        }
+        if (!got) continue;
+        const bool searching = m.mesh.role() == agro::MeshRole::kSearching;
+        const bool was_uplink = m.mesh.role() == agro::MeshRole::kUplink;
+        const double woke = searching ? rx : from;
+        if (!m.mesh.on_frame(frame, blen, m.now(rx))) continue;
+        ++fleet.heard;
+        if (was_uplink && m.mesh.role() == agro::MeshRole::kUplink) {
+          // Still the uplink: tell the sender, in its join slot.
+          size_t count;
+          const size_t len = m.mesh.report(rep, sizeof(rep), &count);
+          const double at = rx + p.beacon_gap_ms + double(n.mesh.window().listen_ms - p.beacon_gap_ms - p.slot_ms);
+          if (at <= end && !fleet.lost()) n.mesh.on_frame(rep, len, n.now(at));
+          continue;
+        }
+        if (t - last_window[size_t(&m - fleet.nodes.data())] > period / 2) {
+          fleet.telemetry(m, rx);
+          last_window[size_t(&m - fleet.nodes.data())] = rx;
+        }
+        // Report in the slot, up to the slot's frames, MAC retries inside.
+        double at = rx + m.mesh.slot_offset_ms();
+        double radio_ms = at - woke;
+        for (uint8_t k = 0; k < m.mesh.slot_frames(); ++k) {
+          size_t count;
+          const size_t len = m.mesh.report(rep, sizeof(rep), &count);
+          radio_ms += double(len) * kAirMsPerByte + 1;
+          fleet.spend(m, double(len) * kAirMsPerByte * kTxMa / 3.6e6, false);
+          if (at <= end && !fleet.lost()) {
+            n.mesh.on_frame(rep, len, n.now(at));
+            m.mesh.reported(count);
+          }
+          at += double(len) * kAirMsPerByte + 1;
+          if (m.mesh.store().empty()) break;
+        }
+        fleet.spend(m, (kRadioStartMs * kRadioStartMa + radio_ms * kRxMa) / 3.6e6, false);
+        if (m.mesh.window_done(true)) fleet.upload(m, t);
+        next_window(m, t);
+      }
+      fleet.spend(n, (kRadioStartMs * kRadioStartMa + (end - t) * kRxMa) / 3.6e6, false);
+      if (n.mesh.window_done(false)) fleet.upload(n, end);
+      next_window(n, end);
+      continue;
+    }
+
+    // A member whose listen ran out without a beacon.
+    const agro::MeshWindow w = n.mesh.window();
+    fleet.spend(n, (kRadioStartMs * kRadioStartMa + double(w.listen_ms) * kRxMa) / 3.6e6, false);
+    if (n.mesh.window_done(false)) fleet.upload(n, t);
+    next_window(n, t);
+  }
+  return fleet;
+}
+
+double pct(std::vector<double> v, int p) {
+  if (v.empty()) return 0;
+  std::sort(v.begin(), v.end());
+  return v[std::min(v.size() - 1, v.size() * size_t(p) / 100)];
+}
+
+struct Summary {
+  double modem_s_day, mah_day, delivered, latency_mean, latency_p95, share_min, share_max;
+};
+
+Summary report(const char* name, const Fleet& f, int days) {
+  double modem = 0, mah = 0, lat = 0, lo = 1e30, hi = 0;
+  for (const Node& n : f.nodes) {
+    modem += n.stats.modem_s;
+    mah += n.stats.modem_mah + n.stats.radio_mah;
+    lo = std::min(lo, n.stats.modem_s);
+    hi = std::max(hi, n.stats.modem_s);
+  }
+  for (double l : f.latency_s) lat += l;
+  Summary s;
+  s.modem_s_day = modem / days;
+  s.mah_day = mah / days;
+  s.delivered = 100.0 * double(f.delivered) / double(std::max(1L, f.generated));
+  s.latency_mean = f.latency_s.empty() ? 0 : lat / double(f.latency_s.size()) / 60;
+  s.latency_p95 = pct(f.latency_s, 95) / 60;
+  s.share_min = lo / days;
+  s.share_max = hi / days;
+  std::printf("  %-14s modem %7.0f s/day  modem+radio %6.1f mAh/day  delivered %5.1f%%  latency %4.1f min (p95 %4.1f)"
+              "  per node %4.0f..%4.0f s/day\n",
+              name, s.modem_s_day, s.mah_day, s.delivered, s.latency_mean, s.latency_p95, s.share_min, s.share_max);
+  return s;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  const int nodes = argc > 1 ? std::clamp(std::atoi(argv[1]), 2, int(agro::kMaxMeshMembers)) : 6;
+  const int days = argc > 2 ? std::max(2, std::atoi(argv[2])) : 14;
+  std::printf("%d controllers, %d days, one 56-byte frame per node every 15 min, frame loss %.0f%%\n", nodes, days,
+              kFrameLoss * 100);
+  const Fleet alone = run_alone(nodes, days);
+  const Fleet mesh = run_mesh(nodes, days);
+  const Summary a = report("every node", alone, days);
+  const Summary m = report("ESP-NOW mesh", mesh, days);
+  std::vector<double> guards(mesh.guards.begin(), mesh.guards.end());
+  std::printf("  mesh: beacons heard %.1f%%, member guard median %.0f ms (p95 %.0f ms), duplicates %ld\n",
+              100.0 * double(mesh.heard) / double(std::max(1L, mesh.beacons * long(nodes - 1))), pct(guards, 50),
+              pct(guards, 95), mesh.duplicates);
+  for (const Node& n : mesh.nodes) {
+    std::printf("    node %x: %3ld sessions, %5.0f s modem, %5.1f mAh radio, SoC %3.0f%%\n", unsigned(n.id),
+                n.stats.sessions, n.stats.modem_s, n.stats.radio_mah, 100 * n.soc_mah / kBatteryMah);
+  }
+  // The mesh has to cut the fleet's modem time at least in half, lose no
+  // more than the modem sessions do, and stay within two windows of the
+  // per-node latency.
+  const bool ok = m.modem_s_day * 2 < a.modem_s_day && m.mah_day < a.mah_day && m.delivered > a.delivered - 1.0 &&
+                  m.latency_mean < a.latency_mean + 30 && mesh.duplicates == 0;
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,165 @@
+// Host energy model of the SIM800L between sessions: hard power-off,
+// AT+CSCLK sleep, or ModemPowerPolicy choosing per idle interval.
+//
+//   g++ -std=c++17 -O2 -Ifirmware/include sim/modem_power_sim.cpp -o modem_power_sim
+//   ./modem_power_sim [days]
+//
+// Each site has its own registration time (lognormal per session), CSCLK
+// sleep current and chance that a sleep loses the registration. Each
+// schedule produces the idle intervals between radio sessions. Charges use
+// the policy's own ModemPowerParams for boot, wake and leakage; the site
+// figures are model assumptions from field logs of the module, not
+// measurements on this board.
+//
+// The learned policy starts from power-on defaults and only sees what the
+// firmware sees: registration times, whether a sleep kept the registration,
+// and the coulomb-counted charge of a sleep (with the counter's 0.05 mAh
+// resolution). "best fixed" is the cheaper of always-off and always-sleep
+// for that cell; "oracle" knows the site's true means and picks the lower
+// expected charge per interval.
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "agro/modem_power.hpp"
+
+namespace {
+
+struct Site {
+  const char* name;
+  double register_ms;    // median network search
+  double register_sigma;
+  uint16_t sleep_ua;     // paging current in CSCLK sleep
+  double drop_rate;      // sleeps that wake up unregistered
+};
+
+constexpr Site kSites[] = {
+    {"good", 4000, 0.3, 1000, 0.01},
+    {"fair", 15000, 0.5, 1500, 0.05},
+    {"weak", 45000, 0.6, 2500, 0.15},
+};
+
+enum class Schedule { k15Min, kHourly, k4PerDay, kMixed };
+constexpr const char* kScheduleNames[] = {"15 min", "hourly", "4/day", "mixed"};
+constexpr double kCoulombResolutionMams = 0.05 * 3600.0 * 1000.0;  // 0.05 mAh in mA*ms
+
+// Idle intervals until the next session, in ms.
+uint32_t next_idle_ms(Schedule s, std::mt19937& rng) {
+  std::uniform_real_distribution<double> u(0.0, 1.0);
+  switch (s) {
+    case Schedule::k15Min:
+      return 15 * 60000;
+    case Schedule::kHourly:
+      return 60 * 60000;
+    case Schedule::k4PerDay:
+      return 6 * 3600000;
+    case Schedule::kMixed:
+      // Hourly telemetry, with alarm and irrigation-report sessions in
+      // between: a quarter of the gaps are a few minutes.
+      return u(rng) < 0.25 ? uint32_t(60000 + u(rng) * 9 * 60000) : uint32_t(20 * 60000 + u(rng) * 60 * 60000);
+  }
+  return 0;
+}
+
+enum class Strategy { kAlwaysOff, kAlwaysSleep, kLearned, kOracle };
+
+struct Result {
+  double mams = 0;
+  long sessions = 0, sleeps = 0;
+};
+
+Result simulate(const Site& site, Schedule sched, Strategy strat, int days) {
+  std::mt19937 rng(7);
+  std::lognormal_distribution<double> reg(std::log(site.register_ms), site.register_sigma);
+  std::bernoulli_distribution drop(site.drop_rate);
+  std::uniform_real_distribution<double> quant(-0.5, 0.5);
+
+  agro::ModemPowerPolicy policy;
+  agro::ModemPowerModel truth;
+  truth.register_ms = uint32_t(site.register_ms * std::exp(site.register_sigma * site.register_sigma / 2));
+  truth.sleep_ua = site.sleep_ua;
+  truth.drop_permille = uint16_t(site.drop_rate * 1000);
+  const agro::ModemPowerPolicy oracle(agro::ModemPowerParams(), truth);
+  const agro::ModemPowerParams& p = policy.params();
+
+  Result r;
+  const uint64_t horizon_ms = uint64_t(days) * 86400000ull;
+  // The first session always boots the module.
+  const double first_reg = reg(rng);
+  r.mams += p.boot_mams + p.register_ma * first_reg;
+  if (strat == Strategy::kLearned) policy.observe_registration(uint32_t(first_reg));
+  for (uint64_t t = 0; t < horizon_ms;) {
+    const uint32_t idle = next_idle_ms(sched, rng);
+    t += idle;
+    ++r.sessions;
+    agro::ModemIdle choice = agro::ModemIdle::kPowerOff;
+    switch (strat) {
+      case Strategy::kAlwaysOff: break;
+      case Strategy::kAlwaysSleep: choice = agro::ModemIdle::kSleep; break;
+      case Strategy::kLearned: choice = policy.decide(idle); break;
+      case Strategy::kOracle: choice = oracle.decide(idle); break;
+    }
+    if (choice == agro::ModemIdle::kSleep) {
+      ++r.sleeps;
+      const double slept = double(site.sleep_ua) / 1000.0 * idle;
+      const bool kept = !drop(rng);
+      r.mams += slept + p.wake_mams;
+      double reg_ms = 0;
+      if (!kept) {
+        reg_ms = reg(rng);
+        r.mams += p.register_ma * reg_ms;
+      }
+      if (strat == Strategy::kLearned) {
+        const double counted = std::max(0.0, std::round(slept / kCoulombResolutionMams + quant(rng)) *
+                                                 kCoulombResolutionMams);
+        policy.observe_sleep(idle, kept, uint32_t(counted));
+        if (!kept) policy.observe_registration(uint32_t(reg_ms));
+      }
+    } else {
+      const double reg_ms = reg(rng);
+      r.mams += double(p.off_ua) / 1000.0 * idle + p.boot_mams + p.register_ma * reg_ms;
+      if (strat == Strategy::kLearned) policy.observe_registration(uint32_t(reg_ms));
+    }
+  }
+  if (strat == Strategy::kLearned) {
+    const agro::ModemPowerModel& m = policy.model();
+    std::printf("    learned: register %5u ms  sleep %4u uA  drop %3u/1000  break-even %6.1f min (true %6.1f)\n",
+                m.register_ms, m.sleep_ua, m.drop_permille, policy.break_even_ms() / 60000.0,
+                oracle.break_even_ms() / 60000.0);
+  }
+  return r;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  const int days = argc > 1 ? std::max(1, std::atoi(argv[1])) : 30;
+  std::printf("SIM800L idle charge, %d days, mAh/day (sessions/day, %% of idles slept by the learned policy)\n",
+              days);
+  bool ok = true;
+  double worst_excess = 0;
+  for (const Site& site : kSites) {
+    for (int s = 0; s < 4; ++s) {
+      const Schedule sched = Schedule(s);
+      std::printf("  %s site, %s uploads\n", site.name, kScheduleNames[s]);
+      const Result learned = simulate(site, sched, Strategy::kLearned, days);
+      const Result off = simulate(site, sched, Strategy::kAlwaysOff, days);
+      const Result sleep = simulate(site, sched, Strategy::kAlwaysSleep, days);
+      const Result oracle = simulate(site, sched, Strategy::kOracle, days);
+      const auto mah = [&](const Result& r) { return r.mams / 3600000.0 / days; };
+      const double best_fixed = std::min(mah(off), mah(sleep));
+      std::printf("    always off %6.2f  always sleep %6.2f  learned %6.2f  oracle %6.2f  (%.0f/day, %.0f%% slept)\n",
+                  mah(off), mah(sleep), mah(learned), mah(oracle), double(learned.sessions) / days,
+                  100.0 * learned.sleeps / std::max(1L, learned.sessions));
+      worst_excess = std::max(worst_excess, mah(learned) / best_fixed - 1.0);
+      // Learning costs a little while the defaults are forgotten; it must
+      // never be meaningfully worse than the better fixed choice.
+      ok = ok && mah(learned) <= best_fixed * 1.05;
+    }
+  }
+  std::printf("learned vs best fixed strategy per cell: worst %+.1f%%\n", worst_excess * 100.0);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,160 @@
+// Host model of the +5V rail: brownouts with every high-current action
+// starting when the firmware asks for it, versus booking through
+// PowerSequencer.
+//
+//   g++ -std=c++20 -O2 -Ifirmware/include sim/power_rail_sim.cpp -o power_rail_sim
+//   ./power_rail_sim [days]
+//
+// The LM2596 output is modelled as a source with output resistance up to its
+// current limit and a collapsing voltage beyond it; the ESP32's 3.3 V LDO
+// browns out below kBrownoutV. Each wake powers the modem for a session and,
+// at random, opens the valve and starts the GPS, each a little after the
+// other as an unsequenced sketch would. A brownout aborts the wake and costs
+// a reboot, network re-registration and a GPS cold start.
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "agro/power_sequencer.hpp"
+
+namespace {
+
+constexpr double kBuckOpenV = 5.05;
+constexpr double kBuckROut = 0.25;       // ohms, buck plus wiring
+constexpr double kBuckLimitA = 2.6;      // LM2596 current limit with this inductor
+constexpr double kBrownoutV = 4.3;       // LDO dropout plus ESP32 brownout level
+constexpr uint32_t kAwakeBaselineMa = 250;  // ESP32 active plus idle modules
+constexpr int kWakesPerDay = 12;
+constexpr uint32_t kWakeWindowMs = 30000;
+constexpr int kTxWindowsPerSession = 3;
+// Recovery after a brownout: reboot, 25 s re-registration, 35 s GPS cold start.
+constexpr double kRecoveryMah = (25.0 * 300.0 + 35.0 * 45.0 + 2.0 * 120.0) / 3600.0;
+
+double rail_volts(uint32_t load_ma) {
+  const double a = load_ma / 1000.0;
+  if (a <= kBuckLimitA) return kBuckOpenV - kBuckROut * a;
+  return (kBuckOpenV - kBuckROut * kBuckLimitA) * kBuckLimitA / a;
+}
+
+struct Action {
+  agro::PowerLoad load;
+  uint32_t request_ms;
+  uint32_t max_defer_ms;
+  uint32_t start_ms = agro::PowerSequencer::kNever;
+  agro::PowerSequencer::Ticket ticket = agro::PowerSequencer::kNoTicket;
+  int tx_index = -1;  // modem transmit windows chain off the previous one
+};
+
+uint32_t duration_of(agro::PowerLoad l) { return agro::kLoadProfiles[static_cast<size_t>(l)].duration_ms; }
+uint32_t peak_of(agro::PowerLoad l) { return agro::kLoadProfiles[static_cast<size_t>(l)].peak_ma; }
+
+struct Stats {
+  long wakes = 0;
+  long brownouts = 0;
+  long forced = 0;  // sequenced actions that missed their deadline and ran anyway
+  uint32_t peak_ma = 0;
+  double min_v = 10.0;
+  std::vector<uint32_t> relay_delay, modem_delay;
+};
+
+std::vector<Action> plan_wake(std::mt19937& rng) {
+  std::uniform_int_distribution<uint32_t> jitter(0, 3000);
+  std::bernoulli_distribution coin(0.5);
+  std::vector<Action> a;
+  a.push_back({agro::PowerLoad::kModemPowerOn, jitter(rng) / 6, 60000});
+  if (coin(rng)) a.push_back({agro::PowerLoad::kRelayPullIn, jitter(rng) + 2000, 8000});
+  if (coin(rng)) a.push_back({agro::PowerLoad::kGpsStart, jitter(rng), 30000});
+  return a;
+}
+
+void run_wake(std::vector<Action> actions, bool sequenced, Stats& st) {
+  agro::PowerSequencer seq({2500, kAwakeBaselineMa});
+  ++st.wakes;
+  for (uint32_t now = 0; now < kWakeWindowMs; ++now) {
+    if (sequenced) {
+      for (const Action& a : actions) {
+        if (a.start_ms != agro::PowerSequencer::kNever && now - a.start_ms == duration_of(a.load)) {
+          seq.release(a.ticket);
+        }
+      }
+      seq.expire(now);
+    }
+    for (size_t i = 0; i < actions.size(); ++i) {
+      Action& a = actions[i];
+      if (a.start_ms != agro::PowerSequencer::kNever) continue;
+      if (a.request_ms == now && sequenced) {
+        seq.reserve(a.load, now, a.max_defer_ms, &a.ticket);
+        if (a.ticket == agro::PowerSequencer::kNoTicket) ++st.forced;
+      }
+      if (int32_t(now - a.request_ms) < 0) continue;
+      bool go = !sequenced || a.ticket == agro::PowerSequencer::kNoTicket || seq.may_start(a.ticket, now);
+      if (sequenced && a.ticket != agro::PowerSequencer::kNoTicket &&
+          seq.start_of(a.ticket) == agro::PowerSequencer::kNever) {
+        ++st.forced;
+        go = true;
+      }
+      if (!go) continue;
+      a.start_ms = now;
+      const uint32_t delay = now - a.request_ms;
+      if (a.load == agro::PowerLoad::kRelayPullIn) st.relay_delay.push_back(delay);
+      if (a.load == agro::PowerLoad::kModemTx || a.load == agro::PowerLoad::kModemPowerOn) {
+        st.modem_delay.push_back(delay);
+      }
+      // Transmit windows follow power-on and each other with a short gap.
+      if (a.load == agro::PowerLoad::kModemPowerOn || (a.load == agro::PowerLoad::kModemTx &&
+                                                       a.tx_index + 1 < kTxWindowsPerSession)) {
+        Action tx{agro::PowerLoad::kModemTx, now + duration_of(a.load) + 400, 60000};
+        tx.tx_index = a.tx_index + 1;
+        actions.push_back(tx);
+      }
+    }
+
+    uint32_t load = kAwakeBaselineMa;
+    for (const Action& a : actions) {
+      if (a.start_ms != agro::PowerSequencer::kNever && now - a.start_ms < duration_of(a.load)) {
+        load += peak_of(a.load);
+      }
+    }
+    st.peak_ma = std::max(st.peak_ma, load);
+    const double v = rail_volts(load);
+    st.min_v = std::min(st.min_v, v);
+    if (v < kBrownoutV) {
+      ++st.brownouts;
+      return;
+    }
+  }
+}
+
+uint32_t percentile(std::vector<uint32_t> v, int pct) {
+  if (v.empty()) return 0;
+  std::sort(v.begin(), v.end());
+  return v[std::min(v.size() - 1, v.size() * pct / 100)];
+}
+
+void report(const char* name, const Stats& st, int days) {
+  std::printf("%-12s peak %4u mA  min rail %.2f V  brownouts/day %5.2f  recovery %6.1f mAh/day  forced %ld\n", name,
+              st.peak_ma, st.min_v, double(st.brownouts) / days, st.brownouts * kRecoveryMah / days, st.forced);
+  std::printf("%-12s relay delay p50/p99/max %u/%u/%u ms, modem delay p50/p99/max %u/%u/%u ms\n", "",
+              percentile(st.relay_delay, 50), percentile(st.relay_delay, 99), percentile(st.relay_delay, 100),
+              percentile(st.modem_delay, 50), percentile(st.modem_delay, 99), percentile(st.modem_delay, 100));
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  const int days = argc > 1 ? std::max(1, std::atoi(argv[1])) : 30;
+  std::mt19937 rng(11);
+  Stats direct, sequenced;
+  for (int w = 0; w < days * kWakesPerDay; ++w) {
+    const std::vector<Action> plan = plan_wake(rng);
+    run_wake(plan, false, direct);
+    run_wake(plan, true, sequenced);
+  }
+  std::printf("+5V rail model, %d days, %d wakes/day, LM2596 limit %.1f A, brownout below %.1f V\n", days,
+              kWakesPerDay, kBuckLimitA, kBrownoutV);
+  report("unsequenced", direct, days);
+  report("sequenced", sequenced, days);
+  return sequenced.brownouts == 0 ? 0 : 1;
+}
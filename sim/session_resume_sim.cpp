@@ -0,0 +1,285 @@
+// Host model of uplink sessions over 2G: a full handshake on every
+// connection against ticket resumption, with the real SessionClient and
+// SessionServer exchanging records over an emulated GPRS link.
+//
+//   g++ -std=c++17 -O2 -Icommon/include -Iserver/include sim/session_resume_sim.cpp server/src/session_server.cpp -o session_resume_sim
+//   ./session_resume_sim [days]
+//
+// A connection costs the TCP handshake (one round trip, the CONNECT OK
+// wait), then the session flights until the client has its Ack, then the
+// immediate close (AT+CIPCLOSE=1). Each flight takes the one-way latency,
+// lognormal per flight, plus serialization at the link rate; each 536-byte
+// segment is lost with the site's probability and resent after the 3 s
+// initial TCP retransmission timeout. The bearer setup before the
+// connection costs the same either way and is reported separately. The
+// device cold boots (losing RTC memory, so its ticket) at random, about
+// once a week. Link figures are model assumptions for GPRS class 10 from
+// field logs, not measurements on this board.
+//
+// Besides the timing, every run checks the protocol: each payload arrives
+// once and intact, a replayed first flight delivers nothing, also to a
+// restarted server (which keeps its ticket log in the working directory),
+// and a client holding an expired ticket recovers on the same connection.
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "agro/server/session_server.hpp"
+#include "agro/session.hpp"
+
+namespace {
+
+using agro::SessionClient;
+using agro::SessionRecord;
+using agro::server::SessionServer;
+
+constexpr uint32_t kDay = 86400;
+constexpr double kBearerS = 3.5;       // CSTT, CIICR, CIFSR
+constexpr double kCloseS = 0.2;        // CIPCLOSE=1 does not wait for FIN
+constexpr double kConnectedMa = 120;   // average while the bearer is up, TX bursts included
+constexpr double kRtoS = 3.0;
+constexpr size_t kSegmentBytes = 536;
+constexpr size_t kPayloadBytes = 64;   // one batched telemetry packet
+constexpr double kMeanColdBootDays = 7.0;
+
+struct Site {
+  const char* name;
+  double rtt_s;      // median round trip
+  double loss;       // per segment
+  double up_bps;
+  double down_bps;
+};
+constexpr Site kSites[] = {
+    {"good coverage", 0.7, 0.01, 24000, 48000},
+    {"fringe coverage", 1.4, 0.05, 9000, 24000},
+};
+
+struct Schedule {
+  const char* name;
+  uint32_t period_s;
+};
+constexpr Schedule kSchedules[] = {{"hourly uploads", 3600}, {"4/day uploads", 6 * 3600}};
+
+class Link {
+ public:
+  Link(const Site& site, uint32_t seed) : site_(site), rng_(seed) {}
+
+  double flight(size_t bytes, bool up) {
+    double t = site_.rtt_s / 2 * std::exp(0.3 * z_(rng_)) + double(bytes) * 8 / (up ? site_.up_bps : site_.down_bps);
+    for (size_t sent = 0; sent < std::max<size_t>(bytes, 1); sent += kSegmentBytes) {
+      while (u_(rng_) < site_.loss) t += kRtoS;
+    }
+    return t;
+  }
+
+ private:
+  const Site& site_;
+  std::mt19937 rng_;
+  std::normal_distribution<double> z_{0.0, 1.0};
+  std::uniform_real_distribution<double> u_{0.0, 1.0};
+};
+
+struct Exchange {
+  bool ok = false;
+  int round_trips = 0;  // including the TCP handshake
+  double seconds = 0;   // connect to close
+  int payloads = 0;
+};
+
+// Feeds a byte stream of records to the server.
+void to_server(SessionServer& server, SessionServer::Connection& c, const std::vector<uint8_t>& bytes, uint32_t now_s,
+               std::vector<uint8_t>* reply, std::vector<std::vector<uint8_t>>* payloads) {
+  size_t used = 0, k;
+  SessionRecord type;
+  const uint8_t* body;
+  size_t len;
+  while ((k = agro::next_record(bytes.data() + used, bytes.size() - used, &type, &body, &len)) != 0 && k != SIZE_MAX) {
+    server.on_record(c, type, body, len, now_s, reply, payloads);
+    used += k;
+  }
+}
+
+// One connection carrying payload. first_flight, if given, receives the
+// client's first flight (for the replay check).
+Exchange run(SessionClient& client, SessionServer& server, Link& link, std::mt19937& rng, uint32_t now_s,
+             const uint8_t* payload, std::vector<uint8_t>* first_flight = nullptr) {
+  Exchange e;
+  e.round_trips = 1;
+  e.seconds = link.flight(60, true) + link.flight(60, false);  // SYN, SYN-ACK
+
+  uint8_t random[agro::kSessionRandomBytes];
+  for (uint8_t& b : random) b = uint8_t(rng());
+  uint8_t buf[1024];
+  std::vector<uint8_t> out(buf, buf + client.begin(now_s, random, payload, kPayloadBytes, buf, sizeof(buf)));
+  if (first_flight) *first_flight = out;
+  SessionServer::Connection conn;
+  std::vector<std::vector<uint8_t>> got;
+  while (!out.empty() && e.round_trips < 8) {
+    ++e.round_trips;
+    std::vector<uint8_t> reply;
+    to_server(server, conn, out, now_s, &reply, &got);
+    e.seconds += link.flight(out.size(), true) + link.flight(reply.size(), false);
+    out.clear();
+    size_t used = 0, k;
+    SessionRecord type;
+    const uint8_t* body;
+    size_t len;
+    while ((k = agro::next_record(reply.data() + used, reply.size() - used, &type, &body, &len)) != 0 &&
+           k != SIZE_MAX) {
+      const size_t n = client.on_record(type, body, len, now_s, buf, sizeof(buf));
+      out.insert(out.end(), buf, buf + n);
+      used += k;
+    }
+  }
+  e.seconds += kCloseS;
+  e.payloads = int(got.size());
+  e.ok = client.state() == SessionClient::State::kDone && got.size() == 1 && got[0].size() == kPayloadBytes &&
+         std::equal(got[0].begin(), got[0].end(), payload);
+  return e;
+}
+
+struct Result {
+  long sessions = 0, failures = 0, full = 0;
+  double round_trips = 0, seconds = 0;
+  std::vector<double> per_session;
+};
+
+Result simulate(const Site& site, const Schedule& sched, bool resume, int days, bool* protocol_ok) {
+  const uint8_t device_key[16] = {0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6,
+                                  0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c};
+  const uint8_t ticket_key[16] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16};
+  constexpr uint32_t kDevice = 0x00a10042;
+  const char* log_path = "session_resume_sim.log";
+  std::remove(log_path);
+  SessionServer server(ticket_key, SessionServer::Config{});
+  *protocol_ok = *protocol_ok && server.open_ticket_log(log_path);
+  server.set_device_key(kDevice, 1, device_key);
+  SessionClient client;
+  client.set_device(kDevice, 1, device_key);
+  Link link(site, 3);
+  std::mt19937 rng(5);
+  std::exponential_distribution<double> boot_gap(1.0 / (kMeanColdBootDays * kDay));
+
+  Result r;
+  std::vector<uint8_t> captured;
+  uint32_t captured_t = 0;
+  double next_boot = boot_gap(rng);
+  uint8_t payload[kPayloadBytes];
+  for (uint32_t t = sched.period_s; t < uint32_t(days) * kDay; t += sched.period_s) {
+    if (t >= next_boot) {
+      client = SessionClient();
+      client.set_device(kDevice, 1, device_key);
+      next_boot += boot_gap(rng);
+    }
+    if (!resume) client.forget_ticket();
+    for (size_t i = 0; i < kPayloadBytes; ++i) payload[i] = uint8_t(t >> (i % 4 * 8)) ^ uint8_t(i);
+    const bool full = !client.can_resume(t);
+    if (captured.empty() && !full) captured_t = t;
+    const Exchange e = run(client, server, link, rng, t, payload, captured.empty() && !full ? &captured : nullptr);
+    ++r.sessions;
+    r.full += full;
+    r.failures += !e.ok;
+    r.round_trips += e.round_trips;
+    r.seconds += e.seconds;
+    r.per_session.push_back(e.seconds);
+  }
+
+  // A replayed resumed first flight must deliver nothing, while its ticket
+  // is still valid: not to the server that saw it, and not after a restart
+  // has emptied the replay windows. The client, still holding a ticket,
+  // gets through the restarted server with a full handshake.
+  if (!captured.empty()) {
+    SessionServer::Connection conn;
+    std::vector<uint8_t> reply;
+    std::vector<std::vector<uint8_t>> got;
+    to_server(server, conn, captured, captured_t, &reply, &got);
+    SessionServer restarted(ticket_key, SessionServer::Config{});
+    const bool opened = restarted.open_ticket_log(log_path);
+    restarted.set_device_key(kDevice, 1, device_key);
+    SessionServer::Connection fresh;
+    to_server(restarted, fresh, captured, captured_t, &reply, &got);
+    const uint32_t now = uint32_t(days) * kDay;
+    const bool resumable = client.can_resume(now);
+    const Exchange e = run(client, restarted, link, rng, now, payload);
+    *protocol_ok = *protocol_ok && opened && got.empty() && restarted.stats().rejected_tickets == 1u + resumable &&
+                   e.ok && !client.resumed();
+  }
+  // A ticket past its lifetime is rejected and the client falls back to a
+  // full handshake on the same connection.
+  if (client.has_ticket()) {
+    const uint32_t late = uint32_t(days) * kDay + SessionServer::Config{}.ticket_lifetime_s;
+    SessionClient stale = client;
+    // The client only checks its own clock; make it believe the ticket is
+    // fresh while the server's has moved on.
+    for (size_t i = 0; i < kPayloadBytes; ++i) payload[i] = uint8_t(i);
+    const uint32_t now = uint32_t(days) * kDay;
+    SessionServer later(ticket_key, SessionServer::Config{});
+    later.set_device_key(kDevice, 1, device_key);
+    uint8_t random[agro::kSessionRandomBytes] = {};
+    uint8_t buf[1024];
+    const size_t n = stale.begin(now, random, payload, kPayloadBytes, buf, sizeof(buf));
+    SessionServer::Connection conn;
+    std::vector<uint8_t> reply;
+    std::vector<std::vector<uint8_t>> got;
+    to_server(later, conn, std::vector<uint8_t>(buf, buf + n), late, &reply, &got);
+    bool recovered = later.stats().rejected_tickets == 1 && got.empty();
+    for (int round = 0; round < 3 && !reply.empty(); ++round) {
+      std::vector<uint8_t> out;
+      size_t used = 0, k;
+      SessionRecord type;
+      const uint8_t* body;
+      size_t len;
+      while ((k = agro::next_record(reply.data() + used, reply.size() - used, &type, &body, &len)) != 0 &&
+             k != SIZE_MAX) {
+        const size_t m = stale.on_record(type, body, len, late, buf, sizeof(buf));
+        out.insert(out.end(), buf, buf + m);
+        used += k;
+      }
+      reply.clear();
+      to_server(later, conn, out, late, &reply, &got);
+    }
+    recovered = recovered && stale.state() == SessionClient::State::kDone && got.size() == 1 && !stale.resumed();
+    *protocol_ok = *protocol_ok && recovered;
+  }
+  *protocol_ok = *protocol_ok && r.failures == 0 && server.stats().bad == 0;
+  std::remove(log_path);
+  return r;
+}
+
+double pct(std::vector<double> v, int p) {
+  if (v.empty()) return 0;
+  std::sort(v.begin(), v.end());
+  return v[std::min(v.size() - 1, v.size() * size_t(p) / 100)];
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  const int days = argc > 1 ? std::max(1, std::atoi(argv[1])) : 30;
+  std::printf("GPRS sessions, %d days: round trips and seconds from connect to close per session,\n", days);
+  std::printf("modem-on s/day with %.1f s bearer setup, charge at %.0f mA while connected\n", kBearerS, kConnectedMa);
+  bool ok = true;
+  for (const Site& site : kSites) {
+    for (const Schedule& sched : kSchedules) {
+      std::printf("  %s (RTT %.1f s, loss %.0f%%), %s\n", site.name, site.rtt_s, site.loss * 100, sched.name);
+      double secs[2] = {0, 0};
+      for (int resume = 0; resume < 2; ++resume) {
+        const Result r = simulate(site, sched, resume != 0, days, &ok);
+        const double n = double(std::max(1L, r.sessions));
+        const double on_per_day = (r.seconds + kBearerS * n) / days;
+        secs[resume] = r.seconds / n;
+        std::printf("    %-18s %4.2f RTTs  %5.2f s (p95 %5.2f s)  %6.1f s/day  %5.2f mAh/day  full %4.1f%%  failed %ld\n",
+                    resume ? "ticket resumption" : "full handshake", r.round_trips / n, r.seconds / n,
+                    pct(r.per_session, 95), on_per_day, on_per_day * kConnectedMa / 3600.0, 100.0 * r.full / n,
+                    r.failures);
+      }
+      // Resumption has to save most of a round trip per session.
+      ok = ok && secs[1] < secs[0] - 0.5 * site.rtt_s;
+    }
+  }
+  std::printf("protocol checks %s\n", ok ? "passed" : "FAILED");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,203 @@
+// Host simulator: SMS count and modem-on time per day for the SMS fallback,
+// human-readable text versus packed 8-bit PDUs, with an end-to-end check
+// through server reassembly over a lossy, reordering channel, across a
+// device restart that loses the sequence counter.
+//
+//   g++ -std=c++20 -O2 -Icommon/include -Ifirmware/include -Iserver/include
+//       sim/sms_packing_sim.cpp server/src/sms_ingest.cpp -o sms_packing_sim
+//   ./sms_packing_sim [days]
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "agro/server/sms_ingest.hpp"
+#include "agro/sms_uplink.hpp"
+
+namespace {
+
+constexpr const char* kServerNumber = "+491701234567";
+constexpr const char* kDeviceNumber = "+491761112223";
+constexpr int kSessionsPerDay = 4;
+constexpr size_t kTextSmsChars = 160;
+// SIM800L timings: power-up and registration, then one AT+CMGS round trip.
+constexpr double kRegistrationS = 12.0;
+constexpr double kPerSmsS = 4.0;
+constexpr double kLossRate = 0.05;
+constexpr double kDuplicateRate = 0.02;
+
+std::vector<agro::TelemetryRecord> make_day(uint32_t day_start, std::mt19937& rng) {
+  std::vector<agro::TelemetryRecord> day;
+  std::normal_distribution<double> jitter(0.0, 1.0);
+  int32_t lat = 525200000, lon = 134050000;
+  for (int h = 0; h < 24; ++h) {
+    const uint32_t t = day_start + h * 3600;
+    day.push_back({t, agro::RecordKind::kBattery, 0, 0, 12640 - h * 3 + int(jitter(rng) * 4), 810 - h});
+    for (uint8_t zone = 0; zone < 2; ++zone) {
+      day.push_back({t + 5, agro::RecordKind::kSoil, zone, 0, 420 - h * 4 + int(jitter(rng) * 6),
+                     2500 + h * 8 + int(jitter(rng) * 10)});
+    }
+    if (h % 6 == 0) {
+      day.push_back({t + 20, agro::RecordKind::kPosition, 0, 0, lat + int(jitter(rng) * 30),
+                     lon + int(jitter(rng) * 30)});
+    }
+    if (h == 6 || h == 18) {
+      day.push_back({t + 600, agro::RecordKind::kValve, uint8_t(h == 18), 0, 20031, 120400});
+      day.push_back({t + 603, agro::RecordKind::kFlow, uint8_t(h == 18), 0, 20031, 9980});
+    }
+  }
+  return day;
+}
+
+std::string format_text(const agro::TelemetryRecord& r) {
+  char line[96];
+  const unsigned hh = r.time / 3600 % 24, mm = r.time / 60 % 60;
+  switch (r.kind) {
+    case agro::RecordKind::kBattery:
+      std::snprintf(line, sizeof(line), "%02u:%02u BAT %.2fV SOC %d%%\n", hh, mm, r.a / 1000.0, r.b / 10);
+      break;
+    case agro::RecordKind::kSoil:
+      std::snprintf(line, sizeof(line), "%02u:%02u SOIL Z%u %.1f%% RAW %d\n", hh, mm, r.zone, r.a / 10.0, r.b);
+      break;
+    case agro::RecordKind::kPosition:
+      std::snprintf(line, sizeof(line), "%02u:%02u GPS %.6f,%.6f\n", hh, mm, r.a / 1e7, r.b / 1e7);
+      break;
+    case agro::RecordKind::kValve:
+      std::snprintf(line, sizeof(line), "%02u:%02u VALVE Z%u %.1fL %ds\n", hh, mm, r.zone, r.a / 1000.0, r.b / 1000);
+      break;
+    default:
+      std::snprintf(line, sizeof(line), "%02u:%02u K%u Z%u %d %d\n", hh, mm, unsigned(r.kind), r.zone, r.a, r.b);
+      break;
+  }
+  return line;
+}
+
+// Whole lines per 160-character GSM 7-bit message.
+size_t count_text_sms(const std::vector<agro::TelemetryRecord>& recs) {
+  size_t messages = 0, used = kTextSmsChars;
+  for (const auto& r : recs) {
+    const size_t len = format_text(r).size();
+    if (used + len > kTextSmsChars) {
+      ++messages;
+      used = 0;
+    }
+    used += len;
+  }
+  return messages;
+}
+
+// What the server's modem or gateway hands over for a received message.
+std::string to_deliver_hex(const agro::SmsPdu& submit, const char* sender) {
+  // Skip SMSC, first octet, MR, DA length/type/digits, PID and DCS to reach
+  // UDL + UD, which the SC passes through unchanged.
+  const std::string hex(submit.hex);
+  const unsigned da_digits = std::stoul(hex.substr(6, 2), nullptr, 16);
+  const size_t udl_off = 2 * (7 + (da_digits + 1) / 2);
+  const std::string udl_and_ud = hex.substr(udl_off);
+
+  std::string out = "0004";
+  const char* digits = sender + 1;
+  char buf[8];
+  std::snprintf(buf, sizeof(buf), "%02X91", unsigned(std::char_traits<char>::length(digits)));
+  out += buf;
+  const size_t n = std::char_traits<char>::length(digits);
+  for (size_t i = 0; i < n; i += 2) {
+    out += i + 1 < n ? digits[i + 1] : 'F';
+    out += digits[i];
+  }
+  out += "0004";
+  out += "00000000000000";
+  out += udl_and_ud;
+  return out;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  const int days = argc > 1 ? std::max(1, std::atoi(argv[1])) : 30;
+  std::mt19937 rng(7);
+  std::uniform_real_distribution<double> coin(0.0, 1.0);
+
+  uint8_t boot_epoch = 200;
+  agro::SmsFallbackUplink uplink(kServerNumber, boot_epoch, 65500);  // exercise wrap-around
+  agro::server::SmsReassembler server(3600);
+
+  size_t text_sms = 0, binary_sms = 0, records_sent = 0, records_lost = 0;
+  std::vector<agro::TelemetryRecord> received, delivered;
+  std::vector<std::pair<std::string, std::vector<uint8_t>>> in_flight;
+  uint32_t now = 1760000000;
+
+  for (int d = 0; d < days; ++d) {
+    // Halfway through, a cold boot without RTC state: the sequence starts
+    // over at 0, far behind where the server's stream is.
+    if (d > 0 && d == days / 2) uplink = agro::SmsFallbackUplink(kServerNumber, ++boot_epoch, 0);
+    const std::vector<agro::TelemetryRecord> day = make_day(now, rng);
+    const size_t per_session = (day.size() + kSessionsPerDay - 1) / kSessionsPerDay;
+    for (size_t off = 0; off < day.size(); off += per_session) {
+      const std::vector<agro::TelemetryRecord> batch(day.begin() + off,
+                                                      day.begin() + std::min(day.size(), off + per_session));
+      text_sms += count_text_sms(batch);
+      records_sent += batch.size();
+
+      for (size_t i = 0; i < batch.size();) {
+        agro::SmsPdu pdu;
+        const size_t used = uplink.encode_next(batch.data() + i, batch.size() - i, &pdu);
+        if (used == 0) return 1;
+        i += used;
+        ++binary_sms;
+
+        agro::server::SmsDeliver msg;
+        if (!agro::server::parse_deliver_pdu(to_deliver_hex(pdu, kDeviceNumber), &msg)) {
+          std::printf("FAIL: server could not parse PDU\n");
+          return 1;
+        }
+        if (coin(rng) < kLossRate) {
+          records_lost += used;
+          continue;
+        }
+        delivered.insert(delivered.end(), batch.begin() + (i - used), batch.begin() + i);
+        in_flight.emplace_back(msg.sender, msg.user_data);
+        if (coin(rng) < kDuplicateRate) in_flight.emplace_back(msg.sender, msg.user_data);
+      }
+      // The SMS network reorders within a session's burst.
+      std::shuffle(in_flight.begin(), in_flight.end(), rng);
+      for (const auto& [sender, ud] : in_flight) server.accept(sender, ud, now, &received);
+      in_flight.clear();
+      now += 6 * 3600;
+      std::vector<std::pair<std::string, agro::TelemetryRecord>> late;
+      server.expire(now, &late);
+      for (const auto& [sender, r] : late) received.push_back(r);
+    }
+  }
+  std::vector<std::pair<std::string, agro::TelemetryRecord>> late;
+  server.expire(now + 86400, &late);
+  for (const auto& [sender, r] : late) received.push_back(r);
+
+  const auto& st = server.stats();
+  const double text_per_day = double(text_sms) / days, bin_per_day = double(binary_sms) / days;
+  std::printf("sms fallback simulation, %d days, %zu records/day, %d sessions/day\n", days, records_sent / days,
+              kSessionsPerDay);
+  std::printf("%-22s sms/day %6.1f  modem-on s/day %6.1f\n", "text (7-bit, 160 ch)", text_per_day,
+              kSessionsPerDay * kRegistrationS + text_per_day * kPerSmsS);
+  std::printf("%-22s sms/day %6.1f  modem-on s/day %6.1f  (%.1f records/sms)\n", "binary PDU (8-bit)",
+              bin_per_day, kSessionsPerDay * kRegistrationS + bin_per_day * kPerSmsS,
+              double(records_sent) / binary_sms);
+  std::printf("server: packets %llu duplicates %llu lost seq %llu malformed %llu restarts %llu, "
+              "records %zu of %zu (%zu lost)\n",
+              (unsigned long long)st.packets, (unsigned long long)st.duplicates, (unsigned long long)st.lost,
+              (unsigned long long)st.malformed, (unsigned long long)st.restarts, received.size(), records_sent,
+              records_lost);
+  const auto by_time = [](const agro::TelemetryRecord& x, const agro::TelemetryRecord& y) {
+    return std::tie(x.time, x.kind, x.zone) < std::tie(y.time, y.kind, y.zone);
+  };
+  std::sort(received.begin(), received.end(), by_time);
+  std::sort(delivered.begin(), delivered.end(), by_time);
+  if (received != delivered || st.malformed != 0 || st.restarts != (days > 1 ? 1u : 0u)) {
+    std::printf("FAIL: reassembly mismatch\n");
+    return 1;
+  }
+  return 0;
+}
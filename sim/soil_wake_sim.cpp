@@ -0,0 +1,149 @@
+// Host simulator: main-CPU wakes per day for soil-moisture-driven irrigation,
+// timer-polled versus ULP threshold wakes.
+//
+//   g++ -std=c++20 -O2 -Ifirmware/include sim/soil_wake_sim.cpp -o soil_wake_sim
+//   ./soil_wake_sim [days]
+//
+// The field dries on a diurnal evapotranspiration curve, the probe reading
+// carries Gaussian noise plus occasional transients that offset a whole
+// sampling burst (relay and modem switching on the same ground), and each
+// irrigation adds a fixed depth.
+// Baseline: a full wake every 15 minutes reads the probe and decides.
+// ULP: the coprocessor samples every 5 minutes and wakes the CPU only on a
+// filtered dry crossing.
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "agro/soil_moisture.hpp"
+
+namespace {
+
+constexpr double kPi = 3.14159265358979323846;
+constexpr int kMinutesPerDay = 24 * 60;
+constexpr int kBaselinePeriodMin = 15;
+constexpr int kUlpPeriodMin = 5;
+constexpr double kIrrigationPermille = 220.0;
+constexpr double kSpuriousMarginPermille = 40.0;
+
+// Rough charge per event, for context only.
+constexpr double kFullWakeMilliCoulomb = 0.35 * 60.0;  // 350 ms at 60 mA
+constexpr double kUlpCycleMilliCoulomb = 0.004 * 8.0;  // 4 ms probe+ADC at 8 mA
+
+struct Field {
+  double permille = 600.0;
+
+  void step_minute(int minute_of_day) {
+    const double sun = std::max(0.0, std::sin((minute_of_day - 6 * 60) * kPi / (12 * 60)));
+    permille -= (0.3 + 7.0 * sun) / 60.0;
+    if (permille < 0) permille = 0;
+  }
+};
+
+class Probe {
+ public:
+  Probe(const agro::SoilProbeConfig& cfg, uint32_t seed) : cfg_(cfg), rng_(seed) {}
+
+  // One oversampling burst. A switching transient lands on a whole burst
+  // now and then, which a single reading cannot tell from dry soil.
+  void burst(double permille, std::vector<uint16_t>& out) {
+    const double span = cfg_.air_raw - cfg_.water_raw;
+    const double offset = spike_(rng_) < 0.03 ? 700.0 : 0.0;
+    for (auto& s : out) {
+      const double raw = cfg_.air_raw - permille * span / 1000.0 + offset + noise_(rng_);
+      s = static_cast<uint16_t>(std::clamp(raw, 0.0, 4095.0));
+    }
+  }
+
+ private:
+  agro::SoilProbeConfig cfg_;
+  std::mt19937 rng_;
+  std::normal_distribution<double> noise_{0.0, 20.0};
+  std::uniform_real_distribution<double> spike_{0.0, 1.0};
+};
+
+struct Result {
+  long wakes = 0;
+  long irrigations = 0;
+  long spurious = 0;  // irrigated while the soil was clearly above the threshold
+  long ulp_cycles = 0;
+  double min_permille = 1000.0;
+};
+
+bool is_spurious(const agro::SoilProbeConfig& cfg, const Field& field) {
+  return field.permille > agro::soil_raw_to_permille(cfg, cfg.dry_raw) + kSpuriousMarginPermille;
+}
+
+Result run_baseline(const agro::SoilProbeConfig& cfg, int days) {
+  Field field;
+  Probe probe(cfg, 1);
+  Result r;
+  std::vector<uint16_t> burst(size_t{1} << cfg.oversample_shift);
+  for (int t = 0; t < days * kMinutesPerDay; ++t) {
+    field.step_minute(t % kMinutesPerDay);
+    r.min_permille = std::min(r.min_permille, field.permille);
+    if (t % kBaselinePeriodMin != 0) continue;
+    ++r.wakes;
+    probe.burst(field.permille, burst);
+    uint32_t acc = 0;
+    for (uint16_t s : burst) acc += s;
+    const uint16_t raw = static_cast<uint16_t>(acc >> cfg.oversample_shift);
+    if (raw >= cfg.dry_raw) {
+      ++r.irrigations;
+      if (is_spurious(cfg, field)) ++r.spurious;
+      field.permille += kIrrigationPermille;
+    }
+  }
+  return r;
+}
+
+Result run_ulp(const agro::SoilProbeConfig& cfg, int days) {
+  Field field;
+  Probe probe(cfg, 1);
+  agro::SoilUlpModel ulp(cfg);
+  Result r;
+  std::vector<uint16_t> burst(ulp.samples_per_cycle());
+  probe.burst(field.permille, burst);
+  ulp.arm(burst[0]);
+  for (int t = 0; t < days * kMinutesPerDay; ++t) {
+    field.step_minute(t % kMinutesPerDay);
+    r.min_permille = std::min(r.min_permille, field.permille);
+    if (t % kUlpPeriodMin != 0) continue;
+    ++r.ulp_cycles;
+    probe.burst(field.permille, burst);
+    if (!ulp.run(burst.data())) continue;
+    ++r.wakes;
+    ++r.irrigations;
+    if (is_spurious(cfg, field)) ++r.spurious;
+    field.permille += kIrrigationPermille;
+    // The woken CPU irrigates and re-arms before going back to sleep.
+    probe.burst(field.permille, burst);
+    ulp.arm(burst[0]);
+  }
+  return r;
+}
+
+void report(const char* name, const Result& r, int days) {
+  const double charge = r.wakes * kFullWakeMilliCoulomb + r.ulp_cycles * kUlpCycleMilliCoulomb;
+  std::printf("%-18s wakes/day %7.2f  irrigations/day %5.2f  spurious %3ld  min moisture %4.0f  ~%.1f mC/day\n",
+              name, double(r.wakes) / days, double(r.irrigations) / days, r.spurious, r.min_permille,
+              charge / days);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  const int days = argc > 1 ? std::max(1, std::atoi(argv[1])) : 30;
+  agro::SoilProbeConfig cfg;
+
+  const Result baseline = run_baseline(cfg, days);
+  const Result ulp = run_ulp(cfg, days);
+
+  std::printf("soil wake simulation, %d days\n", days);
+  report("timer 15 min", baseline, days);
+  report("ULP threshold", ulp, days);
+  std::printf("wake reduction: %.1fx\n", ulp.wakes ? double(baseline.wakes) / ulp.wakes : 0.0);
+  return 0;
+}
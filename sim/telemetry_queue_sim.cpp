@@ -0,0 +1,295 @@
+// Host simulation of uplink scheduling: when the SIM800L is powered, how
+// long alarms wait, and what survives a network outage.
+//
+//   g++ -std=c++17 -O2 -Icommon/include -Ifirmware/include sim/telemetry_queue_sim.cpp -o telemetry_queue_sim
+//   ./telemetry_queue_sim [days]
+//
+// One controller with four zones: soil every 15 min per zone, battery
+// hourly, a position fix every 6 h, two valve runs per zone and day (a
+// valve and a flow record each), and alarms (geofence, faults) at random,
+// about one every two days. Sessions fail with 10% probability at this fair
+// site, and not at all from day 10 to day 13, when the cell is down. Each
+// session boots the modem and searches for the network (lognormal, 15 s
+// median), charged with ModemPowerParams; the modem is off in between.
+//
+//   hourly       a session every hour, alarms wait for it; one 256-record
+//                ring that drops the oldest when full
+//   hourly+alarm the same, plus a session of its own for each alarm
+//   queue        TelemetryQueue: deadlines per class, everything merged
+//                into any session, summaries under storage pressure
+//
+// Latency runs from the alarm to the server's acknowledgement. A separate
+// check raises an alarm while the queue backs off an hour after repeated
+// failures: it must be retried within alarm_retry_max_s.
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <random>
+#include <vector>
+
+#include "agro/memory.hpp"
+#include "agro/modem_power.hpp"
+#include "agro/telemetry_queue.hpp"
+
+namespace {
+
+constexpr int kZones = 4;
+constexpr uint32_t kOutageStart = 10 * 86400;
+constexpr uint32_t kOutageEnd = 13 * 86400;
+constexpr double kFailRate = 0.10;
+constexpr double kSendMsPerRecord = 8.0;  // at 300 mA while transmitting
+constexpr double kSendMa = 300.0;
+constexpr double kFailTimeoutMs = 60000;  // network search given up
+
+enum class Strategy { kHourly, kHourlyAlarm, kQueue };
+constexpr const char* kNames[] = {"hourly", "hourly+alarm", "queue"};
+
+struct Result {
+  long sessions = 0;
+  double mams = 0;
+  std::vector<double> alarm_latency_s;  // outside the outage
+  std::vector<double> outage_latency_s;
+  long alarms = 0, alarms_lost = 0;
+  long routine = 0, routine_delivered = 0;
+  long summarized = 0, dropped = 0;  // routine readings
+  double routine_late_s = 0;  // worst delivery age of a routine reading outside the outage
+};
+
+class Network {
+ public:
+  explicit Network(uint32_t seed) : rng_(seed), reg_(std::log(15000.0), 0.5), fail_(kFailRate) {}
+
+  // Returns the session length in s, or a negative value if it failed.
+  double session(uint32_t now, size_t records, Result* r) {
+    const agro::ModemPowerParams p;
+    ++r->sessions;
+    r->mams += p.boot_mams;
+    if ((now >= kOutageStart && now < kOutageEnd) || fail_(rng_)) {
+      r->mams += p.register_ma * kFailTimeoutMs;
+      return -1;
+    }
+    const double reg_ms = reg_(rng_);
+    const double send_ms = 2000 + kSendMsPerRecord * double(records);
+    r->mams += p.register_ma * reg_ms + kSendMa * send_ms;
+    return (p.boot_mams / 55.0 + reg_ms + send_ms) / 1000.0;
+  }
+
+ private:
+  std::mt19937 rng_;
+  std::lognormal_distribution<double> reg_;
+  std::bernoulli_distribution fail_;
+};
+
+// Records raised at t (s, a whole minute).
+void generate(uint32_t t, std::mt19937& rng, std::vector<agro::TelemetryRecord>* out) {
+  std::uniform_int_distribution<int> soil(200, 600);
+  std::bernoulli_distribution alarm(1.0 / (2 * 1440));
+  agro::TelemetryRecord r;
+  r.time = t;
+  if (t % 900 == 0) {
+    for (int z = 0; z < kZones; ++z) {
+      r.kind = agro::RecordKind::kSoil;
+      r.zone = uint8_t(z);
+      r.a = soil(rng);
+      r.b = r.a * 4;
+      out->push_back(r);
+    }
+  }
+  r.zone = 0;
+  if (t % 3600 == 0) {
+    r.kind = agro::RecordKind::kBattery;
+    r.a = 12600;
+    r.b = 800;
+    out->push_back(r);
+  }
+  if (t % (6 * 3600) == 0) {
+    r.kind = agro::RecordKind::kPosition;
+    r.a = 481173020;
+    r.b = 115166700;
+    out->push_back(r);
+  }
+  const uint32_t minute_of_day = t % 86400 / 60;
+  for (int z = 0; z < kZones; ++z) {
+    if (minute_of_day == uint32_t(330 + 20 * z) || minute_of_day == uint32_t(1170 + 20 * z)) {
+      r.zone = uint8_t(z);
+      r.kind = agro::RecordKind::kValve;
+      r.a = 20000;
+      r.b = 900000;
+      out->push_back(r);
+      r.kind = agro::RecordKind::kFlow;
+      out->push_back(r);
+    }
+  }
+  if (alarm(rng)) {
+    r.kind = agro::RecordKind::kGeofence;
+    r.zone = 0;
+    r.a = 40;
+    r.b = 1;
+    out->push_back(r);
+  }
+}
+
+void deliver(const agro::TelemetryRecord& rec, double at, Result* r) {
+  const agro::TelemetryPriority prio = agro::telemetry_priority(rec.kind);
+  if (prio == agro::TelemetryPriority::kAlarm) {
+    const bool outage = rec.time + 600 >= kOutageStart && rec.time < kOutageEnd;
+    (outage ? r->outage_latency_s : r->alarm_latency_s).push_back(at - rec.time);
+  } else if (prio == agro::TelemetryPriority::kRoutine) {
+    r->routine_delivered += rec.flags & agro::kRecordSummary ? rec.flags & ~agro::kRecordSummary : 1;
+    // A summary carries its newest reading's time.
+    const bool outage = rec.time + 12 * 3600 >= kOutageStart && rec.time < kOutageEnd;
+    if (!outage) r->routine_late_s = std::max(r->routine_late_s, at - rec.time);
+  }
+}
+
+Result run(Strategy s, int days) {
+  std::mt19937 rng(11);
+  Network net(23);
+  Result r;
+  const uint32_t end = uint32_t(days) * 86400;
+  std::vector<agro::TelemetryRecord> fresh;
+
+  if (s == Strategy::kQueue) {
+    agro::TelemetryQueue<agro::mem::kTelemetryRecords> q;
+    static agro::TelemetryRecord batch[agro::mem::kTelemetryRecords];
+    for (uint32_t t = 0; t < end; t += 60) {
+      fresh.clear();
+      generate(t, rng, &fresh);
+      for (const auto& rec : fresh) {
+        if (agro::telemetry_priority(rec.kind) == agro::TelemetryPriority::kAlarm) ++r.alarms;
+        if (agro::telemetry_priority(rec.kind) == agro::TelemetryPriority::kRoutine) ++r.routine;
+        q.push(rec, t);
+      }
+      // The wake timer is set to next_deadline(); a minute tick stands in.
+      if (!q.session_due(t)) continue;
+      const size_t n = q.collect(batch, agro::mem::kTelemetryRecords);
+      const double len = net.session(t, n, &r);
+      if (len < 0) {
+        q.session_failed(t);
+        continue;
+      }
+      for (size_t i = 0; i < n; ++i) deliver(batch[i], t + len, &r);
+      q.acknowledge(n);
+    }
+    const agro::TelemetryQueueStats& st = q.stats();
+    r.summarized = st.summarized;
+    r.dropped = st.dropped[size_t(agro::TelemetryPriority::kRoutine)];
+    r.alarms_lost = st.dropped[size_t(agro::TelemetryPriority::kAlarm)];
+    return r;
+  }
+
+  std::deque<agro::TelemetryRecord> ring;
+  uint32_t retry_alarm_at = 0;
+  for (uint32_t t = 0; t < end; t += 60) {
+    fresh.clear();
+    generate(t, rng, &fresh);
+    bool alarm = false;
+    for (const auto& rec : fresh) {
+      const agro::TelemetryPriority prio = agro::telemetry_priority(rec.kind);
+      if (prio == agro::TelemetryPriority::kAlarm) ++r.alarms;
+      if (prio == agro::TelemetryPriority::kRoutine) ++r.routine;
+      alarm |= prio == agro::TelemetryPriority::kAlarm;
+      if (ring.size() == agro::mem::kTelemetryRecords) {
+        const agro::TelemetryPriority lost = agro::telemetry_priority(ring.front().kind);
+        r.alarms_lost += lost == agro::TelemetryPriority::kAlarm;
+        r.dropped += lost == agro::TelemetryPriority::kRoutine;
+        ring.pop_front();
+      }
+      ring.push_back(rec);
+    }
+    const bool pending_alarm =
+        std::any_of(ring.begin(), ring.end(), [](const agro::TelemetryRecord& x) {
+          return agro::telemetry_priority(x.kind) == agro::TelemetryPriority::kAlarm;
+        });
+    if (s == Strategy::kHourlyAlarm && pending_alarm && (alarm || t >= retry_alarm_at)) {
+      // Alarms only, in a session of their own; same 2 min retry as the queue.
+      size_t n = 0;
+      for (const auto& x : ring) n += agro::telemetry_priority(x.kind) == agro::TelemetryPriority::kAlarm;
+      const double len = net.session(t, n, &r);
+      if (len < 0) {
+        retry_alarm_at = t + 120;
+      } else {
+        for (auto it = ring.begin(); it != ring.end();) {
+          if (agro::telemetry_priority(it->kind) != agro::TelemetryPriority::kAlarm) {
+            ++it;
+            continue;
+          }
+          deliver(*it, t + len, &r);
+          it = ring.erase(it);
+        }
+      }
+    }
+    if (t % 3600 != 0 || ring.empty()) continue;
+    const double len = net.session(t, ring.size(), &r);
+    if (len < 0) continue;
+    for (const auto& x : ring) deliver(x, t + len, &r);
+    ring.clear();
+  }
+  return r;
+}
+
+// Failed sessions until the backoff reaches retry_max_s, then an alarm a
+// minute after the last failure.
+bool alarm_cuts_backoff() {
+  const agro::TelemetryQueueParams p;
+  agro::TelemetryQueue<64> q(p);
+  agro::TelemetryRecord r;
+  r.kind = agro::RecordKind::kSoil;
+  q.push(r, 0, 0);  // due at once
+  uint32_t t = 0, failed = 0;
+  for (uint32_t backoff = p.retry_min_s; backoff < 2 * p.retry_max_s; backoff *= 2) {
+    if (!q.session_due(t)) return false;
+    q.session_failed(t);
+    failed = t;
+    t = q.next_deadline();
+  }
+  if (t != failed + p.retry_max_s) return false;
+  r.kind = agro::RecordKind::kGeofence;
+  r.time = failed + 60;
+  q.push(r, r.time);
+  const uint32_t retry = failed + p.alarm_retry_max_s;
+  return q.next_deadline() == retry && !q.session_due(retry - 1) && q.session_due(retry);
+}
+
+double percentile(std::vector<double> v, double p) {
+  if (v.empty()) return 0;
+  std::sort(v.begin(), v.end());
+  return v[std::min(v.size() - 1, size_t(p * double(v.size())))];
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  const int days = argc > 1 ? std::max(14, std::atoi(argv[1])) : 30;
+  std::printf("uplink scheduling, %d days, cell down days 10-13\n", days);
+  std::printf("  %-13s %9s %8s  %-29s %8s  %-23s\n", "", "sessions", "modem", "alarm latency s (outside outage)",
+              "outage", "routine readings");
+  std::printf("  %-13s %9s %8s  %6s %6s %6s %7s %8s  %9s %6s %6s\n", "", "per day", "mAh/day", "p50", "p90",
+              "p99", "max", "max", "delivered", "summ", "lost");
+  Result results[3];
+  for (int i = 0; i < 3; ++i) {
+    Result& r = results[i] = run(Strategy(i), days);
+    const double max_outage = percentile(r.outage_latency_s, 1.0);
+    std::printf("  %-13s %9.1f %8.1f  %6.0f %6.0f %6.0f %7.0f %8.0f  %8.1f%% %6ld %6ld\n", kNames[i],
+                double(r.sessions) / days, r.mams / 3600000.0 / days, percentile(r.alarm_latency_s, 0.5),
+                percentile(r.alarm_latency_s, 0.9), percentile(r.alarm_latency_s, 0.99),
+                percentile(r.alarm_latency_s, 1.0), max_outage, 100.0 * r.routine_delivered / r.routine,
+                r.summarized, r.dropped);
+    if (r.alarms_lost) std::printf("    %ld of %ld alarms lost\n", r.alarms_lost, r.alarms);
+  }
+  const Result& hourly = results[0];
+  const Result& queue = results[2];
+  // Routine readings must still meet their 12 h deadline outside the outage.
+  const double routine_deadline = agro::TelemetryQueueParams().deadline_s[2] + 3600.0;
+  std::printf("queue: routine readings at most %.1f h old on delivery outside the outage\n",
+              queue.routine_late_s / 3600.0);
+  const bool backoff_ok = alarm_cuts_backoff();
+  std::printf("queue: alarm during a %u s backoff retried after %u s: %s\n", agro::TelemetryQueueParams().retry_max_s,
+              agro::TelemetryQueueParams().alarm_retry_max_s, backoff_ok ? "ok" : "FAILED");
+  const bool ok = queue.alarms_lost == 0 && percentile(queue.alarm_latency_s, 0.99) < 600 &&
+                  queue.sessions < hourly.sessions && queue.routine_late_s <= routine_deadline &&
+                  queue.dropped == 0 && backoff_ok;
+  return ok ? 0 : 1;
+}
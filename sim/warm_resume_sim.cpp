@@ -0,0 +1,185 @@
+// Host model of wake-to-first-action latency: every deep-sleep wake
+// re-initializing from scratch versus resuming from the RTC snapshot.
+//
+//   g++ -std=c++20 -O2 -Icommon/include -Ifirmware/include sim/warm_resume_sim.cpp -o warm_resume_sim
+//   ./warm_resume_sim [days]
+//
+// The controller wakes every 15 minutes. A wake either starts a due zone
+// program (valve), starts an upload (every fourth wake) or just samples the
+// probe. A cold wake runs the full init chain before acting: probe the
+// SIM800L (autobaud, CREG), probe the NEO-6M (UBX-MON-VER, waking it from
+// backup if needed), re-estimate the battery from its rest voltage, and scan
+// the zone programs. A warm wake restores all of that from the snapshot and
+// only waits for what its action needs: nothing for the valve or a sample,
+// a DTR pulse to wake the sleeping modem for an upload.
+//
+// Step durations are model assumptions from the module datasheets and AT
+// timeouts, not measurements. The snapshot seal/check and the schedule
+// cursor are the firmware's own code, and every warm decision is checked
+// against a cold recomputation. Snapshots are lost to brownouts at random,
+// and the config image is reflashed once mid-run.
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "agro/config_store.hpp"
+#include "agro/resume.hpp"
+
+namespace {
+
+constexpr uint32_t kWakePeriodS = 900;
+constexpr int kUploadEveryWakes = 4;
+constexpr double kLostSnapshotRate = 0.002;  // brownout or reset during sleep
+
+// Model step durations, microseconds.
+constexpr uint32_t kAppLoadUs = 95000;        // bootloader, app load, validation skipped after deep sleep
+constexpr uint32_t kStubCheckUs = 40;         // ROM CRC over the 80-byte snapshot
+constexpr uint32_t kRestoreUs = 150;
+constexpr uint32_t kUartInitUs = 2000;
+constexpr uint32_t kAtTimeoutUs = 500000;     // per unanswered AT during autobaud
+constexpr uint32_t kAtReplyUs = 60000;        // AT, ATE0, AT+CREG? once synced
+constexpr uint32_t kGpsPollUs = 250000;       // UBX-MON-VER round trip at 9600 baud
+constexpr uint32_t kGpsBackupWakeUs = 600000; // receiver in backup mode ignores the first poll
+constexpr uint32_t kRestVoltageUs = 400000;   // load off, let the battery settle, 64 ADC samples
+constexpr uint32_t kCoulombSocUs = 1000;
+constexpr uint32_t kScheduleScanUs = 3000;    // open the image, walk the programs
+constexpr uint32_t kDtrWakeUs = 60000;        // modem out of CSCLK sleep
+constexpr uint32_t kAdcSampleUs = 5000;
+constexpr double kAwakeMa = 60.0;
+
+enum class Action { kSample, kValve, kUpload };
+
+agro::ConfigImageBuilder make_config(uint32_t generation, uint16_t shift_min) {
+  agro::ConfigImageBuilder b;
+  b.generation = generation;
+  const agro::ZoneProgram programs[] = {
+      {0, 0x15, uint16_t(330 + shift_min), 120000, 45, 350},
+      {1, 0x7f, uint16_t(375 + shift_min), 40000, 20, 0},
+      {2, 0x0a, uint16_t(1140 + shift_min), 80000, 30, 300},
+  };
+  for (const auto& p : programs) b.zones[b.zone_count++] = p;
+  return b;
+}
+
+uint16_t minute_of_week(uint32_t t_s) { return uint16_t((t_s / 60) % (7 * 24 * 60)); }
+
+// True if the program at cursor falls inside the wake period ending at now.
+bool program_due(const agro::ScheduleCursor& c, uint16_t now_mow) {
+  if (c.index == agro::ScheduleCursor::kNone) return false;
+  const int back = (now_mow - c.minute_of_week + 7 * 24 * 60) % (7 * 24 * 60);
+  return back < int(kWakePeriodS / 60);
+}
+
+struct Run {
+  std::vector<uint32_t> latency_us[2];  // [cold, warm]
+  agro::WakeLatencyStats stats;
+  double awake_mas = 0;
+  long wakes = 0, warm = 0, mismatches = 0;
+};
+
+void simulate(int days, bool use_resume, Run& run) {
+  std::mt19937 rng(21);
+  std::uniform_int_distribution<int> at_tries(1, 3);
+  std::bernoulli_distribution lost(kLostSnapshotRate), gps_in_backup(0.7);
+
+  uint8_t image_a[agro::ConfigImageBuilder::kMaxImageBytes], image_b[sizeof(image_a)];
+  const size_t len_a = make_config(1, 0).build(image_a, sizeof(image_a));
+  const size_t len_b = make_config(2, 10).build(image_b, sizeof(image_b));
+
+  agro::ResumeSnapshot rtc = {};  // RTC slow memory, zero after power-on
+  const uint32_t wakes = uint32_t(days) * 86400u / kWakePeriodS;
+  for (uint32_t w = 0; w < wakes; ++w) {
+    const uint32_t now_s = w * kWakePeriodS;
+    const bool reflashed = w >= wakes / 2;
+    agro::ConfigView cfg;
+    cfg.open(reflashed ? image_b : image_a, reflashed ? len_b : len_a, false);
+    if (lost(rng)) rtc = {};
+
+    const bool warm = use_resume && agro::resume_valid(rtc);
+    agro::ResumeState st = warm ? rtc.state : agro::ResumeState();
+    agro::resume_invalidate(&rtc);
+
+    agro::WakeTimeline tl;
+    tl.begin(warm);
+    uint32_t t = kAppLoadUs + (warm ? kStubCheckUs : 0);
+    tl.mark(agro::WakeMark::kApp, t);
+
+    // Schedule cursor, restored or rescanned.
+    const uint16_t mow = minute_of_week(now_s);
+    agro::ScheduleCursor cursor{st.schedule.next_program, st.schedule.next_minute_of_week};
+    const bool cursor_ok = warm && st.schedule.config_generation == cfg.generation() &&
+                           cursor.index != agro::ScheduleCursor::kNone;
+    const uint16_t scan_from = uint16_t((mow + 7 * 24 * 60 - kWakePeriodS / 60 + 1) % (7 * 24 * 60));
+    const agro::ScheduleCursor fresh = agro::next_zone_program(cfg, scan_from);
+    if (!cursor_ok) cursor = fresh;
+    if (program_due(cursor, mow) != program_due(fresh, mow)) ++run.mismatches;
+
+    const Action action = program_due(cursor, mow)             ? Action::kValve
+                          : w % kUploadEveryWakes == 0          ? Action::kUpload
+                                                                 : Action::kSample;
+    if (warm) {
+      t += kRestoreUs + kCoulombSocUs + (cursor_ok ? 0 : kScheduleScanUs);
+      tl.mark(agro::WakeMark::kReady, t);
+      if (action == Action::kUpload) t += kUartInitUs + kDtrWakeUs;
+      if (action == Action::kSample) t += kAdcSampleUs;
+    } else {
+      t += 2 * kUartInitUs;
+      t += uint32_t(at_tries(rng) - 1) * kAtTimeoutUs + kAtReplyUs;
+      t += kGpsPollUs + (gps_in_backup(rng) ? kGpsBackupWakeUs : 0);
+      t += kRestVoltageUs + kScheduleScanUs;
+      tl.mark(agro::WakeMark::kReady, t);
+      if (action == Action::kSample) t += kAdcSampleUs;
+    }
+    tl.mark(agro::WakeMark::kFirstAction, t);
+    run.stats.add(tl);
+    run.latency_us[warm].push_back(t);
+    run.awake_mas += kAwakeMa * t / 1e6;
+    ++run.wakes;
+    run.warm += warm;
+
+    // Going back to sleep: advance the cursor past this wake and seal.
+    st.schedule.config_generation = cfg.generation();
+    const agro::ScheduleCursor next = agro::next_zone_program(cfg, uint16_t((mow + 1) % (7 * 24 * 60)));
+    st.schedule.next_program = next.index;
+    st.schedule.next_minute_of_week = next.minute_of_week;
+    st.modem.power = agro::ModemPower::kSleeping;
+    st.modem.baud = 9600;
+    st.gps.power = agro::GpsPower::kBackup;
+    st.unix_at_sleep = now_s;
+    if (use_resume) agro::resume_seal(&rtc, st);
+  }
+}
+
+uint32_t pct(std::vector<uint32_t> v, int p) {
+  if (v.empty()) return 0;
+  std::sort(v.begin(), v.end());
+  return v[std::min(v.size() - 1, v.size() * size_t(p) / 100)];
+}
+
+void report(const char* name, const Run& r, int days) {
+  std::vector<uint32_t> all = r.latency_us[0];
+  all.insert(all.end(), r.latency_us[1].begin(), r.latency_us[1].end());
+  std::printf("%-14s wakes %ld (warm %ld)  first action p50 %6.1f ms  p99 %6.1f ms  max %6.1f ms  awake-to-act %.1f mAh/day\n",
+              name, r.wakes, r.warm, pct(all, 50) / 1000.0, pct(all, 99) / 1000.0, pct(all, 100) / 1000.0,
+              r.awake_mas / 3600.0 / days);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  const int days = argc > 1 ? std::max(1, std::atoi(argv[1])) : 60;
+  Run cold, resume;
+  simulate(days, false, cold);
+  simulate(days, true, resume);
+  std::printf("wake-to-first-action, %d days, wake every %u s\n", days, kWakePeriodS);
+  report("always cold", cold, days);
+  report("warm resume", resume, days);
+  std::printf("%-14s warm ewma %.1f ms max %.1f ms, cold ewma %.1f ms max %.1f ms (WakeLatencyStats)\n", "",
+              resume.stats.warm.ewma_us / 1000.0, resume.stats.warm.max_us / 1000.0, resume.stats.cold.ewma_us / 1000.0,
+              resume.stats.cold.max_us / 1000.0);
+  std::printf("schedule decisions differing from a cold rescan: %ld\n", resume.mismatches + cold.mismatches);
+  const bool faster = resume.warm > 0 && pct(resume.latency_us[1], 99) < pct(cold.latency_us[0], 50);
+  return resume.mismatches + cold.mismatches == 0 && faster ? 0 : 1;
+}
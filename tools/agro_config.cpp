@@ -0,0 +1,339 @@
+// Config image compiler: turns the human-editable text file into the binary
+// image the firmware maps from the "agrocfg" partition (config_image.hpp),
+// and dumps an image back as text.
+//
+//   g++ -std=c++20 -O2 -Icommon/include tools/agro_config.cpp -o agro_config
+//   ./agro_config compile tools/agro_config.example.ini config.bin [--generation N]
+//   ./agro_config dump config.bin
+//   parttool.py write_partition --partition-name agrocfg --input config.bin
+//
+// The text format is INI-like: [system], [uplink], [thresholds], [geofence]
+// and [rules] once each, [zone] once per program. '#' starts a comment.
+// Unknown keys are errors so a typo never silently falls back to a default.
+// Each "rule = if ... then ..." line is compiled to bytecode
+// (rule_compiler.hpp); dump shows the rules disassembled.
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "agro/config_image.hpp"
+#include "agro/rule_compiler.hpp"
+
+namespace {
+
+struct Ctx {
+  const char* file;
+  int line = 0;
+  bool ok = true;
+};
+
+void fail(Ctx& c, const std::string& msg) {
+  std::fprintf(stderr, "%s:%d: %s\n", c.file, c.line, msg.c_str());
+  c.ok = false;
+}
+
+std::string trim(const std::string& s) {
+  const size_t b = s.find_first_not_of(" \t\r");
+  if (b == std::string::npos) return "";
+  return s.substr(b, s.find_last_not_of(" \t\r") - b + 1);
+}
+
+bool to_long(const std::string& v, long lo, long hi, long* out) {
+  char* end = nullptr;
+  const long n = std::strtol(v.c_str(), &end, 0);
+  if (end == v.c_str() || *end != '\0' || n < lo || n > hi) return false;
+  *out = n;
+  return true;
+}
+
+template <class T>
+bool set_int(Ctx& c, const std::string& v, T* field) {
+  long n;
+  const long lo = std::is_signed_v<T> ? -(1L << (8 * sizeof(T) - 1)) : 0;
+  const long hi = std::is_signed_v<T> ? (1L << (8 * sizeof(T) - 1)) - 1 : long((1ULL << (8 * sizeof(T))) - 1);
+  if (!to_long(v, lo, hi, &n)) {
+    fail(c, "'" + v + "' is not a number in range");
+    return false;
+  }
+  *field = static_cast<T>(n);
+  return true;
+}
+
+template <size_t N>
+bool set_str(Ctx& c, const std::string& v, char (&field)[N]) {
+  if (v.size() >= N) {
+    fail(c, "'" + v + "' is longer than " + std::to_string(N - 1) + " characters");
+    return false;
+  }
+  std::memset(field, 0, N);
+  std::memcpy(field, v.data(), v.size());
+  return true;
+}
+
+// "mon,wed,fri", "daily" or "weekdays".
+bool parse_days(Ctx& c, const std::string& v, uint8_t* mask) {
+  static const char* kNames[] = {"mon", "tue", "wed", "thu", "fri", "sat", "sun"};
+  if (v == "daily") return *mask = 0x7f, true;
+  if (v == "weekdays") return *mask = 0x1f, true;
+  uint8_t m = 0;
+  size_t pos = 0;
+  while (pos <= v.size()) {
+    const size_t comma = std::min(v.find(',', pos), v.size());
+    const std::string d = trim(v.substr(pos, comma - pos));
+    int i = 0;
+    while (i < 7 && d != kNames[i]) ++i;
+    if (i == 7) {
+      fail(c, "unknown day '" + d + "'");
+      return false;
+    }
+    m |= uint8_t(1u << i);
+    pos = comma + 1;
+  }
+  *mask = m;
+  return true;
+}
+
+bool parse_hhmm(Ctx& c, const std::string& v, uint16_t* minute) {
+  int h, m;
+  char extra;
+  if (std::sscanf(v.c_str(), "%d:%d%c", &h, &m, &extra) != 2 || h < 0 || h > 23 || m < 0 || m > 59) {
+    fail(c, "'" + v + "' is not HH:MM");
+    return false;
+  }
+  *minute = uint16_t(h * 60 + m);
+  return true;
+}
+
+bool parse_degrees_e7(const std::string& v, int32_t* out) {
+  char* end = nullptr;
+  const double d = std::strtod(v.c_str(), &end);
+  if (end == v.c_str() || *trim(end).c_str() != '\0' || d < -180 || d > 180) return false;
+  *out = static_cast<int32_t>(std::llround(d * 1e7));
+  return true;
+}
+
+bool parse_text(const char* path, agro::ConfigImageBuilder* b) {
+  std::ifstream in(path);
+  if (!in) {
+    std::fprintf(stderr, "%s: cannot open\n", path);
+    return false;
+  }
+  Ctx c{path};
+  agro::RuleCompiler rules;
+  std::string section;
+  std::string raw;
+  while (std::getline(in, raw)) {
+    ++c.line;
+    const std::string line = trim(raw.substr(0, raw.find('#')));
+    if (line.empty()) continue;
+    if (line.front() == '[') {
+      if (line.back() != ']') {
+        fail(c, "unterminated section header");
+        continue;
+      }
+      section = line.substr(1, line.size() - 2);
+      if (section == "zone") {
+        if (b->zone_count == agro::kMaxZonePrograms) {
+          fail(c, "more than " + std::to_string(agro::kMaxZonePrograms) + " zone programs");
+          return false;
+        }
+        b->zones[b->zone_count++] = agro::ZoneProgram{};
+      } else if (section != "system" && section != "uplink" && section != "thresholds" && section != "geofence" &&
+                 section != "rules") {
+        fail(c, "unknown section [" + section + "]");
+      }
+      continue;
+    }
+    const size_t eq = line.find('=');
+    if (eq == std::string::npos) {
+      fail(c, "expected key = value");
+      continue;
+    }
+    const std::string key = trim(line.substr(0, eq));
+    const std::string v = trim(line.substr(eq + 1));
+    bool known = true;
+    if (section == "system") {
+      auto& s = b->system;
+      if (key == "node_id") set_int(c, v, &s.node_id);
+      else if (key == "wake_period_s") set_int(c, v, &s.wake_period_s);
+      else if (key == "utc_offset_min") set_int(c, v, &s.utc_offset_min);
+      else known = false;
+    } else if (section == "uplink") {
+      auto& u = b->uplink;
+      if (key == "apn") set_str(c, v, u.apn);
+      else if (key == "host") set_str(c, v, u.host);
+      else if (key == "port") set_int(c, v, &u.port);
+      else if (key == "upload_every_wakes") set_int(c, v, &u.upload_every_wakes);
+      else if (key == "max_batch_records") set_int(c, v, &u.max_batch_records);
+      else if (key == "sms_after_failures") set_int(c, v, &u.sms_after_failures);
+      else if (key == "sms_number") set_str(c, v, u.sms_number);
+      else known = false;
+    } else if (section == "thresholds") {
+      auto& t = b->thresholds;
+      if (key == "soil_air_raw") set_int(c, v, &t.soil_air_raw);
+      else if (key == "soil_water_raw") set_int(c, v, &t.soil_water_raw);
+      else if (key == "soil_dry_raw") set_int(c, v, &t.soil_dry_raw);
+      else if (key == "soil_wet_raw") set_int(c, v, &t.soil_wet_raw);
+      else if (key == "pulses_per_liter") set_int(c, v, &t.pulses_per_liter);
+      else if (key == "max_open_s") set_int(c, v, &t.max_open_s);
+      else if (key == "no_flow_s") set_int(c, v, &t.no_flow_s);
+      else if (key == "leak_pulses") set_int(c, v, &t.leak_pulses);
+      else if (key == "stuck_open_ml_per_min") set_int(c, v, &t.stuck_open_ml_per_min);
+      else if (key == "battery_low_mv") set_int(c, v, &t.battery_low_mv);
+      else if (key == "battery_cutoff_mv") set_int(c, v, &t.battery_cutoff_mv);
+      else known = false;
+    } else if (section == "zone") {
+      auto& z = b->zones[b->zone_count - 1];
+      if (key == "zone") {
+        if (set_int(c, v, &z.zone) && z.zone >= 8) fail(c, "zone must be 0-7");
+      } else if (key == "days") {
+        parse_days(c, v, &z.days_mask);
+      } else if (key == "start") {
+        parse_hhmm(c, v, &z.start_minute);
+      } else if (key == "liters") {
+        long l;
+        if (to_long(v, 0, 4000000, &l)) z.target_ml = uint32_t(l) * 1000u;
+        else fail(c, "'" + v + "' is not a volume in litres");
+      } else if (key == "max_minutes") {
+        set_int(c, v, &z.max_minutes);
+      } else if (key == "dry_permille") {
+        set_int(c, v, &z.dry_permille);
+      } else {
+        known = false;
+      }
+    } else if (section == "geofence") {
+      if (key == "vertex") {
+        const size_t comma = v.find(',');
+        agro::GeofenceVertex p;
+        if (comma == std::string::npos || !parse_degrees_e7(trim(v.substr(0, comma)), &p.lat_e7) ||
+            !parse_degrees_e7(trim(v.substr(comma + 1)), &p.lon_e7)) {
+          fail(c, "vertex must be 'lat, lon' in decimal degrees");
+        } else if (b->geofence_count == agro::kMaxGeofenceVertices) {
+          fail(c, "more than " + std::to_string(agro::kMaxGeofenceVertices) + " geofence vertices");
+        } else {
+          b->geofence[b->geofence_count++] = p;
+        }
+      } else {
+        known = false;
+      }
+    } else if (section == "rules") {
+      if (key != "rule") known = false;
+      else if (!rules.add(v)) fail(c, rules.error());
+    } else {
+      fail(c, "key outside a section");
+      continue;
+    }
+    if (!known) fail(c, "unknown key '" + key + "' in [" + section + "]");
+  }
+  for (size_t i = 0; i < b->zone_count; ++i) {
+    if (b->zones[i].target_ml == 0) {
+      std::fprintf(stderr, "%s: zone program %zu has no volume\n", path, i + 1);
+      c.ok = false;
+    }
+  }
+  std::memcpy(b->rules, rules.code().data(), rules.code().size());
+  b->rule_bytes = rules.code().size();
+  if (b->geofence_count == 1 || b->geofence_count == 2) {
+    std::fprintf(stderr, "%s: a geofence needs at least 3 vertices\n", path);
+    c.ok = false;
+  }
+  return c.ok;
+}
+
+void dump(const agro::ConfigView& v) {
+  std::printf("# generation %u, schema %u.%u, crc %08x\n", v.generation(), agro::kConfigMajor, v.minor(), v.crc());
+  const auto& s = v.system();
+  std::printf("[system]\nnode_id = %u\nwake_period_s = %u\nutc_offset_min = %d\n\n", s.node_id, s.wake_period_s,
+              s.utc_offset_min);
+  const auto& u = v.uplink();
+  std::printf("[uplink]\napn = %s\nhost = %s\nport = %u\nupload_every_wakes = %u\nmax_batch_records = %u\n", u.apn,
+              u.host, u.port, u.upload_every_wakes, u.max_batch_records);
+  std::printf("sms_after_failures = %u\nsms_number = %s\n\n", u.sms_after_failures, u.sms_number);
+  const auto& t = v.thresholds();
+  std::printf("[thresholds]\nsoil_air_raw = %u\nsoil_water_raw = %u\nsoil_dry_raw = %u\nsoil_wet_raw = %u\n",
+              t.soil_air_raw, t.soil_water_raw, t.soil_dry_raw, t.soil_wet_raw);
+  std::printf("pulses_per_liter = %u\nmax_open_s = %u\nno_flow_s = %u\nleak_pulses = %u\n", t.pulses_per_liter,
+              t.max_open_s, t.no_flow_s, t.leak_pulses);
+  std::printf("stuck_open_ml_per_min = %u\nbattery_low_mv = %u\nbattery_cutoff_mv = %u\n", t.stuck_open_ml_per_min,
+              t.battery_low_mv, t.battery_cutoff_mv);
+  static const char* kDays[] = {"mon", "tue", "wed", "thu", "fri", "sat", "sun"};
+  for (size_t i = 0; i < v.zone_count(); ++i) {
+    const agro::ZoneProgram z = v.zone(i);
+    std::string days;
+    for (int d = 0; d < 7; ++d) {
+      if (z.days_mask >> d & 1) days += (days.empty() ? "" : ",") + std::string(kDays[d]);
+    }
+    std::printf("\n[zone]\nzone = %u\ndays = %s\nstart = %02u:%02u\nliters = %u\nmax_minutes = %u\ndry_permille = %u\n",
+                z.zone, days.c_str(), z.start_minute / 60, z.start_minute % 60, z.target_ml / 1000, z.max_minutes,
+                z.dry_permille);
+  }
+  if (v.geofence_count()) std::printf("\n[geofence]\n");
+  for (size_t i = 0; i < v.geofence_count(); ++i) {
+    const agro::GeofenceVertex p = v.geofence(i);
+    std::printf("vertex = %.7f, %.7f\n", p.lat_e7 / 1e7, p.lon_e7 / 1e7);
+  }
+  if (v.rule_bytes()) {
+    // The source is not kept in the image; the code is shown for review.
+    std::printf("\n[rules]\n# %zu bytes of bytecode%s, not recompilable:\n", v.rule_bytes(),
+                agro::rule_verify(v.rules(), v.rule_bytes()) ? "" : " (REJECTED by rule_verify)");
+    const std::string text = agro::rule_disassemble(v.rules(), v.rule_bytes());
+    for (size_t pos = 0; pos < text.size();) {
+      const size_t nl = text.find('\n', pos);
+      std::printf("#   %s\n", text.substr(pos, nl - pos).c_str());
+      pos = nl + 1;
+    }
+  }
+}
+
+int usage() {
+  std::fprintf(stderr, "usage: agro_config compile <in.ini> <out.bin> [--generation N]\n"
+                       "       agro_config dump <image.bin>\n");
+  return 2;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  if (argc < 3) return usage();
+  const std::string cmd = argv[1];
+  if (cmd == "compile") {
+    if (argc != 4 && !(argc == 6 && std::strcmp(argv[4], "--generation") == 0)) return usage();
+    agro::ConfigImageBuilder b;
+    b.generation = argc == 6 ? uint32_t(std::strtoul(argv[5], nullptr, 0)) : uint32_t(std::time(nullptr));
+    if (!parse_text(argv[2], &b)) return 1;
+    uint8_t image[agro::ConfigImageBuilder::kMaxImageBytes];
+    const size_t n = b.build(image, sizeof(image));
+    if (n == 0) {
+      std::fprintf(stderr, "image does not fit in %zu bytes\n", sizeof(image));
+      return 1;
+    }
+    std::ofstream out(argv[3], std::ios::binary);
+    out.write(reinterpret_cast<const char*>(image), std::streamsize(n));
+    if (!out) {
+      std::fprintf(stderr, "%s: write failed\n", argv[3]);
+      return 1;
+    }
+    std::printf("%s: %zu bytes, %zu zone programs, %zu geofence vertices, %zu bytes of rules, generation %u\n",
+                argv[3], n, b.zone_count, b.geofence_count, b.rule_bytes, b.generation);
+    return 0;
+  }
+  if (cmd == "dump" && argc == 3) {
+    std::ifstream in(argv[2], std::ios::binary);
+    const std::vector<char> bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    agro::ConfigView v;
+    const agro::ConfigStatus st = v.open(bytes.data(), bytes.size());
+    if (st != agro::ConfigStatus::kOk) {
+      std::fprintf(stderr, "%s: rejected (status %d)\n", argv[2], static_cast<int>(st));
+      return 1;
+    }
+    dump(v);
+    return 0;
+  }
+  return usage();
+}